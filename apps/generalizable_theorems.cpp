@@ -5,6 +5,11 @@
 #include <functional>
 #include <vector>
 #include <string>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <algorithm>
 
 #include "mm/setmm.h"
 #include "mm/toolbox.h"
@@ -112,115 +117,168 @@ private:
     SubstMap< SymTok, LabTok > subst;
 };
 
-void find_generalizable_theorems() {
-    auto &data = get_set_mm();
-    auto &lib = data.lib;
-    auto &tb = data.tb;
-
-    for (const Assertion &ass : lib.get_assertions()) {
-    //while (true) {
-        //auto &ass = tb.get_assertion(tb.get_label("cvjust"));
-        if (!ass.is_valid() || !ass.is_theorem() || tb.get_sentence(ass.get_thesis()).at(0) != tb.get_turnstile()) {
-            continue;
-        }
-        if (ass.is_modif_disc() || ass.is_usage_disc()) {
-            continue;
-        }
-        tb.new_temp_var_frame();
-
-        auto po = ass.get_proof_operator(tb);
-        auto proof = po->uncompress();
-        auto labs = proof.get_labels();
-        //cout << "Proof vector: {";
-        Reactor reactor(tb, ass.get_ess_hyps().size());
-        for (auto label : labs) {
-            auto ess_hyps = ass.get_ess_hyps();
-            auto it = find(ess_hyps.begin(), ess_hyps.end(), label);
-            if (it != ess_hyps.end()) {
-                //cout << " \"*\",";
-                bool res = reactor.process_hypothesis(tb.get_turnstile_alias(), it-ess_hyps.begin());
-                assert(res);
+// Return the report for ass, or an empty string if it is not generalizable
+static std::string analyze_theorem(LibraryToolbox &tb, const Assertion &ass, LabTok lab_cvv, LabTok lab_cv) {
+    auto po = ass.get_proof_operator(tb);
+    auto proof = po->uncompress();
+    auto labs = proof.get_labels();
+    //cout << "Proof vector: {";
+    Reactor reactor(tb, ass.get_ess_hyps().size());
+    for (auto label : labs) {
+        auto ess_hyps = ass.get_ess_hyps();
+        auto it = find(ess_hyps.begin(), ess_hyps.end(), label);
+        if (it != ess_hyps.end()) {
+            //cout << " \"*\",";
+            bool res = reactor.process_hypothesis(tb.get_turnstile_alias(), it-ess_hyps.begin());
+            assert(res);
 #ifdef NDEBUG
-                (void) res;
+            (void) res;
 #endif
-            } else if (tb.get_assertion(label).is_valid() && tb.get_sentence(label).at(0) == tb.get_turnstile()) {
-                //cout << " \"" << tb.resolve_label(label) << "\",";
-                bool res = reactor.process_label(label);
-                assert(res);
+        } else if (tb.get_assertion(label).is_valid() && tb.get_sentence(label).at(0) == tb.get_turnstile()) {
+            //cout << " \"" << tb.resolve_label(label) << "\",";
+            bool res = reactor.process_label(label);
+            assert(res);
 #ifdef NDEBUG
-                (void) res;
+            (void) res;
 #endif
-            }
         }
-        //cout << " }" << endl;
-        //cout << tb.print_proof(labs, true) << endl;
-
-        bool res = reactor.compute_unification();
-        assert(res);
-
-        SubstMap< SymTok, LabTok > subst2;
-        UnilateralUnificator< SymTok, LabTok > unif(tb.get_standard_is_var());
-        unif.add_parsing_trees(reactor.get_theorem(), tb.get_parsed_sent(ass.get_thesis()));
-        auto hypotheses = reactor.get_hypotheses();
-        for (size_t i = 0; i < ass.get_ess_hyps().size(); i++) {
-            unif.add_parsing_trees(hypotheses[i], tb.get_parsed_sent(ass.get_ess_hyps()[i]));
+    }
+    //cout << " }" << endl;
+    //cout << tb.print_proof(labs, true) << endl;
+
+    bool res = reactor.compute_unification();
+    assert(res);
+
+    SubstMap< SymTok, LabTok > subst2;
+    UnilateralUnificator< SymTok, LabTok > unif(tb.get_standard_is_var());
+    unif.add_parsing_trees(reactor.get_theorem(), tb.get_parsed_sent(ass.get_thesis()));
+    auto hypotheses = reactor.get_hypotheses();
+    for (size_t i = 0; i < ass.get_ess_hyps().size(); i++) {
+        unif.add_parsing_trees(hypotheses[i], tb.get_parsed_sent(ass.get_ess_hyps()[i]));
+    }
+    tie(res, subst2) = unif.unify();
+    assert(res);
+    SubstMap< SymTok, LabTok > generalizables;
+    SubstMap< SymTok, LabTok > not_generalizables;
+    for (const auto &x : subst2) {
+        bool generalizable = true;
+        if (tb.get_standard_is_var()(x.second.label)) {
+            generalizable = false;
         }
-        tie(res, subst2) = unif.unify();
-        assert(res);
-        SubstMap< SymTok, LabTok > generalizables;
-        SubstMap< SymTok, LabTok > not_generalizables;
-        LabTok lab_cvv = tb.get_label("cvv");
-        LabTok lab_cv = tb.get_label("cv");
-        for (const auto &x : subst2) {
-            bool generalizable = true;
-            if (tb.get_standard_is_var()(x.second.label)) {
-                generalizable = false;
-            }
-            if (x.second.label == lab_cvv || x.second.label == lab_cv) {
-                generalizable = false;
-            }
-            if (generalizable) {
-                generalizables.insert(x);
-            } else {
-                not_generalizables.insert(x);
-            }
+        if (x.second.label == lab_cvv || x.second.label == lab_cv) {
+            generalizable = false;
         }
+        if (generalizable) {
+            generalizables.insert(x);
+        } else {
+            not_generalizables.insert(x);
+        }
+    }
 
-        if (!generalizables.empty()) {
-            std::cout << "GENERALIZABLE THEOREM (" << tb.resolve_label(ass.get_thesis()) << ")" << std::endl;
-            std::cout << "Theorem: " << tb.print_sentence(reactor.get_theorem()) << std::endl;
-            if (ass.get_ess_hyps().size() != 0) {
-                std::cout << "with hypotheses:" << std::endl;
-                for (const auto &hyp : reactor.get_hypotheses()) {
-                    std::cout << " * " << tb.print_sentence(hyp) << std::endl;
-                }
+    std::ostringstream out;
+    if (!generalizables.empty()) {
+        out << "GENERALIZABLE THEOREM (" << tb.resolve_label(ass.get_thesis()) << ")" << std::endl;
+        out << "Theorem: " << tb.print_sentence(reactor.get_theorem()) << std::endl;
+        if (ass.get_ess_hyps().size() != 0) {
+            out << "with hypotheses:" << std::endl;
+            for (const auto &hyp : reactor.get_hypotheses()) {
+                out << " * " << tb.print_sentence(hyp) << std::endl;
             }
-            std::cout << "Substitution map for generalizable variables:" << std::endl;
-            for (const auto &x : generalizables) {
+        }
+        out << "Substitution map for generalizable variables:" << std::endl;
+        for (const auto &x : generalizables) {
+            ParsingTree< SymTok, LabTok > pt;
+            pt.label = x.first;
+            out << " * " << tb.print_sentence(pt) << ": " << tb.print_sentence(x.second) << std::endl;
+        }
+        if (!not_generalizables.empty()) {
+            out << "Substitution map for other variables:" << std::endl;
+            for (const auto &x : not_generalizables) {
                 ParsingTree< SymTok, LabTok > pt;
                 pt.label = x.first;
-                std::cout << " * " << tb.print_sentence(pt) << ": " << tb.print_sentence(x.second) << std::endl;
+                out << " * " << tb.print_sentence(pt) << ": " << tb.print_sentence(x.second) << std::endl;
             }
-            if (!not_generalizables.empty()) {
-                std::cout << "Substitution map for other variables:" << std::endl;
-                for (const auto &x : not_generalizables) {
-                    ParsingTree< SymTok, LabTok > pt;
-                    pt.label = x.first;
-                    std::cout << " * " << tb.print_sentence(pt) << ": " << tb.print_sentence(x.second) << std::endl;
+        }
+        out << std::endl;
+    }
+    return out.str();
+}
+
+void find_generalizable_theorems(size_t threads_num) {
+    auto &data = get_set_mm();
+    auto &lib = data.lib;
+    auto &tb = data.tb;
+    LabTok lab_cvv = tb.get_label("cvv");
+    LabTok lab_cv = tb.get_label("cv");
+    const auto &assertions = lib.get_assertions();
+
+    // Workers take theorems in label order, each in its own temporary variable
+    // frame, while this thread prints the reports as soon as they are ready
+    std::vector< std::promise< std::string > > promises(assertions.size());
+    std::atomic< size_t > next_ass(0);
+    std::vector< std::thread > workers;
+    for (size_t i = 0; i < threads_num; i++) {
+        workers.emplace_back([&]() {
+            size_t idx;
+            while ((idx = next_ass++) < assertions.size()) {
+                const Assertion &ass = assertions[idx];
+                if (!ass.is_valid() || !ass.is_theorem() || tb.get_sentence(ass.get_thesis()).at(0) != tb.get_turnstile()) {
+                    promises[idx].set_value("");
+                    continue;
+                }
+                if (ass.is_modif_disc() || ass.is_usage_disc()) {
+                    promises[idx].set_value("");
+                    continue;
                 }
+                tb.new_temp_var_frame();
+                try {
+                    promises[idx].set_value(analyze_theorem(tb, ass, lab_cvv, lab_cv));
+                } catch (...) {
+                    promises[idx].set_exception(std::current_exception());
+                }
+                tb.release_temp_var_frame();
             }
-            std::cout << std::endl;
-        }
+        });
+    }
 
-        tb.release_temp_var_frame();
+    std::exception_ptr error;
+    for (auto &promise : promises) {
+        try {
+            std::cout << promise.get_future().get();
+        } catch (...) {
+            // Stop the workers before letting the exception go
+            error = std::current_exception();
+            next_ass = assertions.size();
+            break;
+        }
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
     }
 }
 
 int find_generalizable_theorems_main(int argc, char *argv[]) {
-    (void) argc;
-    (void) argv;
+    auto print_usage = [&]() {
+        std::cerr << "Usage: " << argv[0] << " [threads]" << std::endl;
+    };
+    if (argc > 2) {
+        print_usage();
+        return 1;
+    }
+    size_t threads_num = std::max(std::thread::hardware_concurrency(), 1u);
+    if (argc >= 2) {
+        threads_num = parse_threads_num(argv[1]);
+        if (threads_num == 0) {
+            std::cerr << "The number of threads must be a positive integer, not " << argv[1] << std::endl;
+            print_usage();
+            return 1;
+        }
+    }
 
-    find_generalizable_theorems();
+    find_generalizable_theorems(threads_num);
 
     return 0;
 }
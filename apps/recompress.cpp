@@ -0,0 +1,265 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include "utils/utils.h"
+#include "mm/reader.h"
+#include "mm/proof.h"
+
+// The same width used by metamath.exe when saving proofs
+const size_t PROOF_LINE_WIDTH = 79;
+
+struct ProofSpan {
+    std::string label;
+    // The proof text lies between the end of $= and the beginning of $.
+    size_t begin;
+    size_t end;
+    size_t indent;
+    bool has_comments;
+};
+
+struct RecompressedProof {
+    bool success;
+    std::string text;
+    std::string error;
+};
+
+// Find the proofs in the text of a database; included files are not followed
+static std::vector< ProofSpan > find_proof_spans(const std::string &text) {
+    enum { OUTSIDE, BEFORE_PROOF, INSIDE_PROOF } state = OUTSIDE;
+    std::vector< ProofSpan > ret;
+    ProofSpan span;
+    bool in_comment = false;
+    size_t prev_begin = 0;
+    size_t prev_end = 0;
+    size_t pos = 0;
+    while (true) {
+        while (pos < text.size() && is_mm_whitespace(text[pos])) {
+            pos++;
+        }
+        if (pos == text.size()) {
+            break;
+        }
+        size_t begin = pos;
+        while (pos < text.size() && !is_mm_whitespace(text[pos])) {
+            pos++;
+        }
+        auto tok = text.substr(begin, pos - begin);
+        if (in_comment) {
+            in_comment = tok != "$)";
+            continue;
+        }
+        if (tok == "$(") {
+            in_comment = true;
+            if (state == INSIDE_PROOF) {
+                span.has_comments = true;
+            }
+            continue;
+        }
+        if (tok == "$p") {
+            state = BEFORE_PROOF;
+            span.label = text.substr(prev_begin, prev_end - prev_begin);
+            auto line_begin = text.rfind('\n', prev_begin);
+            span.indent = prev_begin - (line_begin == std::string::npos ? 0 : line_begin + 1) + 2;
+            span.has_comments = false;
+        } else if (state == BEFORE_PROOF && tok == "$=") {
+            state = INSIDE_PROOF;
+            span.begin = pos;
+        } else if (state == INSIDE_PROOF && tok == "$.") {
+            state = OUTSIDE;
+            span.end = begin;
+            ret.push_back(span);
+        }
+        prev_begin = begin;
+        prev_end = pos;
+    }
+    return ret;
+}
+
+// Format the proof between $= and $. as metamath.exe does, with labels never broken and codes packed
+static std::string format_proof(const Library &lib, const CompressedProof &proof, size_t indent) {
+    std::string ret = "\n";
+    std::string line(indent, ' ');
+    auto push_word = [&](const std::string &word) {
+        if (line.size() > indent && line.size() + 1 + word.size() > PROOF_LINE_WIDTH) {
+            ret += line + "\n";
+            line = std::string(indent, ' ');
+        }
+        if (line.size() > indent) {
+            line += " ";
+        }
+        line += word;
+    };
+    push_word("(");
+    for (const auto &ref : proof.get_refs()) {
+        push_word(lib.resolve_label(ref));
+    }
+    push_word(")");
+    line += " ";
+    CompressedEncoder encoder;
+    for (const auto &code : proof.get_codes()) {
+        for (const char c : encoder.push_code(code)) {
+            if (line.size() >= PROOF_LINE_WIDTH) {
+                ret += line + "\n";
+                line = std::string(indent, ' ');
+            }
+            line += c;
+        }
+    }
+    // Leave room for the closing $.
+    if (line.size() + 3 > PROOF_LINE_WIDTH) {
+        ret += line + "\n";
+        line = std::string(indent, ' ');
+    } else {
+        line += " ";
+    }
+    return ret + line;
+}
+
+static RecompressedProof recompress_proof(const Library &lib, const ProofSpan &span, ProofOperator::CompressionStrategy strategy) {
+    try {
+        LabTok label = lib.get_label(span.label);
+        const Assertion &ass = lib.get_assertion(label);
+        if (!ass.is_valid() || !ass.is_theorem()) {
+            return { false, "", "not a theorem" };
+        }
+        CompressedProof compressed = ass.get_proof_operator(lib)->compress(strategy);
+        // Check that the new proof still proves the theorem before using it
+        compressed.get_executor< Sentence >(lib, ass)->execute();
+        return { true, format_proof(lib, compressed, span.indent), "" };
+    } catch (const MMPPException &e) {
+        return { false, "", e.get_reason() };
+    } catch (const ProofException< Sentence > &e) {
+        return { false, "", e.get_reason() };
+    } catch (const std::exception &e) {
+        return { false, "", e.what() };
+    }
+}
+
+static const std::map< std::string, ProofOperator::CompressionStrategy > strategies = {
+    { "any", ProofOperator::CS_ANY },
+    { "none", ProofOperator::CS_NO_BACKREFS },
+    { "tree", ProofOperator::CS_BACKREFS_ON_IDENTICAL_TREE },
+    { "sentence", ProofOperator::CS_BACKREFS_ON_IDENTICAL_SENTENCE },
+    { "minimize", ProofOperator::CS_MINIMIZE_SIZE },
+};
+
+int recompress_main(int argc, char *argv[]) {
+    auto print_usage = [&]() {
+        std::cerr << "Usage: " << argv[0] << " <input.mm> <output.mm> [any|none|tree|sentence|minimize] [threads]" << std::endl;
+        std::cerr << "Only proofs in the input file are rewritten, not those in included files" << std::endl;
+    };
+    if (argc < 3 || argc > 5) {
+        print_usage();
+        return 1;
+    }
+    boost::filesystem::path input(argv[1]);
+    boost::filesystem::path output(argv[2]);
+    auto strategy = ProofOperator::CS_MINIMIZE_SIZE;
+    if (argc >= 4) {
+        auto it = strategies.find(argv[3]);
+        if (it == strategies.end()) {
+            std::cerr << "Unknown compression strategy " << argv[3] << std::endl;
+            return 1;
+        }
+        strategy = it->second;
+    }
+    size_t threads_num = std::max(std::thread::hardware_concurrency(), 1u);
+    if (argc >= 5) {
+        threads_num = parse_threads_num(argv[4]);
+        if (threads_num == 0) {
+            std::cerr << "The number of threads must be a positive integer, not " << argv[4] << std::endl;
+            print_usage();
+            return 1;
+        }
+    }
+
+    std::cout << "Reading library and executing all proofs..." << std::endl;
+    FileTokenizer ft(input);
+    Reader reader(ft, true, false);
+    reader.run();
+    const LibraryImpl &lib = reader.get_library();
+
+    // The whole input is kept in memory, so that output can be the same file
+    std::string text;
+    {
+        boost::filesystem::ifstream fin(input, std::ios::binary);
+        text.assign(std::istreambuf_iterator< char >(fin), std::istreambuf_iterator< char >());
+    }
+    auto spans = find_proof_spans(text);
+    // More workers than proofs would just sit idle
+    threads_num = std::min(threads_num, std::max< size_t >(spans.size(), 1));
+    std::cout << "Recompressing " << spans.size() << " proofs with " << threads_num << " threads..." << std::endl;
+
+    // Workers take proofs in file order, while this thread writes them out as soon as they are ready
+    auto start_time = std::chrono::steady_clock::now();
+    std::vector< std::promise< RecompressedProof > > promises(spans.size());
+    std::atomic< size_t > next_span(0);
+    std::vector< std::thread > workers;
+    for (size_t i = 0; i < threads_num; i++) {
+        workers.emplace_back([&]() {
+            size_t idx;
+            while ((idx = next_span++) < spans.size()) {
+                if (spans[idx].has_comments) {
+                    promises[idx].set_value({ false, "", "proof contains comments" });
+                } else {
+                    promises[idx].set_value(recompress_proof(lib, spans[idx], strategy));
+                }
+            }
+        });
+    }
+
+    boost::filesystem::ofstream fout(output, std::ios::binary);
+    size_t last = 0;
+    size_t failures = 0;
+    size_t old_proofs_size = 0;
+    size_t new_proofs_size = 0;
+    size_t output_size = 0;
+    for (size_t i = 0; i < spans.size(); i++) {
+        const auto &span = spans[i];
+        auto res = promises[i].get_future().get();
+        fout.write(text.data() + last, static_cast< std::streamsize >(span.begin - last));
+        output_size += span.begin - last;
+        old_proofs_size += span.end - span.begin;
+        if (res.success) {
+            fout << res.text;
+            new_proofs_size += res.text.size();
+            output_size += res.text.size();
+        } else {
+            std::cerr << "Keeping the proof of " << span.label << " as it is: " << res.error << std::endl;
+            failures++;
+            fout.write(text.data() + span.begin, static_cast< std::streamsize >(span.end - span.begin));
+            new_proofs_size += span.end - span.begin;
+            output_size += span.end - span.begin;
+        }
+        last = span.end;
+    }
+    fout.write(text.data() + last, static_cast< std::streamsize >(text.size() - last));
+    output_size += text.size() - last;
+    fout.close();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration< double >(std::chrono::steady_clock::now() - start_time).count();
+
+    std::cout << "Recompressed " << spans.size() - failures << " proofs (" << failures << " kept as they were) in " << seconds << " seconds: "
+              << static_cast< double >(spans.size()) / seconds << " proofs/s, " << size_to_string(static_cast< uint64_t >(static_cast< double >(old_proofs_size) / seconds)) << "/s" << std::endl;
+    std::cout << "Proofs went from " << old_proofs_size << " to " << new_proofs_size << " bytes, saving "
+              << static_cast< int64_t >(old_proofs_size) - static_cast< int64_t >(new_proofs_size) << " bytes" << std::endl;
+    std::cout << "The database went from " << text.size() << " to " << output_size << " bytes" << std::endl;
+    return fout ? 0 : 1;
+}
+static_block {
+    register_main_function("recompress", recompress_main);
+}
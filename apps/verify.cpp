@@ -5,13 +5,33 @@
 #include <iostream>
 
 #include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
 
 #include "platform.h"
 #include "utils/utils.h"
 #include "mm/reader.h"
 #include "mm/proof.h"
+#include "mm/profiler.h"
+
+// Execute all proofs again with a profiler attached, print a report and write all the data as JSON
+static void profile_database(const LibraryImpl &lib, const boost::filesystem::path &json_filename) {
+    ProofProfiler profiler;
+    for (auto &ass : lib.get_assertions()) {
+        if (ass.is_valid() && ass.is_theorem()) {
+            auto executor = ass.get_proof_executor< Sentence >(lib);
+            executor->set_profiler(&profiler);
+            profiler.begin_theorem(ass.get_thesis());
+            Finally end_theorem([&profiler]() { profiler.end_theorem(); });
+            executor->execute();
+        }
+    }
+    profiler.print_report(std::cout, lib);
+    boost::filesystem::ofstream fout(json_filename);
+    fout << profiler.to_json(lib).dump(2) << std::endl;
+    std::cout << std::endl << "Profiling data written to " << json_filename << std::endl;
+}
 
-bool verify_database(boost::filesystem::path filename, bool advanced_tests) {
+bool verify_database(boost::filesystem::path filename, bool advanced_tests, const boost::filesystem::path &profile_filename = {}) {
     bool success = true;
     try {
         std::cout << "Memory usage when starting: " << size_to_string(platform_get_current_used_ram()) << std::endl;
@@ -23,6 +43,11 @@ bool verify_database(boost::filesystem::path filename, bool advanced_tests) {
         std::cout << "Library has " << lib.get_symbols_num() << " symbols and " << lib.get_labels_num() << " labels" << std::endl;
         std::cout << "Memory usage after loading: " << size_to_string(platform_get_current_used_ram()) << std::endl;
 
+        if (!profile_filename.empty()) {
+            std::cout << "Executing all proofs again with profiling..." << std::endl;
+            profile_database(lib, profile_filename);
+        }
+
         if (advanced_tests) {
             std::cout << "Compressing all proofs and executing again..." << std::endl;
             for (auto &ass : lib.get_assertions()) {
@@ -57,6 +82,28 @@ bool verify_database(boost::filesystem::path filename, bool advanced_tests) {
                     compressed.get_executor< Sentence >(lib, ass)->execute();
                 }
             }
+
+            std::cout << "Compressing all proofs minimizing their size and executing again..." << std::endl;
+            size_t orig_size = 0;
+            size_t min_size = 0;
+            for (auto &ass : lib.get_assertions()) {
+                if (ass.is_valid() && ass.is_theorem()) {
+                    auto op = ass.get_proof_operator(lib);
+                    orig_size += compressed_proof_size(lib, op->compress());
+                    CompressedProof compressed = op->compress(ProofOperator::CS_MINIMIZE_SIZE);
+                    compressed.get_executor< Sentence >(lib, ass)->execute();
+                    min_size += compressed_proof_size(lib, compressed);
+                }
+            }
+            std::cout << "Compressed proofs take " << orig_size << " characters as found, " << min_size << " characters when minimized" << std::endl;
+
+            std::cout << "Compressing all proofs with back references on identical trees and executing again..." << std::endl;
+            for (auto &ass : lib.get_assertions()) {
+                if (ass.is_valid() && ass.is_theorem()) {
+                    CompressedProof compressed = ass.get_proof_operator(lib)->compress(ProofOperator::CS_BACKREFS_ON_IDENTICAL_TREE);
+                    compressed.get_executor< Sentence >(lib, ass)->execute();
+                }
+            }
         } else {
             std::cout << "Skipping advanced tests" << std::endl;
         }
@@ -160,8 +207,11 @@ static_block {
 }
 
 int test_simple_one_main(int argc, char *argv[]) {
+    if (argc == 4 && std::string(argv[1]) == "--profile") {
+        return verify_database(argv[3], false, argv[2]) ? 0 : 1;
+    }
     if (argc != 2) {
-        std::cerr << "Provide file name as argument, please" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--profile <report.json>] <file.mm>" << std::endl;
         return 1;
     }
     std::string filename(argv[1]);
@@ -1,12 +1,18 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <map>
+#include <unordered_map>
+#include <cstdint>
+#include <chrono>
+#include <limits>
 
 #include "library.h"
 #include "utils/utils.h"
 #include "funds.h"
 #include "mmtypes.h"
+#include "profiler.h"
 
 //#define PROOF_VERBOSE_DEBUG
 
@@ -64,32 +70,174 @@ struct ProofTree {
     LabTok number;
 };
 
+/*
+ * The proof tree generated by the engine, stored in flat arrays. The children
+ * of a node are the links children[first_child, first_child + children_num).
+ * Each sentence is stored once, and a saved step that is used again links to
+ * the node that proved it instead of copying it, so this is actually a DAG.
+ */
+template< typename SentType_ >
+struct FlatProofTree {
+    typedef ProofSentenceTraits< SentType_ > TraitsType;
+    typedef typename TraitsType::SentType SentType;
+    typedef typename TraitsType::VarType VarType;
+
+    struct Node {
+        LabTok label;
+        LabTok number;
+        uint32_t sentence;
+        // Index in dists; the first set is always empty
+        uint32_t dists;
+        uint32_t first_child;
+        uint32_t children_num;
+    };
+
+    struct Link {
+        uint32_t node;
+        bool essential;
+        // Whether this is a reference to a saved step, which used to be a leaf without label
+        bool saved_step;
+    };
+
+    // The sizes of the arrays, to drop what was added after a checkpoint
+    struct Mark {
+        size_t nodes;
+        size_t children;
+        size_t sentences;
+        size_t dists;
+    };
+
+    FlatProofTree() : dists(1) {
+    }
+
+    Mark get_mark() const {
+        return { this->nodes.size(), this->children.size(), this->sentences.size(), this->dists.size() };
+    }
+
+    void truncate(const Mark &mark) {
+        for (size_t idx = mark.sentences; idx < this->sentences.size(); idx++) {
+            auto range = this->sentence_index.equal_range(boost::hash< SentType >()(this->sentences[idx]));
+            for (auto it = range.first; it != range.second; it++) {
+                if (it->second == idx) {
+                    this->sentence_index.erase(it);
+                    break;
+                }
+            }
+        }
+        this->nodes.resize(mark.nodes);
+        this->children.resize(mark.children);
+        this->sentences.resize(mark.sentences);
+        this->dists.resize(mark.dists);
+    }
+
+    uint32_t add_node(LabTok label, LabTok number, const SentType &sent, const std::set< std::pair< VarType, VarType > > &node_dists,
+                      typename std::vector< Link >::const_iterator children_begin, typename std::vector< Link >::const_iterator children_end) {
+        uint32_t dists_idx = 0;
+        if (!node_dists.empty()) {
+            dists_idx = static_cast< uint32_t >(this->dists.size());
+            this->dists.push_back(node_dists);
+        }
+        this->nodes.push_back({ label, number, this->add_sentence(sent), dists_idx, static_cast< uint32_t >(this->children.size()), static_cast< uint32_t >(children_end - children_begin) });
+        this->children.insert(this->children.end(), children_begin, children_end);
+        return static_cast< uint32_t >(this->nodes.size() - 1);
+    }
+
+    // Adapter to the nested representation, with saved steps as leaves without label
+    ProofTree< SentType_ > unwind(Link link) const {
+        const auto &node = this->nodes.at(link.node);
+        if (link.saved_step) {
+            return { this->sentences[node.sentence], {}, {}, {}, link.essential, {} };
+        }
+        ProofTree< SentType_ > ret = { this->sentences[node.sentence], node.label, {}, this->dists[node.dists], link.essential, node.number };
+        ret.children.reserve(node.children_num);
+        for (uint32_t i = 0; i < node.children_num; i++) {
+            ret.children.push_back(this->unwind(this->children[node.first_child + i]));
+        }
+        return ret;
+    }
+
+    std::vector< Node > nodes;
+    std::vector< Link > children;
+    std::vector< SentType > sentences;
+    std::vector< std::set< std::pair< VarType, VarType > > > dists;
+
+private:
+    uint32_t add_sentence(const SentType &sent) {
+        size_t hash = boost::hash< SentType >()(sent);
+        auto range = this->sentence_index.equal_range(hash);
+        for (auto it = range.first; it != range.second; it++) {
+            if (this->sentences[it->second] == sent) {
+                return it->second;
+            }
+        }
+        this->sentences.push_back(sent);
+        // The tree is handed out to callers, so it cannot keep views on the arena of the engine
+        TraitsType::materialize(this->sentences.back());
+        uint32_t ret = static_cast< uint32_t >(this->sentences.size() - 1);
+        this->sentence_index.insert(std::make_pair(hash, ret));
+        return ret;
+    }
+
+    std::unordered_multimap< size_t, uint32_t > sentence_index;
+};
+
 
+/* Add to dists the distinct variable constraints that the substitution map
+ * imposes on the variables of the substituted terms. Only the constraints of
+ * the assertion are visited, and the variables of each term are collected
+ * once. Return false as soon as a variable would have to be distinct from
+ * itself; in that case dists contains that diagonal pair, but is otherwise
+ * incomplete. */
 template< typename SentType_ >
-void propagate_dists(const Assertion &ass, const typename ProofSentenceTraits< SentType_ >::SubstMapType &subst_map, const typename ProofSentenceTraits< SentType_ >::LibType &lib,
+bool propagate_dists(const Assertion &ass, const typename ProofSentenceTraits< SentType_ >::SubstMapType &subst_map, const typename ProofSentenceTraits< SentType_ >::LibType &lib,
                      std::set< std::pair< typename ProofSentenceTraits< SentType_ >::VarType, typename ProofSentenceTraits< SentType_ >::VarType > > &dists) {
+    typedef ProofSentenceTraits< SentType_ > TraitsType;
+    typedef typename TraitsType::VarType VarType;
     const auto &orig_dists = ass.get_mand_dists();
-    for (auto it1 = subst_map.begin(); it1 != subst_map.end(); it1++) {
-        for (auto it2 = subst_map.begin(); it2 != it1; it2++) {
-            auto &var1 = it1->first;
-            auto &var2 = it2->first;
-            auto &subst1 = it1->second;
-            auto &subst2 = it2->second;
-            if (orig_dists.find(std::minmax(ProofSentenceTraits< SentType_ >::var_to_sym(lib, var1), ProofSentenceTraits< SentType_ >::var_to_sym(lib, var2))) != orig_dists.end()) {
-                for (auto tok1 : ProofSentenceTraits< SentType_ >::get_variable_iterator(lib, subst1)) {
-                    if (!ProofSentenceTraits< SentType_ >::is_variable(lib, tok1)) {
-                        continue;
-                    }
-                    for (auto tok2 : ProofSentenceTraits< SentType_ >::get_variable_iterator(lib, subst2)) {
-                        if (!ProofSentenceTraits< SentType_ >::is_variable(lib, tok2)) {
-                            continue;
-                        }
-                        dists.insert(std::minmax(tok1, tok2));
-                    }
+    if (orig_dists.empty()) {
+        return true;
+    }
+    // Sorted and without repetitions; reserved, so that pointers to the elements remain valid
+    std::vector< std::pair< VarType, std::vector< VarType > > > subst_vars;
+    subst_vars.reserve(2 * orig_dists.size());
+    auto get_subst_vars = [&](SymTok sym) -> const std::vector< VarType >* {
+        const VarType var = TraitsType::sym_to_var(lib, sym);
+        for (const auto &x : subst_vars) {
+            if (x.first == var) {
+                return &x.second;
+            }
+        }
+        auto it = subst_map.find(var);
+        if (it == subst_map.end()) {
+            return nullptr;
+        }
+        std::vector< VarType > vars;
+        for (auto tok : TraitsType::get_variable_iterator(lib, it->second)) {
+            if (TraitsType::is_variable(lib, tok)) {
+                vars.push_back(tok);
+            }
+        }
+        std::sort(vars.begin(), vars.end());
+        vars.erase(std::unique(vars.begin(), vars.end()), vars.end());
+        subst_vars.emplace_back(var, std::move(vars));
+        return &subst_vars.back().second;
+    };
+    for (const auto &dist : orig_dists) {
+        const auto vars1 = get_subst_vars(dist.first);
+        const auto vars2 = get_subst_vars(dist.second);
+        if (vars1 == nullptr || vars2 == nullptr) {
+            continue;
+        }
+        for (auto tok1 : *vars1) {
+            for (auto tok2 : *vars2) {
+                dists.insert(std::minmax(tok1, tok2));
+                if (tok1 == tok2) {
+                    return false;
                 }
             }
         }
     }
+    return true;
 }
 
 template< typename SentType_ >
@@ -119,8 +267,14 @@ public:
         this->gen_proof_tree = gen_proof_tree;
     }
 
+    /* Internally the stack may hold views on the arena of the engine, which
+     * do not survive a rollback or the engine itself; they are materialized
+     * here, so that callers can keep what they find on the stack */
     const std::vector< SentType > &get_stack() const
     {
+        for (auto &sent : this->stack) {
+            TraitsType::materialize(sent);
+        }
         return this->stack;
     }
 
@@ -129,14 +283,41 @@ public:
         return *(this->dists_stack.end()-1);
     }
 
+    /* The labels of the proof as it was built: a saved step used again, including
+     * a memoized step that was replayed, is a single LabTok{} entry instead of
+     * the labels that proved it */
     const std::vector< LabTok > &get_proof_labels() const
     {
         return this->proof;
     }
 
-    const ProofTree< SentType_ > &get_proof_tree() const
+    /* The proof with the saved steps whose proof is known expanded again, so that
+     * it can be read as an uncompressed proof */
+    std::vector< LabTok > get_uncompressed_proof_labels() const
+    {
+        std::vector< LabTok > ret;
+        this->expand_proof(0, this->proof.size(), ret);
+        return ret;
+    }
+
+    // The tree of the step on top of the stack, expanded to the nested representation
+    ProofTree< SentType_ > get_proof_tree() const
+    {
+        if (this->tree_stack.empty()) {
+            return {};
+        }
+        return this->flat_tree.unwind(this->tree_stack.back());
+    }
+
+    const FlatProofTree< SentType_ > &get_flat_proof_tree() const
+    {
+        return this->flat_tree;
+    }
+
+    // The root of the tree of the step on top of the stack in get_flat_proof_tree()
+    typename FlatProofTree< SentType_ >::Link get_flat_proof_tree_root() const
     {
-        return this->proof_tree;
+        return this->tree_stack.back();
     }
 
     void set_debug_output(const std::string &debug_output)
@@ -144,18 +325,100 @@ public:
         this->debug_output = debug_output;
     }
 
-    size_t save_step() {
+    // The profiler is not owned and must outlive the engine; NULL disables profiling
+    void set_profiler(ProofProfiler *profiler)
+    {
+        this->profiler = profiler;
+    }
+
+    // If proof_begin is given, the step is proved by the labels from there on
+    size_t save_step(size_t proof_begin = UNKNOWN_PROOF_BEGIN) {
+        assert(proof_begin == UNKNOWN_PROOF_BEGIN || proof_begin <= this->proof.size());
         this->saved_steps.push_back(this->stack.back());
+        this->saved_ranges.push_back(std::make_pair(proof_begin, this->proof.size()));
+        if (this->gen_proof_tree) {
+            this->saved_links.push_back(this->tree_stack.back());
+        }
+        if (this->profiler != NULL) {
+            this->profiler->record_saved_step();
+        }
         return this->saved_steps.size() - 1;
     }
 
     void process_saved_step(size_t step_num) {
-        this->process_sentence(this->saved_steps.at(step_num));
+        this->push_saved_step(step_num, {}, true);
+    }
+
+    size_t get_proof_size() const {
+        return this->proof.size();
+    }
+
+    /* Record the step on top of the stack, proved by the labels from proof_begin on,
+     * as a saved step, so that replay_memoized_step() can push it again without
+     * executing its proof again. The replayed step refers to the saved step in the
+     * proof; get_uncompressed_proof_labels() expands it. Memoized steps are
+     * discarded on rollback. */
+    void memoize_step(uint64_t key, size_t proof_begin) {
+        if (this->memoized_steps.find(key) != this->memoized_steps.end()) {
+            return;
+        }
+        MemoizedStep step;
+        step.saved_step = this->save_step(proof_begin);
+        step.dists = this->dists_stack.back();
+        this->memoized_steps.insert(std::make_pair(key, std::move(step)));
+        this->memoized_keys.push_back(key);
+    }
+
+    bool replay_memoized_step(uint64_t key) {
+        auto it = this->memoized_steps.find(key);
+        if (it == this->memoized_steps.end()) {
+            return false;
+        }
+        // The memoized tree is shared and expanded as usual, as if its proof was executed again
+        this->push_saved_step(it->second.saved_step, it->second.dists, false);
+        return true;
     }
 
 protected:
+    static constexpr size_t UNKNOWN_PROOF_BEGIN = std::numeric_limits< size_t >::max();
+
+    void push_saved_step(size_t step_num, const std::set< std::pair< VarType, VarType > > &dists, bool leaf_in_tree) {
+        this->push_stack(this->saved_steps.at(step_num), dists);
+        if (this->gen_proof_tree) {
+            auto link = this->saved_links.at(step_num);
+            link.essential = true;
+            link.saved_step = leaf_in_tree;
+            this->tree_stack.push_back(link);
+        }
+        this->saved_refs.push_back(std::make_pair(this->proof.size(), step_num));
+        this->proof.push_back({});
+        if (this->profiler != NULL) {
+            this->profiler->record_saved_step_reuse(this->stack.size());
+        }
+    }
+
+    void expand_proof(size_t begin, size_t end, std::vector< LabTok > &ret) const {
+        auto ref = std::lower_bound(this->saved_refs.begin(), this->saved_refs.end(), std::make_pair(begin, size_t(0)));
+        for (size_t pos = begin; pos < end; pos++) {
+            if (ref != this->saved_refs.end() && ref->first == pos) {
+                const auto &range = this->saved_ranges[ref->second];
+                ref++;
+                // A saved step always comes before its uses, so this terminates
+                if (range.first != UNKNOWN_PROOF_BEGIN) {
+                    this->expand_proof(range.first, range.second, ret);
+                    continue;
+                }
+            }
+            ret.push_back(this->proof[pos]);
+        }
+    }
+
     void process_assertion(const Assertion &child_ass, LabTok label = {})
     {
+        std::chrono::steady_clock::time_point begin_time;
+        if (this->profiler != NULL) {
+            begin_time = std::chrono::steady_clock::now();
+        }
         assert_or_throw< ProofException< SentType_ > >(this->stack.size() >= child_ass.get_mand_hyps_num(), "Stack too small to pop hypotheses");
         const size_t stack_base = this->stack.size() - child_ass.get_mand_hyps_num();
         //this->dists.clear();
@@ -199,13 +462,12 @@ protected:
         }
 
         // Keep track of the distinct variables constraints in the substitution map
-        propagate_dists< SentType_ >(child_ass, subst_map, this->lib, dists);
-        assert_or_throw< ProofException< SentType_ > >(has_no_diagonal(dists.begin(), dists.end()), "Distinct variable constraint violated");
+        assert_or_throw< ProofException< SentType_ > >(propagate_dists< SentType_ >(child_ass, subst_map, this->lib, dists), "Distinct variable constraint violated");
 
         // Build the thesis
         LabTok thesis = child_ass.get_thesis();
         const SentType &thesis_sent = TraitsType::get_sentence(this->lib, thesis);
-        SentType stack_thesis_sent = TraitsType::substitute(this->lib, thesis_sent, subst_map);
+        SentType stack_thesis_sent = TraitsType::substitute(this->lib, thesis_sent, subst_map, this->arena);
 #ifdef PROOF_VERBOSE_DEBUG
         cerr << "    Thesis:         " << print_sentence(thesis_sent, this->lib) << endl << "      becomes:      " << print_sentence(stack_thesis_sent, this->lib) << endl;
 #endif
@@ -224,22 +486,36 @@ protected:
             for (auto it = this->tree_stack.begin() + stack_base; it != this->tree_stack.begin() + stack_base + child_ass.get_float_hyps().size(); it++) {
                 it->essential = false;
             }
-            std::vector< ProofTree< SentType_ > > children(this->tree_stack.begin() + stack_base, this->tree_stack.end());
+            uint32_t node = this->flat_tree.add_node(label, child_ass.get_number(), stack_thesis_sent, dists, this->tree_stack.begin() + stack_base, this->tree_stack.end());
             this->tree_stack.resize(stack_base);
-            this->proof_tree = { stack_thesis_sent, label, children, dists, true, child_ass.get_number() };
-            this->tree_stack.push_back(this->proof_tree);
+            this->tree_stack.push_back({ node, true, false });
         }
         this->proof.push_back(label);
+        if (this->profiler != NULL) {
+            // Do not account the time spent measuring the substitution
+            const std::chrono::nanoseconds time = std::chrono::steady_clock::now() - begin_time;
+            size_t subst_size = 0;
+            for (const auto &subst : subst_map) {
+                for (auto tok : TraitsType::get_variable_iterator(this->lib, subst.second)) {
+                    (void) tok;
+                    subst_size++;
+                }
+            }
+            this->profiler->record_assertion(label, subst_size, dists.size(), this->stack.size(), time);
+        }
     }
 
     void process_sentence(const SentType &sent, LabTok label = {})
     {
         this->push_stack(sent, {});
         if (this->gen_proof_tree) {
-            this->proof_tree = { sent, label, {}, {}, true, {} };
-            this->tree_stack.push_back(this->proof_tree);
+            uint32_t node = this->flat_tree.add_node(label, {}, sent, {}, this->tree_stack.end(), this->tree_stack.end());
+            this->tree_stack.push_back({ node, true, false });
         }
         this->proof.push_back(label);
+        if (this->profiler != NULL) {
+            this->profiler->record_hyp(this->stack.size());
+        }
     }
 
     void process_label(const LabTok label)
@@ -277,7 +553,7 @@ protected:
 
     void checkpoint()
     {
-        this->checkpoints.emplace_back(this->stack.size(), this->proof.size(), this->saved_steps.size());
+        this->checkpoints.emplace_back(this->stack.size(), this->proof.size(), this->saved_steps.size(), this->memoized_keys.size(), this->flat_tree.get_mark(), this->arena.get_mark());
     }
 
     void commit()
@@ -291,6 +567,21 @@ protected:
         this->dists_stack.resize(std::get<0>(this->checkpoints.back()));
         this->proof.resize(std::get<1>(this->checkpoints.back()));
         this->saved_steps.resize(std::get<2>(this->checkpoints.back()));
+        this->saved_ranges.resize(std::get<2>(this->checkpoints.back()));
+        while (!this->saved_refs.empty() && this->saved_refs.back().first >= this->proof.size()) {
+            this->saved_refs.pop_back();
+        }
+        if (this->gen_proof_tree) {
+            this->tree_stack.resize(std::get<0>(this->checkpoints.back()));
+            this->saved_links.resize(std::get<2>(this->checkpoints.back()));
+            this->flat_tree.truncate(std::get<4>(this->checkpoints.back()));
+        }
+        for (auto it = this->memoized_keys.begin() + std::get<3>(this->checkpoints.back()); it != this->memoized_keys.end(); it++) {
+            this->memoized_steps.erase(*it);
+        }
+        this->memoized_keys.resize(std::get<3>(this->checkpoints.back()));
+        // Nothing that survives the rollback refers to the sentences built after the checkpoint
+        this->arena.truncate(std::get<5>(this->checkpoints.back()));
         this->checkpoints.pop_back();
     }
 
@@ -328,16 +619,33 @@ private:
 
     const LibType &lib;
     bool gen_proof_tree;
-    std::vector< SentType > stack;
+    // Storage for the theses built by TraitsType::substitute()
+    typename TraitsType::ArenaType arena;
+    // Mutable, so that get_stack() can materialize it
+    mutable std::vector< SentType > stack;
     std::vector< std::set< std::pair< VarType, VarType > > > dists_stack;
     std::vector< SentType > saved_steps;
-    std::vector< ProofTree< SentType_ > > tree_stack;
-    ProofTree< SentType_ > proof_tree;
+    // Parallel to saved_steps: the labels in proof that prove each saved step, if known
+    std::vector< std::pair< size_t, size_t > > saved_ranges;
+    // The positions in proof that refer to a saved step, in increasing order, with the index of the step
+    std::vector< std::pair< size_t, size_t > > saved_refs;
+    // Parallel to stack and saved_steps when generating the proof tree
+    FlatProofTree< SentType_ > flat_tree;
+    std::vector< typename FlatProofTree< SentType_ >::Link > tree_stack;
+    std::vector< typename FlatProofTree< SentType_ >::Link > saved_links;
     //std::set< std::pair< SymTok, SymTok > > dists;
     std::vector< LabTok > proof;
     //std::vector< std::tuple< size_t, std::set< std::pair< SymTok, SymTok > >, size_t > > checkpoints;
-    std::vector< std::tuple< size_t, size_t, size_t > > checkpoints;
+    std::vector< std::tuple< size_t, size_t, size_t, size_t, typename FlatProofTree< SentType_ >::Mark, typename TraitsType::ArenaType::Mark > > checkpoints;
     std::string debug_output;
+    ProofProfiler *profiler = NULL;
+
+    struct MemoizedStep {
+        size_t saved_step;
+        std::set< std::pair< VarType, VarType > > dists;
+    };
+    std::unordered_map< uint64_t, MemoizedStep > memoized_steps;
+    std::vector< uint64_t > memoized_keys;
 };
 
 class ProofEngine {
@@ -363,6 +671,10 @@ public:
     virtual void checkpoint() = 0;
     virtual void commit() = 0;
     virtual void rollback() = 0;
+    // See memoized_prover() in toolbox.h
+    virtual size_t get_proof_size() const = 0;
+    virtual void memoize_step(uint64_t key, size_t proof_begin) = 0;
+    virtual bool replay_memoized_step(uint64_t key) = 0;
 };
 
 template< typename SentType_ >
@@ -453,6 +765,18 @@ public:
         this->ProofEngineBase< SentType_ >::rollback();
     }
 
+    size_t get_proof_size() const override {
+        return this->ProofEngineBase< SentType_ >::get_proof_size();
+    }
+
+    void memoize_step(uint64_t key, size_t proof_begin) override {
+        this->ProofEngineBase< SentType_ >::memoize_step(key, proof_begin);
+    }
+
+    bool replay_memoized_step(uint64_t key) override {
+        return this->ProofEngineBase< SentType_ >::replay_memoized_step(key);
+    }
+
     const std::vector< SentType > &get_stack() const override {
         return this->ProofEngineBase< SentType_ >::get_stack();
     }
@@ -182,6 +182,9 @@ Assertion::Assertion(bool theorem, bool _has_proof,
     float_hyps(float_hyps), ess_hyps(ess_hyps), opt_hyps(opt_hyps), thesis(thesis), number(number), proof(nullptr),
     comment(comment), modif_disc(false), usage_disc(false), _has_proof(_has_proof)
 {
+    set_union(this->mand_dists.begin(), this->mand_dists.end(),
+              this->opt_dists.begin(), this->opt_dists.end(),
+              inserter(this->dists, this->dists.begin()));
     if (this->comment.find("(Proof modification is discouraged.)") != std::string::npos) {
         this->modif_disc = true;
     }
@@ -196,15 +199,6 @@ Assertion::~Assertion()
 {
 }
 
-const std::set<std::pair<SymTok, SymTok> > Assertion::get_dists() const
-{
-    std::set<std::pair<SymTok, SymTok> > ret;
-    set_union(this->get_mand_dists().begin(), this->get_mand_dists().end(),
-              this->get_opt_dists().begin(), this->get_opt_dists().end(),
-              inserter(ret, ret.begin()));
-    return ret;
-}
-
 LabTok Assertion::get_mand_hyp(size_t i) const
 {
     if (i < this->get_float_hyps().size()) {
@@ -215,7 +215,11 @@ public:
     const std::string &get_comment() const {
         return this->comment;
     }
-    const std::set<std::pair<SymTok, SymTok> > get_dists() const;
+    // Mandatory and optional constraints together
+    const std::set<std::pair<SymTok, SymTok> > &get_dists() const
+    {
+        return this->dists;
+    }
     size_t get_mand_hyps_num() const
     {
         return this->get_float_hyps().size() + this->get_ess_hyps().size();
@@ -253,6 +257,7 @@ private:
     bool theorem;
     std::set< std::pair< SymTok, SymTok > > mand_dists;
     std::set< std::pair< SymTok, SymTok > > opt_dists;
+    std::set< std::pair< SymTok, SymTok > > dists;
     std::vector< LabTok > float_hyps;
     std::vector< LabTok > ess_hyps;
     std::set< LabTok > opt_hyps;
@@ -0,0 +1,81 @@
+#include "libregistry.h"
+
+#include <fstream>
+
+#include "mm/reader.h"
+#include "utils/utils.h"
+
+LoadedLibrary::LoadedLibrary(const boost::filesystem::path &filename, const boost::filesystem::path &cache_filename, const std::string &turnstile, const std::string &digest) :
+    digest(digest)
+{
+    FileTokenizer ft(filename);
+    Reader p(ft, false, true);
+    p.run();
+    auto library = std::make_unique< LibraryImpl >(p.get_library());
+    std::shared_ptr< ToolboxCache > cache = std::make_shared< FileToolboxCache >(cache_filename);
+    this->toolbox = std::make_unique< LibraryToolbox >(*library, turnstile, cache);
+    this->library = std::move(library);
+}
+
+LibraryRegistry::LibraryRegistry()
+{
+}
+
+LibraryRegistry &LibraryRegistry::get_registry()
+{
+    static LibraryRegistry registry;
+    return registry;
+}
+
+static std::string hash_file(const boost::filesystem::path &filename)
+{
+    std::ifstream fin(filename.string(), std::ios::binary);
+    assert_or_throw< std::invalid_argument >(static_cast< bool >(fin), "Could not open file " + filename.string());
+    HashSink hasher;
+    std::vector< char > buffer(1 << 16);
+    while (fin) {
+        fin.read(buffer.data(), buffer.size());
+        hasher.write(buffer.data(), fin.gcount());
+    }
+    return hasher.get_digest();
+}
+
+std::shared_ptr< const LoadedLibrary > LibraryRegistry::get_library(const boost::filesystem::path &filename, const boost::filesystem::path &cache_filename, const std::string &turnstile)
+{
+    key_type key(hash_file(filename), boost::filesystem::file_size(filename), turnstile);
+    std::promise< std::shared_ptr< const LoadedLibrary > > promise;
+    {
+        std::unique_lock< std::mutex > lock(this->global_mutex);
+        auto it = this->loaded.find(key);
+        if (it != this->loaded.end()) {
+            auto ret = it->second.lock();
+            if (ret) {
+                return ret;
+            }
+            this->loaded.erase(it);
+        }
+        auto it2 = this->loading.find(key);
+        if (it2 != this->loading.end()) {
+            auto future = it2->second;
+            lock.unlock();
+            return future.get();
+        }
+        this->loading.insert(std::make_pair(key, promise.get_future().share()));
+    }
+
+    // The database is not available, so we load it ourselves
+    try {
+        std::string digest = std::get<0>(key) + "-" + std::to_string(std::get<1>(key)) + "-" + turnstile;
+        std::shared_ptr< const LoadedLibrary > ret = std::make_shared< LoadedLibrary >(filename, cache_filename, turnstile, digest);
+        std::unique_lock< std::mutex > lock(this->global_mutex);
+        this->loaded[key] = ret;
+        this->loading.erase(key);
+        promise.set_value(ret);
+        return ret;
+    } catch (...) {
+        std::unique_lock< std::mutex > lock(this->global_mutex);
+        this->loading.erase(key);
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+}
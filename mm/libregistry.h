@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <future>
+
+#include <boost/filesystem.hpp>
+
+#include "mm/library.h"
+#include "mm/toolbox.h"
+
+struct LoadedLibrary {
+    LoadedLibrary(const boost::filesystem::path &filename, const boost::filesystem::path &cache_filename, const std::string &turnstile, const std::string &digest);
+
+    // Identifies the content of the database and the turnstile, also across processes
+    std::string digest;
+    std::unique_ptr< const LibraryImpl > library;
+    std::unique_ptr< const LibraryToolbox > toolbox;
+};
+
+/**
+ * @brief A process-wide registry of the loaded databases.
+ *
+ * Databases are identified by the digest of their content and by the turnstile,
+ * so that each of them is parsed and processed only once, however many worksets
+ * request it. The registry only keeps weak references: a database is released as
+ * soon as the last LoadedLibrary pointer is dropped. Concurrent requests for the same
+ * database that is still being loaded wait for the first loader to finish.
+ */
+class LibraryRegistry {
+public:
+    static LibraryRegistry &get_registry();
+    std::shared_ptr< const LoadedLibrary > get_library(const boost::filesystem::path &filename, const boost::filesystem::path &cache_filename, const std::string &turnstile);
+
+private:
+    LibraryRegistry();
+
+    typedef std::tuple< std::string, uintmax_t, std::string > key_type;
+
+    std::mutex global_mutex;
+    std::map< key_type, std::weak_ptr< const LoadedLibrary > > loaded;
+    std::map< key_type, std::shared_future< std::shared_ptr< const LoadedLibrary > > > loading;
+};
@@ -0,0 +1,142 @@
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+
+void ProofProfiler::begin_theorem(LabTok label)
+{
+    assert(!this->in_theorem);
+    this->theorems.emplace_back(label, Counters());
+    this->theorems.back().second.uses = 1;
+    this->in_theorem = true;
+    this->theorem_begin = std::chrono::steady_clock::now();
+}
+
+void ProofProfiler::end_theorem()
+{
+    assert(this->in_theorem);
+    this->current().total_time += std::chrono::steady_clock::now() - this->theorem_begin;
+    this->in_theorem = false;
+}
+
+void ProofProfiler::record_assertion(LabTok label, size_t subst_size, size_t dists_num, size_t stack_size, std::chrono::nanoseconds time)
+{
+    for (auto counters : { &this->current(), &this->assertions[label] }) {
+        counters->assertion_steps++;
+        counters->subst_size += subst_size;
+        counters->max_subst_size = std::max< uint64_t >(counters->max_subst_size, subst_size);
+        counters->dists += dists_num;
+        counters->max_stack_size = std::max< uint64_t >(counters->max_stack_size, stack_size);
+        counters->assertion_time += time;
+    }
+    this->assertions[label].uses++;
+}
+
+void ProofProfiler::record_hyp(size_t stack_size)
+{
+    auto &counters = this->current();
+    counters.hyp_steps++;
+    counters.max_stack_size = std::max< uint64_t >(counters.max_stack_size, stack_size);
+}
+
+void ProofProfiler::record_saved_step()
+{
+    this->current().saved_steps++;
+}
+
+void ProofProfiler::record_saved_step_reuse(size_t stack_size)
+{
+    auto &counters = this->current();
+    counters.saved_step_reuses++;
+    counters.max_stack_size = std::max< uint64_t >(counters.max_stack_size, stack_size);
+}
+
+const std::vector< std::pair< LabTok, ProofProfiler::Counters > > &ProofProfiler::get_theorems() const
+{
+    return this->theorems;
+}
+
+const std::unordered_map< LabTok, ProofProfiler::Counters > &ProofProfiler::get_assertions() const
+{
+    return this->assertions;
+}
+
+static double to_ms(std::chrono::nanoseconds time) {
+    return std::chrono::duration< double, std::milli >(time).count();
+}
+
+template< typename It >
+static void print_top(std::ostream &os, const Library &lib, It begin, It end, size_t top_num, std::chrono::nanoseconds ProofProfiler::Counters::*time) {
+    std::vector< std::pair< LabTok, ProofProfiler::Counters > > sorted(begin, end);
+    auto middle = sorted.begin() + static_cast< ptrdiff_t >(std::min(top_num, sorted.size()));
+    std::partial_sort(sorted.begin(), middle, sorted.end(), [time](const auto &x, const auto &y) {
+        return x.second.*time > y.second.*time;
+    });
+    os << std::setw(24) << std::left << "label" << std::right << std::setw(12) << "time (ms)" << std::setw(10) << "uses"
+       << std::setw(10) << "steps" << std::setw(10) << "hyps" << std::setw(10) << "reuses" << std::setw(12) << "subst size"
+       << std::setw(10) << "max subst" << std::setw(10) << "dists" << std::setw(10) << "max stack" << std::endl;
+    for (auto it = sorted.begin(); it != middle; it++) {
+        const auto &c = it->second;
+        os << std::setw(24) << std::left << lib.resolve_label(it->first) << std::right << std::setw(12) << std::fixed << std::setprecision(3) << to_ms(c.*time)
+           << std::setw(10) << c.uses << std::setw(10) << c.assertion_steps << std::setw(10) << c.hyp_steps << std::setw(10) << c.saved_step_reuses
+           << std::setw(12) << c.subst_size << std::setw(10) << c.max_subst_size << std::setw(10) << c.dists << std::setw(10) << c.max_stack_size << std::endl;
+    }
+}
+
+void ProofProfiler::print_report(std::ostream &os, const Library &lib, size_t top_num) const
+{
+    std::chrono::nanoseconds total_time = std::chrono::nanoseconds::zero();
+    std::chrono::nanoseconds assertion_time = std::chrono::nanoseconds::zero();
+    uint64_t steps = 0;
+    for (const auto &theorem : this->theorems) {
+        total_time += theorem.second.total_time;
+        assertion_time += theorem.second.assertion_time;
+        steps += theorem.second.assertion_steps + theorem.second.hyp_steps + theorem.second.saved_step_reuses;
+    }
+    os << "Executed " << this->theorems.size() << " proofs with " << steps << " steps in " << to_ms(total_time) << " ms, "
+       << to_ms(assertion_time) << " ms of which processing assertions" << std::endl;
+    os << std::endl << "Theorems whose proofs take the most time to execute:" << std::endl;
+    print_top(os, lib, this->theorems.begin(), this->theorems.end(), top_num, &Counters::total_time);
+    os << std::endl << "Assertions whose references take the most time to process:" << std::endl;
+    print_top(os, lib, this->assertions.begin(), this->assertions.end(), top_num, &Counters::assertion_time);
+}
+
+static nlohmann::json jsonize_counters(const Library &lib, LabTok label, const ProofProfiler::Counters &c) {
+    nlohmann::json ret;
+    ret["label"] = lib.resolve_label(label);
+    ret["uses"] = c.uses;
+    ret["assertion_steps"] = c.assertion_steps;
+    ret["hyp_steps"] = c.hyp_steps;
+    ret["saved_steps"] = c.saved_steps;
+    ret["saved_step_reuses"] = c.saved_step_reuses;
+    ret["subst_size"] = c.subst_size;
+    ret["max_subst_size"] = c.max_subst_size;
+    ret["dists"] = c.dists;
+    ret["max_stack_size"] = c.max_stack_size;
+    ret["assertion_time_ns"] = c.assertion_time.count();
+    ret["total_time_ns"] = c.total_time.count();
+    return ret;
+}
+
+nlohmann::json ProofProfiler::to_json(const Library &lib) const
+{
+    nlohmann::json ret;
+    ret["theorems"] = nlohmann::json::array();
+    for (const auto &theorem : this->theorems) {
+        ret["theorems"].push_back(jsonize_counters(lib, theorem.first, theorem.second));
+    }
+    // Sorted by label number, so that reports of different runs can be compared
+    std::vector< std::pair< LabTok, Counters > > assertions(this->assertions.begin(), this->assertions.end());
+    std::sort(assertions.begin(), assertions.end(), [](const auto &x, const auto &y) { return x.first < y.first; });
+    ret["assertions"] = nlohmann::json::array();
+    for (const auto &assertion : assertions) {
+        ret["assertions"].push_back(jsonize_counters(lib, assertion.first, assertion.second));
+    }
+    return ret;
+}
+
+ProofProfiler::Counters &ProofProfiler::current()
+{
+    return this->in_theorem ? this->theorems.back().second : this->orphan;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+
+#include "libs/json.h"
+
+#include "library.h"
+#include "mmtypes.h"
+
+/*
+ * Opt-in instrumentation for ProofEngineBase. When a profiler is attached to
+ * an engine, each step is accounted both to the theorem whose proof is being
+ * executed (set with begin_theorem()) and to the assertion the step
+ * references. A profiler is not thread safe, so all the engines it is
+ * attached to must run on the same thread.
+ */
+class ProofProfiler {
+public:
+    struct Counters {
+        // Executions for theorems, references for assertions
+        uint64_t uses = 0;
+        uint64_t assertion_steps = 0;
+        uint64_t hyp_steps = 0;
+        uint64_t saved_steps = 0;
+        uint64_t saved_step_reuses = 0;
+        // Symbols (or nodes) in the substituted terms
+        uint64_t subst_size = 0;
+        uint64_t max_subst_size = 0;
+        // Distinct variable pairs carried by the resulting steps
+        uint64_t dists = 0;
+        uint64_t max_stack_size = 0;
+        // Time spent processing assertion steps; for theorems there is also the whole execution time
+        std::chrono::nanoseconds assertion_time = std::chrono::nanoseconds::zero();
+        std::chrono::nanoseconds total_time = std::chrono::nanoseconds::zero();
+    };
+
+    void begin_theorem(LabTok label);
+    void end_theorem();
+
+    void record_assertion(LabTok label, size_t subst_size, size_t dists_num, size_t stack_size, std::chrono::nanoseconds time);
+    void record_hyp(size_t stack_size);
+    void record_saved_step();
+    void record_saved_step_reuse(size_t stack_size);
+
+    const std::vector< std::pair< LabTok, Counters > > &get_theorems() const;
+    const std::unordered_map< LabTok, Counters > &get_assertions() const;
+    // The top_num theorems and referenced assertions taking most time
+    void print_report(std::ostream &os, const Library &lib, size_t top_num = 20) const;
+    nlohmann::json to_json(const Library &lib) const;
+
+private:
+    Counters &current();
+
+    std::vector< std::pair< LabTok, Counters > > theorems;
+    std::unordered_map< LabTok, Counters > assertions;
+    bool in_theorem = false;
+    std::chrono::steady_clock::time_point theorem_begin;
+    Counters orphan;
+};
@@ -7,6 +7,8 @@
 #include <cassert>
 #include <unordered_map>
 
+#include <boost/functional/hash.hpp>
+
 #include "utils/utils.h"
 #include "library.h"
 
@@ -151,61 +153,286 @@ const std::vector<LabTok> &UncompressedProof::get_labels() const
     return this->labels;
 }
 
-static void compress_unwind_proof_tree_phase1(const ProofTree< Sentence > &tree,
-                                              std::unordered_map< LabTok, CodeTok > &label_map,
-                                              std::vector< LabTok > &refs,
-                                              std::set< std::vector< SymTok > > &sents,
-                                              std::set< std::vector< SymTok > > &dupl_sents,
-                                              CodeTok &code_idx) {
-    // If the sentence is duplicate and it has children, prune the subtree and record the sentence as duplicate
-    // There is no point in deduplicating subtrees that are already trivial
-    if (!tree.children.empty() && sents.find(tree.sentence) != sents.end()) {
-        dupl_sents.insert(tree.sentence);
-        return;
+/*
+ * A proof where identical subproofs are shared, so that it becomes a DAG. Each node
+ * is created after its children, so the index order is topological and the root is
+ * the last node.
+ */
+struct ProofDag {
+    struct Node {
+        LabTok label;
+        std::vector< size_t > children;
+    };
+
+    std::vector< Node > nodes;
+};
+
+// Share subproofs which are identical as trees, interning each node on its label and its (already interned) children
+static ProofDag build_proof_dag_on_identical_tree(const std::vector< LabTok > &labels, const std::function< size_t(LabTok) > &get_hyp_num) {
+    ProofDag dag;
+    std::unordered_map< std::vector< size_t >, size_t, boost::hash< std::vector< size_t > > > interned;
+    std::vector< size_t > stack;
+    for (const auto &label : labels) {
+        size_t hyp_num = get_hyp_num(label);
+        assert_or_throw< ProofException< Sentence > >(stack.size() >= hyp_num, "Stack too small to pop hypotheses");
+        std::vector< size_t > key;
+        key.push_back(label.val());
+        key.insert(key.end(), stack.end() - hyp_num, stack.end());
+        stack.resize(stack.size() - hyp_num);
+        auto res = interned.insert(std::make_pair(key, dag.nodes.size()));
+        if (res.second) {
+            dag.nodes.push_back({ label, std::vector< size_t >(key.begin() + 1, key.end()) });
+        }
+        stack.push_back(res.first->second);
     }
-    // Recur
-    for (const auto &child : tree.children) {
-        compress_unwind_proof_tree_phase1(child, label_map, refs, sents, dupl_sents, code_idx);
+    assert_or_throw< ProofException< Sentence > >(stack.size() == 1, "Proof execution did not end with a single element on the stack");
+    assert(stack.back() == dag.nodes.size() - 1);
+    return dag;
+}
+
+// FNV-1a on whole symbols; collisions are checked anyway, so it needs to be fast rather than strong
+static uint64_t hash_sentence(const std::vector< SymTok > &sent) {
+    uint64_t ret = 0xcbf29ce484222325;
+    for (const auto &tok : sent) {
+        ret ^= tok.val();
+        ret *= 0x100000001b3;
     }
-    // If the label is new, record it
-    if (label_map.find(tree.label) == label_map.end()) {
-        auto res = label_map.insert(std::make_pair(tree.label, code_idx));
-        code_idx = CodeTok(code_idx.val()+1);
-        assert(res.second);
-        refs.push_back(tree.label);
+    return ret;
+}
+
+/* Share subproofs proving the same sentence, while the proof is executed. A step with children is
+ * replaced by the earlier step proving the same sentence, provided that the latter was completed
+ * before the former began (otherwise nested identical sentences would create a cycle); in that case
+ * the nodes created for the replaced subproof are dropped again, since they will never be written.
+ * Sentences are interned by their hash, so each one is compared in full only on hash matches. */
+static ProofDag build_proof_dag_on_identical_sentence(const std::vector< LabTok > &labels, const std::function< size_t(LabTok) > &get_hyp_num,
+                                                      const std::function< const std::vector< SymTok >&(LabTok) > &process_label) {
+    ProofDag dag;
+    std::vector< uint64_t > hashes;
+    std::vector< std::vector< SymTok > > sents;
+    std::unordered_multimap< uint64_t, size_t > interned;
+    // For each element of the stack, its node and the number of nodes when its subproof began
+    std::vector< std::pair< size_t, size_t > > stack;
+    auto find_interned = [&](uint64_t hash, const std::vector< SymTok > &sent) {
+        auto range = interned.equal_range(hash);
+        for (auto it = range.first; it != range.second; it++) {
+            if (sents[it->second] == sent) {
+                return it->second;
+            }
+        }
+        return dag.nodes.size();
+    };
+    for (const auto &label : labels) {
+        size_t hyp_num = get_hyp_num(label);
+        const auto &sent = process_label(label);
+        assert(stack.size() >= hyp_num);
+        size_t begin = hyp_num == 0 ? dag.nodes.size() : stack[stack.size() - hyp_num].second;
+        std::vector< size_t > children;
+        for (auto it = stack.end() - hyp_num; it != stack.end(); it++) {
+            children.push_back(it->first);
+        }
+        stack.resize(stack.size() - hyp_num);
+        uint64_t hash = hash_sentence(sent);
+        size_t existing = find_interned(hash, sent);
+        if (hyp_num > 0 && existing < begin) {
+            for (size_t i = begin; i < dag.nodes.size(); i++) {
+                auto range = interned.equal_range(hashes[i]);
+                for (auto it = range.first; it != range.second; it++) {
+                    if (it->second == i) {
+                        interned.erase(it);
+                        break;
+                    }
+                }
+            }
+            dag.nodes.resize(begin);
+            hashes.resize(begin);
+            sents.resize(begin);
+            stack.push_back(std::make_pair(existing, begin));
+            continue;
+        }
+        size_t idx = dag.nodes.size();
+        dag.nodes.push_back({ label, std::move(children) });
+        hashes.push_back(hash);
+        // Only the first node proving a sentence is ever referenced, so only that one is interned
+        if (existing == idx) {
+            sents.push_back(sent);
+            interned.insert(std::make_pair(hash, idx));
+        } else {
+            sents.emplace_back();
+        }
+        stack.push_back(std::make_pair(idx, begin));
+    }
+    assert_or_throw< ProofException< Sentence > >(stack.size() == 1, "Proof execution did not end with a single element on the stack");
+    assert(stack.back().first == dag.nodes.size() - 1);
+    return dag;
+}
+
+// Number of times each node is written out in full, given which nodes are saved and back referenced
+static std::vector< double > compute_proof_dag_expansions(const ProofDag &dag, const std::vector< bool > &saved, std::vector< double > &uses) {
+    uses.assign(dag.nodes.size(), 0.0);
+    std::vector< double > expansions(dag.nodes.size(), 0.0);
+    uses.back() = 1.0;
+    for (size_t i = dag.nodes.size(); i > 0; i--) {
+        size_t idx = i - 1;
+        expansions[idx] = saved[idx] ? std::min(uses[idx], 1.0) : uses[idx];
+        for (const auto child : dag.nodes[idx].children) {
+            uses[child] += expansions[idx];
+        }
+    }
+    return expansions;
+}
+
+// Back reference each non trivial subproof which would otherwise be written more than once
+static std::vector< bool > choose_backrefs_on_repetition(const ProofDag &dag) {
+    std::vector< bool > saved(dag.nodes.size(), false);
+    std::vector< double > uses(dag.nodes.size(), 0.0);
+    uses.back() = 1.0;
+    // Parents are decided before their children, so the number of uses of each node is final when it is reached
+    for (size_t i = dag.nodes.size(); i > 0; i--) {
+        size_t idx = i - 1;
+        saved[idx] = !dag.nodes[idx].children.empty() && uses[idx] >= 2.0;
+        double expansions = saved[idx] ? 1.0 : uses[idx];
+        for (const auto child : dag.nodes[idx].children) {
+            uses[child] += expansions;
+        }
+    }
+    return saved;
+}
+
+// Number of characters needed to encode a code in a compressed proof
+static size_t code_length(size_t code) {
+    size_t ret = 1;
+    code = (code - 1) / 20;
+    while (code > 0) {
+        ret++;
+        code = (code - 1) / 5;
+    }
+    return ret;
+}
+
+/* Assign codes to the labels which are not mandatory hypotheses, so that the labels written out
+ * most often get the shortest codes; ties are broken by label, to keep the output deterministic. */
+static void assign_refs_by_frequency(const ProofDag &dag, const std::vector< double > &expansions, std::unordered_map< LabTok, CodeTok > &label_map,
+                                     size_t mand_hyps_num, std::vector< LabTok > &refs) {
+    std::unordered_map< LabTok, double > freqs;
+    for (size_t i = 0; i < dag.nodes.size(); i++) {
+        const auto &label = dag.nodes[i].label;
+        if (label_map.find(label) == label_map.end() || label_map.at(label).val() > mand_hyps_num) {
+            freqs[label] += expansions[i];
+        }
+    }
+    refs.clear();
+    for (const auto &freq : freqs) {
+        refs.push_back(freq.first);
     }
-    // Record the sentence as seen; this must be done when closing, otherwise there are problem with identical nested sentences
-    sents.insert(tree.sentence);
-}
-
-// In order to avoid inconsistencies with label numbering, it is important that phase 2 performs the same prunings as phase 1
-static void compress_unwind_proof_tree_phase2(const ProofTree< Sentence > &tree,
-                                              const std::unordered_map< LabTok, CodeTok > &label_map,
-                                              const std::vector< LabTok > &refs,
-                                              std::set< std::vector< SymTok > > &sents,
-                                              const std::set< std::vector< SymTok > > &dupl_sents,
-                                              std::map< std::vector< SymTok >, CodeTok > &dupl_sents_map,
-                                              std::vector< CodeTok > &codes, CodeTok &code_idx) {
-    // If the sentence is duplicate and it has children, prune the subtree and recall saved sentence
-    if (!tree.children.empty() && sents.find(tree.sentence) != sents.end()) {
-        codes.push_back(dupl_sents_map.at(tree.sentence));
+    std::sort(refs.begin(), refs.end(), [&freqs](const auto &x, const auto &y) {
+        return std::make_pair(-freqs.at(x), x) < std::make_pair(-freqs.at(y), y);
+    });
+    for (size_t i = 0; i < refs.size(); i++) {
+        label_map[refs[i]] = CodeTok(static_cast< CodeTok::val_type >(mand_hyps_num + i + 1));
+    }
+}
+
+// Visit the proof in the order of the compressed encoding, where saved subproofs are written out only the first time
+static void unwind_proof_dag(const ProofDag &dag, const std::vector< bool > &saved, size_t idx, std::vector< size_t > &saved_codes,
+                             size_t &saved_num, const std::function< void(LabTok) > &push_label, const std::function< void(size_t) > &push_saved) {
+    if (saved[idx] && saved_codes[idx] != 0) {
+        push_saved(saved_codes[idx]);
         return;
     }
-    // Recur
-    for (const auto &child : tree.children) {
-        compress_unwind_proof_tree_phase2(child, label_map, refs, sents, dupl_sents, dupl_sents_map, codes, code_idx);
+    for (const auto child : dag.nodes[idx].children) {
+        unwind_proof_dag(dag, saved, child, saved_codes, saved_num, push_label, push_saved);
     }
-    // Push this label
-    codes.push_back(label_map.at(tree.label));
-    // If the sentence is known to be duplicate and has not been saved yet, save it
-    if (dupl_sents.find(tree.sentence) != dupl_sents.end() && dupl_sents_map.find(tree.sentence) == dupl_sents_map.end()) {
-        auto res = dupl_sents_map.insert(std::make_pair(tree.sentence, code_idx));
-        code_idx = CodeTok(code_idx.val()+1);
-        assert(res.second);
-        codes.push_back(CodeTok(0));
+    push_label(dag.nodes[idx].label);
+    if (saved[idx]) {
+        saved_num++;
+        saved_codes[idx] = saved_num;
+        push_saved(0);
     }
-    // Record the sentence as seen; this must be done when closing, for same reason as above
-    sents.insert(tree.sentence);
+}
+
+static std::vector< CodeTok > encode_proof_dag(const ProofDag &dag, const std::vector< bool > &saved, const std::unordered_map< LabTok, CodeTok > &label_map, size_t saved_base) {
+    std::vector< CodeTok > codes;
+    std::vector< size_t > saved_codes(dag.nodes.size(), 0);
+    size_t saved_num = 0;
+    unwind_proof_dag(dag, saved, dag.nodes.size() - 1, saved_codes, saved_num, [&](LabTok label) {
+        codes.push_back(label_map.at(label));
+    }, [&](size_t saved_idx) {
+        codes.push_back(saved_idx == 0 ? CodeTok(0) : CodeTok(static_cast< CodeTok::val_type >(saved_base + saved_idx)));
+    });
+    return codes;
+}
+
+/* Choose which subproofs to back reference by estimating the size of the encoded proof: saving a subproof
+ * costs a Z and makes each later use cost a back reference instead of the whole subproof. Parents are decided
+ * before their children, so the number of uses of each node is exact, while the size of each subproof depends
+ * on the choices on its descendants and is taken from the previous round. Each round is evaluated exactly, with
+ * codes reassigned by frequency, and the best one is kept; the first one is the choice of
+ * CS_BACKREFS_ON_IDENTICAL_SENTENCE, so that we never do worse than that. */
+static std::vector< bool > choose_backrefs_by_cost(const ProofDag &dag, std::unordered_map< LabTok, CodeTok > &label_map,
+                                                   size_t mand_hyps_num, std::vector< LabTok > &refs) {
+    const size_t max_rounds = 8;
+    auto evaluate = [&](const std::vector< bool > &saved) {
+        std::vector< double > uses;
+        auto expansions = compute_proof_dag_expansions(dag, saved, uses);
+        assign_refs_by_frequency(dag, expansions, label_map, mand_hyps_num, refs);
+        size_t size = 0;
+        for (const auto &code : encode_proof_dag(dag, saved, label_map, mand_hyps_num + refs.size())) {
+            size += code == CodeTok(0) ? 1 : code_length(code.val());
+        }
+        return size;
+    };
+    auto saved = choose_backrefs_on_repetition(dag);
+    auto best_saved = saved;
+    size_t best_size = evaluate(saved);
+    for (size_t round = 0; round < max_rounds; round++) {
+        size_t saved_num = static_cast< size_t >(std::count(saved.begin(), saved.end(), true));
+        double backref_cost = static_cast< double >(code_length(mand_hyps_num + refs.size() + std::max< size_t >(saved_num, 1)));
+        // Size of writing each subproof in full, with back references to saved children
+        std::vector< double > sizes(dag.nodes.size(), 0.0);
+        for (size_t i = 0; i < dag.nodes.size(); i++) {
+            sizes[i] = static_cast< double >(code_length(label_map.at(dag.nodes[i].label).val()));
+            for (const auto child : dag.nodes[i].children) {
+                sizes[i] += saved[child] ? backref_cost : sizes[child];
+            }
+        }
+        std::vector< bool > new_saved(dag.nodes.size(), false);
+        std::vector< double > uses(dag.nodes.size(), 0.0);
+        uses.back() = 1.0;
+        for (size_t i = dag.nodes.size(); i > 0; i--) {
+            size_t idx = i - 1;
+            double extra_uses = uses[idx] - 1.0;
+            new_saved[idx] = !dag.nodes[idx].children.empty() && extra_uses >= 1.0 && 1.0 + extra_uses * backref_cost < extra_uses * sizes[idx];
+            double expansions = new_saved[idx] ? 1.0 : uses[idx];
+            for (const auto child : dag.nodes[idx].children) {
+                uses[child] += expansions;
+            }
+        }
+        if (new_saved == saved) {
+            break;
+        }
+        saved = new_saved;
+        size_t size = evaluate(saved);
+        if (size < best_size) {
+            best_size = size;
+            best_saved = saved;
+        }
+    }
+    evaluate(best_saved);
+    return best_saved;
+}
+
+// Assign codes to labels in order of first appearance, as the other strategies do
+static void assign_refs_by_appearance(const ProofDag &dag, const std::vector< bool > &saved, std::unordered_map< LabTok, CodeTok > &label_map, CodeTok &code_idx, std::vector< LabTok > &refs) {
+    std::vector< size_t > saved_codes(dag.nodes.size(), 0);
+    size_t saved_num = 0;
+    unwind_proof_dag(dag, saved, dag.nodes.size() - 1, saved_codes, saved_num, [&](LabTok label) {
+        if (label_map.find(label) == label_map.end()) {
+            label_map.insert(std::make_pair(label, code_idx));
+            code_idx = CodeTok(code_idx.val()+1);
+            refs.push_back(label);
+        }
+    }, [](size_t) {});
 }
 
 const CompressedProof UncompressedProofOperator::compress(CompressionStrategy strategy)
@@ -234,19 +461,32 @@ const CompressedProof UncompressedProofOperator::compress(CompressionStrategy st
             }
             codes.push_back(label_map.at(label));
         }
-    } else if (strategy == CS_BACKREFS_ON_IDENTICAL_SENTENCE || strategy == CS_ANY) {
+    } else if (strategy == CS_BACKREFS_ON_IDENTICAL_SENTENCE || strategy == CS_ANY || strategy == CS_MINIMIZE_SIZE) {
+        // Sentences are read from the stack as the proof is executed, without generating the proof tree
         this->set_relax_checks(true);
-        this->execute();
-        this->set_relax_checks(false);
-        const auto &tree = this->engine.get_proof_tree();
-        std::set< std::vector< SymTok > > sents;
-        std::set< std::vector< SymTok > > dupl_sents;
-        std::map< std::vector< SymTok >, CodeTok > dupl_sents_map;
-        compress_unwind_proof_tree_phase1(tree, label_map, refs, sents, dupl_sents, code_idx);
-        sents.clear();
-        compress_unwind_proof_tree_phase2(tree, label_map, refs, sents, dupl_sents, dupl_sents_map, codes, code_idx);
+        this->engine.set_gen_proof_tree(false);
+        Finally f([this]() {
+            this->engine.set_gen_proof_tree(true);
+            this->set_relax_checks(false);
+        });
+        auto dag = build_proof_dag_on_identical_sentence(this->proof.get_labels(), [this](LabTok label) { return this->get_hyp_num(label); },
+                                                         [this](LabTok label) -> const std::vector< SymTok >& {
+            this->process_label(label);
+            return this->get_stack().back();
+        });
+        if (strategy == CS_MINIMIZE_SIZE) {
+            auto saved = choose_backrefs_by_cost(dag, label_map, this->ass.get_mand_hyps_num(), refs);
+            codes = encode_proof_dag(dag, saved, label_map, this->ass.get_mand_hyps_num() + refs.size());
+        } else {
+            auto saved = choose_backrefs_on_repetition(dag);
+            assign_refs_by_appearance(dag, saved, label_map, code_idx, refs);
+            codes = encode_proof_dag(dag, saved, label_map, this->ass.get_mand_hyps_num() + refs.size());
+        }
     } else if (strategy == CS_BACKREFS_ON_IDENTICAL_TREE) {
-        throw MMPPException("Strategy not implemented yet");
+        auto dag = build_proof_dag_on_identical_tree(this->proof.get_labels(), [this](LabTok label) { return this->get_hyp_num(label); });
+        auto saved = choose_backrefs_on_repetition(dag);
+        assign_refs_by_appearance(dag, saved, label_map, code_idx, refs);
+        codes = encode_proof_dag(dag, saved, label_map, this->ass.get_mand_hyps_num() + refs.size());
     } else {
         throw MMPPException("Strategy does not exist");
     }
@@ -337,6 +577,19 @@ std::string CompressedEncoder::push_code(CodeTok x)
     return std::string(buf.rbegin(), buf.rend());
 }
 
+size_t compressed_proof_size(const Library &lib, const CompressedProof &proof)
+{
+    size_t ret = 0;
+    for (const auto &ref : proof.get_refs()) {
+        ret += lib.resolve_label(ref).size() + 1;
+    }
+    CompressedEncoder encoder;
+    for (const auto &code : proof.get_codes()) {
+        ret += encoder.push_code(code).size();
+    }
+    return ret;
+}
+
 ProofOperator::~ProofOperator()
 {
 }
@@ -20,16 +20,26 @@ public:
         CS_NO_BACKREFS,
         CS_BACKREFS_ON_IDENTICAL_TREE,
         CS_BACKREFS_ON_IDENTICAL_SENTENCE,
+        // Heuristically minimize the size of the encoded proof
+        CS_MINIMIZE_SIZE,
     };
 
     const std::vector< std::vector< SymTok > > &get_stack() const
     {
         return this->engine.get_stack();
     }
-    const ProofTree< Sentence > &get_proof_tree() const
+    ProofTree< Sentence > get_proof_tree() const
     {
         return this->engine.get_proof_tree();
     }
+    const FlatProofTree< Sentence > &get_flat_proof_tree() const
+    {
+        return this->engine.get_flat_proof_tree();
+    }
+    typename FlatProofTree< Sentence >::Link get_flat_proof_tree_root() const
+    {
+        return this->engine.get_flat_proof_tree_root();
+    }
     const std::vector< LabTok > &get_proof_labels() const
     {
         return this->engine.get_proof_labels();
@@ -38,6 +48,10 @@ public:
     {
         this->engine.set_debug_output(debug_output);
     }
+    void set_profiler(ProofProfiler *profiler)
+    {
+        this->engine.set_profiler(profiler);
+    }
     virtual void execute() = 0;
     virtual ~ProofExecutor()
     {
@@ -129,6 +143,8 @@ public:
         CS_NO_BACKREFS,
         CS_BACKREFS_ON_IDENTICAL_TREE,
         CS_BACKREFS_ON_IDENTICAL_SENTENCE,
+        // Heuristically minimize the size of the encoded proof
+        CS_MINIMIZE_SIZE,
     };
 
     virtual const CompressedProof compress(CompressionStrategy strategy=CS_ANY) = 0;
@@ -212,6 +228,9 @@ private:
     uint32_t current = 0;
 };
 
+// Number of characters of the proof when written in a database, excluding whitespace between codes
+size_t compressed_proof_size(const Library &lib, const CompressedProof &proof);
+
 template<typename SentType_>
 std::shared_ptr<ProofExecutor<SentType_> > Proof::get_executor(const Library &lib, const Assertion &ass, bool gen_proof_tree) const
 {
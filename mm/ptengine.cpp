@@ -36,13 +36,25 @@ const ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SentType &ProofSentenc
 
 void ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::check_match(const LibType &lib, LabTok label, const ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SentType &stack, const ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SentType &templ, const ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SubstMapType &subst_map)
 {
-    ProofError< ParsingTree2<SymTok, LabTok> > err = { label, stack, templ, subst_map };
-    assert_or_throw< ProofException< ParsingTree2< SymTok, LabTok > > >(substitute2(templ, lib.get_standard_is_var(), subst_map) == stack, "Essential hypothesis does not match stack", err);
+    if (!substitute2_equal(templ, lib.get_standard_is_var(), subst_map, stack)) {
+        // The error outlives the engine, so it cannot keep views on its arena
+        ProofError< ParsingTree2<SymTok, LabTok> > err = { label, stack, templ, subst_map };
+        err.on_stack.refresh();
+        err.to_subst.refresh();
+        for (auto &subst : err.subst_map) {
+            subst.second.refresh();
+        }
+        throw ProofException< ParsingTree2< SymTok, LabTok > >("Essential hypothesis does not match stack", err);
+    }
 }
 
-ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SentType ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::substitute(const LibType &lib, const ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SentType &templ, const ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SubstMapType &subst_map)
+ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SentType ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::substitute(const LibType &lib, const ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SentType &templ, const ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SubstMapType &subst_map, ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::ArenaType &arena)
 {
-    return substitute2(templ, lib.get_standard_is_var(), subst_map);
+    const auto &is_var = lib.get_standard_is_var();
+    size_t len = substitute2_count(templ, is_var, subst_map);
+    auto nodes = arena.allocate(len);
+    substitute2_write(templ, is_var, subst_map, nodes);
+    return SentType(nodes, len);
 }
 
 ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::PTGenerator ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::get_variable_iterator(const LibType &lib, const ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SentType &sent)
@@ -56,6 +68,11 @@ bool ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::is_variable(const LibTy
     return lib.get_standard_is_var()(var);
 }
 
+void ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::materialize(ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SentType &sent)
+{
+    sent.refresh();
+}
+
 ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::PTGenerator::PTGenerator(const ProofSentenceTraits<ParsingTree2<SymTok, LabTok> >::SentType &sent) : sent(sent) {}
 
 
@@ -89,6 +106,7 @@ template class VectorMap< SymTok, ParsingTree2< SymTok, LabTok > >;
 template struct ProofError< ParsingTree2< SymTok, LabTok > >;
 template class ProofException< ParsingTree2< SymTok, LabTok > >;
 template struct ProofTree< ParsingTree2< SymTok, LabTok > >;
+template struct FlatProofTree< ParsingTree2< SymTok, LabTok > >;
 template class ProofEngineBase< ParsingTree2< SymTok, LabTok > >;
 template class CreativeProofEngineImpl< ParsingTree2< SymTok, LabTok > >;
 template class ProofEngineImpl< ParsingTree2< SymTok, LabTok > >;
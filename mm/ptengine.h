@@ -14,6 +14,8 @@ struct ProofSentenceTraits< ParsingTree2< SymTok, LabTok > > {
     typedef LabTok VarType;
     typedef LibraryToolbox LibType;
     typedef LibraryToolbox AdvLibType;
+    // Substituted theses live here, so that stack and substitution maps only hold views
+    typedef ParsingTree2Arena< SymTok, LabTok > ArenaType;
 
     class PTIterator {
     public:
@@ -43,9 +45,11 @@ struct ProofSentenceTraits< ParsingTree2< SymTok, LabTok > > {
     static SymTok sentence_to_type(const LibType &lib, const SentType &sent);
     static const SentType &get_sentence(const LibType &lib, LabTok label);
     static void check_match(const LibType &lib, LabTok label, const SentType &stack, const SentType &templ, const SubstMapType &subst_map);
-    static SentType substitute(const LibType &lib, const SentType &templ, const SubstMapType &subst_map);
+    static SentType substitute(const LibType &lib, const SentType &templ, const SubstMapType &subst_map, ArenaType &arena);
     static PTGenerator get_variable_iterator(const LibType &lib, const SentType &sent);
     static bool is_variable(const LibType &lib, VarType var);
+    // Make sent own its nodes, so that it does not depend on an arena any more
+    static void materialize(SentType &sent);
 };
 
 extern template class VectorMap< SymTok, ParsingTree2< SymTok, LabTok > >;
@@ -53,6 +57,7 @@ extern template class VectorMap< SymTok, ParsingTree2< SymTok, LabTok > >;
 extern template struct ProofError< ParsingTree2< SymTok, LabTok > >;
 extern template class ProofException< ParsingTree2< SymTok, LabTok > >;
 extern template struct ProofTree< ParsingTree2< SymTok, LabTok > >;
+extern template struct FlatProofTree< ParsingTree2< SymTok, LabTok > >;
 extern template class ProofEngineBase< ParsingTree2< SymTok, LabTok > >;
 extern template class CreativeProofEngineImpl< ParsingTree2< SymTok, LabTok > >;
 extern template class ProofEngineImpl< ParsingTree2< SymTok, LabTok > >;
@@ -88,8 +88,9 @@ void ProofSentenceTraits<Sentence>::check_match(const LibType &lib, LabTok label
     assert_or_throw< ProofException< Sentence > >(stack_it == stack.end(), "Essential hypothesis does not match stack because stack is longer", err);
 }
 
-ProofSentenceTraits<Sentence>::SentType ProofSentenceTraits<Sentence>::substitute(const LibType &lib, const ProofSentenceTraits<Sentence>::SentType &templ, const ProofSentenceTraits<Sentence>::SubstMapType &subst_map)
+ProofSentenceTraits<Sentence>::SentType ProofSentenceTraits<Sentence>::substitute(const LibType &lib, const ProofSentenceTraits<Sentence>::SentType &templ, const ProofSentenceTraits<Sentence>::SubstMapType &subst_map, ProofSentenceTraits<Sentence>::ArenaType &arena)
 {
+    (void) arena;
     return do_subst(templ, subst_map, lib);
 }
 
@@ -103,6 +104,11 @@ bool ProofSentenceTraits<Sentence>::is_variable(const LibType &lib, ProofSentenc
     return !lib.is_constant(var);
 }
 
+void ProofSentenceTraits<Sentence>::materialize(ProofSentenceTraits<Sentence>::SentType &sent)
+{
+    (void) sent;
+}
+
 ProofSentenceTraits<Sentence>::SentGenerator::SentGenerator(const Library &lib, const Sentence &sent) : sentence(sent) {
     (void) lib;
 }
@@ -122,6 +128,7 @@ template class VectorMap< SymTok, Sentence >;
 template struct ProofError< Sentence >;
 template class ProofException< Sentence >;
 template struct ProofTree< Sentence >;
+template struct FlatProofTree< Sentence >;
 template class ProofEngineBase< Sentence >;
 template class CreativeProofEngineImpl< Sentence >;
 template class ProofEngineImpl< Sentence >;
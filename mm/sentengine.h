@@ -15,6 +15,12 @@ struct ProofSentenceTraits< Sentence > {
     typedef SymTok VarType;
     typedef Library LibType;
     typedef LibraryToolbox AdvLibType;
+    // Each sentence owns its symbols
+    struct ArenaType {
+        struct Mark {};
+        Mark get_mark() const { return {}; }
+        void truncate(const Mark&) {}
+    };
 
     class SentGenerator {
     public:
@@ -34,9 +40,10 @@ struct ProofSentenceTraits< Sentence > {
     static SymTok sentence_to_type(const LibType &lib, const SentType &sent);
     static const SentType &get_sentence(const LibType &lib, LabTok label);
     static void check_match(const LibType &lib, LabTok label, const SentType &stack, const SentType &templ, const SubstMapType &subst_map);
-    static SentType substitute(const LibType &lib, const SentType &templ, const SubstMapType &subst_map);
+    static SentType substitute(const LibType &lib, const SentType &templ, const SubstMapType &subst_map, ArenaType &arena);
     static SentGenerator get_variable_iterator(const LibType &lib, const SentType &sent);
     static bool is_variable(const LibType &lib, VarType var);
+    static void materialize(SentType &sent);
 };
 
 extern template class VectorMap< SymTok, Sentence >;
@@ -44,6 +51,7 @@ extern template class VectorMap< SymTok, Sentence >;
 extern template struct ProofError< Sentence >;
 extern template class ProofException< Sentence >;
 extern template struct ProofTree< Sentence >;
+extern template struct FlatProofTree< Sentence >;
 extern template class ProofEngineBase< Sentence >;
 extern template class CreativeProofEngineImpl< Sentence >;
 extern template class ProofEngineImpl< Sentence >;
@@ -1,86 +1,262 @@
 #include "tempgen.h"
 
-#include <mutex>
+#include <limits>
+#include <stdexcept>
 
-TempGenerator::TempGenerator(const Library &lib) : lib(lib),
-    temp_syms(SymTok((SymTok::val_type) lib.get_symbols_num()+1)), temp_labs(LabTok((LabTok::val_type) lib.get_labels_num()+1)),
-    syms_base(lib.get_symbols_num()+1), labs_base(lib.get_labels_num()+1)
+const size_t TempGenerator::CHUNK_SIZE;
+const size_t TempGenerator::MAX_CHUNKS;
+
+static std::atomic< size_t > next_serial(0);
+static std::atomic< size_t > next_scope_id(1);
+static thread_local size_t current_scope = 0;
+
+TempGenerator::Scope::Scope(size_t id) : prev_id(current_scope)
+{
+    current_scope = id;
+}
+
+TempGenerator::Scope::~Scope()
+{
+    current_scope = this->prev_id;
+}
+
+size_t TempGenerator::Scope::new_id()
+{
+    return next_scope_id++;
+}
+
+TempGenerator::TempGenerator(const Library &lib) : lib(lib), serial(next_serial++),
+    syms_base(lib.get_symbols_num()+1), labs_base(lib.get_labels_num()+1), leftovers(std::make_shared< Leftovers >())
 {
     assert(this->lib.is_immutable());
 }
 
-void TempGenerator::create_temp_var(SymTok type_sym)
+template< typename Data >
+TempGenerator::ChunkDirectory< Data >::ChunkDirectory() :
+    chunks(new std::atomic< std::array< Data, CHUNK_SIZE >* >[MAX_CHUNKS]()), chunks_num(0), published_end(0)
+{
+}
+
+template< typename Data >
+TempGenerator::ChunkDirectory< Data >::~ChunkDirectory()
+{
+    for (size_t i = 0; i < std::min(this->chunks_num.load(), MAX_CHUNKS); i++) {
+        delete this->chunks[i].load();
+    }
+}
+
+template< typename Data >
+size_t TempGenerator::ChunkDirectory< Data >::new_chunk()
+{
+    size_t idx = this->chunks_num++;
+    assert_or_throw< std::runtime_error >(idx < MAX_CHUNKS, "Too many temporary tokens");
+    this->chunks[idx].store(new std::array< Data, CHUNK_SIZE >(), std::memory_order_release);
+    return idx * CHUNK_SIZE;
+}
+
+template< typename Data >
+const Data *TempGenerator::ChunkDirectory< Data >::get(size_t offset) const
+{
+    if (offset >= MAX_CHUNKS * CHUNK_SIZE) {
+        return nullptr;
+    }
+    auto chunk = this->chunks[offset / CHUNK_SIZE].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+        return nullptr;
+    }
+    const Data &data = (*chunk)[offset % CHUNK_SIZE];
+    return data.ready.load(std::memory_order_acquire) ? &data : nullptr;
+}
+
+template< typename Data >
+Data &TempGenerator::ChunkDirectory< Data >::get_for_writing(size_t offset)
+{
+    // Only the thread owning the block writes in it
+    return (*this->chunks[offset / CHUNK_SIZE].load(std::memory_order_relaxed))[offset % CHUNK_SIZE];
+}
+
+template< typename Data >
+void TempGenerator::ChunkDirectory< Data >::publish(size_t offset)
+{
+    this->get_for_writing(offset).ready.store(true, std::memory_order_release);
+    size_t end = this->published_end.load();
+    while (end < offset + 1 && !this->published_end.compare_exchange_weak(end, offset + 1)) {}
+}
+
+template< typename Data >
+size_t TempGenerator::ChunkDirectory< Data >::size() const
+{
+    return this->published_end.load();
+}
+
+TempGenerator::ThreadOverlays::~ThreadOverlays()
+{
+    for (auto &entry : this->overlays) {
+        auto leftovers = entry.second.first.lock();
+        if (leftovers != nullptr) {
+            for (auto &scoped : entry.second.second) {
+                leave_overlay(*leftovers, scoped.first, scoped.second);
+            }
+        }
+    }
+}
+
+void TempGenerator::leave_overlay(Leftovers &leftovers, size_t scope, Overlay &overlay)
+{
+    // Variables still in use might be referenced by other threads, so only free ones are left
+    std::unique_lock< std::mutex > lock(leftovers.mutex);
+    if (overlay.syms.next != overlay.syms.end) {
+        leftovers.sym_blocks.push_back(overlay.syms);
+    }
+    if (overlay.labs.next != overlay.labs.end) {
+        leftovers.lab_blocks.push_back(overlay.labs);
+    }
+    for (auto &v : overlay.free_temp_vars) {
+        auto &free_vars = leftovers.free_temp_vars[scope][v.first];
+        free_vars.insert(free_vars.end(), v.second.begin(), v.second.end());
+    }
+    leftovers.available = true;
+}
+
+TempGenerator::Overlay &TempGenerator::get_overlay()
+{
+    static thread_local ThreadOverlays thread_overlays;
+    auto &overlays = thread_overlays.overlays;
+    auto it = overlays.find(this->serial);
+    if (it == overlays.end()) {
+        // Serials are never reused, so this is a good moment to drop the overlays of destroyed generators
+        for (auto it2 = overlays.begin(); it2 != overlays.end(); ) {
+            if (it2->second.first.expired()) {
+                it2 = overlays.erase(it2);
+            } else {
+                it2++;
+            }
+        }
+        it = overlays.insert(std::make_pair(this->serial, std::make_pair(std::weak_ptr< Leftovers >(this->leftovers), std::unordered_map< size_t, Overlay >()))).first;
+    }
+    return it->second.second[current_scope];
+}
+
+bool TempGenerator::is_visible(size_t scope)
+{
+    return scope == 0 || current_scope == 0 || scope == current_scope;
+}
+
+template< typename Data >
+size_t TempGenerator::new_offset(Block &block, ChunkDirectory< Data > &dir, std::vector< Block > Leftovers::*leftover_blocks)
+{
+    if (block.next == block.end) {
+        bool found = false;
+        if (this->leftovers->available) {
+            std::unique_lock< std::mutex > lock(this->leftovers->mutex);
+            auto &blocks = (*this->leftovers).*leftover_blocks;
+            if (!blocks.empty()) {
+                block = blocks.back();
+                blocks.pop_back();
+                found = true;
+            }
+        }
+        if (!found) {
+            block.next = dir.new_chunk();
+            block.end = block.next + CHUNK_SIZE;
+        }
+    }
+    return block.next++;
+}
+
+void TempGenerator::create_temp_var(Overlay &overlay, SymTok type_sym)
 {
-    // Create names and variables
+    // Create names and variables; the number in the name is unique because it comes from the symbol
     assert(lib.is_constant(type_sym));
-    size_t idx = ++this->temp_idx[type_sym];
-    std::string sym_name = this->lib.resolve_symbol(type_sym) + std::to_string(idx);
+    size_t sym_off = this->new_offset(overlay.syms, this->syms, &Leftovers::sym_blocks);
+    size_t lab_off = this->new_offset(overlay.labs, this->labs, &Leftovers::lab_blocks);
+    std::string sym_name = this->lib.resolve_symbol(type_sym) + std::to_string(sym_off + 1);
     assert(this->lib.get_symbol(sym_name) == SymTok{});
     std::string lab_name = "temp" + sym_name;
     assert(this->lib.get_label(lab_name) == LabTok{});
-    SymTok sym = this->temp_syms.create(sym_name);
-    LabTok lab = this->temp_labs.create(lab_name);
-    this->temp_types[lab] = { type_sym, sym };
-    this->temp_asses[lab] = {};
-
-    // Add the variables to a few structures
-    //this->derivations.at(type_sym).push_back(pair< LabTok, vector< SymTok > >(lab, { sym }));
-    this->ders_by_label[lab] = std::pair< SymTok, std::vector< SymTok > >(type_sym, { sym });
-    enlarge_and_set(this->var_lab_to_sym, lab.val() - this->labs_base) = sym;
-    enlarge_and_set(this->var_sym_to_lab, sym.val() - this->syms_base) = lab;
-    enlarge_and_set(this->var_lab_to_type_sym, lab.val() - this->labs_base) = type_sym;
-    enlarge_and_set(this->var_sym_to_type_sym, sym.val() - this->syms_base) = type_sym;
+    SymTok sym(static_cast< SymTok::val_type >(this->syms_base + sym_off));
+    LabTok lab(static_cast< LabTok::val_type >(this->labs_base + lab_off));
+
+    // Fill in the data and publish them
+    auto &sym_data = this->syms.get_for_writing(sym_off);
+    sym_data.scope = current_scope;
+    sym_data.name = sym_name;
+    sym_data.lab = lab;
+    sym_data.type_sym = type_sym;
+    auto &lab_data = this->labs.get_for_writing(lab_off);
+    lab_data.scope = current_scope;
+    lab_data.name = lab_name;
+    lab_data.sym = sym;
+    lab_data.type_sym = type_sym;
+    lab_data.type_sent = { type_sym, sym };
+    lab_data.derivation = std::pair< SymTok, std::vector< SymTok > >(type_sym, { sym });
+    this->syms.publish(sym_off);
+    this->labs.publish(lab_off);
 
     // And insert it to the free list
-    this->free_temp_vars[type_sym].push_back(std::make_pair(lab, sym));
+    overlay.free_temp_vars[type_sym].push_back(std::make_pair(lab, sym));
 }
 
 std::pair<LabTok, SymTok> TempGenerator::new_temp_var(SymTok type_sym)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    if (this->free_temp_vars[type_sym].empty()) {
-        this->create_temp_var(type_sym);
+    auto &overlay = this->get_overlay();
+    auto &free_vars = overlay.free_temp_vars[type_sym];
+    if (free_vars.empty() && this->leftovers->available) {
+        std::unique_lock< std::mutex > lock(this->leftovers->mutex);
+        auto scope_it = this->leftovers->free_temp_vars.find(current_scope);
+        if (scope_it != this->leftovers->free_temp_vars.end()) {
+            auto it = scope_it->second.find(type_sym);
+            if (it != scope_it->second.end()) {
+                free_vars.swap(it->second);
+                scope_it->second.erase(it);
+            }
+        }
     }
-    auto ret = this->free_temp_vars[type_sym].back();
-    this->used_temp_vars[type_sym].push_back(ret);
-    this->free_temp_vars[type_sym].pop_back();
+    if (free_vars.empty()) {
+        this->create_temp_var(overlay, type_sym);
+    }
+    auto ret = free_vars.back();
+    overlay.used_temp_vars[type_sym].push_back(ret);
+    free_vars.pop_back();
     return ret;
 }
 
 LabTok TempGenerator::new_temp_label(std::string name)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
+    std::unique_lock< std::mutex > lock(this->named_labels_mutex);
 
-    LabTok tok = this->temp_labs.get(name);
-    if (tok == LabTok{}) {
-        assert(this->lib.get_label(name) == LabTok{});
-        tok = this->temp_labs.create(name);
+    auto it = this->named_labels.find(name);
+    if (it != this->named_labels.end()) {
+        return it->second;
     }
-    assert(tok != LabTok{});
+    assert(this->lib.get_label(name) == LabTok{});
+    size_t lab_off = this->new_offset(this->get_overlay().labs, this->labs, &Leftovers::lab_blocks);
+    LabTok tok(static_cast< LabTok::val_type >(this->labs_base + lab_off));
+    this->labs.get_for_writing(lab_off).name = name;
+    this->labs.publish(lab_off);
+    this->named_labels[name] = tok;
     return tok;
 }
 
 void TempGenerator::new_temp_var_frame()
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
+    auto &overlay = this->get_overlay();
     std::map< SymTok, size_t > x;
-    for (const auto &v : this->used_temp_vars) {
+    for (const auto &v : overlay.used_temp_vars) {
         x[v.first] = v.second.size();
     }
-    this->temp_vars_stack.push_back(x);
+    overlay.temp_vars_stack.push_back(x);
 }
 
 void TempGenerator::release_temp_var_frame()
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    const auto &stack_pos = this->temp_vars_stack.back();
-    for (auto &v : this->used_temp_vars) {
+    auto &overlay = this->get_overlay();
+    assert(!overlay.temp_vars_stack.empty());
+    const auto &stack_pos = overlay.temp_vars_stack.back();
+    for (auto &v : overlay.used_temp_vars) {
         SymTok type_sym = v.first;
         auto &used_vars = v.second;
-        auto &free_vars = this->free_temp_vars.at(type_sym);
+        auto &free_vars = overlay.free_temp_vars[type_sym];
         auto it = stack_pos.find(type_sym);
         size_t pos = 0;
         if (it != stack_pos.end()) {
@@ -91,96 +267,132 @@ void TempGenerator::release_temp_var_frame()
         }
         used_vars.resize(pos);
     }
-    this->temp_vars_stack.pop_back();
+    overlay.temp_vars_stack.pop_back();
 }
 
-SymTok TempGenerator::get_symbol(std::string s)
+size_t TempGenerator::find_var_offset(const std::string &s, bool label)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
+    // The name ends with the offset plus one, but the type symbol before it may
+    // end with digits too, so each suffix of the final digits is a candidate
+    size_t begin = s.size();
+    while (begin > 0 && s[begin-1] >= '0' && s[begin-1] <= '9') {
+        begin--;
+    }
+    for (size_t pos = std::max(begin, s.size() - std::min< size_t >(s.size(), std::numeric_limits< size_t >::digits10)); pos < s.size(); pos++) {
+        // Numbers in names have no leading zeros and begin from 1
+        if (s[pos] == '0') {
+            continue;
+        }
+        size_t off = std::stoull(s.substr(pos)) - 1;
+        auto data = this->syms.get(off);
+        if (data == nullptr || !is_visible(data->scope)) {
+            continue;
+        }
+        if (label) {
+            // The label is published just after the symbol
+            auto lab_data = this->labs.get(data->lab.val() - this->labs_base);
+            if (lab_data != nullptr && lab_data->name == s) {
+                return off;
+            }
+        } else if (data->name == s) {
+            return off;
+        }
+    }
+    return std::numeric_limits< size_t >::max();
+}
 
-    return this->temp_syms.get(s);
+SymTok TempGenerator::get_symbol(std::string s)
+{
+    size_t off = this->find_var_offset(s, false);
+    if (off == std::numeric_limits< size_t >::max()) {
+        return {};
+    }
+    return SymTok(static_cast< SymTok::val_type >(this->syms_base + off));
 }
 
 LabTok TempGenerator::get_label(std::string s)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    return this->temp_labs.get(s);
+    size_t off = this->find_var_offset(s, true);
+    if (off != std::numeric_limits< size_t >::max()) {
+        return this->syms.get(off)->lab;
+    }
+    std::unique_lock< std::mutex > lock(this->named_labels_mutex);
+    auto it = this->named_labels.find(s);
+    return it == this->named_labels.end() ? LabTok{} : it->second;
 }
 
 std::string TempGenerator::resolve_symbol(SymTok tok)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    return this->temp_syms.resolve(tok);
+    auto data = this->syms.get(tok.val() - this->syms_base);
+    return data == nullptr || !is_visible(data->scope) ? "" : data->name;
 }
 
 std::string TempGenerator::resolve_label(LabTok tok)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    return this->temp_labs.resolve(tok);
+    auto data = this->labs.get(tok.val() - this->labs_base);
+    return data == nullptr || !is_visible(data->scope) ? "" : data->name;
 }
 
 size_t TempGenerator::get_symbols_num()
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    return this->temp_syms.size();
+    return this->syms.size();
 }
 
 size_t TempGenerator::get_labels_num()
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
+    return this->labs.size();
+}
 
-    return this->temp_labs.size();
+const TempGenerator::SymData &TempGenerator::get_sym_data(SymTok sym)
+{
+    auto data = this->syms.get(sym.val() - this->syms_base);
+    if (data == nullptr) {
+        throw std::out_of_range("not a temporary variable");
+    }
+    return *data;
 }
 
-const Sentence &TempGenerator::get_sentence(LabTok label)
+const TempGenerator::LabData &TempGenerator::get_var_lab_data(LabTok lab)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
+    auto data = this->labs.get(lab.val() - this->labs_base);
+    if (data == nullptr || data->sym == SymTok{}) {
+        throw std::out_of_range("not a temporary variable");
+    }
+    return *data;
+}
 
-    return this->temp_types.at(label);
+const Sentence &TempGenerator::get_sentence(LabTok label)
+{
+    return this->get_var_lab_data(label).type_sent;
 }
 
 const Assertion &TempGenerator::get_assertion(LabTok label)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    return this->temp_asses.at(label);
+    this->get_var_lab_data(label);
+    return this->temp_assertion;
 }
 
 LabTok TempGenerator::get_var_sym_to_lab(SymTok sym)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    return this->var_sym_to_lab.at(sym.val() - this->syms_base);
+    return this->get_sym_data(sym).lab;
 }
 
 SymTok TempGenerator::get_var_lab_to_sym(LabTok lab)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    return this->var_lab_to_sym.at(lab.val() - this->labs_base);
+    return this->get_var_lab_data(lab).sym;
 }
 
 SymTok TempGenerator::get_var_sym_to_type_sym(SymTok sym)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    return this->var_sym_to_type_sym.at(sym.val() - this->syms_base);
+    return this->get_sym_data(sym).type_sym;
 }
 
 SymTok TempGenerator::get_var_lab_to_type_sym(LabTok lab)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    return this->var_lab_to_type_sym.at(lab.val() - this->labs_base);
+    return this->get_var_lab_data(lab).type_sym;
 }
 
 const std::pair<SymTok, Sentence> &TempGenerator::get_derivation_rule(LabTok lab)
 {
-    std::unique_lock< std::mutex > lock(this->global_mutex);
-
-    return this->ders_by_label.at(lab);
+    return this->get_var_lab_data(lab).derivation;
 }
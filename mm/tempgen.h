@@ -4,14 +4,53 @@
 #include <vector>
 #include <unordered_map>
 #include <mutex>
-
-#include <boost/interprocess/sync/null_mutex.hpp>
+#include <atomic>
+#include <memory>
+#include <array>
 
 #include "library.h"
 
+/*
+ * Temporary variables and labels live above the tokens of the library. Each
+ * thread takes fresh tokens from its own blocks of ids and keeps its own free
+ * lists and frames in a thread local overlay, so generating, taking and
+ * releasing temporary variables never locks. What is known about a token is
+ * written once in a chunk before the token is published, and chunks never
+ * move, so lookups by token or by the name of a temporary variable do not
+ * lock either. Only labels created by name with new_temp_label() go through
+ * a mutex-protected map.
+ *
+ * Releasing a frame only frees the variables that the calling thread took
+ * after having opened it. When a thread exits, the unused part of its blocks
+ * and its free variables are left to the generator, and other threads pick
+ * them up before reserving new blocks.
+ *
+ * Users sharing a generator, such as the worksets sharing a toolbox, can keep
+ * their temporary variables apart with a Scope: each thread has an overlay for
+ * each scope, and the variables taken in a scope are never handed out in
+ * another one. Names of variables created in a scope are only resolved, in
+ * both directions, in that scope and outside any scope.
+ */
 class TempGenerator {
 public:
+    // While a Scope is alive, the calling thread works in the scope with the given id
+    class Scope {
+    public:
+        Scope(size_t id);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope &operator=(const Scope&) = delete;
+        // A fresh id; ids are never reused, and 0 means no scope
+        static size_t new_id();
+
+    private:
+        size_t prev_id;
+    };
+
     TempGenerator(const Library &lib);
+    TempGenerator(const TempGenerator&) = delete;
+    TempGenerator &operator=(const TempGenerator&) = delete;
+
     std::pair< LabTok, SymTok > new_temp_var(SymTok type_sym);
     LabTok new_temp_label(std::string name);
     void new_temp_var_frame();
@@ -22,6 +61,8 @@ public:
     LabTok get_label(std::string s);
     std::string resolve_symbol(SymTok tok);
     std::string resolve_label(LabTok tok);
+    // One past the highest published token; tokens below it that are
+    // reserved by some thread but not published yet do not resolve
     size_t get_symbols_num();
     size_t get_labels_num();
     const Sentence &get_sentence(LabTok label);
@@ -34,27 +75,103 @@ public:
     SymTok get_var_lab_to_type_sym(LabTok lab);
     const std::pair<SymTok, Sentence> &get_derivation_rule(LabTok lab);
 
+    static const size_t CHUNK_SIZE = 256;
+    static const size_t MAX_CHUNKS = 1 << 15;
+
 private:
-    void create_temp_var(SymTok type_sym);
+    struct SymData {
+        std::atomic< bool > ready{false};
+        size_t scope = 0;
+        std::string name;
+        LabTok lab;
+        SymTok type_sym;
+    };
+
+    struct LabData {
+        std::atomic< bool > ready{false};
+        size_t scope = 0;
+        std::string name;
+        // Only set for the labels of temporary variables
+        SymTok sym;
+        SymTok type_sym;
+        Sentence type_sent;
+        std::pair< SymTok, Sentence > derivation;
+    };
+
+    // Offsets [next, end) are reserved to the thread owning the block
+    struct Block {
+        size_t next = 0;
+        size_t end = 0;
+    };
 
-    std::mutex global_mutex;
-    //boost::interprocess::null_mutex global_mutex;
+    typedef std::map< SymTok, std::vector< std::pair< LabTok, SymTok > > > VarsByType;
+
+    struct Overlay {
+        Block syms;
+        Block labs;
+        VarsByType free_temp_vars;
+        VarsByType used_temp_vars;
+        std::vector< std::map< SymTok, size_t > > temp_vars_stack;
+    };
+
+    // What exited threads left behind; it is shared with the overlays, so
+    // that a thread exiting after the generator is destroyed finds it expired
+    struct Leftovers {
+        std::mutex mutex;
+        std::atomic< bool > available{false};
+        std::vector< Block > sym_blocks;
+        std::vector< Block > lab_blocks;
+        // Keyed by scope
+        std::unordered_map< size_t, VarsByType > free_temp_vars;
+    };
+
+    // The overlays of a thread, keyed by the serial of their generator and then by scope
+    struct ThreadOverlays {
+        ~ThreadOverlays();
+        std::unordered_map< size_t, std::pair< std::weak_ptr< Leftovers >, std::unordered_map< size_t, Overlay > > > overlays;
+    };
+
+    template< typename Data >
+    class ChunkDirectory {
+    public:
+        ChunkDirectory();
+        ~ChunkDirectory();
+        // Reserve the offsets of a new chunk and return its first one
+        size_t new_chunk();
+        // Return NULL if the data at offset was not published yet
+        const Data *get(size_t offset) const;
+        Data &get_for_writing(size_t offset);
+        void publish(size_t offset);
+        size_t size() const;
+
+    private:
+        std::unique_ptr< std::atomic< std::array< Data, CHUNK_SIZE >* >[] > chunks;
+        std::atomic< size_t > chunks_num;
+        std::atomic< size_t > published_end;
+    };
+
+    Overlay &get_overlay();
+    static void leave_overlay(Leftovers &leftovers, size_t scope, Overlay &overlay);
+    // Whether a token created in the given scope is visible from the current one
+    static bool is_visible(size_t scope);
+    template< typename Data >
+    size_t new_offset(Block &block, ChunkDirectory< Data > &dir, std::vector< Block > Leftovers::*leftover_blocks);
+    void create_temp_var(Overlay &overlay, SymTok type_sym);
+    const SymData &get_sym_data(SymTok sym);
+    const LabData &get_var_lab_data(LabTok lab);
+    // Return the offset of the temporary variable whose symbol (or label) is
+    // called s, or the maximum size_t if there is none
+    size_t find_var_offset(const std::string &s, bool label);
 
     const Library &lib;
-    std::map< SymTok, size_t > temp_idx;
-    std::unordered_map< LabTok, Sentence > temp_types;
-    std::unordered_map< LabTok, Assertion > temp_asses;
-    StringCache< SymTok > temp_syms;
-    StringCache< LabTok > temp_labs;
+    const size_t serial;
     std::size_t syms_base;
     std::size_t labs_base;
-    std::map< SymTok, std::vector< std::pair< LabTok, SymTok > > > free_temp_vars;
-    std::map< SymTok, std::vector< std::pair< LabTok, SymTok > > > used_temp_vars;
-    std::vector< std::map< SymTok, size_t > > temp_vars_stack;
-
-    std::vector< LabTok > var_sym_to_lab;
-    std::vector< SymTok > var_lab_to_sym;
-    std::vector< SymTok > var_sym_to_type_sym;
-    std::vector< SymTok > var_lab_to_type_sym;
-    std::unordered_map< LabTok, std::pair< SymTok, std::vector< SymTok > > > ders_by_label;
+    ChunkDirectory< SymData > syms;
+    ChunkDirectory< LabData > labs;
+    const Assertion temp_assertion;
+    std::shared_ptr< Leftovers > leftovers;
+
+    std::mutex named_labels_mutex;
+    std::unordered_map< std::string, LabTok > named_labels;
 };
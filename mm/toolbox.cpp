@@ -1,4 +1,7 @@
 
+#include <algorithm>
+#include <atomic>
+
 #include <boost/filesystem/fstream.hpp>
 
 #include "toolbox.h"
@@ -604,7 +607,21 @@ static std::vector<std::tuple<LabTok, std::vector<size_t>, std::unordered_map<Sy
                                                                                                                              bool just_first, bool up_to_hyps_perms, const std::set< std::pair< SymTok, SymTok > > &antidists) {
     std::vector<std::tuple< LabTok, std::vector< size_t >, std::unordered_map<SymTok, std::vector<SymTok> > > > ret;
     const auto &is_var = self->get_standard_is_var();
-    for (const Assertion &ass : self->gen_assertions()) {
+    // Only assertions whose thesis has the same root or a variable as root can match;
+    // candidates are visited in label order, so that the first match is the same as with a full scan
+    const auto &by_root = self->get_assertions_by_thesis_root();
+    auto same_root_it = by_root.find(pt_thesis.second.label);
+    auto var_root_it = by_root.find(LabTok{});
+    std::vector< LabTok > candidates;
+    if (same_root_it != by_root.end() && pt_thesis.second.label != LabTok{}) {
+        candidates = same_root_it->second;
+    }
+    if (var_root_it != by_root.end()) {
+        auto middle = candidates.insert(candidates.end(), var_root_it->second.begin(), var_root_it->second.end());
+        std::inplace_merge(candidates.begin(), middle, candidates.end());
+    }
+    for (const auto &label : candidates) {
+        const Assertion &ass = self->get_assertion(label);
         if (ass.is_usage_disc()) {
             continue;
         }
@@ -781,6 +798,7 @@ void LibraryToolbox::compute_everything()
     this->compute_ders_by_label();
     this->compute_parser_initialization();
     this->compute_sentences_parsing();
+    this->compute_assertions_by_thesis_root();
     this->compute_labels_to_theses();
     this->compute_registered_provers();
     this->compute_vars();
@@ -874,6 +892,24 @@ const std::unordered_map<SymTok, std::vector<LabTok> > &LibraryToolbox::get_asse
     return this->assertions_by_type;
 }
 
+void LibraryToolbox::compute_assertions_by_thesis_root()
+{
+    const auto &is_var = this->get_standard_is_var();
+    for (const Assertion &ass : this->gen_assertions()) {
+        const auto &label = ass.get_thesis();
+        LabTok root = this->get_parsed_sent(label).label;
+        if (root != LabTok{} && is_var(root)) {
+            root = {};
+        }
+        this->assertions_by_thesis_root[root].push_back(label);
+    }
+}
+
+const std::unordered_map<LabTok, std::vector<LabTok> > &LibraryToolbox::get_assertions_by_thesis_root() const
+{
+    return this->assertions_by_thesis_root;
+}
+
 void LibraryToolbox::compute_derivations()
 {
     // Build the derivation rules; a derivation is created for each $f statement
@@ -1200,3 +1236,9 @@ std::string ProofPrinter::to_string() const
     buf << *this;
     return buf.str();
 }
+
+uint64_t new_memoized_prover_key()
+{
+    static std::atomic< uint64_t > next_key(0);
+    return next_key++;
+}
@@ -6,6 +6,8 @@
 #include <fstream>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <typeindex>
 
 #include <boost/filesystem.hpp>
 
@@ -283,6 +285,14 @@ private:
     void compute_assertions_by_type();
     std::unordered_map< SymTok, std::vector< LabTok > > assertions_by_type;
 
+    // Assertions sorted according to the root label of their parsed thesis; those whose
+    // thesis is a variable or could not be parsed are stored under the empty label
+public:
+    const std::unordered_map< LabTok, std::vector< LabTok > > &get_assertions_by_thesis_root() const;
+private:
+    void compute_assertions_by_thesis_root();
+    std::unordered_map< LabTok, std::vector< LabTok > > assertions_by_thesis_root;
+
     // Formal grammar derivations
 public:
     const std::unordered_map<SymTok, std::vector<std::pair<LabTok, std::vector<SymTok> > > > &get_derivations() const;
@@ -448,6 +458,21 @@ public:
 private:
     std::unique_ptr< TempGenerator > temp_generator;
 
+    // State that other modules keep for this toolbox, created on first use and destroyed with it
+public:
+    template< typename T >
+    std::shared_ptr< T > get_attachment() const {
+        std::unique_lock< std::mutex > lock(this->attachments_mutex);
+        auto &ret = this->attachments[std::type_index(typeid(T))];
+        if (ret == nullptr) {
+            ret = std::make_shared< T >();
+        }
+        return std::static_pointer_cast< T >(ret);
+    }
+private:
+    mutable std::mutex attachments_mutex;
+    mutable std::unordered_map< std::type_index, std::shared_ptr< void > > attachments;
+
     // Replace variables with fresh new ones
 public:
     std::pair< std::vector< ParsingTree< SymTok, LabTok > >, ParsingTree< SymTok, LabTok > > refresh_assertion(const Assertion &ass) const;
@@ -495,6 +520,29 @@ Prover< Engine > cascade_provers(const Prover< Engine > &a,  const Prover< Engin
     };
 }
 
+uint64_t new_memoized_prover_key();
+
+/* Wrap a prover that pushes exactly one sentence on the stack, so that it is executed
+ * only once per engine: the following times the engine pushes the memoized result
+ * instead. This is useful when the same prover is referenced many times in a bigger
+ * proof, as it happens for type provers of repeated subterms. */
+template< typename Engine, typename std::enable_if< std::is_base_of< CheckpointedProofEngine, Engine >::value >::type* = nullptr >
+Prover< Engine > memoized_prover(const Prover< Engine > &prover)
+{
+    const uint64_t key = new_memoized_prover_key();
+    return [prover,key](Engine &engine) {
+        if (engine.replay_memoized_step(key)) {
+            return true;
+        }
+        size_t proof_begin = engine.get_proof_size();
+        bool res = prover(engine);
+        if (res) {
+            engine.memoize_step(key, proof_begin);
+        }
+        return res;
+    };
+}
+
 template< typename Engine, typename std::enable_if< std::is_base_of< ProofEngine, Engine >::value >::type* = nullptr >
 std::string test_prover(Prover< Engine > prover, const LibraryToolbox &tb) {
     Engine engine(tb);
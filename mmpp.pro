@@ -52,7 +52,7 @@ equals(DISABLE_TESTS, "true") {
 }
 
 !win32 {
-    QMAKE_LIBS += -lboost_system -lboost_filesystem -lboost_serialization
+    QMAKE_LIBS += -lboost_system -lboost_filesystem -lboost_serialization -lz
     !equals(DISABLE_TESTS, "true") {
         QMAKE_LIBS += -lboost_unit_test_framework
     }
@@ -117,6 +117,10 @@ SOURCES += \
     platform.cpp \
     web/workset.cpp \
     web/jsonize.cpp \
+    web/events.cpp \
+    web/libcontext.cpp \
+    web/prooftreecache.cpp \
+    web/resultstore.cpp \
     mm/reader.cpp \
     apps/unificator.cpp \
     temp.cpp \
@@ -129,6 +133,7 @@ SOURCES += \
     provers/uct.cpp \
     mm/tokenizer.cpp \
     mm/engine.cpp \
+    mm/profiler.cpp \
     mm/funds.cpp \
     mm/mmtemplates.cpp \
     mm/ptengine.cpp \
@@ -140,10 +145,13 @@ SOURCES += \
     provers/wffblock.cpp \
     apps/tstp.cpp \
     provers/wffsat.cpp \
+    provers/bdd.cpp \
     apps/resolver.cpp \
     provers/subst.cpp \
     apps/verify.cpp \
+    apps/recompress.cpp \
     mm/setmm.cpp \
+    mm/libregistry.cpp \
     test/test_wff.cpp
 
 HEADERS += \
@@ -161,6 +169,10 @@ HEADERS += \
     platform.h \
     web/workset.h \
     web/jsonize.h \
+    web/events.h \
+    web/libcontext.h \
+    web/prooftreecache.h \
+    web/resultstore.h \
     mm/reader.h \
     libs/serialize_tuple.h \
     utils/vectormap.h \
@@ -175,6 +187,7 @@ HEADERS += \
     provers/uct.h \
     mm/tokenizer.h \
     mm/engine.h \
+    mm/profiler.h \
     mm/funds.h \
     mm/mmtypes.h \
     mm/mmtemplates.h \
@@ -195,8 +208,10 @@ HEADERS += \
     provers/sat.h \
     provers/wffblock.h \
     provers/wffsat.h \
+    provers/bdd.h \
     provers/subst.h \
     mm/setmm.h \
+    mm/libregistry.h \
     test/test.h \
     libs/backward.h
 
@@ -325,6 +325,48 @@ private:
     std::vector< size_t > stack;
 };
 
+/* Storage for the nodes of many trees, which are then views on it. Nodes are
+ * allocated in chunks that are never moved, so the views remain valid as
+ * long as the arena lives. */
+template< typename SymType, typename LabType >
+class ParsingTree2Arena {
+public:
+    ParsingTree2Arena() = default;
+    ParsingTree2Arena(const ParsingTree2Arena &) = delete;
+    ParsingTree2Arena &operator=(const ParsingTree2Arena &) = delete;
+
+    ParsingTreeNode< SymType, LabType > *allocate(size_t num) {
+        if (this->chunks.empty() || this->chunks.back().capacity() - this->chunks.back().size() < num) {
+            this->chunks.emplace_back();
+            this->chunks.back().reserve(num > CHUNK_SIZE ? num : CHUNK_SIZE);
+        }
+        auto &chunk = this->chunks.back();
+        chunk.resize(chunk.size() + num);
+        return chunk.data() + chunk.size() - num;
+    }
+
+    // What has been allocated so far, to free what comes after it with truncate()
+    struct Mark {
+        size_t chunks;
+        size_t last_size;
+    };
+
+    Mark get_mark() const {
+        return { this->chunks.size(), this->chunks.empty() ? 0 : this->chunks.back().size() };
+    }
+
+    void truncate(const Mark &mark) {
+        this->chunks.resize(mark.chunks);
+        if (!this->chunks.empty()) {
+            this->chunks.back().resize(mark.last_size);
+        }
+    }
+
+private:
+    static const size_t CHUNK_SIZE = 4096;
+    std::vector< std::vector< ParsingTreeNode< SymType, LabType > > > chunks;
+};
+
 /*template< typename SymType, typename LabType >
 ParsingTree2< SymType, LabType > var_parsing_tree(LabType label, SymType type) {
     ParsingTree2Generator< SymType, LabType > gen;
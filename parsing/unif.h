@@ -3,6 +3,7 @@
 #include <functional>
 #include <unordered_map>
 #include <map>
+#include <algorithm>
 
 #include "parsing/parser.h"
 #include "parsing/algos.h"
@@ -96,48 +97,116 @@ size_t substitute2_count(const ParsingTree2< SymType, LabType > &pt,
     return ret;
 }
 
+// Write the subtree of pt beginning at pt_pos, with the substitution applied, from dest_pos on
+template< typename SymType, typename LabType >
+void substitute2_write_impl(const ParsingTreeNode< SymType, LabType > *pt, size_t &pt_pos,
+                            const std::function< bool(LabType) > &is_var,
+                            const SubstMap2< SymType, LabType > &subst,
+                            ParsingTreeNode< SymType, LabType > *dest, size_t &dest_pos) {
+    const auto &node = pt[pt_pos];
+    if (is_var(node.label)) {
+        auto it = subst.find(node.label);
+        if (it != subst.end()) {
+            std::copy(it->second.get_nodes(), it->second.get_nodes() + it->second.get_nodes_len(), dest + dest_pos);
+            pt_pos++;
+            dest_pos += it->second.get_nodes_len();
+            return;
+        }
+    }
+    const size_t dest_begin = dest_pos;
+    const size_t pt_end = pt_pos + node.descendants_num + 1;
+    dest[dest_pos++] = { node.label, node.type, 0 };
+    pt_pos++;
+    while (pt_pos < pt_end) {
+        substitute2_write_impl(pt, pt_pos, is_var, subst, dest, dest_pos);
+    }
+    dest[dest_begin].descendants_num = dest_pos - dest_begin - 1;
+}
+
+// Write the substituted tree to dest, which must have room for substitute2_count() nodes
+template< typename SymType, typename LabType >
+void substitute2_write(const ParsingTree2< SymType, LabType > &pt,
+                       const std::function< bool(LabType) > &is_var,
+                       const SubstMap2< SymType, LabType > &subst,
+                       ParsingTreeNode< SymType, LabType > *dest) {
+    size_t pt_pos = 0;
+    size_t dest_pos = 0;
+    if (pt.get_nodes_len() != 0) {
+        substitute2_write_impl(pt.get_nodes(), pt_pos, is_var, subst, dest, dest_pos);
+    }
+    assert(pt_pos == pt.get_nodes_len());
+}
+
 template< typename SymType, typename LabType >
 ParsingTree2< SymType, LabType > substitute2(const ParsingTree2< SymType, LabType > &pt,
                                              const std::function< bool(LabType) > &is_var,
                                              const SubstMap2< SymType, LabType > &subst) {
     size_t final_size = substitute2_count(pt, is_var, subst);
-    ParsingTree2Generator< SymType, LabType > gen;
-    gen.reserve(final_size);
-    auto it = pt.get_multi_iterator();
-    bool discard_next_close = false;
-    //for (auto x = it.next(); x.first != it.Finished; x = it.next()) {
-    while (true) {
-        const auto x = it.next();
-        if (x.first == it.Finished) {
-            break;
-        }
-        if (x.first == it.Open) {
-            assert(!discard_next_close);
-            if (is_var(x.second.label)) {
-                auto it = subst.find(x.second.label);
-                if (it != subst.end()) {
-                    discard_next_close = true;
-                    gen.copy_tree(it->second);
-                } else {
-                    gen.open_node(x.second.label, x.second.type);
-                }
-            } else {
-                gen.open_node(x.second.label, x.second.type);
-            }
-        } else {
-            assert(x.first == it.Close);
-            if (discard_next_close) {
-                discard_next_close = false;
-            } else {
-                gen.close_node();
+    ParsingTree2< SymType, LabType > ret;
+    ret.nodes_storage.resize(final_size);
+    substitute2_write(pt, is_var, subst, ret.nodes_storage.data());
+#ifdef UNIFICATOR_SELF_TEST
+    assert(ret == pt_to_pt2(substitute(pt2_to_pt(pt), is_var, subst2_to_subst(subst))));
+#endif
+    return ret;
+}
+
+// Unlike ParsingTreeNode::operator==, also compare the types
+template< typename SymType, typename LabType >
+bool same_pt2_node(const ParsingTreeNode< SymType, LabType > &x, const ParsingTreeNode< SymType, LabType > &y) {
+    return x.label == y.label && x.type == y.type && x.descendants_num == y.descendants_num;
+}
+
+// Match the subtree of pt beginning at pt_pos, with the substitution applied, against target from target_pos on
+template< typename SymType, typename LabType >
+bool substitute2_equal_impl(const ParsingTreeNode< SymType, LabType > *pt, size_t &pt_pos,
+                            const std::function< bool(LabType) > &is_var,
+                            const SubstMap2< SymType, LabType > &subst,
+                            const ParsingTreeNode< SymType, LabType > *target, size_t target_len, size_t &target_pos) {
+    const auto &node = pt[pt_pos];
+    if (is_var(node.label)) {
+        auto it = subst.find(node.label);
+        if (it != subst.end()) {
+            const auto len = it->second.get_nodes_len();
+            if (target_len - target_pos < len || !std::equal(it->second.get_nodes(), it->second.get_nodes() + len, target + target_pos, same_pt2_node< SymType, LabType >)) {
+                return false;
             }
+            pt_pos++;
+            target_pos += len;
+            return true;
+        }
+    }
+    if (target_pos == target_len || target[target_pos].label != node.label || target[target_pos].type != node.type) {
+        return false;
+    }
+    const size_t target_begin = target_pos;
+    const size_t pt_end = pt_pos + node.descendants_num + 1;
+    pt_pos++;
+    target_pos++;
+    while (pt_pos < pt_end) {
+        if (!substitute2_equal_impl(pt, pt_pos, is_var, subst, target, target_len, target_pos)) {
+            return false;
         }
     }
-    ParsingTree2< SymType, LabType > ret = gen.get_parsing_tree();
+    return target_pos - target_begin - 1 == target[target_begin].descendants_num;
+}
+
+/* Same as substitute2(pt, is_var, subst) == target, but the two trees are
+ * walked together, so the substituted tree is never built. */
+template< typename SymType, typename LabType >
+bool substitute2_equal(const ParsingTree2< SymType, LabType > &pt,
+                       const std::function< bool(LabType) > &is_var,
+                       const SubstMap2< SymType, LabType > &subst,
+                       const ParsingTree2< SymType, LabType > &target) {
+    if (pt.get_nodes_len() == 0) {
+        return target.get_nodes_len() == 0;
+    }
+    size_t pt_pos = 0;
+    size_t target_pos = 0;
+    bool ret = substitute2_equal_impl(pt.get_nodes(), pt_pos, is_var, subst, target.get_nodes(), target.get_nodes_len(), target_pos) && target_pos == target.get_nodes_len();
 #ifdef UNIFICATOR_SELF_TEST
-    assert(ret == pt_to_pt2(substitute(pt2_to_pt(pt), is_var, subst2_to_subst(subst))));
+    assert(ret == (substitute2(pt, is_var, subst) == target));
 #endif
-    assert(final_size == ret.nodes_storage.size());
     return ret;
 }
 
@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <sys/resource.h>
 #include <cstdio>
+#include <ctime>
 #include <pthread.h>
 #include <sys/syscall.h>
 #include <iostream>
@@ -117,6 +118,12 @@ void platform_set_current_thread_low_priority() {
     setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
 }
 
+std::chrono::nanoseconds platform_get_current_thread_cpu_time() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
 
 // Memory functions taken from http://nadeausoftware.com/articles/2012/07/c_c_tip_how_get_process_resident_set_size_physical_memory_use
 
@@ -168,6 +175,7 @@ std::string platform_type_of_current_exception() {
 #include <unistd.h>
 #include <sys/resource.h>
 #include <cstdio>
+#include <ctime>
 #include <pthread.h>
 #include <mach/mach.h>
 #include <iostream>
@@ -264,6 +272,12 @@ void platform_set_current_thread_low_priority() {
     sched.sched_priority = 0; //sched_get_priority_min();
 }
 
+std::chrono::nanoseconds platform_get_current_thread_cpu_time() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
 
 // Memory functions taken from http://nadeausoftware.com/articles/2012/07/c_c_tip_how_get_process_resident_set_size_physical_memory_use
 
@@ -415,6 +429,14 @@ void platform_set_current_thread_low_priority() {
     SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
 }
 
+std::chrono::nanoseconds platform_get_current_thread_cpu_time() {
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    // FILETIME counts intervals of 100 nanoseconds
+    uint64_t total = ((static_cast< uint64_t >(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime) + ((static_cast< uint64_t >(user.dwHighDateTime) << 32) | user.dwLowDateTime);
+    return std::chrono::nanoseconds(total * 100);
+}
+
 // FIXME
 std::string platform_type_of_current_exception() {
     return "";
@@ -424,6 +446,146 @@ std::string platform_type_of_current_exception() {
 #error Current platform is not supported. Please add support in plaftorm.cpp.
 #endif
 
+#if (defined(__linux) || defined(__linux__) || (defined(__APPLE__) && defined(__MACH__)))
+
+#include <cerrno>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// flock() locks belong to the open file description, unlike fcntl() ones, which belong to the process
+PlatformLockedFile::PlatformLockedFile(const boost::filesystem::path &filename, bool exclusive) {
+    int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot open " + filename.string());
+    }
+    int res;
+    while ((res = flock(fd, exclusive ? LOCK_EX : LOCK_SH)) < 0 && errno == EINTR) {}
+    if (res < 0) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "cannot lock " + filename.string());
+    }
+    this->handle = fd;
+}
+
+PlatformLockedFile::~PlatformLockedFile() {
+    // Closing the descriptor also releases the lock
+    close(static_cast< int >(this->handle));
+}
+
+uint64_t PlatformLockedFile::size() const {
+    struct stat st;
+    if (fstat(static_cast< int >(this->handle), &st) < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot stat locked file");
+    }
+    return static_cast< uint64_t >(st.st_size);
+}
+
+std::string PlatformLockedFile::read_from(uint64_t offset) const {
+    std::string ret;
+    char buf[65536];
+    while (true) {
+        ssize_t res = pread(static_cast< int >(this->handle), buf, sizeof(buf), static_cast< off_t >(offset));
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "cannot read locked file");
+        }
+        if (res == 0) {
+            return ret;
+        }
+        ret.append(buf, static_cast< size_t >(res));
+        offset += static_cast< uint64_t >(res);
+    }
+}
+
+void PlatformLockedFile::append(const std::string &data) {
+    // With O_APPEND each write goes to the end of the file
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t res = write(static_cast< int >(this->handle), data.data() + done, data.size() - done);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "cannot write locked file");
+        }
+        done += static_cast< size_t >(res);
+    }
+}
+
+#elif (defined(_WIN32))
+
+#include <system_error>
+
+PlatformLockedFile::PlatformLockedFile(const boost::filesystem::path &filename, bool exclusive) {
+    HANDLE h = CreateFileW(filename.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        throw std::system_error(static_cast< int >(GetLastError()), std::system_category(), "cannot open " + filename.string());
+    }
+    OVERLAPPED ov = {};
+    if (!LockFileEx(h, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, MAXDWORD, MAXDWORD, &ov)) {
+        DWORD err = GetLastError();
+        CloseHandle(h);
+        throw std::system_error(static_cast< int >(err), std::system_category(), "cannot lock " + filename.string());
+    }
+    this->handle = reinterpret_cast< intptr_t >(h);
+}
+
+PlatformLockedFile::~PlatformLockedFile() {
+    HANDLE h = reinterpret_cast< HANDLE >(this->handle);
+    OVERLAPPED ov = {};
+    UnlockFileEx(h, 0, MAXDWORD, MAXDWORD, &ov);
+    CloseHandle(h);
+}
+
+uint64_t PlatformLockedFile::size() const {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(reinterpret_cast< HANDLE >(this->handle), &size)) {
+        throw std::system_error(static_cast< int >(GetLastError()), std::system_category(), "cannot stat locked file");
+    }
+    return static_cast< uint64_t >(size.QuadPart);
+}
+
+std::string PlatformLockedFile::read_from(uint64_t offset) const {
+    std::string ret;
+    char buf[65536];
+    while (true) {
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast< DWORD >(offset);
+        ov.OffsetHigh = static_cast< DWORD >(offset >> 32);
+        DWORD res;
+        if (!ReadFile(reinterpret_cast< HANDLE >(this->handle), buf, sizeof(buf), &res, &ov)) {
+            if (GetLastError() == ERROR_HANDLE_EOF) {
+                return ret;
+            }
+            throw std::system_error(static_cast< int >(GetLastError()), std::system_category(), "cannot read locked file");
+        }
+        if (res == 0) {
+            return ret;
+        }
+        ret.append(buf, res);
+        offset += res;
+    }
+}
+
+void PlatformLockedFile::append(const std::string &data) {
+    // An offset of all ones writes at the end of the file
+    OVERLAPPED ov = {};
+    ov.Offset = MAXDWORD;
+    ov.OffsetHigh = MAXDWORD;
+    DWORD res;
+    if (!WriteFile(reinterpret_cast< HANDLE >(this->handle), data.data(), static_cast< DWORD >(data.size()), &res, &ov) || res != data.size()) {
+        throw std::system_error(static_cast< int >(GetLastError()), std::system_category(), "cannot write locked file");
+    }
+}
+
+#endif
+
 #ifdef STACKTRACE_USE_BACKWARD
 
 PlatformStackTrace platform_get_stack_trace() {
@@ -4,6 +4,7 @@
 #include <thread>
 #include <cstdint>
 #include <functional>
+#include <chrono>
 
 #include <boost/filesystem.hpp>
 
@@ -83,6 +84,29 @@ uint64_t platform_get_peak_used_ram();
 uint64_t platform_get_current_used_ram();
 void platform_set_current_thread_name(const std::string &name);
 void platform_set_current_thread_low_priority();
+// CPU time consumed so far by the calling thread
+std::chrono::nanoseconds platform_get_current_thread_cpu_time();
 PlatformStackTrace platform_get_stack_trace();
 void platform_dump_stack_trace(std::ostream &str, const PlatformStackTrace &trace);
 std::string platform_type_of_current_exception();
+
+/* A file kept open and locked, shared or exclusive, for the lifetime of the
+ * object. All I/O goes through the same descriptor, and the lock is not
+ * released when other descriptors on the same file are closed, so it also
+ * excludes other locks taken in the same process. The file is created if it
+ * does not exist. Errors are reported with std::system_error. */
+class PlatformLockedFile {
+public:
+    PlatformLockedFile(const boost::filesystem::path &filename, bool exclusive);
+    ~PlatformLockedFile();
+    PlatformLockedFile(const PlatformLockedFile&) = delete;
+    PlatformLockedFile &operator=(const PlatformLockedFile&) = delete;
+    uint64_t size() const;
+    // Everything from offset to the end of the file
+    std::string read_from(uint64_t offset) const;
+    // Write data at the end of the file
+    void append(const std::string &data);
+
+private:
+    intptr_t handle;
+};
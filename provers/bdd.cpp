@@ -0,0 +1,130 @@
+#include "bdd.h"
+
+#include <limits>
+
+#include <boost/functional/hash.hpp>
+
+static const uint8_t OP_IMP = 0xb;
+
+BDD::BDD(const std::vector<pvar> &vars)
+{
+    // Terminal nodes sit after every variable in the ordering
+    const size_t terminal_idx = std::numeric_limits< size_t >::max();
+    this->nodes.push_back({terminal_idx, FALSE_NODE, FALSE_NODE});
+    this->nodes.push_back({terminal_idx, TRUE_NODE, TRUE_NODE});
+    for (size_t i = 0; i < vars.size(); i++) {
+        this->var_map[vars[i]] = i;
+    }
+}
+
+size_t BDD::TripleHash::operator()(const std::tuple<size_t, BDD::Node, BDD::Node> &x) const
+{
+    size_t ret = 0;
+    boost::hash_combine(ret, std::get<0>(x));
+    boost::hash_combine(ret, std::get<1>(x));
+    boost::hash_combine(ret, std::get<2>(x));
+    return ret;
+}
+
+BDD::Node BDD::make_node(size_t var_idx, BDD::Node low, BDD::Node high)
+{
+    if (low == high) {
+        return low;
+    }
+    auto key = std::make_tuple(var_idx, low, high);
+    auto it = this->unique_table.find(key);
+    if (it != this->unique_table.end()) {
+        return it->second;
+    }
+    Node ret = static_cast< Node >(this->nodes.size());
+    this->nodes.push_back({var_idx, low, high});
+    this->unique_table.insert(std::make_pair(key, ret));
+    return ret;
+}
+
+BDD::Node BDD::apply(uint8_t op, BDD::Node a, BDD::Node b)
+{
+    if (this->is_terminal(a) && this->is_terminal(b)) {
+        return ((op >> (2 * a + b)) & 1) ? TRUE_NODE : FALSE_NODE;
+    }
+    auto key = std::make_tuple(static_cast< size_t >(op), a, b);
+    auto it = this->computed_table.find(key);
+    if (it != this->computed_table.end()) {
+        return it->second;
+    }
+    size_t var_idx = std::min(this->nodes[a].var_idx, this->nodes[b].var_idx);
+    Node a_low = this->nodes[a].var_idx == var_idx ? this->nodes[a].low : a;
+    Node a_high = this->nodes[a].var_idx == var_idx ? this->nodes[a].high : a;
+    Node b_low = this->nodes[b].var_idx == var_idx ? this->nodes[b].low : b;
+    Node b_high = this->nodes[b].var_idx == var_idx ? this->nodes[b].high : b;
+    Node low = this->apply(op, a_low, b_low);
+    Node high = this->apply(op, a_high, b_high);
+    Node ret = this->make_node(var_idx, low, high);
+    this->computed_table.insert(std::make_pair(key, ret));
+    return ret;
+}
+
+BDD::Node BDD::apply_not(BDD::Node a)
+{
+    return this->apply(OP_IMP, a, FALSE_NODE);
+}
+
+BDD::Node BDD::apply_imp(BDD::Node a, BDD::Node b)
+{
+    return this->apply(OP_IMP, a, b);
+}
+
+BDD::Node BDD::get_var_node(size_t var_idx)
+{
+    return this->make_node(var_idx, FALSE_NODE, TRUE_NODE);
+}
+
+BDD::Node BDD::from_wff(const pwff &wff)
+{
+    auto it = this->wff_cache.find(wff);
+    if (it != this->wff_cache.end()) {
+        return it->second;
+    }
+    Node ret;
+    if (std::dynamic_pointer_cast< const True >(wff)) {
+        ret = TRUE_NODE;
+    } else if (std::dynamic_pointer_cast< const False >(wff)) {
+        ret = FALSE_NODE;
+    } else if (auto var = std::dynamic_pointer_cast< const Var >(wff)) {
+        ret = this->get_var_node(this->var_map.at(var));
+    } else if (auto not_wff = std::dynamic_pointer_cast< const Not >(wff)) {
+        ret = this->apply_not(this->from_wff(not_wff->get_a()));
+    } else if (auto imp_wff = std::dynamic_pointer_cast< const Imp >(wff)) {
+        ret = this->apply_imp(this->from_wff(imp_wff->get_a()), this->from_wff(imp_wff->get_b()));
+    } else {
+        // All other connectives are reduced to their imp_not form
+        ret = this->from_wff(wff->imp_not_form());
+    }
+    this->wff_cache.insert(std::make_pair(wff, ret));
+    return ret;
+}
+
+bool BDD::is_terminal(BDD::Node a) const
+{
+    return a == FALSE_NODE || a == TRUE_NODE;
+}
+
+size_t BDD::get_var_idx(BDD::Node a) const
+{
+    return this->nodes[a].var_idx;
+}
+
+BDD::Node BDD::get_low(BDD::Node a) const
+{
+    return this->nodes[a].low;
+}
+
+BDD::Node BDD::get_high(BDD::Node a) const
+{
+    return this->nodes[a].high;
+}
+
+size_t BDD::get_nodes_num() const
+{
+    return this->nodes.size();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <tuple>
+#include <cstdint>
+
+#include "wff.h"
+
+/**
+ * @brief A reduced ordered binary decision diagram manager for propositional formulas.
+ *
+ * Nodes are stored in a single table and identified by their index; the unique table
+ * guarantees that each function is represented by exactly one node, and the computed
+ * table caches the results of previous operations. Terminals are BDD::FALSE_NODE and
+ * BDD::TRUE_NODE. Variables are ordered as in the vector passed to the constructor.
+ */
+class BDD {
+public:
+    typedef uint32_t Node;
+    static const Node FALSE_NODE = 0;
+    static const Node TRUE_NODE = 1;
+
+    BDD(const std::vector< pvar > &vars);
+    Node from_wff(const pwff &wff);
+    Node apply_not(Node a);
+    Node apply_imp(Node a, Node b);
+    Node get_var_node(size_t var_idx);
+    bool is_terminal(Node a) const;
+    size_t get_var_idx(Node a) const;
+    Node get_low(Node a) const;
+    Node get_high(Node a) const;
+    size_t get_nodes_num() const;
+
+private:
+    Node make_node(size_t var_idx, Node low, Node high);
+    // Op is a truth table, where bit (2*a+b) is the value of (a op b)
+    Node apply(uint8_t op, Node a, Node b);
+
+    struct NodeData {
+        size_t var_idx;
+        Node low;
+        Node high;
+    };
+
+    struct TripleHash {
+        size_t operator()(const std::tuple< size_t, Node, Node > &x) const;
+    };
+
+    std::vector< NodeData > nodes;
+    std::unordered_map< std::tuple< size_t, Node, Node >, Node, TripleHash > unique_table;
+    std::unordered_map< std::tuple< size_t, Node, Node >, Node, TripleHash > computed_table;
+    pvar_map< size_t > var_map;
+    // Formulas are hash-consed, so caching on the pointer identifies equal subformulas
+    std::map< pwff, Node > wff_cache;
+};
@@ -6,6 +6,7 @@
 #include <map>
 #include <tuple>
 #include <cmath>
+#include <limits>
 
 Minisat::Lit to_minisat_literal(const std::pair<bool, uint32_t> &lit)
 {
@@ -56,41 +57,67 @@ void CNFProblem::feed_to_minisat(Minisat::Solver &solver) const
     }
 }
 
-std::tuple<bool, std::vector<std::pair<Literal, const std::vector<Literal> *> >, std::function< void() > > CNFProblem::do_unit_propagation(const std::vector<Literal> &orig_clause) const
+std::tuple<bool, std::vector< size_t >, std::function< void() > > CNFProblem::do_unit_propagation(const std::vector<Literal> &orig_clause, size_t clause_num, const std::vector< bool > *active, bool gen_prover) const
 {
     std::map< Literal, size_t > ret_map;
-    std::vector<std::pair<Literal, const std::vector<Literal> *> > ret;
+    // For each deduced literal, the clause it was deduced from (or SIZE_MAX if it comes from the assumptions) and the indices of the literals that were used
+    std::vector< size_t > ret_reasons;
+    std::vector< std::vector< size_t > > ret_antecedents;
     std::vector< std::function< void() > > ret_provers;
     auto callback = this->callback;
+    // Walk back the deduction graph from the two conflicting literals and collect the clauses it used
+    auto collect_core = [&ret_reasons,&ret_antecedents](size_t pos_idx, size_t neg_idx) {
+        std::vector< bool > visited(ret_reasons.size(), false);
+        std::vector< size_t > queue = { pos_idx, neg_idx };
+        std::set< size_t > core;
+        while (!queue.empty()) {
+            size_t idx = queue.back();
+            queue.pop_back();
+            if (visited[idx]) {
+                continue;
+            }
+            visited[idx] = true;
+            if (ret_reasons[idx] != std::numeric_limits< size_t >::max()) {
+                core.insert(ret_reasons[idx]);
+            }
+            queue.insert(queue.end(), ret_antecedents[idx].begin(), ret_antecedents[idx].end());
+        }
+        return std::vector< size_t >(core.begin(), core.end());
+    };
     for (size_t lit_idx = 0; lit_idx < orig_clause.size(); lit_idx++) {
         const auto &lit = orig_clause[lit_idx];
         auto neg_lit = invert_literal(lit);
         bool res;
-        std::tie(std::ignore, res) = ret_map.insert(std::make_pair(neg_lit, ret.size()));
+        std::tie(std::ignore, res) = ret_map.insert(std::make_pair(neg_lit, ret_reasons.size()));
         if (res) {
-            ret.push_back(make_pair(neg_lit, nullptr));
-            ret_provers.push_back([callback,lit_idx,orig_clause]() {
-                callback->prove_not_or_elim(lit_idx, orig_clause);
-            });
+            ret_reasons.push_back(std::numeric_limits< size_t >::max());
+            ret_antecedents.push_back({});
+            if (gen_prover) {
+                ret_provers.push_back([callback,lit_idx,orig_clause]() {
+                    callback->prove_not_or_elim(lit_idx, orig_clause);
+                });
+            }
         }
         if (ret_map.find(lit) != ret_map.end()) {
             // We already have a contradiction in the assumptions; this should actually never happens...
             assert(false);
-            return make_tuple(false, ret, [](){});
+            return make_tuple(false, std::vector< size_t >(), [](){});
         }
     }
     bool cont = true;
     while (cont) {
         cont = false;
-        for (size_t clause_idx = 0; clause_idx < this->clauses.size(); clause_idx++) {
+        for (size_t clause_idx = 0; clause_idx < clause_num; clause_idx++) {
+            if (active && !(*active)[clause_idx]) {
+                continue;
+            }
             const auto &clause = this->clauses[clause_idx];
-            const auto &clause_cb = this->callbacks[clause_idx];
             bool unsolved_found = false;
             bool skip_clause = false;
             Literal unsolved;
             Literal neg_unsolved;
             size_t unsolved_idx = 0;
-            std::vector< std::function< void() > > used_provers;
+            std::vector< size_t > used_lits;
             for (size_t lit_idx = 0; lit_idx < clause.size(); lit_idx++) {
                 const auto &lit = clause[lit_idx];
                 if (ret_map.find(lit) != ret_map.end()) {
@@ -102,7 +129,7 @@ std::tuple<bool, std::vector<std::pair<Literal, const std::vector<Literal> *> >,
                 auto neg_it = ret_map.find(neg_lit);
                 if (neg_it != ret_map.end()) {
                     // The literal is automatically false, so we can ignore it
-                    used_provers.push_back(ret_provers[neg_it->second]);
+                    used_lits.push_back(neg_it->second);
                     continue;
                 } else {
                     if (unsolved_found) {
@@ -126,24 +153,42 @@ std::tuple<bool, std::vector<std::pair<Literal, const std::vector<Literal> *> >,
                 unsolved_idx = clause.size()-1;
                 unsolved = clause.at(unsolved_idx);
                 neg_unsolved = invert_literal(unsolved);
-                used_provers.pop_back();
+                used_lits.pop_back();
             }
             // We found exactly one unsolved literal (or perhaps anyone if noone is solved), so it must be true
             bool res;
-            std::tie(std::ignore, res) = ret_map.insert(std::make_pair(unsolved, ret.size()));
+            size_t unsolved_pos = 0;
+            std::tie(std::ignore, res) = ret_map.insert(std::make_pair(unsolved, ret_reasons.size()));
             if (res) {
-                ret.push_back(std::make_pair(unsolved, &clause));
-                assert(used_provers.size() + 1 == clause.size());
-                ret_provers.push_back([callback,clause_cb,orig_clause,used_provers,clause,unsolved_idx]() {
-                    clause_cb(orig_clause);
-                    for (const auto &used_prover : used_provers) {
-                        used_prover();
+                unsolved_pos = ret_reasons.size();
+                ret_reasons.push_back(clause_idx);
+                ret_antecedents.push_back(used_lits);
+                assert(used_lits.size() + 1 == clause.size());
+                if (gen_prover) {
+                    const auto &clause_cb = this->callbacks[clause_idx];
+                    std::vector< std::function< void() > > used_provers;
+                    for (const auto used_lit : used_lits) {
+                        used_provers.push_back(ret_provers[used_lit]);
                     }
-                    callback->prove_unit_res(clause, unsolved_idx, orig_clause);
-                });
+                    ret_provers.push_back([callback,clause_cb,orig_clause,used_provers,clause,unsolved_idx]() {
+                        clause_cb(orig_clause);
+                        for (const auto &used_prover : used_provers) {
+                            used_prover();
+                        }
+                        callback->prove_unit_res(clause, unsolved_idx, orig_clause);
+                    });
+                }
             }
             auto conflict_it = ret_map.find(neg_unsolved);
             if (conflict_it != ret_map.end()) {
+                /* If the unsolved literal was already present, it was not actually deduced
+                 * again; this can only happen if the clause was already fully falsified,
+                 * in which case neg_unsolved was not present and we do not arrive here. */
+                assert(res);
+                auto core = collect_core(unsolved_pos, conflict_it->second);
+                if (!gen_prover) {
+                    return make_tuple(false, core, [](){});
+                }
                 auto pos_prover = ret_provers.back();
                 auto neg_prover = ret_provers[conflict_it->second];
                 if (!unsolved.first) {
@@ -151,7 +196,7 @@ std::tuple<bool, std::vector<std::pair<Literal, const std::vector<Literal> *> >,
                 }
                 auto lit = unsolved;
                 lit.first = true;
-                return make_tuple(false, ret, [orig_clause,pos_prover,neg_prover,lit,callback](){
+                return make_tuple(false, core, [orig_clause,pos_prover,neg_prover,lit,callback](){
                     pos_prover();
                     neg_prover();
                     callback->prove_absurdum(lit, orig_clause);
@@ -160,62 +205,116 @@ std::tuple<bool, std::vector<std::pair<Literal, const std::vector<Literal> *> >,
             cont = true;
         }
     }
-    return make_tuple(true, ret, [](){});
+    return make_tuple(true, std::vector< size_t >(), [](){});
 }
 
 std::pair<bool, std::function<void ()> > CNFProblem::solve()
 {
-    const auto &callback = this->callback;
-    this->callbacks.clear();
-    for (size_t i = 0; i < this->clauses.size(); i++) {
-        this->callbacks.push_back([callback,i](const auto &context){
-            callback->prove_clause(i, context);
-        });
-    }
     Minisat::Solver solver;
     this->feed_to_minisat(solver);
     bool res = solver.solve();
     if (res) {
         return std::make_pair(true, [](){});
     }
+    std::vector< Clause > learnt;
+    size_t cursor = 0;
+    get_learnt_clauses(solver, learnt, cursor);
     // For some reason, even when the problem is UNSAT, the solver does not push the empty clause at the end
-    solver.refutation.push_back({true, {}});
-    for (const auto &ref : solver.refutation) {
+    learnt.push_back({});
+    return std::make_pair(false, this->prove_refutation(learnt));
+}
+
+void CNFProblem::get_learnt_clauses(const Minisat::Solver &solver, std::vector<Clause> &learnt, size_t &cursor)
+{
+    for (; cursor < solver.refutation.size(); cursor++) {
+        const auto &ref = solver.refutation[cursor];
         if (!ref.first) {
-            // TODO There is room for optimization using clause deletion here
             continue;
         }
-        //cout << "Inferring clause:";
         Clause clause;
         for (const auto &lit : ref.second) {
-            auto lit2 = from_minisat_literal(lit);
-            //cout << " " << to_number_literal(lit2);
-            clause.push_back(lit2);
+            clause.push_back(from_minisat_literal(lit));
         }
-        //cout << endl;
-        auto propagation = this->do_unit_propagation(clause);
+        learnt.push_back(clause);
+    }
+}
+
+std::function<void ()> CNFProblem::prove_refutation(const std::vector<Clause> &learnt, RefutationDepsCache *cache)
+{
+    const auto &callback = this->callback;
+    this->callbacks.clear();
+    for (size_t i = 0; i < this->clauses.size(); i++) {
+        this->callbacks.push_back([callback,i](const auto &context){
+            callback->prove_clause(i, context);
+        });
+    }
+
+    /* Most clauses learnt by the solver are not needed to derive the empty clause,
+     * so before generating any proof we trim the refutation in the style of DRAT-trim:
+     * we append all the learnt clauses (up to the empty one), then we walk them
+     * backward and only check, marking their dependencies as needed, those that
+     * are themselves needed. Clause deletions are ignored, since keeping clauses
+     * around does not break unit propagation. */
+    size_t orig_clause_num = this->clauses.size();
+    for (const auto &clause : learnt) {
+        this->clauses.push_back(clause);
+        if (clause.empty()) {
+            break;
+        }
+    }
+    assert(this->clauses.size() > orig_clause_num && this->clauses.back().empty());
+    this->callbacks.resize(this->clauses.size());
+    std::vector< bool > needed(this->clauses.size(), false);
+    needed.back() = true;
+    for (size_t i = this->clauses.size(); i > orig_clause_num; i--) {
+        size_t clause_idx = i - 1;
+        if (!needed[clause_idx]) {
+            continue;
+        }
+        size_t learnt_idx = clause_idx - orig_clause_num;
+        bool cacheable = cache != nullptr && learnt_idx < cache->checked.size();
+        if (cacheable && cache->checked[learnt_idx]) {
+            for (const auto &dep : cache->deps[learnt_idx]) {
+                needed[dep.first ? orig_clause_num + dep.second : dep.second] = true;
+            }
+            continue;
+        }
+        auto propagation = this->do_unit_propagation(this->clauses[clause_idx], clause_idx, nullptr, false);
         assert(!std::get<0>(propagation));
-        /*cout << "Unit propagation trace:" << endl;
-        for (const auto &lit : get<1>(propagation)) {
-            cout << " * " << to_number_literal(lit.first);
-            if (lit.second) {
-                cout << " from clause";
-                for (const auto &lit2 : *lit.second) {
-                    cout << " " << to_number_literal(lit2);
-                }
+        std::vector< std::pair< bool, size_t > > deps;
+        for (const auto dep_idx : std::get<1>(propagation)) {
+            needed[dep_idx] = true;
+            if (dep_idx >= orig_clause_num) {
+                deps.emplace_back(true, dep_idx - orig_clause_num);
+            } else if (cacheable && dep_idx < cache->orig_num) {
+                deps.emplace_back(false, dep_idx);
+            } else {
+                cacheable = false;
             }
-            cout << endl;
-        }*/
-        // The refutation worked, so that we can add the new clause
-        this->clauses.push_back(clause);
+        }
+        if (cacheable) {
+            cache->checked[learnt_idx] = true;
+            cache->deps[learnt_idx] = std::move(deps);
+        }
+    }
+
+    // Now we can replay the needed clauses, using only the needed ones for unit propagation
+    for (size_t clause_idx = orig_clause_num; clause_idx < this->clauses.size(); clause_idx++) {
+        if (!needed[clause_idx]) {
+            continue;
+        }
+        const Clause clause = this->clauses[clause_idx];
+        auto propagation = this->do_unit_propagation(clause, clause_idx, &needed, true);
+        assert(!std::get<0>(propagation));
+        // The refutation worked, so that we can use the new clause
         const auto &prover = std::get<2>(propagation);
-        this->callbacks.push_back([prover,callback,clause](const auto &context) {
+        this->callbacks[clause_idx] = [prover,callback,clause](const auto &context) {
             prover();
             callback->prove_imp_intr(clause, context);
-        });
-        if (ref.second.empty()) {
+        };
+        if (clause.empty()) {
             // We have finally proved the empty clause, so we can return
-            return std::make_pair(false, prover);
+            return prover;
         }
     }
     assert(!"Should never arrive here");
@@ -44,6 +44,18 @@ struct CNFCallbackTest : public CNFCallback {
     std::vector< Clause > orig_clauses;
 };
 
+/* What prove_refutation() found while trimming a refutation, to be reused by later calls
+ * whose problem begins with the same original clauses and whose learnt clauses begin with
+ * the same learnt clauses, as in an incremental session. For each of the first
+ * checked.size() learnt clauses that was checked, deps lists the clauses its unit
+ * propagation used: original clauses (false, idx) or learnt clauses (true, idx). Only
+ * dependencies on the first orig_num original clauses are cached. */
+struct RefutationDepsCache {
+    size_t orig_num = 0;
+    std::vector< bool > checked;
+    std::vector< std::vector< std::pair< bool, size_t > > > deps;
+};
+
 struct CNFProblem {
     size_t var_num;
     std::vector< Clause > clauses;
@@ -51,9 +63,20 @@ struct CNFProblem {
 
     void print_dimacs(std::ostream &stream) const;
     std::pair< bool, std::function< void() > > solve();
+    /* Given the clauses learnt by a solver that refuted this problem, ending with the empty
+     * clause, return the prover for the refutation; each learnt clause must follow from
+     * the original clauses and the previous learnt clauses by unit propagation. Solvers
+     * used incrementally with assumptions can therefore reuse what they learnt in previous runs;
+     * with cache, the learnt clauses checked by previous runs are not checked again. */
+    std::function< void() > prove_refutation(const std::vector< Clause > &learnt, RefutationDepsCache *cache = nullptr);
+    /* Append to learnt the clauses learnt by solver after position cursor of its refutation
+     * log and move cursor to the end of the log, so that a solver used incrementally only
+     * has its new clauses converted. */
+    static void get_learnt_clauses(const Minisat::Solver &solver, std::vector< Clause > &learnt, size_t &cursor);
 
 private:
-    std::tuple<bool, std::vector<std::pair<Literal, const std::vector<Literal> *> >, std::function<void ()> > do_unit_propagation(const std::vector< Literal > &orig_clause) const;
+    // Besides the outcome and the prover, return the indices of the clauses used to derive the contradiction
+    std::tuple<bool, std::vector< size_t >, std::function<void ()> > do_unit_propagation(const std::vector< Literal > &orig_clause, size_t clause_num, const std::vector< bool > *active, bool gen_prover) const;
     void feed_to_minisat(Minisat::Solver &solver) const;
 
     std::vector< std::function< void(const Clause &context) > > callbacks;
@@ -1,4 +1,9 @@
 
+#include <thread>
+#include <atomic>
+#include <future>
+#include <sstream>
+
 #include <boost/range/adaptor/reversed.hpp>
 
 #include "subst.h"
@@ -113,20 +118,55 @@ ParsingTree< SymTok, LabTok > create_temp_var_pt(const LibraryToolbox &tb, SymTo
     return create_var_pt(tb, var_data.second);
 }
 
-ParsingTree< SymTok, LabTok > create_pt(const LibraryToolbox &tb, const std::string &templ_str, const std::map< std::string, ParsingTree< SymTok, LabTok > > &subst_str) {
-    auto templ = tb.parse_sentence(tb.read_sentence(templ_str));
-    SubstMap< SymTok, LabTok > subst;
-    for (const auto &p : subst_str) {
-        auto var_sym = tb.get_symbol(p.first);
-        assert(var_sym != SymTok{});
-        assert(tb.get_standard_is_var_sym()(var_sym));
-        auto var_lab = tb.get_var_sym_to_lab(var_sym);
-        subst[var_lab] = p.second;
-    }
-    auto ret = substitute(templ, tb.get_standard_is_var(), subst);
-    ret.validate(tb.get_validation_rule());
-    return ret;
-}
+/* A parsing tree template, parsed only once, whose variables are replaced
+ * by the trees given in the same order as they were listed at construction.
+ */
+class PtTemplate {
+public:
+    PtTemplate(const LibraryToolbox &tb, const std::string &templ_str, const std::vector< std::string > &vars_str) :
+        templ(tb.parse_sentence(tb.read_sentence(templ_str)))
+    {
+        for (const auto &var_str : vars_str) {
+            auto var_sym = tb.get_symbol(var_str);
+            assert(var_sym != SymTok{});
+            assert(tb.get_standard_is_var_sym()(var_sym));
+            this->vars.push_back(tb.get_var_sym_to_lab(var_sym));
+        }
+    }
+
+    ParsingTree< SymTok, LabTok > operator()(const LibraryToolbox &tb, const std::vector< ParsingTree< SymTok, LabTok > > &pts) const {
+        assert(pts.size() == this->vars.size());
+        SubstMap< SymTok, LabTok > subst;
+        for (size_t i = 0; i < pts.size(); i++) {
+            subst[this->vars[i]] = pts[i];
+        }
+        auto ret = substitute(this->templ, tb.get_standard_is_var(), subst);
+        assert(ret.validate(tb.get_validation_rule()));
+        return ret;
+    }
+
+private:
+    ParsingTree< SymTok, LabTok > templ;
+    std::vector< LabTok > vars;
+};
+
+// Everything subst_search needs that does not depend on the derivation being considered
+struct SubstSearchData {
+    explicit SubstSearchData(const LibraryToolbox &tb) :
+        equalities(compute_equalities(tb)), adaptors(compute_type_adaptors(tb)), var_types(compute_var_types(this->equalities, this->adaptors)),
+        bound_data(preprocess_bound_data(tb)),
+        conjunction(tb, "wff ( ph /\\ ps )", { "ph", "ps" }), implication(tb, "wff ( ph -> ps )", { "ph", "ps" }),
+        forall(tb, "wff A. x ph", { "x", "ph" }), restr_forall(tb, "wff A. x e. A ph", { "x", "A", "ph" }) {}
+
+    std::map< SymTok, std::tuple< LabTok, LabTok, LabTok > > equalities;
+    std::map< SymTok, std::pair< SymTok, LabTok > > adaptors;
+    std::set< SymTok > var_types;
+    std::map< LabTok, std::pair< size_t, std::map< size_t, size_t > > > bound_data;
+    PtTemplate conjunction;
+    PtTemplate implication;
+    PtTemplate forall;
+    PtTemplate restr_forall;
+};
 
 ParsingTree< SymTok, LabTok > create_adaptor_pt(const LibraryToolbox &tb, const std::map< SymTok, std::pair< SymTok, LabTok > > &adaptors, const ParsingTree< SymTok, LabTok > &pt) {
     ParsingTree< SymTok, LabTok > ret;
@@ -172,153 +212,243 @@ ParsingTree< SymTok, LabTok > create_not_free_pt(const LibraryToolbox &tb, const
     }
 }
 
-ParsingTree< SymTok, LabTok > create_conjunction_pt(const LibraryToolbox &tb, const ParsingTree< SymTok, LabTok > &pt1, const ParsingTree< SymTok, LabTok > &pt2) {
-    return create_pt(tb, "wff ( ph /\\ ps )", { { "ph", pt1 }, { "ps", pt2 } });
+ParsingTree< SymTok, LabTok > create_conjunction_pt(const LibraryToolbox &tb, const SubstSearchData &data, const ParsingTree< SymTok, LabTok > &pt1, const ParsingTree< SymTok, LabTok > &pt2) {
+    return data.conjunction(tb, { pt1, pt2 });
 }
 
-ParsingTree< SymTok, LabTok > create_implication_pt(const LibraryToolbox &tb, const ParsingTree< SymTok, LabTok > &pt1, const ParsingTree< SymTok, LabTok > &pt2) {
-    return create_pt(tb, "wff ( ph -> ps )", { { "ph", pt1 }, { "ps", pt2 } });
+ParsingTree< SymTok, LabTok > create_implication_pt(const LibraryToolbox &tb, const SubstSearchData &data, const ParsingTree< SymTok, LabTok > &pt1, const ParsingTree< SymTok, LabTok > &pt2) {
+    return data.implication(tb, { pt1, pt2 });
 }
 
-ParsingTree< SymTok, LabTok > create_forall_pt(const LibraryToolbox &tb, const ParsingTree< SymTok, LabTok > &pt1, const ParsingTree< SymTok, LabTok > &pt2) {
-    return create_pt(tb, "wff A. x ph", { { "x", pt1 }, { "ph", pt2 } });
+ParsingTree< SymTok, LabTok > create_forall_pt(const LibraryToolbox &tb, const SubstSearchData &data, const ParsingTree< SymTok, LabTok > &pt1, const ParsingTree< SymTok, LabTok > &pt2) {
+    return data.forall(tb, { pt1, pt2 });
 }
 
-ParsingTree< SymTok, LabTok > create_restr_forall_pt(const LibraryToolbox &tb, const ParsingTree< SymTok, LabTok > &pt1, const ParsingTree< SymTok, LabTok > &pt2, const ParsingTree< SymTok, LabTok > &pt3) {
-    return create_pt(tb, "wff A. x e. A ph", { { "x", pt1 }, { "A", pt2 }, { "ph", pt3 } });
+ParsingTree< SymTok, LabTok > create_restr_forall_pt(const LibraryToolbox &tb, const SubstSearchData &data, const ParsingTree< SymTok, LabTok > &pt1, const ParsingTree< SymTok, LabTok > &pt2, const ParsingTree< SymTok, LabTok > &pt3) {
+    return data.restr_forall(tb, { pt1, pt2, pt3 });
 }
 
-std::pair< bool, bool > search_theorem(const LibraryToolbox &tb, const std::vector<std::pair<SymTok, ParsingTree<SymTok, LabTok> > > &hypotheses, const std::pair<SymTok, ParsingTree<SymTok, LabTok> > &thesis,
+std::pair< bool, bool > search_theorem(const LibraryToolbox &tb, std::ostream &out, const std::vector<std::pair<SymTok, ParsingTree<SymTok, LabTok> > > &hypotheses, const std::pair<SymTok, ParsingTree<SymTok, LabTok> > &thesis,
                                        const std::set< std::pair< SymTok, SymTok > > &acceptable_dists = {}) {
     bool found = false;
     bool has_dists = false;
     for (const auto &hyp : hypotheses) {
-        std::cout << "      & " << tb.print_sentence(hyp.second) << std::endl;
+        out << "      & " << tb.print_sentence(hyp.second) << std::endl;
         hyp.second.validate(tb.get_validation_rule());
     }
-    std::cout << "     => " << tb.print_sentence(thesis.second) << std::endl;
+    out << "     => " << tb.print_sentence(thesis.second) << std::endl;
     thesis.second.validate(tb.get_validation_rule());
 
     if (hypotheses.size() >= 10) {
-        std::cout << "     Too many hypotheses, I refuse to process..." << std::endl;
+        out << "     Too many hypotheses, I refuse to process..." << std::endl;
         return std::make_pair(false, false);
     }
 
     auto res = tb.unify_assertion(hypotheses, thesis);
     if (!res.empty()) {
-        std::cout << "     Found match " << tb.resolve_label(std::get<0>(res[0])) << std::endl;
+        out << "     Found match " << tb.resolve_label(std::get<0>(res[0])) << std::endl;
         found = true;
         VectorMap< SymTok, Sentence > subst(std::get<2>(res[0]).begin(), std::get<2>(res[0]).end());
         auto dists = propagate_dists< Sentence >(tb.get_assertion(std::get<0>(res[0])), subst, tb);
         if (!is_included(dists.begin(), dists.end(), acceptable_dists.begin(), acceptable_dists.end())) {
-            std::cout << "     It has (excessive) DISTINCT VARIABLES provisions!" << std::endl;
+            out << "     It has (excessive) DISTINCT VARIABLES provisions!" << std::endl;
             has_dists = true;
         }
     } else {
-        std::cout << "     Found NO match..." << std::endl;
+        out << "     Found NO match..." << std::endl;
     }
     return std::make_pair(found, has_dists);
 }
 
-int subst_search_main(int argc, char *argv[]) {
-    (void) argc;
-    (void) argv;
-
-    bool search_global = true;
-    bool search_local = true;
-
-    auto &data = get_set_mm();
-    //auto &lib = data.lib;
-    auto &tb = data.tb;
-
-    auto &ders = tb.get_derivations();
-    auto equalities = compute_equalities(tb);
-    auto adaptors = compute_type_adaptors(tb);
-    auto var_types = compute_var_types(equalities, adaptors);
-    auto bound_data = preprocess_bound_data(tb);
-
-    int attempted = 0;
-    int found = 0;
-    for (const auto &der : ders) {
-        const auto type = der.first;
-        for (const auto &der2 : der.second) {
-            tb.new_temp_var_frame();
-            Finally f1([&tb]() {
-                tb.release_temp_var_frame();
-            });
+// Return whether the derivation was attempted and whether substitution rules were found for it
+static std::pair< bool, bool > search_derivation(const LibraryToolbox &tb, const SubstSearchData &data, SymTok type, LabTok label, const std::vector< SymTok > &rule, std::ostream &out) {
+    const bool search_global = true;
+    const bool search_local = true;
+    const auto &ders = tb.get_derivations();
+
+    tb.new_temp_var_frame();
+    Finally f1([&tb]() {
+        tb.release_temp_var_frame();
+    });
+
+    std::pair< size_t, std::map< size_t, size_t > > this_bound_data = { {}, {} };
+    bool has_bound_data = false;
+    auto this_bound_data_it = data.bound_data.find(label);
+    if (this_bound_data_it != data.bound_data.end()) {
+        this_bound_data = this_bound_data_it->second;
+        has_bound_data = true;
+    }
+    bool has_vars = false;
+    for (const auto sym : rule) {
+        if (ders.find(sym) != ders.end()) {
+            has_vars = true;
+        }
+    }
+    if (!has_vars) {
+        return std::make_pair(false, false);
+    }
 
-            const auto label = der2.first;
-            std::pair< size_t, std::map< size_t, size_t > > this_bound_data = { {}, {} };
-            bool has_bound_data = false;
-            auto this_bound_data_it = bound_data.find(label);
-            if (this_bound_data_it != bound_data.end()) {
-                this_bound_data = this_bound_data_it->second;
-                has_bound_data = true;
+    out << std::endl << "Considering derivation " << tb.resolve_label(label) <<" for type " << tb.resolve_symbol(type) << ", with variables:";
+    for (const auto sym : rule) {
+        if (ders.find(sym) != ders.end()) {
+            out << " " << tb.resolve_symbol(sym);
+        }
+    }
+    out << std::endl;
+
+    bool this_found = false;
+
+    if (search_global) {
+        ParsingTree< SymTok, LabTok > pt_left;
+        ParsingTree< SymTok, LabTok > pt_right;
+        pt_left.label = label;
+        pt_left.type = type;
+        pt_right.label = label;
+        pt_right.type = type;
+        std::vector< ParsingTree< SymTok, LabTok > > pts_eq_hyps;
+        std::vector< ParsingTree< SymTok, LabTok > > pts_nf_hyps;
+        out << " * Search for a global substitution rule" << std::endl;
+        size_t hyp_body_idx = 0;
+        for (size_t i = 0; i < rule.size(); i++) {
+            auto var_type = rule[i];
+            size_t current_pos = pt_left.children.size();
+            if (data.var_types.find(var_type) != data.var_types.end()) {
+                auto bound_data_it = this_bound_data.second.find(current_pos);
+                if (bound_data_it != this_bound_data.second.end()) {
+                    auto pt_var = create_temp_var_pt(tb, var_type);
+                    pt_left.children.push_back(pt_var);
+                    pt_right.children.push_back(pt_var);
+                } else {
+                    auto pt_var1 = create_temp_var_pt(tb, var_type);
+                    auto pt_var2 = create_temp_var_pt(tb, var_type);
+                    if (current_pos == this_bound_data.first) {
+                        hyp_body_idx = pts_eq_hyps.size();
+                    }
+                    pts_eq_hyps.push_back(create_equality_pt(tb, data.equalities, data.adaptors, pt_var1, pt_var2));
+                    pt_left.children.push_back(pt_var1);
+                    pt_right.children.push_back(pt_var2);
+                }
             }
-            const auto &rule = der2.second;
-            bool has_vars = false;
-            for (const auto sym : rule) {
-                if (ders.find(sym) != ders.end()) {
-                    has_vars = true;
+        }
+        std::set< std::pair< SymTok, SymTok > > acceptable_dists;
+        if (has_bound_data) {
+            // If we have bound_data for this syntax constructor, then we need to patch the body hypothesis
+            // and create not-free hypotheses
+            std::set< size_t > vars_idx;
+            for (const auto &p : boost::adaptors::reverse(this_bound_data.second)) {
+                auto var_idx = p.first;
+                auto range_idx = p.second;
+                for (const auto &prev_var_idx : vars_idx) {
+                    assert(prev_var_idx != var_idx);
+                    assert(pt_left.children[prev_var_idx].label != pt_left.children[var_idx].label);
+                    acceptable_dists.insert(std::minmax(tb.get_var_lab_to_sym(pt_left.children[prev_var_idx].label), tb.get_var_lab_to_sym(pt_left.children[var_idx].label)));
+                }
+                vars_idx.insert(var_idx);
+                assert(pt_left.children[var_idx] == pt_right.children[var_idx]);
+                if (range_idx < pt_left.children.size()) {
+                    pts_eq_hyps[hyp_body_idx] = create_restr_forall_pt(tb, data, pt_left.children[var_idx], pt_left.children[range_idx], pts_eq_hyps[hyp_body_idx]);
+                } else {
+                    pts_eq_hyps[hyp_body_idx] = create_forall_pt(tb, data, pt_left.children[var_idx], pts_eq_hyps[hyp_body_idx]);
                 }
             }
-            if (!has_vars) {
-                continue;
+            for (const auto &p : this_bound_data.second) {
+                for (const auto &var_idx : vars_idx) {
+                    auto range_idx = p.second;
+                    if (range_idx < pt_left.children.size()) {
+                        pts_nf_hyps.push_back(create_not_free_pt(tb, data.equalities, data.adaptors, pt_left.children[var_idx], pt_left.children[range_idx]));
+                        pts_nf_hyps.push_back(create_not_free_pt(tb, data.equalities, data.adaptors, pt_left.children[var_idx], pt_right.children[range_idx]));
+                    }
+                }
             }
+        }
+        auto pt_equal = create_equality_pt(tb, data.equalities, data.adaptors, pt_left, pt_right);
 
-            std::cout << std::endl << "Considering derivation " << tb.resolve_label(label) <<" for type " << tb.resolve_symbol(type) << ", with variables:";
-            for (const auto sym : rule) {
-                if (ders.find(sym) != ders.end()) {
-                    std::cout << " " << tb.resolve_symbol(sym);
-                }
+        auto pt_imp_thesis = pt_equal;
+        if (!pts_eq_hyps.empty()) {
+            auto pt_all_hyps = pts_eq_hyps[0];
+            for (size_t j = 1; j < pts_eq_hyps.size(); j++) {
+                pt_all_hyps = create_conjunction_pt(tb, data, pt_all_hyps, pts_eq_hyps[j]);
             }
-            std::cout << std::endl;
-
-            bool this_found = false;
-            Finally f2([&this_found,&attempted,&found]() {
-                attempted++;
-                if (this_found) {
-                    std::cout << "   Substitution rules found!" << std::endl;
-                    found++;
-                } else {
-                    std::cout << "   Substitution rules NOT FOUND..." << std::endl;
+            pt_imp_thesis = create_implication_pt(tb, data, pt_all_hyps, pt_equal);
+        }
+        std::vector< std::pair< SymTok, ParsingTree< SymTok, LabTok > > > pts_imp_hyps;
+        for (const auto &pt : pts_nf_hyps) {
+            pts_imp_hyps.push_back(std::make_pair(tb.get_turnstile(), pt));
+        }
+        out << "   Implication form" << std::endl;
+        auto res = search_theorem(tb, out, pts_imp_hyps, std::make_pair(tb.get_turnstile(), pt_imp_thesis), acceptable_dists);
+        if (res.first && !res.second) {
+            this_found = true;
+        }
+
+        auto pt_ded_var = create_temp_var_pt(tb, tb.get_turnstile_alias());
+        auto pt_ded_thesis = create_implication_pt(tb, data, pt_ded_var, pt_equal);
+        std::vector< std::pair< SymTok, ParsingTree< SymTok, LabTok > > > pts_ded_hyps;
+        for (const auto &pt : pts_eq_hyps) {
+            pts_ded_hyps.push_back(std::make_pair(tb.get_turnstile(), create_implication_pt(tb, data, pt_ded_var, pt)));
+        }
+        for (const auto &pt : pts_nf_hyps) {
+            pts_ded_hyps.push_back(std::make_pair(tb.get_turnstile(), pt));
+        }
+        out << "   Deduction form" << std::endl;
+        res = search_theorem(tb, out, pts_ded_hyps, std::make_pair(tb.get_turnstile(), pt_ded_thesis), acceptable_dists);
+        if (res.first && !res.second) {
+            this_found = true;
+        }
+    }
+
+    if (search_local) {
+        bool all_local_found = true;
+        Finally f3([&all_local_found,&this_found]() {
+            if (all_local_found) {
+                this_found = true;
+            }
+        });
+        size_t pivot_pos = 0;
+        for (size_t i = 0; i < rule.size(); i++) {
+            auto pivot_var_type = rule[i];
+            if (data.var_types.find(pivot_var_type) != data.var_types.end()) {
+                auto bound_data_it = this_bound_data.second.find(pivot_pos);
+                if (bound_data_it != this_bound_data.second.end()) {
+                    pivot_pos++;
+                    continue;
                 }
-            });
 
-            if (search_global) {
+                bool this_local_found = false;
+                Finally f4([&this_local_found,&all_local_found]() {
+                    if (!this_local_found) {
+                        all_local_found = false;
+                    }
+                });
+                out << " * Search for a substitution rule for " << tb.resolve_symbol(pivot_var_type) << " in position " << i << std::endl;
+                ParsingTree< SymTok, LabTok > pt_hyp;
                 ParsingTree< SymTok, LabTok > pt_left;
                 ParsingTree< SymTok, LabTok > pt_right;
                 pt_left.label = label;
                 pt_left.type = type;
                 pt_right.label = label;
                 pt_right.type = type;
-                std::vector< ParsingTree< SymTok, LabTok > > pts_eq_hyps;
-                std::vector< ParsingTree< SymTok, LabTok > > pts_nf_hyps;
-                std::cout << " * Search for a global substitution rule" << std::endl;
-                size_t hyp_body_idx = 0;
-                for (size_t i = 0; i < rule.size(); i++) {
-                    auto var_type = rule[i];
-                    size_t current_pos = pt_left.children.size();
-                    if (var_types.find(var_type) != var_types.end()) {
-                        auto bound_data_it = this_bound_data.second.find(current_pos);
-                        if (bound_data_it != this_bound_data.second.end()) {
-                            auto pt_var = create_temp_var_pt(tb, var_type);
-                            pt_left.children.push_back(pt_var);
-                            pt_right.children.push_back(pt_var);
+                for (size_t j = 0; j < rule.size(); j++) {
+                    auto var_type = rule[j];
+                    if (data.var_types.find(var_type) != data.var_types.end()) {
+                        ParsingTree< SymTok, LabTok > pt_var1;
+                        ParsingTree< SymTok, LabTok > pt_var2;
+                        pt_var1 = create_temp_var_pt(tb, var_type);
+                        if (i == j) {
+                            pt_var2 = create_temp_var_pt(tb, var_type);
+                            pt_hyp = create_equality_pt(tb, data.equalities, data.adaptors, pt_var1, pt_var2);
                         } else {
-                            auto pt_var1 = create_temp_var_pt(tb, var_type);
-                            auto pt_var2 = create_temp_var_pt(tb, var_type);
-                            if (current_pos == this_bound_data.first) {
-                                hyp_body_idx = pts_eq_hyps.size();
-                            }
-                            pts_eq_hyps.push_back(create_equality_pt(tb, equalities, adaptors, pt_var1, pt_var2));
-                            pt_left.children.push_back(pt_var1);
-                            pt_right.children.push_back(pt_var2);
+                            pt_var2 = pt_var1;
                         }
+                        pt_left.children.push_back(pt_var1);
+                        pt_right.children.push_back(pt_var2);
                     }
                 }
+                ParsingTree< SymTok, LabTok > pt_thesis = create_equality_pt(tb, data.equalities, data.adaptors, pt_left, pt_right);
+
                 std::set< std::pair< SymTok, SymTok > > acceptable_dists;
-                if (has_bound_data) {
+                std::vector< ParsingTree< SymTok, LabTok > > pts_nf_hyps;
+                if (has_bound_data && pivot_pos == this_bound_data.first) {
                     // If we have bound_data for this syntax constructor, then we need to patch the body hypothesis
                     // and create not-free hypotheses
                     std::set< size_t > vars_idx;
@@ -333,204 +463,171 @@ int subst_search_main(int argc, char *argv[]) {
                         vars_idx.insert(var_idx);
                         assert(pt_left.children[var_idx] == pt_right.children[var_idx]);
                         if (range_idx < pt_left.children.size()) {
-                            pts_eq_hyps[hyp_body_idx] = create_restr_forall_pt(tb, pt_left.children[var_idx], pt_left.children[range_idx], pts_eq_hyps[hyp_body_idx]);
+                            pt_hyp = create_restr_forall_pt(tb, data, pt_left.children[var_idx], pt_left.children[range_idx], pt_hyp);
                         } else {
-                            pts_eq_hyps[hyp_body_idx] = create_forall_pt(tb, pt_left.children[var_idx], pts_eq_hyps[hyp_body_idx]);
+                            pt_hyp = create_forall_pt(tb, data, pt_left.children[var_idx], pt_hyp);
                         }
                     }
                     for (const auto &p : this_bound_data.second) {
                         for (const auto &var_idx : vars_idx) {
                             auto range_idx = p.second;
                             if (range_idx < pt_left.children.size()) {
-                                pts_nf_hyps.push_back(create_not_free_pt(tb, equalities, adaptors, pt_left.children[var_idx], pt_left.children[range_idx]));
-                                pts_nf_hyps.push_back(create_not_free_pt(tb, equalities, adaptors, pt_left.children[var_idx], pt_right.children[range_idx]));
+                                pts_nf_hyps.push_back(create_not_free_pt(tb, data.equalities, data.adaptors, pt_left.children[var_idx], pt_left.children[range_idx]));
+                                pts_nf_hyps.push_back(create_not_free_pt(tb, data.equalities, data.adaptors, pt_left.children[var_idx], pt_right.children[range_idx]));
                             }
                         }
                     }
                 }
-                auto pt_equal = create_equality_pt(tb, equalities, adaptors, pt_left, pt_right);
 
-                auto pt_imp_thesis = pt_equal;
-                if (!pts_eq_hyps.empty()) {
-                    auto pt_all_hyps = pts_eq_hyps[0];
-                    for (size_t j = 1; j < pts_eq_hyps.size(); j++) {
-                        pt_all_hyps = create_conjunction_pt(tb, pt_all_hyps, pts_eq_hyps[j]);
-                    }
-                    pt_imp_thesis = create_implication_pt(tb, pt_all_hyps, pt_equal);
-                }
-                std::vector< std::pair< SymTok, ParsingTree< SymTok, LabTok > > > pts_imp_hyps;
-                for (const auto &pt : pts_nf_hyps) {
-                    pts_imp_hyps.push_back(std::make_pair(tb.get_turnstile(), pt));
-                }
-                std::cout << "   Implication form" << std::endl;
-                auto res = search_theorem(tb, pts_imp_hyps, std::make_pair(tb.get_turnstile(), pt_imp_thesis), acceptable_dists);
+                /*out << "   Inference form" << std::endl;
+                auto res = search_theorem(tb, out, {std::make_pair(tb.get_turnstile(), pt_hyp)}, std::make_pair(tb.get_turnstile(), pt_thesis));*/
+
+                ParsingTree< SymTok, LabTok > pt_thm = create_implication_pt(tb, data, pt_hyp, pt_thesis);
+                out << "   Implication form" << std::endl;
+                auto res = search_theorem(tb, out, {}, std::make_pair(tb.get_turnstile(), pt_thm));
                 if (res.first && !res.second) {
-                    this_found = true;
+                    this_local_found = true;
                 }
 
-                auto pt_ded_var = create_temp_var_pt(tb, tb.get_turnstile_alias());
-                auto pt_ded_thesis = create_implication_pt(tb, pt_ded_var, pt_equal);
-                std::vector< std::pair< SymTok, ParsingTree< SymTok, LabTok > > > pts_ded_hyps;
-                for (const auto &pt : pts_eq_hyps) {
-                    pts_ded_hyps.push_back(std::make_pair(tb.get_turnstile(), create_implication_pt(tb, pt_ded_var, pt)));
-                }
-                for (const auto &pt : pts_nf_hyps) {
-                    pts_ded_hyps.push_back(std::make_pair(tb.get_turnstile(), pt));
-                }
-                std::cout << "   Deduction form" << std::endl;
-                res = search_theorem(tb, pts_ded_hyps, std::make_pair(tb.get_turnstile(), pt_ded_thesis), acceptable_dists);
+                ParsingTree< SymTok, LabTok > pt_ph = create_temp_var_pt(tb, tb.get_turnstile_alias());
+                ParsingTree< SymTok, LabTok > pt_hypd = create_implication_pt(tb, data, pt_ph, pt_hyp);
+                ParsingTree< SymTok, LabTok > pt_thesisd = create_implication_pt(tb, data, pt_ph, pt_thesis);
+                out << "   Deduction form" << std::endl;
+                res = search_theorem(tb, out, {std::make_pair(tb.get_turnstile(), pt_hypd)}, std::make_pair(tb.get_turnstile(), pt_thesisd));
                 if (res.first && !res.second) {
-                    this_found = true;
+                    this_local_found = true;
                 }
-            }
-
-            if (search_local) {
-                bool all_local_found = true;
-                Finally f3([&all_local_found,&this_found]() {
-                    if (all_local_found) {
-                        this_found = true;
-                    }
-                });
-                size_t pivot_pos = 0;
-                for (size_t i = 0; i < rule.size(); i++) {
-                    auto pivot_var_type = rule[i];
-                    if (var_types.find(pivot_var_type) != var_types.end()) {
-                        auto bound_data_it = this_bound_data.second.find(pivot_pos);
-                        if (bound_data_it != this_bound_data.second.end()) {
-                            pivot_pos++;
-                            continue;
-                        }
-
-                        bool this_local_found = false;
-                        Finally f4([&this_local_found,&all_local_found]() {
-                            if (!this_local_found) {
-                                all_local_found = false;
-                            }
-                        });
-                        std::cout << " * Search for a substitution rule for " << tb.resolve_symbol(pivot_var_type) << " in position " << i << std::endl;
-                        ParsingTree< SymTok, LabTok > pt_hyp;
-                        ParsingTree< SymTok, LabTok > pt_left;
-                        ParsingTree< SymTok, LabTok > pt_right;
-                        pt_left.label = label;
-                        pt_left.type = type;
-                        pt_right.label = label;
-                        pt_right.type = type;
-                        for (size_t j = 0; j < rule.size(); j++) {
-                            auto var_type = rule[j];
-                            if (var_types.find(var_type) != var_types.end()) {
-                                ParsingTree< SymTok, LabTok > pt_var1;
-                                ParsingTree< SymTok, LabTok > pt_var2;
-                                pt_var1 = create_temp_var_pt(tb, var_type);
-                                if (i == j) {
-                                    pt_var2 = create_temp_var_pt(tb, var_type);
-                                    pt_hyp = create_equality_pt(tb, equalities, adaptors, pt_var1, pt_var2);
-                                } else {
-                                    pt_var2 = pt_var1;
-                                }
-                                pt_left.children.push_back(pt_var1);
-                                pt_right.children.push_back(pt_var2);
+                pivot_pos++;
+            } else if (false) {  //(rule[i] == var_type) {
+                if (false) {
+                    out << " * Search for a not-free rule for " << tb.resolve_symbol(rule[i]) << " in position " << i << std::endl;
+                    tb.new_temp_var_frame();
+                    Finally f([&tb]() {
+                        tb.release_temp_var_frame();
+                    });
+                    ParsingTree< SymTok, LabTok > pt_body;
+                    pt_body.label = label;
+                    pt_body.type = type;
+                    ParsingTree< SymTok, LabTok > pt_var;
+                    pt_var.type = {};  //var_type;
+                    for (unsigned j = 0; j < rule.size(); j++) {
+                        if (ders.find(rule[j]) != ders.end()) {
+                            ParsingTree< SymTok, LabTok > pt_var2;
+                            auto var = tb.new_temp_var(rule[j]);
+                            pt_var2.label = var.first;
+                            pt_var2.type = rule[j];
+                            pt_body.children.push_back(pt_var2);
+                            if (i == j) {
+                                pt_var.label = var.first;
                             }
                         }
-                        ParsingTree< SymTok, LabTok > pt_thesis = create_equality_pt(tb, equalities, adaptors, pt_left, pt_right);
-
-                        std::set< std::pair< SymTok, SymTok > > acceptable_dists;
-                        std::vector< ParsingTree< SymTok, LabTok > > pts_nf_hyps;
-                        if (has_bound_data && pivot_pos == this_bound_data.first) {
-                            // If we have bound_data for this syntax constructor, then we need to patch the body hypothesis
-                            // and create not-free hypotheses
-                            std::set< size_t > vars_idx;
-                            for (const auto &p : boost::adaptors::reverse(this_bound_data.second)) {
-                                auto var_idx = p.first;
-                                auto range_idx = p.second;
-                                for (const auto &prev_var_idx : vars_idx) {
-                                    assert(prev_var_idx != var_idx);
-                                    assert(pt_left.children[prev_var_idx].label != pt_left.children[var_idx].label);
-                                    acceptable_dists.insert(std::minmax(tb.get_var_lab_to_sym(pt_left.children[prev_var_idx].label), tb.get_var_lab_to_sym(pt_left.children[var_idx].label)));
-                                }
-                                vars_idx.insert(var_idx);
-                                assert(pt_left.children[var_idx] == pt_right.children[var_idx]);
-                                if (range_idx < pt_left.children.size()) {
-                                    pt_hyp = create_restr_forall_pt(tb, pt_left.children[var_idx], pt_left.children[range_idx], pt_hyp);
-                                } else {
-                                    pt_hyp = create_forall_pt(tb, pt_left.children[var_idx], pt_hyp);
-                                }
-                            }
-                            for (const auto &p : this_bound_data.second) {
-                                for (const auto &var_idx : vars_idx) {
-                                    auto range_idx = p.second;
-                                    if (range_idx < pt_left.children.size()) {
-                                        pts_nf_hyps.push_back(create_not_free_pt(tb, equalities, adaptors, pt_left.children[var_idx], pt_left.children[range_idx]));
-                                        pts_nf_hyps.push_back(create_not_free_pt(tb, equalities, adaptors, pt_left.children[var_idx], pt_right.children[range_idx]));
-                                    }
-                                }
-                            }
+                    }
+                    ParsingTree< SymTok, LabTok > pt_nf;
+                    pt_nf.type = tb.get_turnstile_alias();
+                    pt_nf.label = std::get<2>(data.equalities.at(type));
+                    pt_nf.children.push_back(pt_var);
+                    pt_nf.children.push_back(pt_body);
+                    assert(pt_nf.validate(tb.get_validation_rule()));
+                    out << "   Searching for " << tb.print_sentence(pt_nf) << std::endl;
+                    auto res = tb.unify_assertion({}, std::make_pair(tb.get_turnstile(), pt_nf));
+                    if (!res.empty()) {
+                        out << "     Found match " << tb.resolve_label(std::get<0>(res[0])) << std::endl;
+                        if (!tb.get_assertion(std::get<0>(res[0])).get_mand_dists().empty()) {
+                            out << "     It has DISTINCT VARIABLES provisions!" << std::endl;
                         }
+                    } else {
+                        out << "     Found NO match..." << std::endl;
+                    }
+                }
+            }
+        }
+    }
 
-                        /*std::cout << "   Inference form" << std::endl;
-                        auto res = search_theorem(tb, {std::make_pair(tb.get_turnstile(), pt_hyp)}, std::make_pair(tb.get_turnstile(), pt_thesis));*/
+    if (this_found) {
+        out << "   Substitution rules found!" << std::endl;
+    } else {
+        out << "   Substitution rules NOT FOUND..." << std::endl;
+    }
+    return std::make_pair(true, this_found);
+}
 
-                        ParsingTree< SymTok, LabTok > pt_thm = create_implication_pt(tb, pt_hyp, pt_thesis);
-                        std::cout << "   Implication form" << std::endl;
-                        auto res = search_theorem(tb, {}, std::make_pair(tb.get_turnstile(), pt_thm));
-                        if (res.first && !res.second) {
-                            this_local_found = true;
-                        }
+int subst_search_main(int argc, char *argv[]) {
+    auto print_usage = [&]() {
+        std::cerr << "Usage: " << argv[0] << " [threads]" << std::endl;
+    };
+    if (argc > 2) {
+        print_usage();
+        return 1;
+    }
+    size_t threads_num = std::max(std::thread::hardware_concurrency(), 1u);
+    if (argc >= 2) {
+        threads_num = parse_threads_num(argv[1]);
+        if (threads_num == 0) {
+            std::cerr << "The number of threads must be a positive integer, not " << argv[1] << std::endl;
+            print_usage();
+            return 1;
+        }
+    }
 
-                        ParsingTree< SymTok, LabTok > pt_ph = create_temp_var_pt(tb, tb.get_turnstile_alias());
-                        ParsingTree< SymTok, LabTok > pt_hypd = create_implication_pt(tb, pt_ph, pt_hyp);
-                        ParsingTree< SymTok, LabTok > pt_thesisd = create_implication_pt(tb, pt_ph, pt_thesis);
-                        std::cout << "   Deduction form" << std::endl;
-                        res = search_theorem(tb, {std::make_pair(tb.get_turnstile(), pt_hypd)}, std::make_pair(tb.get_turnstile(), pt_thesisd));
-                        if (res.first && !res.second) {
-                            this_local_found = true;
-                        }
-                        pivot_pos++;
-                    } else if (false) {  //(rule[i] == var_type) {
-                        if (false) {
-                            std::cout << " * Search for a not-free rule for " << tb.resolve_symbol(rule[i]) << " in position " << i << std::endl;
-                            tb.new_temp_var_frame();
-                            Finally f([&tb]() {
-                                tb.release_temp_var_frame();
-                            });
-                            ParsingTree< SymTok, LabTok > pt_body;
-                            pt_body.label = label;
-                            pt_body.type = type;
-                            ParsingTree< SymTok, LabTok > pt_var;
-                            pt_var.type = {};  //var_type;
-                            for (unsigned j = 0; j < rule.size(); j++) {
-                                if (ders.find(rule[j]) != ders.end()) {
-                                    ParsingTree< SymTok, LabTok > pt_var2;
-                                    auto var = tb.new_temp_var(rule[j]);
-                                    pt_var2.label = var.first;
-                                    pt_var2.type = rule[j];
-                                    pt_body.children.push_back(pt_var2);
-                                    if (i == j) {
-                                        pt_var.label = var.first;
-                                    }
-                                }
-                            }
-                            ParsingTree< SymTok, LabTok > pt_nf;
-                            pt_nf.type = tb.get_turnstile_alias();
-                            pt_nf.label = std::get<2>(equalities.at(type));
-                            pt_nf.children.push_back(pt_var);
-                            pt_nf.children.push_back(pt_body);
-                            assert(pt_nf.validate(tb.get_validation_rule()));
-                            std::cout << "   Searching for " << tb.print_sentence(pt_nf) << std::endl;
-                            auto res = tb.unify_assertion({}, std::make_pair(tb.get_turnstile(), pt_nf));
-                            if (!res.empty()) {
-                                std::cout << "     Found match " << tb.resolve_label(std::get<0>(res[0])) << std::endl;
-                                if (!tb.get_assertion(std::get<0>(res[0])).get_mand_dists().empty()) {
-                                    std::cout << "     It has DISTINCT VARIABLES provisions!" << std::endl;
-                                }
-                            } else {
-                                std::cout << "     Found NO match..." << std::endl;
-                            }
-                        }
-                    }
+    auto &set_mm = get_set_mm();
+    //auto &lib = set_mm.lib;
+    auto &tb = set_mm.tb;
+    const SubstSearchData data(tb);
+
+    std::vector< std::tuple< SymTok, LabTok, const std::vector< SymTok >* > > jobs;
+    for (const auto &der : tb.get_derivations()) {
+        for (const auto &der2 : der.second) {
+            jobs.emplace_back(der.first, der2.first, &der2.second);
+        }
+    }
+
+    // Workers take derivations in order, each in its own temporary variable
+    // frame, while this thread prints the reports as soon as they are ready
+    struct SearchResult {
+        bool attempted;
+        bool found;
+        std::string output;
+    };
+    std::vector< std::promise< SearchResult > > promises(jobs.size());
+    std::atomic< size_t > next_job(0);
+    std::vector< std::thread > workers;
+    for (size_t i = 0; i < threads_num; i++) {
+        workers.emplace_back([&]() {
+            size_t idx;
+            while ((idx = next_job++) < jobs.size()) {
+                try {
+                    std::ostringstream out;
+                    auto res = search_derivation(tb, data, std::get<0>(jobs[idx]), std::get<1>(jobs[idx]), *std::get<2>(jobs[idx]), out);
+                    promises[idx].set_value({ res.first, res.second, out.str() });
+                } catch (...) {
+                    promises[idx].set_exception(std::current_exception());
                 }
             }
+        });
+    }
+
+    int attempted = 0;
+    int found = 0;
+    std::exception_ptr error;
+    for (auto &promise : promises) {
+        try {
+            auto res = promise.get_future().get();
+            std::cout << res.output;
+            attempted += res.attempted;
+            found += res.found;
+        } catch (...) {
+            // Stop the workers before letting the exception go
+            error = std::current_exception();
+            next_job = jobs.size();
+            break;
         }
     }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
 
     std::cout << std::endl << "Found " << found << " out of " << attempted << " attempts" << std::endl;
 
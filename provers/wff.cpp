@@ -1,6 +1,13 @@
 
 #include "wff.h"
 #include "mm/ptengine.h"
+#include "bdd.h"
+
+#include <unordered_map>
+#include <typeinfo>
+#include <array>
+
+#include <boost/functional/hash.hpp>
 
 //#define LOG_WFF
 
@@ -42,12 +49,136 @@ bool Wff::is_false() const
     return false;
 }
 
-Prover<CheckpointedProofEngine> Wff::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> Wff::compute_type_prover(const LibraryToolbox &tb) const
 {
     (void) tb;
     return null_prover;
 }
 
+/* Memoized values are computed without holding the node lock, since computing
+ * them can require other memoized values of the same node (for example, the
+ * Tseitin variable requires the type prover). If two threads race, they compute
+ * the same value and only the first one is kept. */
+pwff Wff::imp_not_form() const
+{
+    {
+        std::unique_lock< std::mutex > lock(this->memo_mutex);
+        if (this->imp_not_memo_valid) {
+            return this->imp_not_memo ? this->imp_not_memo : this->imp_not_memo_self.lock();
+        }
+    }
+    auto ret = this->compute_imp_not_form();
+    std::unique_lock< std::mutex > lock(this->memo_mutex);
+    if (!this->imp_not_memo_valid) {
+        if (ret.get() == this) {
+            this->imp_not_memo_self = ret;
+        } else {
+            this->imp_not_memo = ret;
+        }
+        this->imp_not_memo_valid = true;
+    }
+    return ret;
+}
+
+static bool same_table(const std::weak_ptr< WffHashConsTable > &x, const std::shared_ptr< WffHashConsTable > &y) {
+    return !x.owner_before(y) && !y.owner_before(x);
+}
+
+Prover<CheckpointedProofEngine> Wff::get_type_prover(const LibraryToolbox &tb) const
+{
+    auto table = Wff::get_hash_cons_table(tb);
+    {
+        std::unique_lock< std::mutex > lock(this->memo_mutex);
+        if (same_table(this->type_prover_memo_tb, table)) {
+            return this->type_prover_memo;
+        }
+    }
+    // Repeated subformulas are type-proved only once per engine
+    auto ret = memoized_prover(this->compute_type_prover(tb));
+    std::unique_lock< std::mutex > lock(this->memo_mutex);
+    this->type_prover_memo_tb = table;
+    this->type_prover_memo = ret;
+    return ret;
+}
+
+bool Wff::can_share_with(const Wff &x) const
+{
+    return this->to_string() == x.to_string();
+}
+
+/* The nodes of a toolbox, split in shards with their own locks. Entries of dead nodes
+ * are dropped when met during a lookup, and a whole shard is swept each time it doubles
+ * in size, so that its size stays proportional to the number of live nodes. */
+struct WffHashConsTable {
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_multimap< size_t, std::weak_ptr< const Wff > > nodes;
+        size_t sweep_size = 64;
+    };
+    std::array< Shard, 16 > shards;
+};
+
+std::shared_ptr< WffHashConsTable > Wff::get_hash_cons_table(const LibraryToolbox &tb)
+{
+    return tb.get_attachment< WffHashConsTable >();
+}
+
+void Wff::set_scope(const LibraryToolbox &tb) const
+{
+    this->scope = Wff::get_hash_cons_table(tb);
+}
+
+/* Children are already hash-consed, so two nodes are structurally equal if they have
+ * the same type and the same children pointers; leaves are compared with can_share_with().
+ * A node takes the table of its first child that has one. */
+pwff Wff::hash_cons(pwff candidate)
+{
+    const auto children = candidate->get_children();
+    for (const auto &child : children) {
+        if (!candidate->scope.expired()) {
+            break;
+        }
+        candidate->scope = child->scope;
+    }
+    auto table = candidate->scope.lock();
+    if (table == nullptr) {
+        return candidate;
+    }
+    size_t hash = typeid(*candidate).hash_code();
+    if (children.empty()) {
+        boost::hash_combine(hash, candidate->to_string());
+    }
+    for (const auto &child : children) {
+        boost::hash_combine(hash, child.get());
+    }
+    auto &shard = table->shards[hash % table->shards.size()];
+    std::unique_lock< std::mutex > lock(shard.mutex);
+    auto range = shard.nodes.equal_range(hash);
+    for (auto it = range.first; it != range.second; ) {
+        auto node = it->second.lock();
+        if (!node) {
+            it = shard.nodes.erase(it);
+            continue;
+        }
+        if (typeid(*node) == typeid(*candidate) && node->get_children() == children && (!children.empty() || node->can_share_with(*candidate))) {
+            return node;
+        }
+        it++;
+    }
+    if (shard.nodes.size() >= shard.sweep_size) {
+        for (auto it = shard.nodes.begin(); it != shard.nodes.end(); ) {
+            if (it->second.expired()) {
+                it = shard.nodes.erase(it);
+            } else {
+                it++;
+            }
+        }
+        shard.sweep_size = std::max(shard.sweep_size, 2 * shard.nodes.size());
+    }
+    shard.nodes.insert(std::make_pair(hash, candidate));
+    return candidate;
+}
+
 Prover<CheckpointedProofEngine> Wff::get_imp_not_prover(const LibraryToolbox &tb) const
 {
     (void) tb;
@@ -62,36 +193,169 @@ Prover< CheckpointedProofEngine > Wff::get_subst_prover(pvar var, bool positive,
     return null_prover;
 }
 
+static const RegisteredProver simp_refl_rp = LibraryToolbox::register_prover({}, "|- ( ph <-> ph )");
+static const RegisteredProver simp_comm_rp = LibraryToolbox::register_prover({"|- ( ph <-> ps )"}, "|- ( ps <-> ph )");
+static const RegisteredProver simp_trans_rp = LibraryToolbox::register_prover({"|- ( ph <-> ps )", "|- ( ps <-> ch )"}, "|- ( ph <-> ch )");
+static const RegisteredProver simp_not_rp = LibraryToolbox::register_prover({"|- ( ph <-> ps )"}, "|- ( -. ph <-> -. ps )");
+static const RegisteredProver simp_imp_rp = LibraryToolbox::register_prover({"|- ( ph <-> ps )", "|- ( ch <-> th )"}, "|- ( ( ph -> ch ) <-> ( ps -> th ) )");
+static const RegisteredProver simp_true_rp = LibraryToolbox::register_prover({"|- ph", "|- ps"}, "|- ( ph <-> ps )");
+static const RegisteredProver simp_false_rp = LibraryToolbox::register_prover({"|- -. ph", "|- -. ps"}, "|- ( ph <-> ps )");
+static const RegisteredProver simp_notnot_rp = LibraryToolbox::register_prover({}, "|- ( ph <-> -. -. ph )");
+static const RegisteredProver simp_imp_true_rp = LibraryToolbox::register_prover({"|- ph"}, "|- ( ps <-> ( ph -> ps ) )");
+static const RegisteredProver simp_imp_false_rp = LibraryToolbox::register_prover({}, "|- ( -. ph <-> ( ph -> F. ) )");
+
+// Prove ( a <-> c ) from ( a <-> b ) and ( b <-> c ); the proof of a trivial equivalence is never used
+static Prover< CheckpointedProofEngine > simp_trans(const pwff &a, const pwff &b, const pwff &c, const Prover< CheckpointedProofEngine > &ab, const Prover< CheckpointedProofEngine > &bc, const LibraryToolbox &tb) {
+    if (b == c) {
+        return ab;
+    }
+    if (a == b) {
+        return bc;
+    }
+    return tb.build_registered_prover< CheckpointedProofEngine >(simp_trans_rp, {{"ph", a->get_type_prover(tb)}, {"ps", b->get_type_prover(tb)}, {"ch", c->get_type_prover(tb)}}, {ab, bc});
+}
+
+static Prover< CheckpointedProofEngine > simp_comm(const pwff &a, const pwff &b, const Prover< CheckpointedProofEngine > &ba, const LibraryToolbox &tb) {
+    return tb.build_registered_prover< CheckpointedProofEngine >(simp_comm_rp, {{"ph", b->get_type_prover(tb)}, {"ps", a->get_type_prover(tb)}}, {ba});
+}
+
+/* Simplify a formula in imp_not form by propagating T. and F. and removing double
+ * negations, returning the simplified formula and a proof of ( wff <-> simplified ).
+ * After a variable is replaced by a constant, this is what makes the residual
+ * formulas of different branches coincide, so that they are proved only once. */
+std::pair< pwff, Prover< CheckpointedProofEngine > > Wff::simplify(pwff wff, AdvTruthMemo &memo, const LibraryToolbox &tb) {
+    auto it = memo.simplified.find(wff);
+    if (it != memo.simplified.end()) {
+        return it->second;
+    }
+    // First simplify the children, then the node itself
+    pwff partial = wff;
+    auto partial_prover = tb.build_registered_prover< CheckpointedProofEngine >(simp_refl_rp, {{"ph", wff->get_type_prover(tb)}}, {});
+    pwff ret;
+    Prover< CheckpointedProofEngine > ret_prover;
+    auto children = wff->get_children();
+    if (dynamic_cast< const Not* >(wff.get()) != nullptr) {
+        auto a = simplify(children[0], memo, tb);
+        if (a.first != children[0]) {
+            partial = Not::create(a.first);
+            partial_prover = tb.build_registered_prover< CheckpointedProofEngine >(simp_not_rp, {{"ph", children[0]->get_type_prover(tb)}, {"ps", a.first->get_type_prover(tb)}}, {a.second});
+        }
+        if (!partial->is_true() && !partial->is_false() && dynamic_cast< const Not* >(a.first.get()) != nullptr) {
+            ret = a.first->get_children()[0];
+            ret_prover = simp_comm(partial, ret, tb.build_registered_prover< CheckpointedProofEngine >(simp_notnot_rp, {{"ph", ret->get_type_prover(tb)}}, {}), tb);
+        }
+    } else if (dynamic_cast< const Imp* >(wff.get()) != nullptr) {
+        auto a = simplify(children[0], memo, tb);
+        auto b = simplify(children[1], memo, tb);
+        if (a.first != children[0] || b.first != children[1]) {
+            partial = Imp::create(a.first, b.first);
+            partial_prover = tb.build_registered_prover< CheckpointedProofEngine >(simp_imp_rp,
+                {{"ph", children[0]->get_type_prover(tb)}, {"ps", a.first->get_type_prover(tb)}, {"ch", children[1]->get_type_prover(tb)}, {"th", b.first->get_type_prover(tb)}},
+                {a.second, b.second});
+        }
+        if (!partial->is_true() && !partial->is_false()) {
+            if (a.first->is_true()) {
+                ret = b.first;
+                ret_prover = simp_comm(partial, ret, tb.build_registered_prover< CheckpointedProofEngine >(simp_imp_true_rp,
+                    {{"ph", a.first->get_type_prover(tb)}, {"ps", b.first->get_type_prover(tb)}}, {a.first->get_truth_prover(tb)}), tb);
+            } else if (b.first->is_false()) {
+                // The negation might be a double negation, which is simplified again
+                auto neg = Not::create(a.first);
+                auto neg_prover = simp_comm(partial, neg, tb.build_registered_prover< CheckpointedProofEngine >(simp_imp_false_rp,
+                    {{"ph", a.first->get_type_prover(tb)}}, {}), tb);
+                auto neg_simpl = simplify(neg, memo, tb);
+                ret = neg_simpl.first;
+                ret_prover = simp_trans(partial, neg, ret, neg_prover, neg_simpl.second, tb);
+            }
+        }
+    }
+    if (partial->is_true() && partial != True::create()) {
+        ret = True::create();
+        ret_prover = tb.build_registered_prover< CheckpointedProofEngine >(simp_true_rp, {{"ph", partial->get_type_prover(tb)}, {"ps", ret->get_type_prover(tb)}},
+            {partial->get_truth_prover(tb), ret->get_truth_prover(tb)});
+    } else if (partial->is_false() && partial != False::create()) {
+        ret = False::create();
+        ret_prover = tb.build_registered_prover< CheckpointedProofEngine >(simp_false_rp, {{"ph", partial->get_type_prover(tb)}, {"ps", ret->get_type_prover(tb)}},
+            {partial->get_falsity_prover(tb), ret->get_falsity_prover(tb)});
+    } else if (ret == nullptr) {
+        ret = partial;
+    }
+    auto res = std::make_pair(ret, memoized_prover(simp_trans(wff, partial, ret, partial_prover, ret_prover, tb)));
+    memo.simplified.insert(std::make_pair(wff, res));
+    return res;
+}
+
 const RegisteredProver Wff::adv_truth_1_rp = LibraryToolbox::register_prover({"|- ch", "|- ( ph -> ( ps <-> ch ) )"}, "|- ( ph -> ps )");
 const RegisteredProver Wff::adv_truth_2_rp = LibraryToolbox::register_prover({"|- ch", "|- ( ph -> ( ps <-> ch ) )"}, "|- ( ph -> ps )");
 const RegisteredProver Wff::adv_truth_3_rp = LibraryToolbox::register_prover({"|- ( ph -> ps )", "|- ( -. ph -> ps )"}, "|- ps");
-std::pair<bool, Prover<CheckpointedProofEngine> > Wff::adv_truth_internal(pvar_set::iterator cur_var, pvar_set::iterator end_var, const LibraryToolbox &tb) const {
-    if (cur_var == end_var) {
-        return make_pair(this->is_true(), this->get_truth_prover(tb));
+const RegisteredProver Wff::adv_truth_5_rp = LibraryToolbox::register_prover({"|- ( ph -> ( ps <-> ch ) )", "|- ( ch <-> th )"}, "|- ( ph -> ( ps <-> th ) )");
+/* The formula is already known to be a tautology and simplified, so its substitutions
+ * are tautologies too; we split on variables following the BDD ordering and skip
+ * the ones that do not appear in the formula. After each substitution the residual
+ * formula is simplified: when both branches give the same residual, the variable
+ * is eliminated with a single proof of it, instead of proving it twice. Since
+ * formulas are hash-consed, equal residual formulas are the same node, and their
+ * proof is generated once. */
+Prover<CheckpointedProofEngine> Wff::adv_truth_internal(pwff wff, const std::vector< pvar > &vars, size_t cur_var, AdvTruthMemo &memo, const LibraryToolbox &tb) {
+    auto it = memo.proofs.find(wff);
+    if (it != memo.proofs.end()) {
+        return it->second;
+    }
+    Prover< CheckpointedProofEngine > ret;
+    pwff pos_wff, neg_wff;
+    while (cur_var != vars.size()) {
+        pos_wff = wff->subst(vars[cur_var], true);
+        if (pos_wff != wff) {
+            break;
+        }
+        cur_var++;
+    }
+    if (cur_var == vars.size()) {
+        assert(wff->is_true());
+        ret = wff->get_truth_prover(tb);
     } else {
-        const auto &var = *cur_var++;
-        pwff pos_wff = this->subst(var, true);
-        pwff neg_wff = this->subst(var, false);
+        const auto &var = vars[cur_var];
+        neg_wff = wff->subst(var, false);
         pwff pos_antecent = var;
         pwff neg_antecent = Not::create(var);
-        auto rec_pos_prover = pos_wff->adv_truth_internal(cur_var, end_var, tb);
-        auto rec_neg_prover = neg_wff->adv_truth_internal(cur_var, end_var, tb);
-        if (!rec_pos_prover.first || !rec_neg_prover.first) {
-            return make_pair(false, null_prover);
+        auto pos_simpl = simplify(pos_wff, memo, tb);
+        auto neg_simpl = simplify(neg_wff, memo, tb);
+        auto pos_prover = wff->get_subst_prover(var, true, tb);
+        auto neg_prover = wff->get_subst_prover(var, false, tb);
+        if (pos_simpl.first != pos_wff) {
+            pos_prover = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_5_rp,
+                {{"ph", pos_antecent->get_type_prover(tb)}, {"ps", wff->get_type_prover(tb)}, {"ch", pos_wff->get_type_prover(tb)}, {"th", pos_simpl.first->get_type_prover(tb)}},
+                {pos_prover, pos_simpl.second});
+        }
+        if (neg_simpl.first != neg_wff) {
+            neg_prover = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_5_rp,
+                {{"ph", neg_antecent->get_type_prover(tb)}, {"ps", wff->get_type_prover(tb)}, {"ch", neg_wff->get_type_prover(tb)}, {"th", neg_simpl.first->get_type_prover(tb)}},
+                {neg_prover, neg_simpl.second});
+        }
+        if (pos_simpl.first == neg_simpl.first) {
+            auto rec_prover = adv_truth_internal(pos_simpl.first, vars, cur_var+1, memo, tb);
+            auto equiv_prover = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_3_rp,
+                {{"ph", pos_antecent->get_type_prover(tb)}, {"ps", Biimp::create(wff, pos_simpl.first)->get_type_prover(tb)}},
+                {pos_prover, neg_prover});
+            ret = memoized_prover(tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_4_rp,
+                {{"ph", wff->get_type_prover(tb)}, {"ps", pos_simpl.first->get_type_prover(tb)}},
+                {rec_prover, equiv_prover}));
+        } else {
+            auto rec_pos_prover = adv_truth_internal(pos_simpl.first, vars, cur_var+1, memo, tb);
+            auto rec_neg_prover = adv_truth_internal(neg_simpl.first, vars, cur_var+1, memo, tb);
+            auto pos_mp_prover = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_1_rp,
+                {{"ph", pos_antecent->get_type_prover(tb)}, {"ps", wff->get_type_prover(tb)}, {"ch", pos_simpl.first->get_type_prover(tb)}},
+                {rec_pos_prover, pos_prover});
+            auto neg_mp_prover = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_2_rp,
+                {{"ph", neg_antecent->get_type_prover(tb)}, {"ps", wff->get_type_prover(tb)}, {"ch", neg_simpl.first->get_type_prover(tb)}},
+                {rec_neg_prover, neg_prover});
+            ret = memoized_prover(tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_3_rp,
+                {{"ph", pos_antecent->get_type_prover(tb)}, {"ps", wff->get_type_prover(tb)}},
+                {pos_mp_prover, neg_mp_prover}));
         }
-        auto pos_prover = this->get_subst_prover(var, true, tb);
-        auto neg_prover = this->get_subst_prover(var, false, tb);
-        auto pos_mp_prover = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_1_rp,
-            {{"ph", pos_antecent->get_type_prover(tb)}, {"ps", this->get_type_prover(tb)}, {"ch", pos_wff->get_type_prover(tb)}},
-            {rec_pos_prover.second, pos_prover});
-        auto neg_mp_prover = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_2_rp,
-            {{"ph", neg_antecent->get_type_prover(tb)}, {"ps", this->get_type_prover(tb)}, {"ch", neg_wff->get_type_prover(tb)}},
-            {rec_neg_prover.second, neg_prover});
-        auto final = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_3_rp,
-            {{"ph", pos_antecent->get_type_prover(tb)}, {"ps", this->get_type_prover(tb)}},
-            {pos_mp_prover, neg_mp_prover});
-        return make_pair(true, final);
     }
+    memo.proofs.insert(std::make_pair(wff, ret));
+    return ret;
 }
 
 const RegisteredProver Wff::adv_truth_4_rp = LibraryToolbox::register_prover({"|- ps", "|- ( ph <-> ps )"}, "|- ph");
@@ -104,20 +368,44 @@ std::pair<bool, Prover<CheckpointedProofEngine> > Wff::get_adv_truth_prover(cons
 #ifdef LOG_WFF
     cerr << "not_imp form: " << not_imp->to_string() << endl;
 #endif
-    pvar_set vars;
-    this->get_variables(vars);
-    auto real = not_imp->adv_truth_internal(vars.begin(), vars.end(), tb);
-    if (!real.first) {
+    pvar_set vars_set;
+    this->get_variables(vars_set);
+    std::vector< pvar > vars(vars_set.begin(), vars_set.end());
+    // First decide whether the formula is a tautology, without generating any proof
+    BDD bdd(vars);
+    if (bdd.from_wff(not_imp) != BDD::TRUE_NODE) {
         return make_pair(false, null_prover);
     }
+    AdvTruthMemo memo;
+    auto simpl = simplify(not_imp, memo, tb);
+    auto real = adv_truth_internal(simpl.first, vars, 0, memo, tb);
+    if (simpl.first != not_imp) {
+        real = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_4_rp, {{"ph", not_imp->get_type_prover(tb)}, {"ps", simpl.first->get_type_prover(tb)}}, {real, simpl.second});
+    }
     auto equiv = this->get_imp_not_prover(tb);
-    auto final = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_4_rp, {{"ph", this->get_type_prover(tb)}, {"ps", not_imp->get_type_prover(tb)}}, {real.second, equiv});
+    auto final = tb.build_registered_prover< CheckpointedProofEngine >(Wff::adv_truth_4_rp, {{"ph", this->get_type_prover(tb)}, {"ps", not_imp->get_type_prover(tb)}}, {real, equiv});
     return make_pair(true, final);
 }
 
 pvar Wff::get_tseitin_var(const LibraryToolbox &tb) const
 {
-    return Var::create(this->to_parsing_tree(tb), tb);
+    auto table = Wff::get_hash_cons_table(tb);
+    {
+        std::unique_lock< std::mutex > lock(this->memo_mutex);
+        if (same_table(this->tseitin_var_memo_tb, table)) {
+            return this->tseitin_var_memo ? this->tseitin_var_memo : this->tseitin_var_memo_self.lock();
+        }
+    }
+    pvar ret = Var::create(this->to_parsing_tree(tb), tb);
+    std::unique_lock< std::mutex > lock(this->memo_mutex);
+    this->tseitin_var_memo_tb = table;
+    if (ret.get() == this) {
+        this->tseitin_var_memo.reset();
+        this->tseitin_var_memo_self = ret;
+    } else {
+        this->tseitin_var_memo = ret;
+    }
+    return ret;
 }
 
 static const RegisteredProver id_rp = LibraryToolbox::register_prover({}, "|- ( ph -> ph )");
@@ -134,19 +422,29 @@ std::tuple<CNFProblem, pvar_map<uint32_t>, std::vector< Prover< CheckpointedProo
 
 void Wff::set_library_toolbox(const LibraryToolbox &tb) const
 {
-    for (auto child : this->get_children()) {
+    auto children = this->get_children();
+    for (auto child : children) {
         child->set_library_toolbox(tb);
     }
+    if (!children.empty() && this->scope.expired()) {
+        this->set_scope(tb);
+    }
 }
 
 True::True() {
 }
 
+std::shared_ptr< const True > True::create()
+{
+    static const std::shared_ptr< const True > node = enable_create< True >::create();
+    return node;
+}
+
 std::string True::to_string() const {
     return "T.";
 }
 
-pwff True::imp_not_form() const {
+pwff True::compute_imp_not_form() const {
     return True::create();
 }
 
@@ -174,7 +472,7 @@ bool True::is_true() const
 }
 
 const RegisteredProver True::type_rp = LibraryToolbox::register_prover({}, "wff T.");
-Prover<CheckpointedProofEngine> True::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> True::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(True::type_rp, {}, {});
 }
@@ -219,11 +517,17 @@ std::vector<pwff> True::get_children() const
 False::False() {
 }
 
+std::shared_ptr< const False > False::create()
+{
+    static const std::shared_ptr< const False > node = enable_create< False >::create();
+    return node;
+}
+
 std::string False::to_string() const {
     return "F.";
 }
 
-pwff False::imp_not_form() const {
+pwff False::compute_imp_not_form() const {
     return False::create();
 }
 
@@ -251,7 +555,7 @@ bool False::is_false() const
 }
 
 const RegisteredProver False::type_rp = LibraryToolbox::register_prover({}, "wff F.");
-Prover<CheckpointedProofEngine> False::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> False::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(False::type_rp, {}, {});
 }
@@ -309,17 +613,19 @@ static auto var_cons_helper(const std::string &string_repr, const LibraryToolbox
 
 Var::Var(const std::string &string_repr, const LibraryToolbox &tb) :
     name(var_cons_helper(string_repr, tb)), string_repr(string_repr) {
+    this->set_scope(tb);
 }
 
 Var::Var(const Var::NameType &name, const LibraryToolbox &tb) :
     name(name), string_repr(tb.print_sentence(tb.reconstruct_sentence(pt2_to_pt(name))).to_string()) {
+    this->set_scope(tb);
 }
 
 std::string Var::to_string() const {
     return this->string_repr;
 }
 
-pwff Var::imp_not_form() const {
+pwff Var::compute_imp_not_form() const {
     return this->shared_from_this();
 }
 
@@ -341,7 +647,7 @@ void Var::get_variables(pvar_set &vars) const
     vars.insert(this->shared_from_this());
 }
 
-Prover<CheckpointedProofEngine> Var::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> Var::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_type_prover(this->get_name());
     /*auto label = tb.get_var_sym_to_lab(tb.get_symbol(this->name));
@@ -420,10 +726,21 @@ std::vector<pwff> Var::get_children() const
     return {};
 }
 
+// Only variables of the same toolbox meet in a table, so their names are always resolved
+bool Var::can_share_with(const Wff &x) const
+{
+    auto px = dynamic_cast< const Var* >(&x);
+    assert(px != nullptr);
+    return this->string_repr == px->string_repr && this->get_name() == px->get_name();
+}
+
+/* Variables created from a string are not shared, so their name can be resolved here
+ * without affecting the formulas of other toolboxes. */
 void Var::set_library_toolbox(const LibraryToolbox &tb) const
 {
     if (!this->name.quick_is_valid()) {
         this->name = var_cons_helper(string_repr, tb);
+        this->set_scope(tb);
     }
 }
 
@@ -435,7 +752,7 @@ std::string Not::to_string() const {
     return "-. " + this->a->to_string();
 }
 
-pwff Not::imp_not_form() const {
+pwff Not::compute_imp_not_form() const {
     return Not::create(this->a->imp_not_form());
 }
 
@@ -471,7 +788,7 @@ bool Not::is_false() const
 }
 
 const RegisteredProver Not::type_rp = LibraryToolbox::register_prover({}, "wff -. ph");
-Prover<CheckpointedProofEngine> Not::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> Not::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(Not::type_rp, {{ "ph", this->a->get_type_prover(tb) }}, {});
 }
@@ -526,7 +843,7 @@ std::string Imp::to_string() const {
     return "( " + this->a->to_string() + " -> " + this->b->to_string() + " )";
 }
 
-pwff Imp::imp_not_form() const {
+pwff Imp::compute_imp_not_form() const {
     return Imp::create(this->a->imp_not_form(), this->b->imp_not_form());
 }
 
@@ -579,7 +896,7 @@ bool Imp::is_false() const
 }
 
 const RegisteredProver Imp::type_rp = LibraryToolbox::register_prover({}, "wff ( ph -> ps )");
-Prover<CheckpointedProofEngine> Imp::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> Imp::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(Imp::type_rp, {{ "ph", this->a->get_type_prover(tb) }, { "ps", this->b->get_type_prover(tb) }}, {});
 }
@@ -641,7 +958,7 @@ std::string Biimp::to_string() const {
     return "( " + this->a->to_string() + " <-> " + this->b->to_string() + " )";
 }
 
-pwff Biimp::imp_not_form() const {
+pwff Biimp::compute_imp_not_form() const {
     auto ain = this->a->imp_not_form();
     auto bin = this->b->imp_not_form();
     return Not::create(Imp::create(Imp::create(ain, bin), Not::create(Imp::create(bin, ain))));
@@ -661,7 +978,7 @@ void Biimp::get_variables(pvar_set &vars) const
 }
 
 const RegisteredProver Biimp::type_rp = LibraryToolbox::register_prover({}, "wff ( ph <-> ps )");
-Prover<CheckpointedProofEngine> Biimp::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> Biimp::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(Biimp::type_rp, {{ "ph", this->a->get_type_prover(tb) }, { "ps", this->b->get_type_prover(tb) }}, {});
 }
@@ -714,7 +1031,7 @@ std::string Xor::to_string() const {
     return "( " + this->a->to_string() + " \\/_ " + this->b->to_string() + " )";
 }
 
-pwff Xor::imp_not_form() const {
+pwff Xor::compute_imp_not_form() const {
     return Not::create(Biimp::create(this->a->imp_not_form(), this->b->imp_not_form()))->imp_not_form();
 }
 
@@ -730,7 +1047,7 @@ void Xor::get_variables(pvar_set &vars) const
 }
 
 const RegisteredProver Xor::type_rp = LibraryToolbox::register_prover({}, "wff ( ph \\/_ ps )");
-Prover<CheckpointedProofEngine> Xor::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> Xor::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(Xor::type_rp, {{ "ph", this->a->get_type_prover(tb) }, { "ps", this->b->get_type_prover(tb) }}, {});
 }
@@ -783,7 +1100,7 @@ std::string Nand::to_string() const {
     return "( " + this->a->to_string() + " -/\\ " + this->b->to_string() + " )";
 }
 
-pwff Nand::imp_not_form() const {
+pwff Nand::compute_imp_not_form() const {
     return Not::create(And::create(this->a->imp_not_form(), this->b->imp_not_form()))->imp_not_form();
 }
 
@@ -799,7 +1116,7 @@ void Nand::get_variables(pvar_set &vars) const
 }
 
 const RegisteredProver Nand::type_rp = LibraryToolbox::register_prover({}, "wff ( ph -/\\ ps )");
-Prover<CheckpointedProofEngine> Nand::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> Nand::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(Nand::type_rp, {{ "ph", this->a->get_type_prover(tb) }, { "ps", this->b->get_type_prover(tb) }}, {});
 }
@@ -850,7 +1167,7 @@ std::string Or::to_string() const {
     return "( " + this->a->to_string() + " \\/ " + this->b->to_string() + " )";
 }
 
-pwff Or::imp_not_form() const {
+pwff Or::compute_imp_not_form() const {
     return Imp::create(Not::create(this->a->imp_not_form()), this->b->imp_not_form());
 }
 
@@ -866,7 +1183,7 @@ void Or::get_variables(pvar_set &vars) const
 }
 
 const RegisteredProver Or::type_rp = LibraryToolbox::register_prover({}, "wff ( ph \\/ ps )");
-Prover<CheckpointedProofEngine> Or::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> Or::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(Or::type_rp, {{ "ph", this->a->get_type_prover(tb) }, { "ps", this->b->get_type_prover(tb) }}, {});
 }
@@ -927,13 +1244,13 @@ void And::get_variables(pvar_set &vars) const
     this->b->get_variables(vars);
 }
 
-pwff And::imp_not_form() const
+pwff And::compute_imp_not_form() const
 {
     return Not::create(Imp::create(this->a->imp_not_form(), Not::create(this->b->imp_not_form())));
 }
 
 const RegisteredProver And::type_rp = LibraryToolbox::register_prover({}, "wff ( ph /\\ ps )");
-Prover<CheckpointedProofEngine> And::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> And::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(And::type_rp, {{ "ph", this->a->get_type_prover(tb) }, { "ps", this->b->get_type_prover(tb) }}, {});
 }
@@ -1005,7 +1322,7 @@ bool ConvertibleWff::is_false() const
     return this->imp_not_form()->is_false();
 }
 
-/*Prover<AbstractCheckpointedProofEngine> ConvertibleWff::get_type_prover(const LibraryToolbox &tb) const
+/*Prover<AbstractCheckpointedProofEngine> ConvertibleWff::compute_type_prover(const LibraryToolbox &tb) const
 {
     (void) tb;
     // Disabled, because ordinarily I do not want to use this generic and probably inefficient method
@@ -1023,7 +1340,7 @@ std::string And3::to_string() const
     return "( " + this->a->to_string() + " /\\ " + this->b->to_string() + " /\\ " + this->c->to_string() + " )";
 }
 
-pwff And3::imp_not_form() const
+pwff And3::compute_imp_not_form() const
 {
     return And::create(And::create(this->a, this->b), this->c)->imp_not_form();
 }
@@ -1041,7 +1358,7 @@ void And3::get_variables(pvar_set &vars) const
 }
 
 const RegisteredProver And3::type_rp = LibraryToolbox::register_prover({}, "wff ( ph /\\ ps /\\ ch )");
-Prover<CheckpointedProofEngine> And3::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> And3::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(And3::type_rp, {{ "ph", this->a->get_type_prover(tb) }, { "ps", this->b->get_type_prover(tb) }, { "ch", this->c->get_type_prover(tb) }}, {});
 }
@@ -1107,7 +1424,7 @@ std::string Or3::to_string() const
     return "( " + this->a->to_string() + " \\/ " + this->b->to_string() + " \\/ " + this->c->to_string() + " )";
 }
 
-pwff Or3::imp_not_form() const
+pwff Or3::compute_imp_not_form() const
 {
     return Or::create(Or::create(this->a, this->b), this->c)->imp_not_form();
 }
@@ -1125,7 +1442,7 @@ void Or3::get_variables(pvar_set &vars) const
 }
 
 const RegisteredProver Or3::type_rp = LibraryToolbox::register_prover({}, "wff ( ph \\/ ps \\/ ch )");
-Prover<CheckpointedProofEngine> Or3::get_type_prover(const LibraryToolbox &tb) const
+Prover<CheckpointedProofEngine> Or3::compute_type_prover(const LibraryToolbox &tb) const
 {
     return tb.build_registered_prover< CheckpointedProofEngine >(Or3::type_rp, {{ "ph", this->a->get_type_prover(tb) }, { "ps", this->b->get_type_prover(tb) }, { "ch", this->c->get_type_prover(tb) }}, {});
 }
@@ -4,6 +4,7 @@
 #include <memory>
 #include <set>
 #include <vector>
+#include <mutex>
 
 #include "mm/library.h"
 #include "mm/proof.h"
@@ -16,6 +17,8 @@ typedef std::shared_ptr< const Wff > pwff;
 
 class Var;
 typedef std::shared_ptr< const Var > pvar;
+
+struct WffHashConsTable;
 struct pvar_comp {
     bool operator()(const pvar &x, const pvar &y) const;
 };
@@ -44,11 +47,24 @@ pvar_set collect_tseitin_vars(const CNForm &cnf);
 pvar_map< uint32_t > build_tseitin_map(const pvar_set &vars);
 std::pair<CNFProblem, std::vector<Prover<CheckpointedProofEngine> > > build_cnf_problem(const CNForm &cnf, const pvar_map< uint32_t > &var_map);
 
+/**
+ * @brief A propositional formula.
+ *
+ * Formulas are hash-consed within the toolbox their variables belong to:
+ * the create() methods return the already existing node if a structurally
+ * equal one is alive, so that equal subformulas are shared. The table is
+ * attached to the toolbox and goes away with it; formulas that do not refer
+ * to a toolbox yet (for example variables created from a string, until
+ * set_library_toolbox() is called) are not shared, except T. and F. Each
+ * node also memoizes its imp_not form, its type prover and its Tseitin
+ * variable, so that they are computed only once however many times the node
+ * appears in a bigger formula.
+ */
 class Wff {
 public:
     virtual ~Wff();
     virtual std::string to_string() const = 0;
-    virtual pwff imp_not_form() const = 0;
+    pwff imp_not_form() const;
     virtual pwff subst(pvar var, bool positive) const = 0;
     ParsingTree2<SymTok, LabTok> to_parsing_tree(const LibraryToolbox &tb) const;
     virtual void get_variables(pvar_set &vars) const = 0;
@@ -56,7 +72,7 @@ public:
     virtual bool is_true() const;
     virtual Prover< CheckpointedProofEngine > get_falsity_prover(const LibraryToolbox &tb) const;
     virtual bool is_false() const;
-    virtual Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const;
+    Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const;
     virtual Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const;
     virtual Prover< CheckpointedProofEngine > get_subst_prover(pvar var, bool positive, const LibraryToolbox &tb) const;
     virtual bool operator==(const Wff &x) const = 0;
@@ -66,14 +82,55 @@ public:
     std::tuple<CNFProblem, pvar_map<uint32_t>, std::vector<Prover<CheckpointedProofEngine> > > get_tseitin_cnf_problem(const LibraryToolbox &tb) const;
     virtual std::vector< pwff > get_children() const = 0;
     virtual void set_library_toolbox(const LibraryToolbox &tb) const;
+    static pwff hash_cons(pwff candidate);
+
+protected:
+    virtual pwff compute_imp_not_form() const = 0;
+    virtual Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const;
+    // Whether this and x, which have the same type and the same children, should be identified when hash-consing
+    virtual bool can_share_with(const Wff &x) const;
+    // Hash-cons this node and the ones built on it in the table of tb
+    void set_scope(const LibraryToolbox &tb) const;
 
 private:
-    std::pair< bool, Prover< CheckpointedProofEngine > > adv_truth_internal(pvar_set::iterator cur_var, pvar_set::iterator end_var, const LibraryToolbox &tb) const;
+    static std::shared_ptr< WffHashConsTable > get_hash_cons_table(const LibraryToolbox &tb);
+
+    // The table of the toolbox this node belongs to, if any
+    mutable std::weak_ptr< WffHashConsTable > scope;
+    mutable std::mutex memo_mutex;
+    /* A node can be its own imp_not form or Tseitin variable: in that case we only
+     * keep a weak pointer, so that the node does not keep itself alive. */
+    mutable bool imp_not_memo_valid = false;
+    mutable pwff imp_not_memo;
+    mutable std::weak_ptr< const Wff > imp_not_memo_self;
+    /* Memos depending on the toolbox are keyed by its table, which unlike the address
+     * of the toolbox cannot be reused by another toolbox. */
+    mutable std::weak_ptr< WffHashConsTable > type_prover_memo_tb;
+    mutable Prover< CheckpointedProofEngine > type_prover_memo;
+    mutable std::weak_ptr< WffHashConsTable > tseitin_var_memo_tb;
+    mutable pvar tseitin_var_memo;
+    mutable std::weak_ptr< const Var > tseitin_var_memo_self;
+
+    struct AdvTruthMemo {
+        std::map< pwff, Prover< CheckpointedProofEngine > > proofs;
+        std::map< pwff, std::pair< pwff, Prover< CheckpointedProofEngine > > > simplified;
+    };
+    static std::pair< pwff, Prover< CheckpointedProofEngine > > simplify(pwff wff, AdvTruthMemo &memo, const LibraryToolbox &tb);
+    static Prover< CheckpointedProofEngine > adv_truth_internal(pwff wff, const std::vector< pvar > &vars, size_t cur_var, AdvTruthMemo &memo, const LibraryToolbox &tb);
 
     static const RegisteredProver adv_truth_1_rp;
     static const RegisteredProver adv_truth_2_rp;
     static const RegisteredProver adv_truth_3_rp;
     static const RegisteredProver adv_truth_4_rp;
+    static const RegisteredProver adv_truth_5_rp;
+};
+
+template< typename T >
+struct enable_hash_cons : public enable_create< T > {
+    template< typename... Args >
+    static std::shared_ptr< const T > create(Args&&... args) {
+        return std::static_pointer_cast< const T >(Wff::hash_cons(enable_create< T >::create(std::forward< Args >(args)...)));
+    }
 };
 
 /**
@@ -93,16 +150,18 @@ private:
     static const RegisteredProver falsity_rp;
 };
 
-class True : public Wff, public enable_create< True > {
+class True : public Wff, public enable_hash_cons< True > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
+    // T. does not depend on the toolbox, so there is a single node
+    static std::shared_ptr< const True > create();
     std::string to_string() const override;
-    pwff imp_not_form() const override;
+    pwff compute_imp_not_form() const override;
     pwff subst(pvar var, bool positive) const override;
     void get_variables(pvar_set &vars) const override;
     Prover< CheckpointedProofEngine > get_truth_prover(const LibraryToolbox &tb) const override;
     bool is_true() const override;
-    Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+    Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
     Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
     Prover< CheckpointedProofEngine > get_subst_prover(pvar var, bool positive, const LibraryToolbox &tb) const override;
     bool operator==(const Wff &x) const override;
@@ -120,16 +179,18 @@ private:
     static const RegisteredProver tseitin1_rp;
 };
 
-class False : public Wff, public enable_create< False > {
+class False : public Wff, public enable_hash_cons< False > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
+    // F. does not depend on the toolbox, so there is a single node
+    static std::shared_ptr< const False > create();
     std::string to_string() const override;
-    pwff imp_not_form() const override;
+    pwff compute_imp_not_form() const override;
     pwff subst(pvar var, bool positive) const override;
     void get_variables(pvar_set &vars) const override;
     Prover< CheckpointedProofEngine > get_falsity_prover(const LibraryToolbox &tb) const override;
     bool is_false() const override;
-    Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+    Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
     Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
     Prover< CheckpointedProofEngine > get_subst_prover(pvar var, bool positive, const LibraryToolbox &tb) const override;
     bool operator==(const Wff &x) const override;
@@ -147,16 +208,16 @@ private:
     static const RegisteredProver tseitin1_rp;
 };
 
-class Var : public Wff, public enable_create< Var > {
+class Var : public Wff, public enable_hash_cons< Var > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
   typedef ParsingTree2< SymTok, LabTok > NameType;
 
   std::string to_string() const override;
-  pwff imp_not_form() const override;
+  pwff compute_imp_not_form() const override;
   pwff subst(pvar var, bool positive) const override;
   void get_variables(pvar_set &vars) const override;
-  Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+  Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_subst_prover(pvar var, bool positive, const LibraryToolbox &tb) const override;
   bool operator==(const Wff &x) const override;
@@ -164,6 +225,7 @@ public:
   void get_tseitin_form(CNForm &cnf, const LibraryToolbox &tb, const Wff &glob_ctx) const override;
   std::vector< pwff > get_children() const override;
   void set_library_toolbox(const LibraryToolbox &tb) const override;
+  bool can_share_with(const Wff &x) const override;
   const NameType &get_name() const {
       assert(this->name.quick_is_valid());
       return this->name;
@@ -191,18 +253,18 @@ private:
   static const RegisteredProver subst_indep_rp;
 };
 
-class Not : public Wff, public enable_create< Not > {
+class Not : public Wff, public enable_hash_cons< Not > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
   std::string to_string() const override;
-  pwff imp_not_form() const override;
+  pwff compute_imp_not_form() const override;
   pwff subst(pvar var, bool positive) const override;
   void get_variables(pvar_set &vars) const override;
   Prover< CheckpointedProofEngine > get_truth_prover(const LibraryToolbox &tb) const override;
   bool is_true() const override;
   Prover< CheckpointedProofEngine > get_falsity_prover(const LibraryToolbox &tb) const override;
   bool is_false() const override;
-  Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+  Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_subst_prover(pvar var, bool positive, const LibraryToolbox &tb) const override;
   bool operator==(const Wff &x) const override;
@@ -226,18 +288,18 @@ private:
   static const RegisteredProver tseitin2_rp;
 };
 
-class Imp : public Wff, public enable_create< Imp > {
+class Imp : public Wff, public enable_hash_cons< Imp > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
   std::string to_string() const override;
-  pwff imp_not_form() const override;
+  pwff compute_imp_not_form() const override;
   pwff subst(pvar var, bool positive) const override;
   void get_variables(pvar_set &vars) const override;
   Prover< CheckpointedProofEngine > get_truth_prover(const LibraryToolbox &tb) const override;
   bool is_true() const override;
   Prover< CheckpointedProofEngine > get_falsity_prover(const LibraryToolbox &tb) const override;
   bool is_false() const override;
-  Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+  Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_subst_prover(pvar var, bool positive, const LibraryToolbox &tb) const override;
   bool operator==(const Wff &x) const override;
@@ -270,14 +332,14 @@ private:
   static const RegisteredProver tseitin3_rp;
 };
 
-class Biimp : public ConvertibleWff, public enable_create< Biimp > {
+class Biimp : public ConvertibleWff, public enable_hash_cons< Biimp > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
   std::string to_string() const override;
-  pwff imp_not_form() const override;
+  pwff compute_imp_not_form() const override;
   pwff half_imp_not_form() const;
   void get_variables(pvar_set &vars) const override;
-  Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+  Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
   bool operator==(const Wff &x) const override;
   void get_tseitin_form(CNForm &cnf, const LibraryToolbox &tb, const Wff &glob_ctx) const override;
@@ -304,14 +366,14 @@ private:
   static const RegisteredProver tseitin4_rp;
 };
 
-class And : public ConvertibleWff, public enable_create< And > {
+class And : public ConvertibleWff, public enable_hash_cons< And > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
   std::string to_string() const override;
-  pwff imp_not_form() const override;
+  pwff compute_imp_not_form() const override;
   pwff half_imp_not_form() const;
   void get_variables(pvar_set &vars) const override;
-  Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+  Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
   bool operator==(const Wff &x) const override;
   void get_tseitin_form(CNForm &cnf, const LibraryToolbox &tb, const Wff &glob_ctx) const override;
@@ -337,14 +399,14 @@ private:
   static const RegisteredProver tseitin3_rp;
 };
 
-class Or : public ConvertibleWff, public enable_create< Or > {
+class Or : public ConvertibleWff, public enable_hash_cons< Or > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
   std::string to_string() const override;
-  pwff imp_not_form() const override;
+  pwff compute_imp_not_form() const override;
   pwff half_imp_not_form() const;
   void get_variables(pvar_set &vars) const override;
-  Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+  Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
   bool operator==(const Wff &x) const override;
   void get_tseitin_form(CNForm &cnf, const LibraryToolbox &tb, const Wff &glob_ctx) const override;
@@ -370,14 +432,14 @@ private:
   static const RegisteredProver tseitin3_rp;
 };
 
-class Nand : public ConvertibleWff, public enable_create< Nand > {
+class Nand : public ConvertibleWff, public enable_hash_cons< Nand > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
   std::string to_string() const override;
-  pwff imp_not_form() const override;
+  pwff compute_imp_not_form() const override;
   pwff half_imp_not_form() const;
   void get_variables(pvar_set &vars) const override;
-  Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+  Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
   bool operator==(const Wff &x) const override;
   void get_tseitin_form(CNForm &cnf, const LibraryToolbox &tb, const Wff &glob_ctx) const override;
@@ -403,14 +465,14 @@ private:
   static const RegisteredProver tseitin3_rp;
 };
 
-class Xor : public ConvertibleWff, public enable_create< Xor > {
+class Xor : public ConvertibleWff, public enable_hash_cons< Xor > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
   std::string to_string() const override;
-  pwff imp_not_form() const override;
+  pwff compute_imp_not_form() const override;
   pwff half_imp_not_form() const;
   void get_variables(pvar_set &vars) const override;
-  Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+  Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
   Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
   bool operator==(const Wff &x) const override;
   void get_tseitin_form(CNForm &cnf, const LibraryToolbox &tb, const Wff &glob_ctx) const override;
@@ -437,14 +499,14 @@ private:
   static const RegisteredProver tseitin4_rp;
 };
 
-class And3 : public ConvertibleWff, public enable_create< And3 > {
+class And3 : public ConvertibleWff, public enable_hash_cons< And3 > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
     std::string to_string() const override;
-    pwff imp_not_form() const override;
+    pwff compute_imp_not_form() const override;
     pwff half_imp_not_form() const;
     void get_variables(pvar_set &vars) const override;
-    Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+    Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
     Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
     bool operator==(const Wff &x) const override;
     void get_tseitin_form(CNForm &cnf, const LibraryToolbox &tb, const Wff &glob_ctx) const override;
@@ -476,14 +538,14 @@ protected:
     static const RegisteredProver tseitin6_rp;
 };
 
-class Or3 : public ConvertibleWff, public enable_create< Or3 > {
+class Or3 : public ConvertibleWff, public enable_hash_cons< Or3 > {
     friend pwff wff_from_pt(const ParsingTree<SymTok, LabTok> &pt, const LibraryToolbox &tb);
 public:
     std::string to_string() const override;
-    pwff imp_not_form() const override;
+    pwff compute_imp_not_form() const override;
     pwff half_imp_not_form() const;
     void get_variables(pvar_set &vars) const override;
-    Prover< CheckpointedProofEngine > get_type_prover(const LibraryToolbox &tb) const override;
+    Prover< CheckpointedProofEngine > compute_type_prover(const LibraryToolbox &tb) const override;
     Prover< CheckpointedProofEngine > get_imp_not_prover(const LibraryToolbox &tb) const override;
     void get_tseitin_form(CNForm &cnf, const LibraryToolbox &tb, const Wff &glob_ctx) const override;
     std::vector< pwff > get_children() const override;
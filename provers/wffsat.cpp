@@ -11,7 +11,11 @@ struct CNFCallbackImpl : public CNFCallbackTest {
         //CNFCallbackTest::prove_clause(idx, context);
         pwff concl = this->clause_to_pwff(this->orig_clauses.at(idx));
         pwff loc_ctx = Not::create(this->clause_to_pwff(context));
-        this->prover_stack.push_back(imp_intr_prover(concl, this->orig_provers.at(idx), this->glob_ctx, loc_ctx, this->tb));
+        this->prover_stack.push_back(imp_intr_prover(concl, this->get_orig_prover(idx), this->glob_ctx, loc_ctx, this->tb));
+    }
+
+    virtual Prover< CheckpointedProofEngine > get_orig_prover(size_t idx) {
+        return this->orig_provers.at(idx);
     }
 
     void prove_not_or_elim(size_t idx, const Clause &context) {
@@ -89,6 +93,7 @@ struct CNFCallbackImpl : public CNFCallbackTest {
     std::vector< pwff > atoms;
 
     CNFCallbackImpl(const LibraryToolbox &tb) : tb(tb) {}
+    virtual ~CNFCallbackImpl() {}
 
     pwff clause_to_pwff(const Clause &c) {
         if (c.empty()) {
@@ -123,7 +128,10 @@ std::pair<bool, Prover<CheckpointedProofEngine> > get_sat_prover(pwff wff, const
     }*/
     CNFCallbackImpl cnf_cb(tb);
     cnf_cb.orig_clauses = cnf.clauses;
-    cnf_cb.orig_provers = provers;
+    // Each clause is usually used many times in the refutation
+    for (const auto &prover : provers) {
+        cnf_cb.orig_provers.push_back(memoized_prover(prover));
+    }
     cnf_cb.glob_ctx = glob_ctx;
     cnf_cb.atoms.resize(ts_map.size());
     for (const auto &x : ts_map) {
@@ -140,3 +148,141 @@ std::pair<bool, Prover<CheckpointedProofEngine> > get_sat_prover(pwff wff, const
         return make_pair(true, final_prover);
     }
 }
+
+
+struct WffSatSessionCallback : public CNFCallbackImpl {
+    WffSatSessionCallback(const WffSatSession &session, pwff glob_ctx) : CNFCallbackImpl(session.tb), session(session) {
+        this->glob_ctx = glob_ctx;
+        this->atoms.assign(session.atoms.begin(), session.atoms.end());
+    }
+
+    // Only the clauses actually used by the refutation need a prover
+    Prover< CheckpointedProofEngine > get_orig_prover(size_t idx) override {
+        if (idx >= this->session.clauses.size()) {
+            return this->tb.build_registered_prover(idi_rp, {{"ph", this->glob_ctx->get_type_prover(this->tb)}}, {});
+        }
+        auto it = this->orig_provers_memo.find(idx);
+        if (it != this->orig_provers_memo.end()) {
+            return it->second;
+        }
+        const auto &origin = this->session.clause_origins[idx];
+        auto cnf_it = this->cnf_memo.find(origin);
+        if (cnf_it == this->cnf_memo.end()) {
+            CNForm cnf;
+            origin->get_tseitin_form(cnf, this->tb, *this->glob_ctx);
+            cnf_it = this->cnf_memo.insert(std::make_pair(origin, cnf)).first;
+        }
+        auto prover = memoized_prover(cnf_it->second.at(this->session.clause_keys[idx]));
+        this->orig_provers_memo.insert(std::make_pair(idx, prover));
+        return prover;
+    }
+
+    const WffSatSession &session;
+    std::map< pwff, CNForm > cnf_memo;
+    std::map< size_t, Prover< CheckpointedProofEngine > > orig_provers_memo;
+};
+
+WffSatSession::WffSatSession(const LibraryToolbox &tb, size_t max_learnt) : tb(tb), max_learnt(max_learnt), solver(std::make_unique< Minisat::Solver >())
+{
+}
+
+uint32_t WffSatSession::get_var_idx(const pvar &var)
+{
+    auto it = this->var_map.find(var);
+    if (it != this->var_map.end()) {
+        return it->second;
+    }
+    uint32_t idx = static_cast< uint32_t >(this->solver->newVar());
+    assert(idx == this->atoms.size());
+    this->var_map[var] = idx;
+    this->atoms.push_back(var);
+    return idx;
+}
+
+void WffSatSession::add_wff(const pwff &glob_ctx)
+{
+    if (!this->added_wffs.insert(glob_ctx).second) {
+        return;
+    }
+    CNForm cnf;
+    glob_ctx->get_tseitin_form(cnf, this->tb, *glob_ctx);
+    for (const auto &clause : cnf) {
+        if (this->clause_map.find(clause.first) != this->clause_map.end()) {
+            continue;
+        }
+        Clause new_clause;
+        Minisat::vec< Minisat::Lit > lits;
+        for (const auto &term : clause.first) {
+            new_clause.push_back(std::make_pair(term.first, this->get_var_idx(term.second)));
+            lits.push(to_minisat_literal(new_clause.back()));
+        }
+        this->clause_map.insert(std::make_pair(clause.first, this->clauses.size()));
+        this->clauses.push_back(new_clause);
+        this->clause_origins.push_back(glob_ctx);
+        this->clause_keys.push_back(clause.first);
+        this->solver->addClause_(lits);
+    }
+}
+
+void WffSatSession::restart_solver()
+{
+    this->solver = std::make_unique< Minisat::Solver >();
+    for (size_t i = 0; i < this->atoms.size(); i++) {
+        this->solver->newVar();
+    }
+    for (const auto &clause : this->clauses) {
+        Minisat::vec< Minisat::Lit > lits;
+        for (const auto &lit : clause) {
+            lits.push(to_minisat_literal(lit));
+        }
+        this->solver->addClause_(lits);
+    }
+    this->learnt.clear();
+    this->deps_cache = RefutationDepsCache();
+}
+
+void WffSatSession::read_learnt_clauses()
+{
+    size_t cursor = 0;
+    CNFProblem::get_learnt_clauses(*this->solver, this->learnt, cursor);
+    this->solver->refutation.clear();
+}
+
+std::pair< bool, Prover< CheckpointedProofEngine > > WffSatSession::get_sat_prover(pwff wff)
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    if (this->learnt.size() > this->max_learnt) {
+        this->restart_solver();
+    }
+    auto glob_ctx = Not::create(wff);
+    this->add_wff(glob_ctx);
+    uint32_t ctx_idx = this->get_var_idx(glob_ctx->get_tseitin_var(this->tb));
+    bool sat = this->solver->solve(to_minisat_literal(std::make_pair(true, ctx_idx)));
+    this->read_learnt_clauses();
+    if (sat) {
+        return std::make_pair(false, null_prover);
+    }
+
+    // The refutation is checked against all the clauses in the session, plus the assumption
+    CNFProblem problem;
+    problem.var_num = this->atoms.size();
+    problem.clauses = this->clauses;
+    problem.clauses.push_back({{true, ctx_idx}});
+    // Only the clauses of the session, not the assumption, can be dependencies kept for later queries
+    this->deps_cache.orig_num = this->clauses.size();
+    this->deps_cache.checked.resize(this->learnt.size(), false);
+    this->deps_cache.deps.resize(this->learnt.size());
+    // When the solver rejects an assumption, its negation follows by unit propagation;
+    // these two clauses only hold for this query, so they are removed afterwards
+    this->learnt.push_back({{false, ctx_idx}});
+    this->learnt.push_back({});
+    WffSatSessionCallback cnf_cb(*this, glob_ctx);
+    cnf_cb.orig_clauses = problem.clauses;
+    problem.callback = &cnf_cb;
+    auto prover = problem.prove_refutation(this->learnt, &this->deps_cache);
+    this->learnt.resize(this->learnt.size() - 2);
+    prover();
+    assert(cnf_cb.prover_stack.size() == 1);
+    auto final_prover = this->tb.build_registered_prover(falsify_rp, {{"ph", wff->get_type_prover(this->tb)}}, {cnf_cb.prover_stack[0]});
+    return std::make_pair(true, final_prover);
+}
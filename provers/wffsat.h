@@ -1,5 +1,59 @@
 #pragma once
 
+#include <mutex>
+#include <map>
+#include <set>
+#include <vector>
+#include <memory>
+
 #include "wff.h"
+#include "sat.h"
 
 std::pair< bool, Prover< CheckpointedProofEngine > > get_sat_prover(pwff wff, const LibraryToolbox &tb);
+
+/**
+ * @brief An incremental SAT session for checking many related formulas.
+ *
+ * All the queries share the same Minisat::Solver: the Tseitin variables of hash-consed
+ * subformulas are allocated only once, the definitional clauses of a formula are added
+ * the first time it is seen and each query is solved under the assumption that the
+ * negation of the formula holds. Thus the solver retains its learnt clauses and each
+ * query only pays for the subformulas that are new to the session.
+ *
+ * The learnt clauses are also used to generate the proofs: each of them is checked
+ * only once, the first time a refutation needs it. When there are more than
+ * max_learnt of them, the session starts again with a fresh solver, which only
+ * receives the definitional clauses.
+ */
+class WffSatSession {
+public:
+    WffSatSession(const LibraryToolbox &tb, size_t max_learnt = DEFAULT_MAX_LEARNT);
+    std::pair< bool, Prover< CheckpointedProofEngine > > get_sat_prover(pwff wff);
+
+private:
+    friend struct WffSatSessionCallback;
+
+    static const size_t DEFAULT_MAX_LEARNT = 1 << 16;
+
+    uint32_t get_var_idx(const pvar &var);
+    void add_wff(const pwff &glob_ctx);
+    void restart_solver();
+    void read_learnt_clauses();
+
+    const LibraryToolbox &tb;
+    const size_t max_learnt;
+    std::mutex mutex;
+    std::unique_ptr< Minisat::Solver > solver;
+    pvar_map< uint32_t > var_map;
+    std::vector< pvar > atoms;
+    std::set< pwff > added_wffs;
+    std::map< CNForm::key_type, size_t > clause_map;
+    std::vector< Clause > clauses;
+    // Definitional clauses are tautologies, so their proofs can be generated again under
+    // the context of any later query starting from the formula that introduced them
+    std::vector< pwff > clause_origins;
+    std::vector< CNForm::key_type > clause_keys;
+    // The clauses learnt by the current solver, whose log is emptied as it is read
+    std::vector< Clause > learnt;
+    RefutationDepsCache deps_cache;
+};
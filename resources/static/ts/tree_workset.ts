@@ -132,6 +132,11 @@ export class WorksetManager extends TreeManager implements NodePainter, WorksetE
         let node = this.tree.get_node(node_id);
         this.update_node(node);
       }
+    } else if (event["event"] === "overflow") {
+      // Some events were dropped, so any step might have changed
+      for (let node_id of this.remote_id_map.values()) {
+        this.update_node(this.tree.get_node(node_id));
+      }
     }
   }
 
@@ -59,6 +59,7 @@ export class Workset {
   styles : Map< RenderingStyles, Renderer >;
   root_step : Step;
   receiving_events : boolean = false;
+  event_source : EventSource = null;
   receiving_stats : boolean = false;
   event_listeners : WorksetEventListener[];
   addendum;
@@ -127,11 +128,34 @@ export class Workset {
 
   start_receiving_events() : void {
     this.receiving_events = true;
-    this.receive_event();
+    // Prefer the pushed event stream, which delivers batches of events as soon as they happen
+    if (typeof EventSource !== "undefined") {
+      let self = this;
+      this.event_source = new EventSource(`/api/${API_VERSION}/workset/${this.id}/events`);
+      let opened : boolean = false;
+      this.event_source.onopen = function () : void {
+        // The browser reconnects by itself, but the events sent in the meantime are lost
+        if (opened) {
+          self.process_event({ "event": "overflow" });
+        }
+        opened = true;
+      };
+      this.event_source.onmessage = function (message : MessageEvent) : void {
+        for (let data of JSON.parse(message.data)) {
+          self.process_event(data);
+        }
+      };
+    } else {
+      this.receive_event();
+    }
   }
 
   stop_receiving_events() : void {
     this.receiving_events = false;
+    if (this.event_source !== null) {
+      this.event_source.close();
+      this.event_source = null;
+    }
   }
 
   process_stats(stats : object) : void {
@@ -196,15 +220,23 @@ export class Workset {
 
   load_from_remote(load_steps : boolean) : Promise<void> {
     let self = this;
-    return this.do_api_request(`get_context`).then(function(data : any) : Promise<void> {
+    return this.do_api_request(`get_context`).then(function(data : any) : Promise<any> {
       self.name = data.name;
+      if (data.status !== "loaded") {
+        return Promise.resolve(data);
+      }
+      // The library context is large, but the browser can revalidate it against its ETag
+      return self.do_api_request(`library_context`).then(function(context : any) : any {
+        self.symbols = context.symbols;
+        self.labels = context.labels;
+        self.addendum = context.addendum;
+        return data;
+      });
+    }).then(function(data : any) : Promise<void> {
       if (data.status === "loaded") {
         self.loaded = true;
-        self.symbols = data.symbols;
-        self.labels = data.labels;
         self.symbols_inv = invert_list(self.symbols);
         self.labels_inv = invert_list(self.labels);
-        self.addendum = data.addendum;
         self.max_number = data.max_number;
       } else {
         self.loaded = false;
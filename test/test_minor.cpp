@@ -2,8 +2,28 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <iterator>
 
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include "platform.h"
 #include "mm/proof.h"
+#include "mm/reader.h"
+#include "mm/tempgen.h"
+#include "mm/toolbox.h"
+#include "mm/setmm.h"
+#include "libs/json.h"
+#include "web/resultstore.h"
+#include "web/strategy.h"
 #include "test.h"
 
 #ifdef ENABLE_TEST_CODE
@@ -69,4 +89,543 @@ BOOST_AUTO_TEST_CASE(test_has_no_diagonal) {
     BOOST_TEST(has_no_diagonal(x3.begin(), x3.end()));
 }
 
+static const std::string test_compression_db = R"db(
+$c ( ) -> wff |- $.
+$v ph ps $.
+wph $f wff ph $.
+wps $f wff ps $.
+wi $a wff ( ph -> ps ) $.
+ax-1 $a |- ( ph -> ( ps -> ph ) ) $.
+th1 $p |- ( ( ph -> ph ) -> ( ( ph -> ph ) -> ( ph -> ph ) ) ) $= wph wph wi wph wph wi ax-1 $.
+th2 $p |- ( ( ( ph -> ph ) -> ( ph -> ph ) ) -> ( ( ( ph -> ph ) -> ( ph -> ph ) ) -> ( ( ph -> ph ) -> ( ph -> ph ) ) ) ) $=
+  wph wph wi wph wph wi wi wph wph wi wph wph wi wi ax-1 $.
+${
+  ax-mp.1 $e |- ph $.
+  ax-mp.2 $e |- ( ph -> ps ) $.
+  ax-mp $a |- ps $.
+$}
+${
+  th3.1 $e |- ph $.
+  th3.2 $e |- ( ph -> ph ) $.
+  th3 $p |- ph $= wph wph wph wph th3.1 th3.2 ax-mp th3.2 ax-mp $.
+$}
+)db";
+
+static boost::filesystem::path write_test_database(const std::string &content) {
+    auto filename = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("mmpp-test-%%%%-%%%%.mm");
+    boost::filesystem::ofstream fout(filename);
+    fout << content;
+    return filename;
+}
+
+// Read a database from a string, going through a temporary file
+struct TestDatabase {
+    TestDatabase(const std::string &content) : filename(write_test_database(content)), ft(filename), reader(ft, true, false) {
+        this->reader.run();
+        boost::filesystem::remove(this->filename);
+    }
+
+    boost::filesystem::path filename;
+    FileTokenizer ft;
+    Reader reader;
+};
+
+static size_t proof_tree_size(const ProofTree< Sentence > &tree) {
+    size_t ret = 1;
+    for (const auto &child : tree.children) {
+        ret += proof_tree_size(child);
+    }
+    return ret;
+}
+
+// Expose the checkpointing interface of the base engine
+struct TestCheckpointEngine : public ProofEngineBase< Sentence > {
+    using ProofEngineBase< Sentence >::ProofEngineBase;
+    using ProofEngineBase< Sentence >::process_label;
+    using ProofEngineBase< Sentence >::checkpoint;
+    using ProofEngineBase< Sentence >::rollback;
+};
+
+BOOST_AUTO_TEST_CASE(test_proof_tree_rollback) {
+    TestDatabase db(test_compression_db);
+    const LibraryImpl &lib = db.reader.get_library();
+    TestCheckpointEngine engine(lib, true);
+    auto run = [&](const std::vector< std::string > &labels) {
+        for (const auto &label : labels) {
+            engine.process_label(lib.get_label(label));
+        }
+    };
+    const std::vector< std::string > attempt = { "wph", "wph", "wi", "wph", "wph", "wi", "ax-1" };
+    run({ "wph" });
+    const auto &tree = engine.get_flat_proof_tree();
+    const auto nodes = tree.nodes.size();
+    const auto children = tree.children.size();
+    const auto sentences = tree.sentences.size();
+    engine.checkpoint();
+    run(attempt);
+    BOOST_TEST(tree.nodes.size() > nodes);
+    const auto attempt_sentences = tree.sentences.size();
+    engine.rollback();
+    BOOST_TEST(tree.nodes.size() == nodes);
+    BOOST_TEST(tree.children.size() == children);
+    BOOST_TEST(tree.sentences.size() == sentences);
+    BOOST_TEST(engine.get_stack().size() == 1u);
+    BOOST_TEST(proof_tree_size(engine.get_proof_tree()) == 1u);
+
+    // The sentences dropped on rollback are not found by the deduplication any more
+    run(attempt);
+    BOOST_TEST(tree.sentences.size() == attempt_sentences);
+    BOOST_TEST(proof_tree_size(engine.get_proof_tree()) == 7u);
+}
+
+BOOST_AUTO_TEST_CASE(test_memoized_step_replay) {
+    TestDatabase db(test_compression_db);
+    const LibraryImpl &lib = db.reader.get_library();
+    TestCheckpointEngine engine(lib, true);
+    auto run = [&](const std::vector< std::string > &labels) {
+        for (const auto &label : labels) {
+            engine.process_label(lib.get_label(label));
+        }
+    };
+    auto resolve = [&](const std::vector< std::string > &labels) {
+        return vector_map(labels.begin(), labels.end(), [&](const std::string &label) { return lib.get_label(label); });
+    };
+    run({ "wph", "wph", "wi" });
+    engine.memoize_step(1, 0);
+    BOOST_TEST(engine.replay_memoized_step(1));
+    BOOST_TEST(!engine.replay_memoized_step(2));
+    run({ "ax-1" });
+
+    // The replayed step refers to the saved step instead of repeating its labels
+    const auto full = resolve({ "wph", "wph", "wi", "wph", "wph", "wi", "ax-1" });
+    BOOST_TEST(engine.get_proof_labels().size() == 5u);
+    BOOST_TEST((engine.get_uncompressed_proof_labels() == full));
+    BOOST_TEST(proof_tree_size(engine.get_proof_tree()) == full.size());
+
+    // Replays after a checkpoint are dropped on rollback, and so are steps memoized after it
+    engine.checkpoint();
+    BOOST_TEST(engine.replay_memoized_step(1));
+    BOOST_TEST(engine.replay_memoized_step(1));
+    run({ "wi" });
+    engine.memoize_step(2, 5);
+    BOOST_TEST(engine.replay_memoized_step(2));
+    BOOST_TEST(engine.get_proof_labels().size() == 9u);
+    BOOST_TEST(engine.get_uncompressed_proof_labels().size() == 3 * full.size());
+    engine.rollback();
+    BOOST_TEST(!engine.replay_memoized_step(2));
+    BOOST_TEST(engine.get_proof_labels().size() == 5u);
+    BOOST_TEST((engine.get_uncompressed_proof_labels() == full));
+}
+
+BOOST_AUTO_TEST_CASE(test_compression_strategies) {
+    TestDatabase db(test_compression_db);
+    const LibraryImpl &lib = db.reader.get_library();
+    for (const auto &label : { "th1", "th2", "th3" }) {
+        const Assertion &ass = lib.get_assertion(lib.get_label(label));
+        auto labels = ass.get_proof_operator(lib)->uncompress().get_labels();
+        UncompressedProof uncompressed_orig(labels);
+        auto executor = uncompressed_orig.get_executor< Sentence >(lib, ass, true);
+        executor->execute();
+        BOOST_TEST(executor->get_flat_proof_tree().nodes.size() == labels.size());
+        BOOST_TEST(executor->get_flat_proof_tree().sentences.size() < labels.size());
+        BOOST_TEST(proof_tree_size(executor->get_proof_tree()) == labels.size());
+        BOOST_TEST(executor->get_proof_tree().sentence == lib.get_sentence(ass.get_thesis()));
+        std::map< ProofOperator::CompressionStrategy, size_t > sizes;
+        for (const auto strategy : { ProofOperator::CS_ANY, ProofOperator::CS_NO_BACKREFS, ProofOperator::CS_BACKREFS_ON_IDENTICAL_TREE,
+             ProofOperator::CS_BACKREFS_ON_IDENTICAL_SENTENCE, ProofOperator::CS_MINIMIZE_SIZE }) {
+            CompressedProof compressed = UncompressedProof(labels).get_operator(lib, ass)->compress(strategy);
+            compressed.get_executor< Sentence >(lib, ass)->execute();
+            auto uncompressed = compressed.get_operator(lib, ass)->uncompress();
+            uncompressed.get_executor< Sentence >(lib, ass)->execute();
+            // Strategies working on sentences may replace a subproof with another one proving the same sentence
+            if (strategy == ProofOperator::CS_NO_BACKREFS || strategy == ProofOperator::CS_BACKREFS_ON_IDENTICAL_TREE) {
+                BOOST_TEST(uncompressed.get_labels() == labels);
+            }
+            // Saved steps used again are shared in the flat tree and become leaves when it is expanded
+            auto comp_executor = compressed.get_executor< Sentence >(lib, ass, true);
+            comp_executor->execute();
+            auto steps = static_cast< size_t >(std::count_if(compressed.get_codes().begin(), compressed.get_codes().end(), [](CodeTok code) { return code != CodeTok{}; }));
+            BOOST_TEST(proof_tree_size(comp_executor->get_proof_tree()) == steps);
+            sizes[strategy] = compressed_proof_size(lib, compressed);
+        }
+        for (const auto &size : sizes) {
+            BOOST_TEST(sizes[ProofOperator::CS_MINIMIZE_SIZE] <= size.second);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_verify_profile) {
+    auto db_filename = write_test_database(test_compression_db);
+    auto json_filename = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("mmpp-test-%%%%-%%%%.json");
+    std::vector< std::string > args = { "verify", "--profile", json_filename.string(), db_filename.string() };
+    std::vector< char* > argv;
+    for (auto &arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    int ret = get_main_functions().at("verify")(static_cast< int >(argv.size()), argv.data());
+    boost::filesystem::remove(db_filename);
+    BOOST_TEST(ret == 0);
+    nlohmann::json report;
+    {
+        boost::filesystem::ifstream fin(json_filename);
+        fin >> report;
+    }
+    boost::filesystem::remove(json_filename);
+
+    std::map< std::string, nlohmann::json > theorems;
+    for (const auto &theorem : report.at("theorems")) {
+        theorems[theorem.at("label").get< std::string >()] = theorem;
+    }
+    BOOST_TEST(theorems.size() == 3u);
+    BOOST_TEST(theorems.at("th1").at("assertion_steps").get< uint64_t >() == 3u);
+    BOOST_TEST(theorems.at("th1").at("hyp_steps").get< uint64_t >() == 4u);
+    BOOST_TEST(theorems.at("th3").at("assertion_steps").get< uint64_t >() == 2u);
+    BOOST_TEST(theorems.at("th3").at("hyp_steps").get< uint64_t >() == 7u);
+    for (const auto &theorem : theorems) {
+        BOOST_TEST(theorem.second.at("uses").get< uint64_t >() == 1u);
+        BOOST_TEST(theorem.second.at("assertion_time_ns").get< int64_t >() <= theorem.second.at("total_time_ns").get< int64_t >());
+    }
+
+    std::map< std::string, nlohmann::json > assertions;
+    for (const auto &assertion : report.at("assertions")) {
+        assertions[assertion.at("label").get< std::string >()] = assertion;
+    }
+    BOOST_TEST(assertions.at("wi").at("uses").get< uint64_t >() == 8u);
+    BOOST_TEST(assertions.at("ax-1").at("uses").get< uint64_t >() == 2u);
+    BOOST_TEST(assertions.at("ax-mp").at("uses").get< uint64_t >() == 2u);
+    BOOST_TEST(assertions.at("ax-mp").at("assertion_steps").get< uint64_t >() == 2u);
+}
+
+BOOST_AUTO_TEST_CASE(test_recompress_arguments) {
+    auto input = write_test_database(test_compression_db);
+    auto output = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("mmpp-test-%%%%-%%%%.mm");
+    auto recompress = [&](const std::string &threads) {
+        std::vector< std::string > args = { "recompress", input.string(), output.string(), "minimize", threads };
+        std::vector< char* > argv;
+        for (auto &arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        return get_main_functions().at("recompress")(static_cast< int >(argv.size()), argv.data());
+    };
+    // Bad thread counts are refused before anything is written
+    for (const auto &threads : { "", "x", "2x", "-1", "0", "99999999999999999999999" }) {
+        BOOST_TEST(recompress(threads) == 1);
+        BOOST_TEST(!boost::filesystem::exists(output));
+    }
+    BOOST_TEST(recompress("2") == 0);
+    boost::filesystem::remove(input);
+    {
+        TestDatabase db([&]() {
+            boost::filesystem::ifstream fin(output);
+            return std::string(std::istreambuf_iterator< char >(fin), std::istreambuf_iterator< char >());
+        }());
+        const LibraryImpl &lib = db.reader.get_library();
+        for (const auto &label : { "th1", "th2", "th3" }) {
+            const Assertion &ass = lib.get_assertion(lib.get_label(label));
+            BOOST_TEST(ass.is_valid());
+            ass.get_proof_executor< Sentence >(lib)->execute();
+        }
+    }
+    boost::filesystem::remove(output);
+}
+
+BOOST_AUTO_TEST_CASE(test_threads_arguments) {
+    BOOST_TEST(parse_threads_num("12") == 12u);
+    for (const auto &threads : { "", "x", "2x", "-1", "+1", "0", "99999999999999999999999" }) {
+        BOOST_TEST(parse_threads_num(threads) == 0u);
+    }
+    // Bad thread counts are refused before any work starts
+    for (const auto &name : { "generalizable_theorems", "subst_search" }) {
+        for (const auto &threads : { "x", "0" }) {
+            std::vector< std::string > args = { name, threads };
+            std::vector< char* > argv;
+            for (auto &arg : args) {
+                argv.push_back(&arg[0]);
+            }
+            BOOST_TEST(get_main_functions().at(name)(static_cast< int >(argv.size()), argv.data()) == 1);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_temp_generator_threads) {
+    TestDatabase db(test_compression_db);
+    const LibraryImpl &lib = db.reader.get_library();
+    SymTok wff = lib.get_symbol("wff");
+    TempGenerator tg(lib);
+    auto kept = tg.new_temp_var(wff);
+
+    std::mutex mutex;
+    std::set< LabTok > labs;
+    std::vector< std::thread > threads;
+    for (size_t i = 0; i < 4; i++) {
+        threads.emplace_back([&]() {
+            for (size_t j = 0; j < 100; j++) {
+                tg.new_temp_var_frame();
+                std::vector< std::pair< LabTok, SymTok > > vars;
+                for (size_t k = 0; k < 3; k++) {
+                    vars.push_back(tg.new_temp_var(wff));
+                }
+                tg.release_temp_var_frame();
+                std::unique_lock< std::mutex > lock(mutex);
+                for (const auto &var : vars) {
+                    labs.insert(var.first);
+                    BOOST_TEST(var.first != kept.first);
+                    BOOST_TEST(tg.get_symbol(tg.resolve_symbol(var.second)) == var.second);
+                    BOOST_TEST(tg.get_label(tg.resolve_label(var.first)) == var.first);
+                    BOOST_TEST(tg.get_var_lab_to_sym(var.first) == var.second);
+                    BOOST_TEST(tg.get_sentence(var.first) == Sentence({ wff, var.second }));
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    // Each thread keeps reusing the variables released by its frames, and
+    // leaves them to the next threads when it exits
+    BOOST_TEST(labs.size() >= 3);
+    BOOST_TEST(labs.size() <= 4 * 3);
+    std::thread([&]() {
+        for (size_t k = 0; k < 3; k++) {
+            BOOST_TEST(labs.count(tg.new_temp_var(wff).first) == 1);
+        }
+    }).join();
+    LabTok hyp = tg.new_temp_label("hypothesis.0");
+    BOOST_TEST(tg.new_temp_label("hypothesis.0") == hyp);
+    BOOST_TEST(tg.get_label("hypothesis.0") == hyp);
+    BOOST_TEST(tg.get_label("tempwff1000") == LabTok{});
+    BOOST_CHECK_THROW(tg.get_sentence(hyp), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(test_temp_generator_scopes) {
+    TestDatabase db(test_compression_db);
+    const LibraryImpl &lib = db.reader.get_library();
+    SymTok wff = lib.get_symbol("wff");
+    TempGenerator tg(lib);
+    const size_t scope1 = TempGenerator::Scope::new_id();
+    const size_t scope2 = TempGenerator::Scope::new_id();
+    auto global = tg.new_temp_var(wff);
+    std::pair< LabTok, SymTok > var1;
+    {
+        TempGenerator::Scope scope(scope1);
+        tg.new_temp_var_frame();
+        var1 = tg.new_temp_var(wff);
+        tg.release_temp_var_frame();
+        BOOST_TEST(tg.get_symbol(tg.resolve_symbol(global.second)) == global.second);
+    }
+    std::string name1 = tg.resolve_symbol(var1.second);
+    BOOST_TEST(tg.get_symbol(name1) == var1.second);
+    {
+        // Variables released in another scope are not reused, and their names do not resolve
+        TempGenerator::Scope scope(scope2);
+        auto var2 = tg.new_temp_var(wff);
+        BOOST_TEST(var2.first != var1.first);
+        BOOST_TEST(tg.resolve_symbol(var1.second) == "");
+        BOOST_TEST(tg.resolve_label(var1.first) == "");
+        BOOST_TEST(tg.get_symbol(name1) == SymTok{});
+        BOOST_TEST(tg.get_symbol(tg.resolve_symbol(var2.second)) == var2.second);
+        BOOST_TEST(tg.get_var_lab_to_sym(var1.first) == var1.second);
+        // Scopes nest
+        {
+            TempGenerator::Scope inner(scope1);
+            BOOST_TEST(tg.new_temp_var(wff).first == var1.first);
+        }
+        BOOST_TEST(tg.resolve_symbol(var1.second) == "");
+    }
+    // The free variables of a scope are left to that scope when a thread exits
+    std::pair< LabTok, SymTok > var3;
+    std::thread([&]() {
+        TempGenerator::Scope scope(scope2);
+        tg.new_temp_var_frame();
+        var3 = tg.new_temp_var(wff);
+        tg.release_temp_var_frame();
+    }).join();
+    std::thread([&]() {
+        {
+            TempGenerator::Scope scope(scope1);
+            BOOST_TEST(tg.new_temp_var(wff).first != var3.first);
+        }
+        TempGenerator::Scope scope(scope2);
+        BOOST_TEST(tg.new_temp_var(wff).first == var3.first);
+    }).join();
+}
+
+BOOST_AUTO_TEST_CASE(test_temp_generator_names) {
+    // Type symbols ending with digits must not confuse the lookup of temporary variables by name
+    TestDatabase db("$c ty2 ty $.\n");
+    const LibraryImpl &lib = db.reader.get_library();
+    TempGenerator tg(lib);
+    for (const auto &type : { "ty2", "ty" }) {
+        SymTok type_sym = lib.get_symbol(type);
+        for (size_t i = 0; i < 30; i++) {
+            auto var = tg.new_temp_var(type_sym);
+            BOOST_TEST(tg.get_symbol(tg.resolve_symbol(var.second)) == var.second);
+            BOOST_TEST(tg.get_label(tg.resolve_label(var.first)) == var.first);
+            BOOST_TEST(tg.get_var_sym_to_type_sym(var.second) == type_sym);
+        }
+    }
+    BOOST_TEST(tg.get_symbols_num() == 60);
+    BOOST_TEST(tg.get_symbol("ty2") == SymTok{});
+    BOOST_TEST(tg.get_symbol("ty261") == SymTok{});
+}
+
+BOOST_AUTO_TEST_CASE(test_result_store_persistence) {
+    auto filename = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("mmpp-test-%%%%-%%%%.results");
+    std::vector< std::string > proof = { "wph", "#0", "ax-1" };
+    {
+        auto store = ResultStore::get_store(filename);
+        BOOST_TEST(store->get("goal").empty());
+        store->put("goal", proof);
+        BOOST_TEST(store->get("goal") == proof);
+    }
+    {
+        // Appended by another process, the last record still being written
+        boost::filesystem::ofstream fout(filename, std::ios::app);
+        fout << R"({"key":"other","proof":["th1"]})" << "\n" << R"({"key":"trunc)";
+    }
+    {
+        auto store = ResultStore::get_store(filename);
+        BOOST_TEST(store->get_size() == 2);
+        BOOST_TEST(store->get("goal") == proof);
+        BOOST_TEST(store->get("other") == std::vector< std::string >({ "th1" }));
+        // The truncated record is terminated before appending
+        store->put("new", proof);
+    }
+    {
+        auto store = ResultStore::get_store(filename);
+        BOOST_TEST(store->get_size() == 3);
+        BOOST_TEST(store->get("new") == proof);
+        BOOST_TEST(store->get("trunc").empty());
+        boost::filesystem::ofstream fout(filename, std::ios::app);
+        fout << R"({"key":"later","proof":["th2"]})" << "\n";
+        fout.close();
+        store->refresh();
+        BOOST_TEST(store->get("later") == std::vector< std::string >({ "th2" }));
+    }
+    boost::filesystem::remove(filename);
+}
+
+BOOST_AUTO_TEST_CASE(test_locked_file_exclusion) {
+    auto filename = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("mmpp-test-%%%%-%%%%.lock");
+    std::atomic< bool > acquired(false);
+    std::thread reader;
+    {
+        PlatformLockedFile file(filename, true);
+        file.append("abc\n");
+        reader = std::thread([&]() {
+            PlatformLockedFile shared(filename, false);
+            acquired = true;
+            BOOST_TEST(shared.read_from(0) == "abc\ndef\n");
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        // Closing another descriptor on the same file does not drop the lock
+        {
+            boost::filesystem::ifstream fin(filename);
+            BOOST_TEST(fin.get() == 'a');
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        BOOST_TEST(!acquired);
+        file.append("def\n");
+        BOOST_TEST(file.size() == 8u);
+        BOOST_TEST(file.read_from(7) == "\n");
+    }
+    reader.join();
+    BOOST_TEST(acquired);
+    boost::filesystem::remove(filename);
+}
+
+BOOST_AUTO_TEST_CASE(test_assertions_by_thesis_root) {
+    const auto &tb = get_set_mm().tb;
+    const auto &by_root = tb.get_assertions_by_thesis_root();
+    // Lists are in label order, so that the lookup finds the same first match as a full scan
+    size_t indexed = 0;
+    for (const auto &pair : by_root) {
+        BOOST_TEST(std::is_sorted(pair.second.begin(), pair.second.end()));
+        indexed += pair.second.size();
+    }
+    std::vector< LabTok > theses;
+    for (const Assertion &ass : tb.gen_assertions()) {
+        theses.push_back(ass.get_thesis());
+    }
+    BOOST_TEST(indexed == theses.size());
+
+    // Whatever a linear scan finds to unify with a sentence must be among the candidates of the index
+    auto var_root_it = by_root.find(LabTok{});
+    for (size_t i = 0; i < theses.size(); i += 997) {
+        const auto &pt = tb.get_parsed_sent(theses[i]);
+        std::set< LabTok > candidates;
+        auto same_root_it = by_root.find(pt.label);
+        if (same_root_it != by_root.end() && pt.label != LabTok{}) {
+            candidates.insert(same_root_it->second.begin(), same_root_it->second.end());
+        }
+        if (var_root_it != by_root.end()) {
+            candidates.insert(var_root_it->second.begin(), var_root_it->second.end());
+        }
+        BOOST_TEST(candidates.count(theses[i]) == 1);
+        for (const auto &label : theses) {
+            UnilateralUnificator< SymTok, LabTok > unif(tb.get_standard_is_var());
+            unif.add_parsing_trees(tb.get_parsed_sent(label), pt);
+            if (unif.is_unifiable() && candidates.count(label) == 0) {
+                BOOST_ERROR("assertion " << tb.resolve_label(label) << " is missing from the candidates for " << tb.resolve_label(theses[i]));
+            }
+        }
+    }
+}
+
+struct TestHypothesisCallback final : public StepStrategyCallback {
+    TestHypothesisCallback(CreativeProofEngineImpl< Sentence > &engine, const Sentence &sent) : engine(engine), sent(sent) {}
+
+    bool prove() {
+        this->engine.process_new_hypothesis(this->sent);
+        return true;
+    }
+
+    CreativeProofEngineImpl< Sentence > &engine;
+    Sentence sent;
+};
+
+BOOST_AUTO_TEST_CASE(test_result_proof_serialization) {
+    const auto &tb = get_set_mm().tb;
+    StepStrategyData data;
+    data.thesis = tb.read_sentence("|- ps");
+    data.hypotheses = { tb.read_sentence("|- ph"), tb.read_sentence("|- ( ph -> ps )") };
+    std::vector< std::string > proof = { "wph", "wps", "#0", "#1", "ax-mp" };
+
+    auto result = deserialize_result_proof(data, proof, tb);
+    BOOST_REQUIRE((result != nullptr));
+    BOOST_TEST(serialize_result_proof(data, *result, tb) == proof);
+
+    CreativeProofEngineImpl< Sentence > engine(tb);
+    std::vector< std::shared_ptr< StepStrategyCallback > > children;
+    for (const auto &hyp : data.hypotheses) {
+        children.push_back(std::make_shared< TestHypothesisCallback >(engine, hyp));
+    }
+    BOOST_TEST(result->prove(engine, children));
+    BOOST_TEST((engine.get_stack() == std::vector< Sentence >({ data.thesis })));
+
+    // A stored proof that does not end with the thesis is rejected and leaves the engine untouched
+    StepStrategyData other = data;
+    other.thesis = data.hypotheses[0];
+    auto wrong = deserialize_result_proof(other, proof, tb);
+    BOOST_REQUIRE((wrong != nullptr));
+    BOOST_TEST(!wrong->prove(engine, children));
+    BOOST_TEST((engine.get_stack() == std::vector< Sentence >({ data.thesis })));
+    BOOST_TEST(serialize_result_proof(other, *wrong, tb).empty());
+
+    // Exceptions that are not proof errors are propagated after rolling back
+    struct ThrowingCallback final : public StepStrategyCallback {
+        bool prove() {
+            throw std::runtime_error("hypothesis prover failed");
+        }
+    };
+    std::vector< std::shared_ptr< StepStrategyCallback > > throwing_children = { children[0], std::make_shared< ThrowingCallback >() };
+    BOOST_CHECK_THROW(result->prove(engine, throwing_children), std::runtime_error);
+    BOOST_TEST((engine.get_stack() == std::vector< Sentence >({ data.thesis })));
+    BOOST_TEST(result->prove(engine, children));
+    BOOST_TEST(engine.get_stack().size() == 2u);
+
+    BOOST_TEST((deserialize_result_proof(data, { "wph", "nonexistent" }, tb) == nullptr));
+    BOOST_TEST((deserialize_result_proof(data, { "wph", "#x" }, tb) == nullptr));
+}
+
 #endif
@@ -4,6 +4,7 @@
 #include "mm/setmm.h"
 #include "parsing/earley.h"
 #include "parsing/lr.h"
+#include "parsing/unif.h"
 #include "test.h"
 
 #ifdef ENABLE_TEST_CODE
@@ -320,4 +321,52 @@ BOOST_DATA_TEST_CASE(test_unification, boost::unit_test::data::make(unification_
     }
 }
 
+BOOST_AUTO_TEST_CASE(test_substitute2) {
+    auto derivations = get_unification_test_derivation();
+    LRParser< char, size_t > lr(derivations);
+    lr.initialize();
+    auto parse = [&lr](const std::string &str, char type) {
+        auto pt = lr.parse(std::vector< char >(str.begin(), str.end()), type);
+        BOOST_TEST(pt.label != 0);
+        return pt;
+    };
+    std::function< bool(size_t) > is_var = [](auto x) { return x >= 200; };
+
+    auto templ = parse("x+(y+z)+x", 'S');
+    SubstMap< char, size_t > subst = { { 200, parse("1", 'D') }, { 201, parse("3-y", 'S') } };
+    SubstMap< char, size_t > other_subst = { { 200, parse("1", 'D') }, { 201, parse("3-x", 'S') } };
+    auto templ2 = pt_to_pt2(templ);
+    auto subst2 = subst_to_subst2(subst);
+    auto expected = pt_to_pt2(substitute(templ, is_var, subst));
+    auto other = pt_to_pt2(substitute(templ, is_var, other_subst));
+    auto longer = pt_to_pt2(substitute(parse("x+(y+z)+x+x", 'S'), is_var, subst));
+
+    BOOST_TEST(substitute2(templ2, is_var, subst2) == expected);
+    BOOST_TEST(substitute2_equal(templ2, is_var, subst2, expected));
+    BOOST_TEST(!substitute2_equal(templ2, is_var, subst2, other));
+    BOOST_TEST(!substitute2_equal(templ2, is_var, subst2, longer));
+    BOOST_TEST(!substitute2_equal(templ2, is_var, subst2, t4(expected.get_nodes(), expected.get_nodes_len() - 1)));
+    BOOST_TEST(!substitute2_equal(templ2, is_var, subst2, templ2));
+    // Nodes with the same labels but different types do not match, both outside and inside substituted variables
+    for (size_t pos : { size_t(0), expected.get_nodes_len() - 1 }) {
+        std::vector< ParsingTreeNode< char, size_t > > retyped(expected.get_nodes(), expected.get_nodes() + expected.get_nodes_len());
+        retyped[pos].type = 'T';
+        BOOST_TEST(!substitute2_equal(templ2, is_var, subst2, t4(retyped.data(), retyped.size())));
+    }
+
+    ParsingTree2Arena< char, size_t > arena;
+    size_t len = substitute2_count(templ2, is_var, subst2);
+    auto nodes = arena.allocate(len);
+    substitute2_write(templ2, is_var, subst2, nodes);
+    BOOST_TEST(t4(nodes, len) == expected);
+
+    // Truncating the arena reuses the space allocated after the mark and keeps what came before
+    auto mark = arena.get_mark();
+    arena.allocate(len);
+    arena.allocate(10000);
+    arena.truncate(mark);
+    BOOST_TEST(arena.allocate(len) == nodes + len);
+    BOOST_TEST(t4(nodes, len) == expected);
+}
+
 #endif
@@ -2,7 +2,9 @@
 #include "test/test.h"
 #include "provers/wff.h"
 #include "provers/wffsat.h"
+#include "provers/bdd.h"
 #include "mm/setmm.h"
+#include "mm/ptengine.h"
 
 #ifdef ENABLE_TEST_CODE
 
@@ -164,6 +166,71 @@ BOOST_DATA_TEST_CASE(test_wff_adv_truth_prover, boost::unit_test::data::make(wff
     }
 }
 
+static size_t adv_truth_proof_size(const pwff &wff, const LibraryToolbox &tb) {
+    wff->set_library_toolbox(tb);
+    CreativeProofEngineImpl< Sentence > engine(tb);
+    auto res = wff->get_adv_truth_prover(tb);
+    BOOST_TEST(res.first);
+    BOOST_TEST(res.second(engine));
+    BOOST_TEST(engine.get_stack().back() == tb.reconstruct_sentence(pt2_to_pt(wff->to_parsing_tree(tb)), tb.get_turnstile()));
+    return engine.get_proof_labels().size();
+}
+
+BOOST_AUTO_TEST_CASE(test_wff_adv_truth_prover_wide) {
+    auto &data = get_set_mm();
+    auto &tb = data.tb;
+
+    // A conjunction of independent tautologies: once a variable is substituted the
+    // residual formula is the same in both branches, so the proof must grow
+    // polynomially with the number of conjuncts, not exponentially
+    std::vector< std::string > names = { "ph", "ps", "ch", "th", "ta", "et", "ze", "si", "rh", "mu" };
+    auto wide_wff = [&names](size_t num) {
+        pwff ret = True::create();
+        for (size_t i = 0; i < num; i++) {
+            ret = And::create(Imp::create(Var::create(names[i]), Var::create(names[i])), ret);
+        }
+        return ret;
+    };
+    size_t small_size = adv_truth_proof_size(wide_wff(5), tb);
+    size_t large_size = adv_truth_proof_size(wide_wff(10), tb);
+    BOOST_TEST(large_size < 16 * small_size);
+}
+
+BOOST_AUTO_TEST_CASE(test_wff_hash_cons) {
+    auto &data = get_set_mm();
+    auto &tb = data.tb;
+
+    // Formulas are shared only once they belong to a toolbox
+    BOOST_TEST((Var::create("ph", tb) == Var::create("ph", tb)));
+    pvar ph1 = Var::create("ph");
+    pvar ph2 = Var::create("ph");
+    BOOST_TEST((ph1 != ph2));
+    BOOST_TEST((Imp::create(ph1, ph2) != Imp::create(ph1, ph2)));
+    ph1->set_library_toolbox(tb);
+    ph2->set_library_toolbox(tb);
+    BOOST_TEST((Imp::create(ph1, ph2) == Imp::create(ph1, ph2)));
+    BOOST_TEST((Not::create(Imp::create(ph1, True::create())) == Not::create(Imp::create(ph1, True::create()))));
+    BOOST_TEST((True::create() == True::create()));
+}
+
+BOOST_DATA_TEST_CASE(test_wff_bdd, boost::unit_test::data::make(wff_data), trivially_true, trivially_false, actually_true, wff) {
+    (void) trivially_true;
+    (void) trivially_false;
+
+    auto &data = get_set_mm();
+    //auto &lib = data.lib;
+    auto &tb = data.tb;
+
+    wff->set_library_toolbox(tb);
+
+    pvar_set vars;
+    wff->get_variables(vars);
+    BDD bdd(std::vector< pvar >(vars.begin(), vars.end()));
+    auto node = bdd.from_wff(wff);
+    BOOST_TEST((node == BDD::TRUE_NODE) == actually_true);
+    BOOST_TEST(bdd.from_wff(Not::create(Not::create(wff))) == node);
+}
+
 BOOST_DATA_TEST_CASE(test_wff_minisat_prover, boost::unit_test::data::make(wff_data), trivially_true, trivially_false, actually_true, wff) {
     (void) trivially_true;
     (void) trivially_false;
@@ -185,6 +252,33 @@ BOOST_DATA_TEST_CASE(test_wff_minisat_prover, boost::unit_test::data::make(wff_d
     }
 }
 
+BOOST_DATA_TEST_CASE(test_wff_minisat_session, boost::unit_test::data::make(wff_data), trivially_true, trivially_false, actually_true, wff) {
+    (void) trivially_true;
+    (void) trivially_false;
+
+    auto &data = get_set_mm();
+    //auto &lib = data.lib;
+    auto &tb = data.tb;
+
+    wff->set_library_toolbox(tb);
+
+    // The same session is used for all the formulas, so that later queries reuse the clauses of earlier ones
+    static WffSatSession session(tb);
+    // This one starts a new solver whenever it has learnt anything
+    static WffSatSession restarting_session(tb, 0);
+    for (auto sess : { &session, &restarting_session }) {
+        CreativeProofEngineImpl< Sentence > engine(tb);
+        auto res = sess->get_sat_prover(wff);
+        BOOST_TEST(res.first == actually_true);
+        auto res2 = res.second(engine);
+        BOOST_TEST(res2 == actually_true);
+        if (res2) {
+            BOOST_TEST(engine.get_stack().size() == (size_t) 1);
+            BOOST_TEST(engine.get_stack().back() == tb.reconstruct_sentence(pt2_to_pt(wff->to_parsing_tree(tb)), tb.get_turnstile()));
+        }
+    }
+}
+
 std::vector< std::string > wff_from_pt_data = {
     "wff T.",
     "wff F.",
@@ -219,4 +313,23 @@ BOOST_DATA_TEST_CASE(test_wff_from_pt, boost::unit_test::data::make(wff_from_pt_
     BOOST_TEST(pt2_to_pt(parsed->to_parsing_tree(tb)) == pt);
 }
 
+BOOST_AUTO_TEST_CASE(test_pt_engine_stack_outlives_rollback) {
+    auto &data = get_set_mm();
+    auto &tb = data.tb;
+    auto first = Imp::create(Var::create("ph", tb), Var::create("ps", tb));
+    auto second = Imp::create(Var::create("ps", tb), Not::create(Var::create("ph", tb)));
+    auto expected = first->to_parsing_tree(tb);
+
+    CreativeProofEngineImpl< ParsingTree2< SymTok, LabTok > > engine(tb, true);
+    engine.checkpoint();
+    BOOST_TEST(first->get_type_prover(tb)(engine));
+    auto top = engine.get_stack().back();
+    auto tree = engine.get_proof_tree();
+    engine.rollback();
+    // Build something else where the rolled back tree used to be
+    BOOST_TEST(second->get_type_prover(tb)(engine));
+    BOOST_TEST((top == expected));
+    BOOST_TEST((tree.sentence == expected));
+}
+
 #endif
@@ -1,6 +1,7 @@
 #include "threadmanager.h"
 
 #include <iostream>
+#include <algorithm>
 
 #include "utils/utils.h"
 #include "platform.h"
@@ -53,42 +54,221 @@ static_block {
     register_main_function("thread_test", thread_test_main);
 }
 
-CoroutineThreadManager::CoroutineThreadManager(size_t thread_num) : running(true), running_coros(0) {
+static thread_local CoroutineThreadManager *current_manager = nullptr;
+static thread_local size_t current_worker = 0;
+
+CoroutineProfile::CoroutineProfile(const std::string &name) : name(name), cpu_time(0), slices(0), samples(0)
+{
+}
+
+static std::mutex profiles_mutex;
+static std::unordered_map< std::string, std::shared_ptr< CoroutineProfile > > profiles;
+
+std::shared_ptr< CoroutineProfile > CoroutineProfile::get_profile(const std::string &name)
+{
+    std::unique_lock< std::mutex > lock(profiles_mutex);
+    auto &ret = profiles[name];
+    if (ret == nullptr) {
+        ret = std::shared_ptr< CoroutineProfile >(new CoroutineProfile(name));
+    }
+    return ret;
+}
+
+std::vector< std::shared_ptr< CoroutineProfile > > CoroutineProfile::get_profiles()
+{
+    std::unique_lock< std::mutex > lock(profiles_mutex);
+    std::vector< std::shared_ptr< CoroutineProfile > > ret;
+    for (const auto &profile : profiles) {
+        ret.push_back(profile.second);
+    }
+    return ret;
+}
+
+const std::string &CoroutineProfile::get_name() const
+{
+    return this->name;
+}
+
+std::chrono::nanoseconds CoroutineProfile::get_cpu_time() const
+{
+    return std::chrono::nanoseconds(this->cpu_time.load());
+}
+
+uint64_t CoroutineProfile::get_slices() const
+{
+    return this->slices;
+}
+
+uint64_t CoroutineProfile::get_samples() const
+{
+    return this->samples;
+}
+
+DurationHistogram::DurationHistogram() : count(0), total(0), max(0)
+{
+    for (auto &x : this->buckets) {
+        x = 0;
+    }
+}
+
+void DurationHistogram::add(std::chrono::steady_clock::duration duration)
+{
+    uint64_t us = static_cast< uint64_t >(std::max< std::chrono::microseconds::rep >(std::chrono::duration_cast< std::chrono::microseconds >(duration).count(), 0));
+    size_t bucket = 0;
+    while (bucket < BUCKETS_NUM && us >= (static_cast< uint64_t >(1) << bucket)) {
+        bucket++;
+    }
+    this->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    this->count.fetch_add(1, std::memory_order_relaxed);
+    this->total.fetch_add(duration.count(), std::memory_order_relaxed);
+    auto max = this->max.load(std::memory_order_relaxed);
+    while (duration.count() > max && !this->max.compare_exchange_weak(max, duration.count(), std::memory_order_relaxed)) {}
+}
+
+std::vector< uint64_t > DurationHistogram::get_buckets() const
+{
+    std::vector< uint64_t > ret;
+    for (const auto &x : this->buckets) {
+        ret.push_back(x.load(std::memory_order_relaxed));
+    }
+    return ret;
+}
+
+uint64_t DurationHistogram::get_count() const
+{
+    return this->count.load(std::memory_order_relaxed);
+}
+
+std::chrono::steady_clock::duration DurationHistogram::get_total() const
+{
+    return std::chrono::steady_clock::duration(this->total.load(std::memory_order_relaxed));
+}
+
+std::chrono::steady_clock::duration DurationHistogram::get_max() const
+{
+    return std::chrono::steady_clock::duration(this->max.load(std::memory_order_relaxed));
+}
+
+CoroutineGroup::CoroutineGroup(unsigned weight) : weight(weight), active_coros(0), running_time(0)
+{
+}
+
+size_t CoroutineGroup::get_active_coros() const
+{
+    return this->active_coros;
+}
+
+std::chrono::steady_clock::duration CoroutineGroup::get_running_time() const
+{
+    return std::chrono::steady_clock::duration(this->running_time.load());
+}
+
+CoroutineToken::CoroutineToken(CoroutinePriority priority) : canceled(false), priority(priority)
+{
+}
+
+void CoroutineToken::cancel()
+{
+    this->canceled = true;
+}
+
+bool CoroutineToken::is_canceled() const
+{
+    return this->canceled;
+}
+
+void CoroutineToken::set_priority(CoroutinePriority priority)
+{
+    this->priority = priority;
+}
+
+CoroutinePriority CoroutineToken::get_priority() const
+{
+    return this->priority;
+}
+
+CoroutineThreadManager::CoroutineThreadManager(size_t thread_num) : running(true), next_queue(0), queued_coros(0), idle_workers(0), running_coros(0),
+    next_coro_id(1), dispatched_coros(0), stolen_coros(0), canceled_coros(0), yields_per_second(0.0), queued_timed_coros(0), sampling_interval(0) {
+    for (auto &x : this->queued_by_priority) {
+        x = 0;
+    }
+    for (size_t i = 0; i < thread_num; i++) {
+        this->queues.push_back(std::make_unique< WorkerQueue >());
+        this->activities.push_back(std::make_unique< WorkerActivity >());
+    }
     for (size_t i = 0; i < thread_num; i++) {
         this->threads.emplace_back([this,i]() {
             platform_set_current_thread_name(std::string("CTM-") + std::to_string(i));
-            this->thread_fn();
+            current_manager = this;
+            current_worker = i;
+            this->thread_fn(i);
         });
     }
     this->timed_thread = std::make_unique< std::thread >([this]() {
         platform_set_current_thread_name("CTM-timed");
         this->timed_fn();
     });
+    this->sampler_thread = std::make_unique< std::thread >([this]() {
+        platform_set_current_thread_name("CTM-sampler");
+        this->sampler_fn();
+    });
 }
 
 CoroutineThreadManager::~CoroutineThreadManager() {
     this->stop();
 }
 
-void CoroutineThreadManager::add_coroutine(std::weak_ptr<Coroutine> coro) {
+static unsigned safe_hardware_concurrency() noexcept {
+    auto system = std::thread::hardware_concurrency();
+    if (system > 0) {
+        return system;
+    } else {
+        return 1;
+    }
+}
+
+CoroutineThreadManager &CoroutineThreadManager::get_global()
+{
+    static CoroutineThreadManager manager(safe_hardware_concurrency());
+    return manager;
+}
+
+void CoroutineThreadManager::add_coroutine(std::weak_ptr<Coroutine> coro, std::shared_ptr<CoroutineGroup> group, std::shared_ptr<CoroutineToken> token) {
     CoroutineRuntimeData coro_rd;
     coro_rd.coroutine = coro;
+    coro_rd.group = group;
+    coro_rd.token = token;
+    coro_rd.id = this->next_coro_id++;
     this->enqueue_coroutine(std::move(coro_rd), false);
 }
 
-void CoroutineThreadManager::add_timed_coroutine(std::weak_ptr<Coroutine> coro, std::chrono::system_clock::duration wait_time)
+void CoroutineThreadManager::add_timed_coroutine(std::weak_ptr<Coroutine> coro, std::chrono::system_clock::duration wait_time, std::shared_ptr<CoroutineGroup> group, std::shared_ptr<CoroutineToken> token)
 {
     CoroutineRuntimeData coro_rd;
     coro_rd.coroutine = coro;
+    coro_rd.group = group;
+    coro_rd.token = token;
+    coro_rd.id = this->next_coro_id++;
     std::unique_lock< std::mutex > lock(this->timed_mutex);
     this->timed_coros.push(std::make_pair(std::chrono::system_clock::now() + wait_time, coro_rd));
+    this->queued_timed_coros++;
     this->timed_cond.notify_one();
 }
 
 void CoroutineThreadManager::stop() {
     this->running = false;
-    this->can_go.notify_all();
-    this->timed_cond.notify_all();
+    {
+        std::unique_lock< std::mutex > lock(this->idle_mutex);
+        this->can_go.notify_all();
+    }
+    {
+        std::unique_lock< std::mutex > lock(this->timed_mutex);
+        this->timed_cond.notify_all();
+    }
+    {
+        std::unique_lock< std::mutex > lock(this->sampling_mutex);
+        this->sampling_cond.notify_all();
+    }
     this->join();
 }
 
@@ -101,38 +281,144 @@ void CoroutineThreadManager::join() {
     if (this->timed_thread->joinable()) {
         this->timed_thread->join();
     }
+    if (this->sampler_thread->joinable()) {
+        this->sampler_thread->join();
+    }
 }
 
 std::tuple<unsigned, size_t, size_t> CoroutineThreadManager::get_stats()
 {
-    std::unique_lock< std::mutex > lock1(this->timed_mutex);
-    std::unique_lock< std::mutex > lock2(this->obj_mutex);
-    return std::tuple<unsigned, size_t, size_t>(this->running_coros, this->coros.size(), this->timed_coros.size());
+    return std::tuple<unsigned, size_t, size_t>(this->running_coros, this->queued_coros, this->queued_timed_coros);
+}
+
+CoroutineThreadManager::Stats CoroutineThreadManager::get_detailed_stats(size_t hot_coros_num)
+{
+    Stats ret;
+    std::tie(ret.running_coros, ret.queued_coros, ret.queued_timed_coros) = this->get_stats();
+    for (const auto &queue : this->queues) {
+        ret.queue_depths.push_back(queue->depth);
+    }
+    for (const auto &x : this->queued_by_priority) {
+        ret.queued_by_priority.push_back(x);
+    }
+    ret.dispatched_coros = this->dispatched_coros;
+    ret.stolen_coros = this->stolen_coros;
+    ret.canceled_coros = this->canceled_coros;
+    ret.yields = this->count_yields();
+    ret.yields_per_second = this->yields_per_second;
+    auto wait_count = this->wait_time.get_count();
+    ret.mean_wait_time = wait_count == 0 ? std::chrono::steady_clock::duration(0) : this->wait_time.get_total() / static_cast< std::chrono::steady_clock::rep >(wait_count);
+    ret.max_wait_time = this->wait_time.get_max();
+    ret.wait_time_histogram = this->wait_time.get_buckets();
+    ret.slice_time_histogram = this->slice_time.get_buckets();
+    for (const auto &profile : CoroutineProfile::get_profiles()) {
+        ret.profiles.push_back({profile->get_name(), profile->get_cpu_time(), profile->get_slices(), profile->get_samples()});
+    }
+    std::sort(ret.profiles.begin(), ret.profiles.end(), [](const auto &x, const auto &y) { return x.cpu_time > y.cpu_time; });
+    // The sampling lock is only shared with the sampler thread, never with the workers
+    std::unique_lock< std::mutex > lock(this->sampling_mutex);
+    ret.sampling_interval = this->sampling_interval;
+    for (const auto &coro : this->hot_coros) {
+        ret.hot_coroutines.push_back(coro.second);
+    }
+    lock.unlock();
+    std::sort(ret.hot_coroutines.begin(), ret.hot_coroutines.end(), [](const auto &x, const auto &y) { return x.samples > y.samples; });
+    if (ret.hot_coroutines.size() > hot_coros_num) {
+        ret.hot_coroutines.resize(hot_coros_num);
+    }
+    return ret;
 }
 
-void CoroutineThreadManager::thread_fn() {
+void CoroutineThreadManager::set_sampling_interval(std::chrono::steady_clock::duration interval)
+{
+    std::unique_lock< std::mutex > lock(this->sampling_mutex);
+    if (this->sampling_interval == std::chrono::steady_clock::duration(0) && interval > std::chrono::steady_clock::duration(0)) {
+        this->hot_coros.clear();
+    }
+    this->sampling_interval = std::max(interval, std::chrono::steady_clock::duration(0));
+    this->sampling_cond.notify_all();
+}
+
+uint64_t CoroutineThreadManager::count_yields() const
+{
+    uint64_t ret = 0;
+    for (const auto &activity : this->activities) {
+        ret += activity->yields;
+    }
+    return ret;
+}
+
+std::chrono::steady_clock::duration CoroutineThreadManager::compute_quantum(const CoroutineThreadManager::CoroutineRuntimeData &coro) const
+{
+    if (coro.group == nullptr) {
+        return BUDGET_QUANTUM;
+    }
+    size_t active = std::max< size_t >(coro.group->active_coros, 1);
+    return std::max(MIN_BUDGET_QUANTUM, BUDGET_QUANTUM * static_cast< std::chrono::steady_clock::rep >(coro.group->weight) / static_cast< std::chrono::steady_clock::rep >(active));
+}
+
+void CoroutineThreadManager::thread_fn(size_t worker_idx) {
     platform_set_current_thread_low_priority();
     while (this->running) {
         CoroutineRuntimeData tmp;
-        if (dequeue_coroutine(tmp)) {
+        if (dequeue_coroutine(worker_idx, tmp)) {
             bool reenqueue = true;
             auto strong_coro = tmp.coroutine.lock();
+            if (tmp.token != nullptr && tmp.token->is_canceled()) {
+                this->canceled_coros++;
+                strong_coro = nullptr;
+            }
             if (strong_coro != nullptr) {
-                tmp.budget += BUDGET_QUANTUM;
-                while (tmp.budget > std::chrono::seconds(0)) {
+                auto &activity = *this->activities[worker_idx];
+                auto profile = strong_coro->get_profile().get();
+                activity.coro_id = tmp.id;
+                activity.profile = profile;
+                activity.running_time = tmp.running_time.count();
+                auto slice_start = std::chrono::steady_clock::now();
+                auto cpu_start = platform_get_current_thread_cpu_time();
+                uint64_t yields = 0;
+                tmp.budget += this->compute_quantum(tmp);
+                while (reenqueue && tmp.budget > std::chrono::seconds(0)) {
+                    // Give up the rest of the slice if the coroutine was canceled or more urgent work arrived
+                    if (tmp.token != nullptr && tmp.token->is_canceled()) {
+                        reenqueue = false;
+                        break;
+                    }
+                    if (this->has_queued_above(tmp.priority)) {
+                        tmp.budget = std::chrono::steady_clock::duration(0);
+                        break;
+                    }
                     auto start_time = std::chrono::steady_clock::now();
                     reenqueue = strong_coro->execute();
                     auto stop_time = std::chrono::steady_clock::now();
                     auto running_time = stop_time - start_time;
                     tmp.running_time += running_time;
                     tmp.budget -= running_time;
+                    if (tmp.group != nullptr) {
+                        tmp.group->running_time += running_time.count();
+                    }
+                    yields++;
+                    activity.running_time = tmp.running_time.count();
                 }
+                this->slice_time.add(std::chrono::steady_clock::now() - slice_start);
+                if (profile != nullptr) {
+                    profile->cpu_time += (platform_get_current_thread_cpu_time() - cpu_start).count();
+                    profile->slices++;
+                }
+                activity.yields += yields;
+                activity.profile = nullptr;
+                activity.coro_id = 0;
             } else {
                 reenqueue = false;
             }
+            // Release the coroutine before possibly handing it to another thread
+            strong_coro = nullptr;
             if (reenqueue) {
                 this->enqueue_coroutine(std::move(tmp), true);
             } else {
+                if (tmp.group != nullptr) {
+                    tmp.group->active_coros--;
+                }
                 this->running_coros--;
             }
         }
@@ -155,6 +441,7 @@ void CoroutineThreadManager::timed_fn()
             auto data = top.second;
             this->enqueue_coroutine(std::move(data), false);
             this->timed_coros.pop();
+            this->queued_timed_coros--;
         } else {
             this->timed_cond.wait_until(lock, top.first);
             if (!this->running) {
@@ -164,41 +451,194 @@ void CoroutineThreadManager::timed_fn()
     }
 }
 
+void CoroutineThreadManager::sampler_fn()
+{
+    std::unique_lock< std::mutex > lock(this->sampling_mutex);
+    auto rate_time = std::chrono::steady_clock::now();
+    auto rate_yields = this->count_yields();
+    while (this->running) {
+        bool sampling = this->sampling_interval > std::chrono::steady_clock::duration(0);
+        this->sampling_cond.wait_for(lock, sampling ? std::min(this->sampling_interval, RATE_INTERVAL) : RATE_INTERVAL);
+        if (!this->running) {
+            return;
+        }
+        if (this->sampling_interval > std::chrono::steady_clock::duration(0)) {
+            this->take_sample();
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - rate_time >= RATE_INTERVAL) {
+            auto yields = this->count_yields();
+            this->yields_per_second = static_cast< double >(yields - rate_yields) / std::chrono::duration< double >(now - rate_time).count();
+            rate_time = now;
+            rate_yields = yields;
+        }
+    }
+}
+
+void CoroutineThreadManager::take_sample()
+{
+    for (const auto &activity : this->activities) {
+        uint64_t coro_id = activity->coro_id;
+        if (coro_id == 0) {
+            continue;
+        }
+        auto profile = activity->profile.load();
+        auto &hot = this->hot_coros[coro_id];
+        hot.id = coro_id;
+        hot.name = profile != nullptr ? profile->get_name() : "";
+        hot.running_time = std::chrono::steady_clock::duration(activity->running_time.load());
+        hot.samples++;
+        if (profile != nullptr) {
+            profile->samples++;
+        }
+    }
+    /* Keep only the hottest half of the coroutines when the table is full; they are
+     * ranked, so that ties (for example when every coroutine has a single sample)
+     * do not empty the table */
+    if (this->hot_coros.size() > MAX_HOT_COROS) {
+        std::vector< std::pair< uint64_t, uint64_t > > ranked;
+        ranked.reserve(this->hot_coros.size());
+        for (const auto &coro : this->hot_coros) {
+            ranked.emplace_back(coro.second.samples, coro.first);
+        }
+        auto kept_end = ranked.begin() + MAX_HOT_COROS / 2;
+        std::nth_element(ranked.begin(), kept_end, ranked.end(), [](const auto &x, const auto &y) { return x.first > y.first; });
+        for (auto it = kept_end; it != ranked.end(); it++) {
+            this->hot_coros.erase(it->second);
+        }
+    }
+}
+
 void CoroutineThreadManager::enqueue_coroutine(CoroutineThreadManager::CoroutineRuntimeData &&coro, bool reenqueueing) {
-    std::unique_lock< std::mutex > lock(this->obj_mutex);
-    this->coros.push_back(std::move(coro));
+    if (!reenqueueing && coro.group != nullptr) {
+        coro.group->active_coros++;
+    }
+    coro.enqueue_time = std::chrono::steady_clock::now();
+    coro.priority = coro.token != nullptr ? coro.token->get_priority() : PRIORITY_NORMAL;
+    auto priority = coro.priority;
+    // Workers keep their own coroutines, while new ones are spread round robin
+    size_t queue_idx = current_manager == this ? current_worker : this->next_queue++ % this->queues.size();
+    // Count the coroutine before it becomes visible, so that the counter never underflows
+    this->queued_coros++;
+    this->queued_by_priority[priority]++;
+    this->queues[queue_idx]->depth++;
+    {
+        std::unique_lock< std::mutex > lock(this->queues[queue_idx]->mutex);
+        this->queues[queue_idx]->coros[priority].push_back(std::move(coro));
+    }
     if (reenqueueing) {
         this->running_coros--;
     }
-    this->can_go.notify_one();
+    // See dequeue_coroutine() for why this does not lose wakeups
+    if (this->idle_workers > 0) {
+        std::unique_lock< std::mutex > lock(this->idle_mutex);
+        this->can_go.notify_one();
+    }
 }
 
-bool CoroutineThreadManager::dequeue_coroutine(CoroutineThreadManager::CoroutineRuntimeData &coro) {
-    std::unique_lock< std::mutex > lock(this->obj_mutex);
-    while (this->coros.empty()) {
-        this->can_go.wait(lock);
-        if (!this->running) {
-            return false;
-        }
-    }
-    if (!this->running) {
+bool CoroutineThreadManager::try_pop(size_t queue_idx, CoroutinePriority priority, bool steal, CoroutineThreadManager::CoroutineRuntimeData &coro)
+{
+    auto &queue = *this->queues[queue_idx];
+    std::unique_lock< std::mutex > lock(queue.mutex);
+    auto &coros = queue.coros[priority];
+    if (coros.empty()) {
         return false;
     }
-    std::swap(coro, this->coros.front());
-    this->coros.pop_front();
-    this->running_coros++;
+    // The owner consumes its queue in FIFO order, so that coroutines are served round robin, while thieves take from the back
+    if (steal) {
+        std::swap(coro, coros.back());
+        coros.pop_back();
+    } else {
+        std::swap(coro, coros.front());
+        coros.pop_front();
+    }
+    queue.depth--;
     return true;
 }
 
+bool CoroutineThreadManager::has_queued_above(CoroutinePriority priority) const
+{
+    for (size_t i = 0; i < priority; i++) {
+        if (this->queued_by_priority[i] > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CoroutineThreadManager::dequeue_coroutine(size_t worker_idx, CoroutineThreadManager::CoroutineRuntimeData &coro) {
+    while (this->running) {
+        bool found = false;
+        bool stolen = false;
+        // More urgent coroutines are served first, even if they have to be stolen from another worker
+        for (size_t priority = 0; !found && priority < PRIORITY_NUM; priority++) {
+            if (this->queued_by_priority[priority] == 0) {
+                continue;
+            }
+            found = this->try_pop(worker_idx, static_cast< CoroutinePriority >(priority), false, coro);
+            for (size_t i = 1; !found && i < this->queues.size(); i++) {
+                found = this->try_pop((worker_idx + i) % this->queues.size(), static_cast< CoroutinePriority >(priority), true, coro);
+                stolen = found;
+            }
+        }
+        if (found) {
+            this->queued_coros--;
+            this->queued_by_priority[coro.priority]--;
+            this->running_coros++;
+            this->dispatched_coros++;
+            if (stolen) {
+                this->stolen_coros++;
+            }
+            this->wait_time.add(std::chrono::steady_clock::now() - coro.enqueue_time);
+            return true;
+        }
+        /* Idle workers announce themselves before checking the queued counter, while enqueuers
+         * increment the counter before checking for idle workers; so either the worker sees the
+         * new coroutine or the enqueuer sees the idle worker and wakes it up. */
+        std::unique_lock< std::mutex > lock(this->idle_mutex);
+        this->idle_workers++;
+        while (this->running && this->queued_coros == 0) {
+            this->can_go.wait(lock);
+        }
+        this->idle_workers--;
+    }
+    return false;
+}
+
+CoroutineContext::~CoroutineContext()
+{
+}
+
 bool Coroutine::execute() {
     if (this->coro_impl && *this->coro_impl) {
-        (*this->coro_impl)();
+        if (this->context != nullptr) {
+            this->context->run_slice([this]() {
+                (*this->coro_impl)();
+            });
+        } else {
+            (*this->coro_impl)();
+        }
         return true;
     } else {
         return false;
     }
 }
 
+void Coroutine::set_profile(std::shared_ptr< CoroutineProfile > profile)
+{
+    this->profile = profile;
+}
+
+const std::shared_ptr< CoroutineProfile > &Coroutine::get_profile() const
+{
+    return this->profile;
+}
+
+void Coroutine::set_context(std::shared_ptr< CoroutineContext > context)
+{
+    this->context = context;
+}
+
 Yielder::Yielder(coroutine_push< void > &base_yield) : yield_impl(base_yield) {
 }
 
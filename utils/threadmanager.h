@@ -7,8 +7,11 @@
 #include <chrono>
 #include <vector>
 #include <list>
+#include <deque>
+#include <array>
 #include <atomic>
 #include <queue>
+#include <unordered_map>
 
 #include "platform.h"
 #include "utils.h"
@@ -24,6 +27,66 @@ private:
     coroutine_push< void > &yield_impl;
 };
 
+/*
+ * CPU accounting shared by a class of coroutines (for example, all the
+ * coroutines running a certain strategy). Profiles are registered by name
+ * and never destroyed, so the scheduler can update them without locks.
+ */
+class CoroutineProfile {
+public:
+    static std::shared_ptr< CoroutineProfile > get_profile(const std::string &name);
+    static std::vector< std::shared_ptr< CoroutineProfile > > get_profiles();
+    const std::string &get_name() const;
+    std::chrono::nanoseconds get_cpu_time() const;
+    uint64_t get_slices() const;
+    uint64_t get_samples() const;
+
+private:
+    friend class CoroutineThreadManager;
+
+    CoroutineProfile(const std::string &name);
+
+    const std::string name;
+    std::atomic< std::chrono::nanoseconds::rep > cpu_time;
+    std::atomic< uint64_t > slices;
+    std::atomic< uint64_t > samples;
+};
+
+/*
+ * A histogram of durations with logarithmic buckets, which can be updated
+ * and read concurrently without locks.
+ */
+class DurationHistogram {
+public:
+    // Bucket i counts durations shorter than 2^i microseconds; the last one is unbounded
+    static const size_t BUCKETS_NUM = 24;
+
+    DurationHistogram();
+    void add(std::chrono::steady_clock::duration duration);
+    std::vector< uint64_t > get_buckets() const;
+    uint64_t get_count() const;
+    std::chrono::steady_clock::duration get_total() const;
+    std::chrono::steady_clock::duration get_max() const;
+
+private:
+    std::array< std::atomic< uint64_t >, BUCKETS_NUM + 1 > buckets;
+    std::atomic< uint64_t > count;
+    std::atomic< std::chrono::steady_clock::rep > total;
+    std::atomic< std::chrono::steady_clock::rep > max;
+};
+
+/*
+ * Thread state that a coroutine expects while it runs, such as the temporary
+ * variable scope of its workset. A coroutine can resume on any worker, so the
+ * state is set up again for each time slice.
+ */
+class CoroutineContext {
+public:
+    virtual ~CoroutineContext();
+    // Execute slice with the state of the context
+    virtual void run_slice(const std::function< void() > &slice) = 0;
+};
+
 class Coroutine {
 public:
     Coroutine() : coro_impl() {}
@@ -34,6 +97,11 @@ public:
     void set_body(std::shared_ptr< T > body) {
         this->coro_impl = make_coroutine(body);
     }
+    // Must be set before the coroutine is handed to the scheduler
+    void set_profile(std::shared_ptr< CoroutineProfile > profile);
+    const std::shared_ptr< CoroutineProfile > &get_profile() const;
+    // Must be set before the coroutine is handed to the scheduler
+    void set_context(std::shared_ptr< CoroutineContext > context);
 
 private:
 
@@ -55,6 +123,8 @@ private:
     }
 
     std::unique_ptr< coroutine_pull< void > > coro_impl;
+    std::shared_ptr< CoroutineProfile > profile;
+    std::shared_ptr< CoroutineContext > context;
 };
 
 /*
@@ -77,45 +147,193 @@ std::shared_ptr< Coroutine > make_auto_coroutine(std::shared_ptr< T > body) {
 
 struct CTMComp;
 
+/*
+ * Coroutines belonging to the same group (for example, all the coroutines
+ * spawned by a web session) share a single fair share of the scheduler:
+ * the time slice of each coroutine is the group's quantum divided by the
+ * number of active coroutines in the group.
+ */
+class CoroutineGroup {
+public:
+    CoroutineGroup(unsigned weight = 1);
+    size_t get_active_coros() const;
+    std::chrono::steady_clock::duration get_running_time() const;
+
+private:
+    friend class CoroutineThreadManager;
+
+    const unsigned weight;
+    std::atomic< size_t > active_coros;
+    std::atomic< std::chrono::steady_clock::rep > running_time;
+};
+
+enum CoroutinePriority {
+    PRIORITY_INTERACTIVE = 0,
+    PRIORITY_NORMAL,
+    PRIORITY_BACKGROUND,
+    PRIORITY_NUM,
+};
+
+/*
+ * A token shared by a set of related coroutines: the scheduler reads their
+ * priority each time it enqueues them and drops them as soon as they are
+ * canceled. Long running coroutines should also check is_canceled() after
+ * yielding, so that they do not waste the remainder of their time slice.
+ */
+class CoroutineToken {
+public:
+    CoroutineToken(CoroutinePriority priority = PRIORITY_NORMAL);
+    void cancel();
+    bool is_canceled() const;
+    void set_priority(CoroutinePriority priority);
+    CoroutinePriority get_priority() const;
+
+private:
+    std::atomic< bool > canceled;
+    std::atomic< CoroutinePriority > priority;
+};
+
 class CoroutineThreadManager {
 public:
     struct CoroutineRuntimeData {
-        CoroutineRuntimeData() : coroutine(), running_time(0), budget(0) {}
+        CoroutineRuntimeData() : coroutine(), id(0), running_time(0), budget(0), priority(PRIORITY_NORMAL) {}
 
         std::weak_ptr< Coroutine > coroutine;
+        std::shared_ptr< CoroutineGroup > group;
+        std::shared_ptr< CoroutineToken > token;
+        uint64_t id;
         std::chrono::steady_clock::duration running_time;
         std::chrono::steady_clock::duration budget;
+        std::chrono::steady_clock::time_point enqueue_time;
+        CoroutinePriority priority;
     };
 
     struct CTMComp {
         bool operator()(const std::pair< std::chrono::system_clock::time_point, CoroutineThreadManager::CoroutineRuntimeData > &x, const std::pair< std::chrono::system_clock::time_point, CoroutineThreadManager::CoroutineRuntimeData > &y) const;
     };
 
+    struct ProfileStats {
+        std::string name;
+        std::chrono::nanoseconds cpu_time;
+        uint64_t slices;
+        uint64_t samples;
+    };
+
+    struct HotCoroutine {
+        uint64_t id;
+        std::string name;
+        std::chrono::steady_clock::duration running_time;
+        uint64_t samples;
+    };
+
+    struct Stats {
+        unsigned running_coros;
+        size_t queued_coros;
+        size_t queued_timed_coros;
+        std::vector< size_t > queue_depths;
+        std::vector< size_t > queued_by_priority;
+        uint64_t canceled_coros;
+        uint64_t dispatched_coros;
+        uint64_t stolen_coros;
+        uint64_t yields;
+        double yields_per_second;
+        std::chrono::steady_clock::duration mean_wait_time;
+        std::chrono::steady_clock::duration max_wait_time;
+        std::vector< uint64_t > wait_time_histogram;
+        std::vector< uint64_t > slice_time_histogram;
+        // Sorted by decreasing CPU time
+        std::vector< ProfileStats > profiles;
+        std::chrono::steady_clock::duration sampling_interval;
+        // Sorted by decreasing number of samples
+        std::vector< HotCoroutine > hot_coroutines;
+    };
+
     const std::chrono::steady_clock::duration BUDGET_QUANTUM = std::chrono::milliseconds(100);
+    const std::chrono::steady_clock::duration MIN_BUDGET_QUANTUM = std::chrono::milliseconds(5);
+    const std::chrono::steady_clock::duration RATE_INTERVAL = std::chrono::seconds(1);
+    const size_t MAX_HOT_COROS = 1024;
 
     CoroutineThreadManager(size_t thread_num);
     ~CoroutineThreadManager();
-    void add_coroutine(std::weak_ptr<Coroutine> coro);
-    void add_timed_coroutine(std::weak_ptr<Coroutine> coro, std::chrono::system_clock::duration wait_time);
+    // The process-wide manager, with one worker for each hardware thread
+    static CoroutineThreadManager &get_global();
+    void add_coroutine(std::weak_ptr<Coroutine> coro, std::shared_ptr< CoroutineGroup > group = nullptr, std::shared_ptr< CoroutineToken > token = nullptr);
+    void add_timed_coroutine(std::weak_ptr<Coroutine> coro, std::chrono::system_clock::duration wait_time, std::shared_ptr< CoroutineGroup > group = nullptr, std::shared_ptr< CoroutineToken > token = nullptr);
     void stop();
     void join();
+    // Statistics are read from atomic counters, without taking any scheduler lock
     std::tuple<unsigned, size_t, size_t> get_stats();
+    /* Counters and histograms are atomic; only the profile registry and the sampler state
+     * are read under their own locks, which the workers do not take while scheduling */
+    Stats get_detailed_stats(size_t hot_coros_num = 10);
+    /* While sampling is enabled (i.e., the interval is positive), each worker is periodically
+     * inspected and the coroutine it is executing is charged with a sample, so that the hottest
+     * coroutines can be reported. Enabling sampling forgets previous samples. */
+    void set_sampling_interval(std::chrono::steady_clock::duration interval);
 
 private:
-    void thread_fn();
+    // Each worker has its own queue for each priority; idle workers steal from the others
+    struct WorkerQueue {
+        WorkerQueue() : depth(0) {}
+
+        std::mutex mutex;
+        std::array< std::deque< CoroutineRuntimeData >, PRIORITY_NUM > coros;
+        std::atomic< size_t > depth;
+    };
+
+    /* What each worker is executing, published for the sampler. The fields are written
+     * independently, so a sample might mix up two consecutive coroutines; this is acceptable
+     * for statistical purposes. */
+    struct WorkerActivity {
+        WorkerActivity() : yields(0), coro_id(0), profile(nullptr), running_time(0) {}
+
+        std::atomic< uint64_t > yields;
+        std::atomic< uint64_t > coro_id;
+        std::atomic< CoroutineProfile* > profile;
+        std::atomic< std::chrono::steady_clock::rep > running_time;
+    };
+
+    void thread_fn(size_t worker_idx);
     void timed_fn();
+    void sampler_fn();
+    void take_sample();
+    uint64_t count_yields() const;
     void enqueue_coroutine(CoroutineRuntimeData &&coro, bool reenqueueing);
-    bool dequeue_coroutine(CoroutineRuntimeData &coro);
+    bool dequeue_coroutine(size_t worker_idx, CoroutineRuntimeData &coro);
+    bool try_pop(size_t queue_idx, CoroutinePriority priority, bool steal, CoroutineRuntimeData &coro);
+    bool has_queued_above(CoroutinePriority priority) const;
+    std::chrono::steady_clock::duration compute_quantum(const CoroutineRuntimeData &coro) const;
 
     std::atomic< bool > running;
-    std::mutex obj_mutex;
+    std::vector< std::unique_ptr< WorkerQueue > > queues;
+    std::atomic< size_t > next_queue;
+    std::atomic< size_t > queued_coros;
+    std::array< std::atomic< size_t >, PRIORITY_NUM > queued_by_priority;
+    std::atomic< size_t > idle_workers;
+    std::mutex idle_mutex;
     std::condition_variable can_go;
-    std::list< CoroutineRuntimeData > coros;
     std::atomic< unsigned > running_coros;
     std::vector< std::thread > threads;
 
+    std::atomic< uint64_t > next_coro_id;
+    std::atomic< uint64_t > dispatched_coros;
+    std::atomic< uint64_t > stolen_coros;
+    std::atomic< uint64_t > canceled_coros;
+    DurationHistogram wait_time;
+    DurationHistogram slice_time;
+    std::vector< std::unique_ptr< WorkerActivity > > activities;
+    std::atomic< double > yields_per_second;
+
     std::mutex timed_mutex;
     std::condition_variable timed_cond;
     std::priority_queue< std::pair< std::chrono::system_clock::time_point, CoroutineRuntimeData >, std::vector< std::pair< std::chrono::system_clock::time_point, CoroutineRuntimeData > >, CTMComp > timed_coros;
+    std::atomic< size_t > queued_timed_coros;
     std::unique_ptr< std::thread > timed_thread;
+
+    // The sampler thread also computes the yield rate, so it runs even when sampling is disabled
+    std::mutex sampling_mutex;
+    std::condition_variable sampling_cond;
+    std::chrono::steady_clock::duration sampling_interval;
+    std::unordered_map< uint64_t, HotCoroutine > hot_coros;
+    std::unique_ptr< std::thread > sampler_thread;
 };
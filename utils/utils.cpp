@@ -1,6 +1,8 @@
 
 #include "utils.h"
 
+#include <stdexcept>
+
 #include <boost/crc.hpp>
 #include <boost/type_index.hpp>
 
@@ -65,6 +67,17 @@ void register_main_function(const std::string &name, const std::function< int(in
     get_main_functions().insert(make_pair(name, main_function));
 }
 
+size_t parse_threads_num(const std::string &s) {
+    if (s.empty() || !std::all_of(s.begin(), s.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+        return 0;
+    }
+    try {
+        return std::stoul(s);
+    } catch (const std::out_of_range&) {
+        return 0;
+    }
+}
+
 class HasherCRC32 final : public Hasher {
 public:
     void update(const char *s, std::size_t n) {
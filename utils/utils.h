@@ -70,6 +70,8 @@ void toc(const Tic &t, int reps);
 
 std::map< std::string, std::function< int(int, char*[]) > > &get_main_functions();
 void register_main_function(const std::string &name, const std::function< int(int, char*[]) > &main_function);
+// Parse a number of threads given on the command line; return 0 if s is not a positive decimal number
+size_t parse_threads_num(const std::string &s);
 
 // static_block implementation from https://stackoverflow.com/a/34321324/807307
 #define CONCATENATE(s1, s2) s1##s2
@@ -0,0 +1,111 @@
+#include "events.h"
+
+EventSubscription::EventSubscription(size_t max_events) : max_events(max_events), overflowed(false), closed(false)
+{
+}
+
+void EventSubscription::push(const nlohmann::json &event)
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    if (this->closed || this->overflowed) {
+        return;
+    }
+    if (event.count("step_id") != 0) {
+        auto key = std::make_pair(event.at("event").get< std::string >(), event.at("step_id").get< size_t >());
+        if (!this->pending_steps.insert(key).second) {
+            return;
+        }
+    }
+    if (this->events.size() >= this->max_events) {
+        this->events.clear();
+        this->pending_steps.clear();
+        this->overflowed = true;
+        nlohmann::json overflow = nlohmann::json::object();
+        overflow["event"] = "overflow";
+        this->events.push_back(overflow);
+    } else {
+        this->events.push_back(event);
+    }
+    this->cond.notify_all();
+}
+
+std::vector<nlohmann::json> EventSubscription::pop(std::chrono::steady_clock::duration timeout, size_t max_num)
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (this->events.empty() && !this->closed) {
+        if (this->cond.wait_until(lock, deadline) == std::cv_status::timeout) {
+            break;
+        }
+    }
+    std::vector< nlohmann::json > ret;
+    while (!this->events.empty() && ret.size() < max_num) {
+        auto &event = this->events.front();
+        if (event.count("step_id") != 0) {
+            this->pending_steps.erase(std::make_pair(event.at("event").get< std::string >(), event.at("step_id").get< size_t >()));
+        }
+        ret.push_back(std::move(event));
+        this->events.pop_front();
+    }
+    if (this->events.empty()) {
+        this->overflowed = false;
+    }
+    return ret;
+}
+
+void EventSubscription::close()
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    this->closed = true;
+    this->cond.notify_all();
+}
+
+bool EventSubscription::is_closed()
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    return this->closed;
+}
+
+std::shared_ptr<EventSubscription> EventDispatcher::subscribe()
+{
+    auto ret = std::make_shared< EventSubscription >();
+    std::unique_lock< std::mutex > lock(this->mutex);
+    this->subscriptions.push_back(ret);
+    return ret;
+}
+
+void EventDispatcher::dispatch(const nlohmann::json &event)
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    for (auto it = this->subscriptions.begin(); it != this->subscriptions.end(); ) {
+        auto strong = it->lock();
+        if (strong == nullptr) {
+            it = this->subscriptions.erase(it);
+        } else {
+            strong->push(event);
+            it++;
+        }
+    }
+}
+
+void EventDispatcher::close()
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    for (const auto &sub : this->subscriptions) {
+        auto strong = sub.lock();
+        if (strong != nullptr) {
+            strong->close();
+        }
+    }
+    this->subscriptions.clear();
+}
+
+std::string format_event_stream_batch(const std::vector<nlohmann::json> &events)
+{
+    if (events.empty()) {
+        // A comment line, which keeps proxies from closing the connection
+        return ": keepalive\n\n";
+    }
+    nlohmann::json batch = events;
+    return "data: " + batch.dump() + "\n\n";
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <set>
+#include <list>
+#include <memory>
+
+#include "libs/json.h"
+
+/*
+ * The events of a workset waiting to be delivered to a single client. Events
+ * referring to the same step are coalesced, since the client is going to fetch
+ * the step anyway; if too many events pile up because the client does not
+ * keep up, they are replaced by a single "overflow" event, after which the
+ * client is expected to reload its whole state.
+ */
+class EventSubscription {
+public:
+    EventSubscription(size_t max_events = 4096);
+    void push(const nlohmann::json &event);
+    // Wait until at least an event is available (or the timeout expires), then return up to max_num events
+    std::vector< nlohmann::json > pop(std::chrono::steady_clock::duration timeout, size_t max_num);
+    void close();
+    bool is_closed();
+
+private:
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::list< nlohmann::json > events;
+    std::set< std::pair< std::string, size_t > > pending_steps;
+    size_t max_events;
+    bool overflowed;
+    bool closed;
+};
+
+class EventDispatcher {
+public:
+    std::shared_ptr< EventSubscription > subscribe();
+    void dispatch(const nlohmann::json &event);
+    void close();
+
+private:
+    std::mutex mutex;
+    std::list< std::weak_ptr< EventSubscription > > subscriptions;
+};
+
+// Format a batch of events as a server-sent event
+std::string format_event_stream_batch(const std::vector< nlohmann::json > &events);
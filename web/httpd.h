@@ -53,6 +53,20 @@ private:
     bool answered;
 };
 
+// Answer with the chunks returned by a function, until it returns an empty string
+class HTTPFunctionAnswerer : public HTTPAnswerer {
+public:
+    HTTPFunctionAnswerer(const std::function< std::string() > &producer) : producer(producer) {
+    }
+
+    std::string answer() {
+        return this->producer();
+    }
+
+private:
+    std::function< std::string() > producer;
+};
+
 class HTTPFileAnswerer : public HTTPAnswerer {
 public:
     HTTPFileAnswerer(std::shared_ptr< std::istream > infile) : infile(infile) {
@@ -73,6 +87,20 @@ private:
     std::shared_ptr< std::istream > infile;
 };
 
+// A file answerer that also knows where the file is, so that backends can send it directly from the filesystem
+class HTTPPathAnswerer : public HTTPFileAnswerer {
+public:
+    HTTPPathAnswerer(std::shared_ptr< std::istream > infile, const std::string &path) : HTTPFileAnswerer(infile), path(path) {
+    }
+
+    const std::string &get_path() const {
+        return this->path;
+    }
+
+private:
+    std::string path;
+};
+
 class HTTPPostIterator {
 public:
     virtual ~HTTPPostIterator() {}
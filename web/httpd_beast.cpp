@@ -1,56 +1,662 @@
+#include "httpd_beast.h"
+
+#include <future>
+#include <sstream>
+#include <iomanip>
 
 #include <boost/beast.hpp>
-#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/ip/v6_only.hpp>
+#include <boost/algorithm/string.hpp>
 
-#include "httpd_beast.h"
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "utils/utils.h"
 
-void handle_connection(boost::asio::ip::tcp::socket socket) {
-    boost::system::error_code ec;
-    boost::beast::flat_buffer buffer;
-    bool close = false;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+namespace net = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+static const size_t MAX_BODY_SIZE = 50*1024*1024;
+static const auto KEEP_ALIVE_TIMEOUT = std::chrono::seconds(60);
+static const std::string METRICS_URL = "/metrics";
+
+static std::string url_decode(const std::string &s, bool plus_is_space)
+{
+    std::string ret;
+    ret.reserve(s.size());
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '%' && i + 2 < s.size() && isxdigit(s[i+1]) && isxdigit(s[i+2])) {
+            ret.push_back(static_cast< char >(std::stoi(s.substr(i+1, 2), nullptr, 16)));
+            i += 2;
+        } else if (s[i] == '+' && plus_is_space) {
+            ret.push_back(' ');
+        } else {
+            ret.push_back(s[i]);
+        }
+    }
+    return ret;
+}
+
+static bool is_local_address(const net::ip::address &addr)
+{
+    if (addr.is_loopback()) {
+        return true;
+    }
+    // The acceptor is dual stack, so IPv4 clients appear as mapped addresses
+    if (addr.is_v6() && addr.to_v6().is_v4_mapped()) {
+        return net::ip::make_address_v4(net::ip::v4_mapped, addr.to_v6()).is_loopback();
+    }
+    return false;
+}
+
+std::string HTTPMetrics::normalize_endpoint(const std::string &url)
+{
+    std::vector< std::string > parts;
+    boost::split(parts, url, boost::is_any_of("/"));
+    std::string ret;
+    for (const auto &part : parts) {
+        if (part.empty()) {
+            continue;
+        }
+        if (ret == "/static") {
+            return "/static/*";
+        }
+        if (std::all_of(part.begin(), part.end(), [](char c) { return isdigit(c); })) {
+            ret += "/:n";
+        } else if (part.size() > 32) {
+            ret += "/:token";
+        } else {
+            ret += "/" + part;
+        }
+    }
+    return ret.empty() ? "/" : ret;
+}
+
+void HTTPMetrics::begin_request(const std::string &endpoint)
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    this->endpoints[endpoint].in_flight++;
+}
+
+void HTTPMetrics::end_request(const std::string &endpoint, std::chrono::steady_clock::duration duration)
+{
+    auto us = std::chrono::duration_cast< std::chrono::microseconds >(duration).count();
+    size_t bucket = 0;
+    while (bucket < BUCKETS_NUM && us > (100ll << bucket)) {
+        bucket++;
+    }
+    std::unique_lock< std::mutex > lock(this->mutex);
+    auto &metrics = this->endpoints[endpoint];
+    metrics.in_flight--;
+    metrics.count++;
+    metrics.total_time += duration;
+    metrics.buckets[bucket]++;
+}
+
+std::string HTTPMetrics::to_text()
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    std::ostringstream in_flight;
+    std::ostringstream latency;
+    in_flight << "# HELP webmmpp_http_requests_in_flight Requests being served, by endpoint\n";
+    in_flight << "# TYPE webmmpp_http_requests_in_flight gauge\n";
+    latency << "# HELP webmmpp_http_request_duration_seconds Time between receiving a request and finishing to send the answer, by endpoint\n";
+    latency << "# TYPE webmmpp_http_request_duration_seconds histogram\n";
+    latency << std::setprecision(6);
+    for (const auto &endpoint : this->endpoints) {
+        std::string label = "endpoint=\"" + boost::replace_all_copy(boost::replace_all_copy(endpoint.first, "\\", "\\\\"), "\"", "\\\"") + "\"";
+        const auto &metrics = endpoint.second;
+        in_flight << "webmmpp_http_requests_in_flight{" << label << "} " << metrics.in_flight << "\n";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < BUCKETS_NUM; i++) {
+            cumulative += metrics.buckets[i];
+            latency << "webmmpp_http_request_duration_seconds_bucket{" << label << ",le=\"" << 1e-4 * static_cast< double >(1ll << i) << "\"} " << cumulative << "\n";
+        }
+        latency << "webmmpp_http_request_duration_seconds_bucket{" << label << ",le=\"+Inf\"} " << metrics.count << "\n";
+        latency << "webmmpp_http_request_duration_seconds_sum{" << label << "} " << std::chrono::duration< double >(metrics.total_time).count() << "\n";
+        latency << "webmmpp_http_request_duration_seconds_count{" << label << "} " << metrics.count << "\n";
+    }
+    return in_flight.str() + latency.str();
+}
+
+/*
+ * A keep-alive connection. Everything touching the stream runs on the
+ * connection's strand; the target is called on the server's worker pool and
+ * streams are produced on a dedicated thread, which post their results back
+ * to the strand.
+ */
+class BeastConnection : public std::enable_shared_from_this< BeastConnection > {
+public:
+    BeastConnection(HTTPD_beast &server, tcp::socket &&socket, bool local) : server(server), stream(std::move(socket)), local(local) {
+    }
+
+    void run() {
+        net::dispatch(this->stream.get_executor(), [self=this->shared_from_this()]() {
+            self->do_read();
+        });
+    }
+
+private:
+    void do_read() {
+        this->parser = std::make_unique< http::request_parser< http::string_body > >();
+        this->parser->body_limit(MAX_BODY_SIZE);
+        this->stream.expires_after(KEEP_ALIVE_TIMEOUT);
+        http::async_read(this->stream, this->buffer, *this->parser, [self=this->shared_from_this()](beast::error_code ec, size_t) {
+            self->on_read(ec);
+        });
+    }
+
+    void on_read(beast::error_code ec) {
+        if (ec == http::error::end_of_stream) {
+            this->do_close();
+            return;
+        }
+        if (ec) {
+            return;
+        }
+        auto req = this->parser->release();
+        this->keep_alive = req.keep_alive();
+        this->version = req.version();
+        std::string target(req.target());
+        std::string url = url_decode(target.substr(0, target.find('?')), false);
+        if (url == METRICS_URL && req.method() == http::verb::get && this->local) {
+            this->send_string(200, { { "Content-Type", "text/plain; version=0.0.4" } }, this->server.metrics.to_text());
+            return;
+        }
+
+        this->endpoint = HTTPMetrics::normalize_endpoint(url);
+        this->start_time = std::chrono::steady_clock::now();
+        this->server.metrics.begin_request(this->endpoint);
+        std::unordered_map< std::string, std::string > req_headers;
+        for (const auto &field : req) {
+            auto &value = req_headers[std::string(field.name_string())];
+            value += (value.empty() ? "" : ", ") + std::string(field.value());
+        }
+        std::string version_str = this->version == 10 ? "HTTP/1.0" : "HTTP/1.1";
+        this->cb = std::make_unique< HTTPCallback_beast >(url, std::string(req.method_string()), version_str, std::move(req_headers));
+        // Handlers can take long, and streams can last indefinitely
+        this->stream.expires_never();
+        std::string content_type(req[http::field::content_type]);
+        net::post(*this->server.workers, [self=this->shared_from_this(),content_type,body=std::move(req.body())]() {
+            self->handle(content_type, body);
+        });
+    }
+
+    // Called on the worker pool
+    void handle(const std::string &content_type, const std::string &body) {
+        try {
+            this->server.target.answer(*this->cb);
+            if (!this->cb->get_send_response() && this->cb->get_post_iterator() != nullptr) {
+                this->cb->process_post_data(content_type, body);
+                this->cb->get_post_iterator()->finish();
+            }
+        } catch (...) {
+            default_exception_handler(std::current_exception());
+            this->post_string(500, { { "Content-Type", "text/plain" } }, "500 Internal Server Error");
+            return;
+        }
+        auto &answerer = this->cb->get_answerer();
+        if (auto string_answerer = dynamic_cast< HTTPStringAnswerer* >(answerer.get())) {
+            this->post_string(this->cb->get_status_code(), this->cb->get_headers(), string_answerer->answer());
+#if defined(__linux__)
+        } else if (auto path_answerer = dynamic_cast< HTTPPathAnswerer* >(answerer.get())) {
+            net::post(this->stream.get_executor(), [self=this->shared_from_this(),path=path_answerer->get_path()]() {
+                self->send_file(path);
+            });
+#endif
+        } else {
+            net::post(this->stream.get_executor(), [self=this->shared_from_this()]() {
+                self->send_stream();
+            });
+        }
+    }
+
+    void post_string(unsigned int status_code, const std::vector< std::pair< std::string, std::string > > &headers, std::string &&body) {
+        net::post(this->stream.get_executor(), [self=this->shared_from_this(),status_code,headers,body=std::move(body)]() mutable {
+            self->send_string(status_code, headers, std::move(body));
+        });
+    }
+
+    template< typename Body >
+    void fill_header(http::response< Body > &res, unsigned int status_code, const std::vector< std::pair< std::string, std::string > > &headers) {
+        res.version(this->version);
+        res.result(status_code);
+        res.set(http::field::server, "webmmpp");
+        for (const auto &header : headers) {
+            res.insert(header.first, header.second);
+        }
+        res.keep_alive(this->keep_alive);
+    }
+
+    void send_string(unsigned int status_code, const std::vector< std::pair< std::string, std::string > > &headers, std::string &&body) {
+        auto res = std::make_shared< http::response< http::string_body > >();
+        this->fill_header(*res, status_code, headers);
+        res->body() = std::move(body);
+        res->prepare_payload();
+        http::async_write(this->stream, *res, [self=this->shared_from_this(),res](beast::error_code ec, size_t) {
+            self->finish_response(ec, res->need_eof());
+        });
+    }
+
+#if defined(__linux__)
+    void send_file(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            this->send_string(404, { { "Content-Type", "text/plain" } }, "404 Not Found");
+            return;
+        }
+        auto res = std::make_shared< http::response< http::empty_body > >();
+        this->fill_header(*res, this->cb->get_status_code(), this->cb->get_headers());
+        res->content_length(st.st_size);
+        auto sr = std::make_shared< http::response_serializer< http::empty_body > >(*res);
+        http::async_write_header(this->stream, *sr, [self=this->shared_from_this(),res,sr,fd,size=st.st_size](beast::error_code ec, size_t) {
+            if (ec) {
+                ::close(fd);
+                self->finish_response(ec, true);
+                return;
+            }
+            self->stream.socket().native_non_blocking(true);
+            self->do_sendfile(fd, 0, size, res->need_eof());
+        });
+    }
+
+    // The kernel copies the file to the socket, without passing through user space
+    void do_sendfile(int fd, off_t offset, off_t size, bool need_eof) {
+        auto &socket = this->stream.socket();
+        while (offset < size) {
+            ssize_t res = ::sendfile(socket.native_handle(), fd, &offset, size - offset);
+            if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                socket.async_wait(tcp::socket::wait_write, [self=this->shared_from_this(),fd,offset,size,need_eof](beast::error_code ec) {
+                    if (ec) {
+                        ::close(fd);
+                        self->finish_response(ec, true);
+                        return;
+                    }
+                    self->do_sendfile(fd, offset, size, need_eof);
+                });
+                return;
+            }
+            if (res <= 0) {
+                ::close(fd);
+                this->finish_response(beast::error_code(errno, beast::system_category()), true);
+                return;
+            }
+        }
+        ::close(fd);
+        this->finish_response({}, need_eof);
+    }
+#endif
+
+    void send_stream() {
+        auto res = std::make_shared< http::response< http::empty_body > >();
+        this->fill_header(*res, this->cb->get_status_code(), this->cb->get_headers());
+        bool chunked = this->cb->get_size() == static_cast< uint64_t >(-1);
+        if (chunked) {
+            res->chunked(true);
+        } else {
+            res->content_length(this->cb->get_size());
+        }
+        auto sr = std::make_shared< http::response_serializer< http::empty_body > >(*res);
+        http::async_write_header(this->stream, *sr, [self=this->shared_from_this(),res,sr,chunked](beast::error_code ec, size_t) {
+            if (ec) {
+                self->finish_response(ec, true);
+                return;
+            }
+            bool need_eof = res->need_eof();
+            if (!self->server.stream_started()) {
+                self->finish_response(net::error::operation_aborted, true);
+                return;
+            }
+            std::thread([self,chunked,need_eof]() mutable {
+                HTTPD_beast &server = self->server;
+                self->produce_stream(chunked, need_eof);
+                // Release the connection before the server is allowed to destroy the I/O context
+                self.reset();
+                server.stream_finished();
+            }).detach();
+        });
+    }
+
+    // Runs on its own thread, since answerers of streams may block waiting for content
+    void produce_stream(bool chunked, bool need_eof) {
+        beast::error_code ec;
+        bool finished = false;
+        while (!finished && !ec) {
+            auto chunk = std::make_shared< std::string >();
+            try {
+                *chunk = this->cb->get_answerer()->answer();
+            } catch (...) {
+                default_exception_handler(std::current_exception());
+                ec = net::error::operation_aborted;
+                break;
+            }
+            finished = chunk->empty();
+            auto promise = std::make_shared< std::promise< beast::error_code > >();
+            auto future = promise->get_future();
+            net::post(this->stream.get_executor(), [self=this->shared_from_this(),chunk,chunked,promise]() {
+                auto handler = [promise,chunk](beast::error_code ec, size_t) {
+                    promise->set_value(ec);
+                };
+                if (chunk->empty()) {
+                    if (chunked) {
+                        net::async_write(self->stream, http::make_chunk_last(), handler);
+                    } else {
+                        promise->set_value({});
+                    }
+                } else if (chunked) {
+                    auto body = std::make_shared< http::chunk_body< net::const_buffer > >(http::make_chunk(net::const_buffer(chunk->data(), chunk->size())));
+                    net::async_write(self->stream, *body, [handler,body](beast::error_code ec, size_t size) {
+                        handler(ec, size);
+                    });
+                } else {
+                    net::async_write(self->stream, net::buffer(*chunk), handler);
+                }
+            });
+            // When the server is stopping the I/O threads may never run the write
+            while (future.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout) {
+                if (this->server.stopping) {
+                    return;
+                }
+            }
+            ec = future.get();
+        }
+        net::post(this->stream.get_executor(), [self=this->shared_from_this(),ec,need_eof]() {
+            self->finish_response(ec, need_eof || ec);
+        });
+    }
+
+    void finish_response(beast::error_code ec, bool close) {
+        if (!this->endpoint.empty()) {
+            this->server.metrics.end_request(this->endpoint, std::chrono::steady_clock::now() - this->start_time);
+            this->endpoint.clear();
+        }
+        this->cb.reset();
+        if (ec) {
+            return;
+        }
+        if (close) {
+            this->do_close();
+        } else {
+            this->do_read();
+        }
+    }
+
+    void do_close() {
+        beast::error_code ec;
+        this->stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+    }
+
+    HTTPD_beast &server;
+    beast::tcp_stream stream;
+    bool local;
+    beast::flat_buffer buffer;
+    std::unique_ptr< http::request_parser< http::string_body > > parser;
+    bool keep_alive = false;
+    unsigned version = 11;
+    std::unique_ptr< HTTPCallback_beast > cb;
+    std::string endpoint;
+    std::chrono::steady_clock::time_point start_time;
+};
 
-    while (!close) {
-        boost::beast::http::request< boost::beast::http::string_body > req;
-        boost::beast::http::read(socket, buffer, req, ec);
-        if (ec == boost::beast::http::error::end_of_stream) {
-            break;
+HTTPD_beast::HTTPD_beast(int port, HTTPTarget &target, bool restrict_to_localhost, size_t io_threads_num, size_t workers_num) :
+    port(port), target(target), restrict_to_localhost(restrict_to_localhost), io_threads_num(io_threads_num), workers_num(workers_num),
+    running(false), stopping(false), active_streams(0)
+{
+}
+
+void HTTPD_beast::start()
+{
+    std::unique_lock< std::mutex > lock(this->daemon_mutex);
+    if (this->running) {
+        return;
+    }
+    this->ioc = std::make_unique< net::io_context >(static_cast< int >(this->io_threads_num));
+    try {
+        this->acceptor = std::make_unique< tcp::acceptor >(*this->ioc);
+        tcp::endpoint endpoint(tcp::v6(), static_cast< unsigned short >(this->port));
+        this->acceptor->open(endpoint.protocol());
+        this->acceptor->set_option(net::ip::v6_only(false));
+        this->acceptor->set_option(net::socket_base::reuse_address(true));
+        this->acceptor->bind(endpoint);
+        this->acceptor->listen(net::socket_base::max_listen_connections);
+    } catch (boost::system::system_error &e) {
+        this->acceptor.reset();
+        this->ioc.reset();
+        throw std::string("Could not start httpd daemon: ") + e.what();
+    }
+    this->workers = std::make_unique< net::thread_pool >(this->workers_num);
+    this->do_accept();
+    for (size_t i = 0; i < this->io_threads_num; i++) {
+        this->io_threads.emplace_back([this]() {
+            this->ioc->run();
+        });
+    }
+    this->running = true;
+    this->daemon_cv.notify_all();
+}
+
+void HTTPD_beast::do_accept()
+{
+    this->acceptor->async_accept(net::make_strand(*this->ioc), [this](beast::error_code ec, tcp::socket socket) {
+        if (!ec) {
+            beast::error_code ec2;
+            auto remote = socket.remote_endpoint(ec2);
+            bool local = !ec2 && is_local_address(remote.address());
+            if (!ec2 && (local || !this->restrict_to_localhost)) {
+                std::make_shared< BeastConnection >(*this, std::move(socket), local)->run();
+            }
+        }
+        if (this->acceptor->is_open()) {
+            this->do_accept();
         }
-        assert(!ec);
-        boost::beast::http::string_body::value_type body = "Test";
-        auto size = body.size();
-        boost::beast::http::response< boost::beast::http::string_body > res(std::piecewise_construct, std::make_tuple(std::move(body)), std::make_tuple(boost::beast::http::status::ok, req.version()));
-        res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(boost::beast::http::field::content_type, "text/plain");
-        res.content_length(size);
-        res.keep_alive(req.keep_alive());
-        close = res.need_eof();
-        boost::beast::http::write(socket, res, ec);
-        assert(!ec);
+    });
+}
+
+void HTTPD_beast::stop()
+{
+    std::unique_lock< std::mutex > lock(this->daemon_mutex);
+    if (!this->running) {
+        return;
+    }
+    this->stopping = true;
+    net::post(*this->ioc, [this]() {
+        beast::error_code ec;
+        this->acceptor->close(ec);
+    });
+    // Producers notice that we are stopping as soon as their answerer returns
+    while (this->active_streams != 0) {
+        this->daemon_cv.wait(lock);
+    }
+    this->workers->join();
+    this->ioc->stop();
+    for (auto &thread : this->io_threads) {
+        thread.join();
     }
+    this->io_threads.clear();
+    this->workers.reset();
+    this->acceptor.reset();
+    this->ioc.reset();
+    this->running = false;
+    this->stopping = false;
+    this->daemon_cv.notify_all();
+}
+
+void HTTPD_beast::join()
+{
+    std::unique_lock< std::mutex > lock(this->daemon_mutex);
+    while (this->running) {
+        this->daemon_cv.wait(lock);
+    }
+}
+
+bool HTTPD_beast::is_running()
+{
+    std::unique_lock< std::mutex > lock(this->daemon_mutex);
+    return this->running;
+}
+
+HTTPD_beast::~HTTPD_beast()
+{
+    this->stop();
+}
+
+HTTPMetrics &HTTPD_beast::get_metrics()
+{
+    return this->metrics;
+}
+
+bool HTTPD_beast::stream_started()
+{
+    std::unique_lock< std::mutex > lock(this->daemon_mutex);
+    if (this->stopping) {
+        return false;
+    }
+    this->active_streams++;
+    return true;
+}
+
+void HTTPD_beast::stream_finished()
+{
+    std::unique_lock< std::mutex > lock(this->daemon_mutex);
+    this->active_streams--;
+    this->daemon_cv.notify_all();
+}
+
+HTTPCallback_beast::HTTPCallback_beast(const std::string &url, const std::string &method, const std::string &version, std::unordered_map<std::string, std::string> &&req_headers) :
+    url(url), method(method), version(version), req_headers(std::move(req_headers)), cookies_extracted(false), status_code(200),
+    answerer(std::make_unique< HTTPStringAnswerer >()), size(-1), send_response(false)
+{
+}
 
-    socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+void HTTPCallback_beast::set_status_code(unsigned int status_code)
+{
+    this->status_code = status_code;
+    this->send_response = true;
 }
 
-int beast_main(int argc, char *argv[]) {
-    (void) argc;
-    (void) argv;
+void HTTPCallback_beast::add_header(std::string header, std::string content)
+{
+    this->headers.push_back(std::make_pair(header, content));
+}
 
-    const auto address = boost::asio::ip::make_address_v6("::ffff:127.0.0.1");
-    const short port = 8080;
+void HTTPCallback_beast::set_post_iterator(std::unique_ptr<HTTPPostIterator> &&post_iterator)
+{
+    this->post_iterator = std::move(post_iterator);
+}
+
+void HTTPCallback_beast::set_answerer(std::unique_ptr<HTTPAnswerer> &&answerer)
+{
+    this->answerer = std::move(answerer);
+}
+
+void HTTPCallback_beast::set_answer(std::string &&answer)
+{
+    this->answerer = std::make_unique< HTTPStringAnswerer >(answer);
+}
+
+void HTTPCallback_beast::set_size(uint64_t size)
+{
+    this->size = size;
+}
+
+const std::string &HTTPCallback_beast::get_url()
+{
+    return this->url;
+}
+
+const std::string &HTTPCallback_beast::get_method()
+{
+    return this->method;
+}
+
+const std::string &HTTPCallback_beast::get_version()
+{
+    return this->version;
+}
+
+const std::unordered_map<std::string, std::string> &HTTPCallback_beast::get_request_headers()
+{
+    return this->req_headers;
+}
 
-    boost::asio::io_context ioc;
-    boost::asio::ip::tcp::acceptor acceptor(ioc, {address, port});
-    std::list< std::thread > children_threads;
-    while (true) {
-        boost::asio::ip::tcp::socket socket(ioc);
-        acceptor.accept(socket);
-        children_threads.emplace_back([socket=std::move(socket)]() mutable { handle_connection(std::move(socket)); });
+const std::unordered_map<std::string, std::string> &HTTPCallback_beast::get_cookies()
+{
+    if (!this->cookies_extracted) {
+        this->cookies_extracted = true;
+        for (const auto &header : this->req_headers) {
+            if (!boost::iequals(header.first, "Cookie")) {
+                continue;
+            }
+            std::vector< std::string > pairs;
+            boost::split(pairs, header.second, boost::is_any_of(";"));
+            for (const auto &pair : pairs) {
+                auto eq_pos = pair.find('=');
+                if (eq_pos == std::string::npos) {
+                    continue;
+                }
+                this->cookies[boost::trim_copy(pair.substr(0, eq_pos))] = boost::trim_copy(pair.substr(eq_pos + 1));
+            }
+        }
     }
+    return this->cookies;
+}
+
+unsigned int HTTPCallback_beast::get_status_code() const
+{
+    return this->status_code;
+}
+
+const std::vector<std::pair<std::string, std::string> > &HTTPCallback_beast::get_headers() const
+{
+    return this->headers;
+}
+
+std::unique_ptr<HTTPAnswerer> &HTTPCallback_beast::get_answerer()
+{
+    return this->answerer;
+}
 
-    return 0;
+std::unique_ptr<HTTPPostIterator> &HTTPCallback_beast::get_post_iterator()
+{
+    return this->post_iterator;
 }
-static_block {
-    register_main_function("beast", beast_main);
+
+uint64_t HTTPCallback_beast::get_size() const
+{
+    return this->size;
+}
+
+bool HTTPCallback_beast::get_send_response() const
+{
+    return this->send_response;
+}
+
+void HTTPCallback_beast::process_post_data(const std::string &content_type, const std::string &data)
+{
+    if (!content_type.empty() && !boost::istarts_with(content_type, "application/x-www-form-urlencoded")) {
+        return;
+    }
+    std::vector< std::string > pairs;
+    boost::split(pairs, data, boost::is_any_of("&"));
+    for (const auto &pair : pairs) {
+        if (pair.empty()) {
+            continue;
+        }
+        auto eq_pos = pair.find('=');
+        std::string key = url_decode(pair.substr(0, eq_pos), true);
+        std::string value = eq_pos == std::string::npos ? "" : url_decode(pair.substr(eq_pos + 1), true);
+        this->post_iterator->receive(key, "", "", "", value, 0);
+    }
 }
@@ -1 +1,129 @@
 #pragma once
+
+#include "web/httpd.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <map>
+#include <chrono>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+/*
+ * Latency histograms and in-flight counters for each endpoint. URLs are
+ * normalized to endpoints by replacing numeric and opaque path components,
+ * so that for example all steps of all worksets share the same series.
+ */
+class HTTPMetrics {
+public:
+    // Bucket i counts requests taking at most 100us * 2^i; the last one is unbounded
+    static const size_t BUCKETS_NUM = 20;
+
+    static std::string normalize_endpoint(const std::string &url);
+    void begin_request(const std::string &endpoint);
+    void end_request(const std::string &endpoint, std::chrono::steady_clock::duration duration);
+    // Prometheus text exposition format
+    std::string to_text();
+
+private:
+    struct EndpointMetrics {
+        uint64_t in_flight = 0;
+        uint64_t count = 0;
+        std::chrono::steady_clock::duration total_time = std::chrono::steady_clock::duration::zero();
+        std::array< uint64_t, BUCKETS_NUM + 1 > buckets = {};
+    };
+
+    std::mutex mutex;
+    std::map< std::string, EndpointMetrics > endpoints;
+};
+
+/*
+ * An asynchronous HTTP/1.1 server on Boost.Beast. Connections are served by a
+ * few I/O threads and kept alive between requests; the target is called on a
+ * bounded pool of worker threads, since handlers (and in particular WaitForPost
+ * callbacks) are allowed to block. Streams of unknown length get their own
+ * producer thread, because they are expected to live long. Static files are
+ * sent with sendfile() where available. Metrics are served at /metrics to
+ * local clients.
+ */
+class HTTPD_beast : public HTTPD {
+public:
+    HTTPD_beast(int port, HTTPTarget &target, bool restrict_to_localhost, size_t io_threads_num = 2, size_t workers_num = 16);
+    void start();
+    void stop();
+    void join();
+    bool is_running();
+    ~HTTPD_beast();
+
+    HTTPMetrics &get_metrics();
+
+private:
+    friend class BeastConnection;
+
+    void do_accept();
+    // Return false if the server is stopping, in which case the stream must not be started
+    bool stream_started();
+    void stream_finished();
+
+    int port;
+    HTTPTarget &target;
+    bool restrict_to_localhost;
+    size_t io_threads_num;
+    size_t workers_num;
+
+    std::mutex daemon_mutex;
+    std::condition_variable daemon_cv;
+    bool running;
+    std::atomic< bool > stopping;
+    size_t active_streams;
+    std::unique_ptr< boost::asio::io_context > ioc;
+    std::unique_ptr< boost::asio::ip::tcp::acceptor > acceptor;
+    std::unique_ptr< boost::asio::thread_pool > workers;
+    std::vector< std::thread > io_threads;
+    HTTPMetrics metrics;
+};
+
+class HTTPCallback_beast : public HTTPCallback {
+public:
+    HTTPCallback_beast(const std::string &url, const std::string &method, const std::string &version, std::unordered_map< std::string, std::string > &&req_headers);
+    void set_status_code(unsigned int status_code);
+    void add_header(std::string header, std::string content);
+    void set_post_iterator(std::unique_ptr< HTTPPostIterator > &&post_iterator);
+    void set_answerer(std::unique_ptr< HTTPAnswerer > &&answerer);
+    void set_answer(std::string &&answer);
+    void set_size(uint64_t size);
+
+    const std::string &get_url();
+    const std::string &get_method();
+    const std::string &get_version();
+    const std::unordered_map< std::string, std::string > &get_request_headers();
+    const std::unordered_map< std::string, std::string > &get_cookies();
+
+    unsigned int get_status_code() const;
+    const std::vector< std::pair< std::string, std::string > > &get_headers() const;
+    std::unique_ptr< HTTPAnswerer > &get_answerer();
+    std::unique_ptr< HTTPPostIterator > &get_post_iterator();
+    uint64_t get_size() const;
+    bool get_send_response() const;
+    // Only application/x-www-form-urlencoded bodies are decoded
+    void process_post_data(const std::string &content_type, const std::string &data);
+
+private:
+    std::string url;
+    std::string method;
+    std::string version;
+    std::unordered_map< std::string, std::string > req_headers;
+    bool cookies_extracted;
+    std::unordered_map< std::string, std::string > cookies;
+    unsigned int status_code;
+    std::vector< std::pair< std::string, std::string > > headers;
+    std::unique_ptr< HTTPAnswerer > answerer;
+    std::unique_ptr< HTTPPostIterator > post_iterator;
+    uint64_t size;
+    bool send_response;
+};
@@ -104,3 +104,38 @@ nlohmann::json jsonize(Step &step)
     }
     return ret;
 }
+
+static std::chrono::microseconds::rep to_us(std::chrono::nanoseconds duration)
+{
+    return std::chrono::duration_cast< std::chrono::microseconds >(duration).count();
+}
+
+nlohmann::json jsonize(const CoroutineThreadManager::Stats &stats)
+{
+    nlohmann::json ret = nlohmann::json::object();
+    ret["running_coros"] = stats.running_coros;
+    ret["queued_coros"] = stats.queued_coros;
+    ret["queued_timed_coros"] = stats.queued_timed_coros;
+    ret["queue_depths"] = stats.queue_depths;
+    ret["queued_by_priority"] = stats.queued_by_priority;
+    ret["canceled_coros"] = stats.canceled_coros;
+    ret["dispatched_coros"] = stats.dispatched_coros;
+    ret["stolen_coros"] = stats.stolen_coros;
+    ret["yields"] = stats.yields;
+    ret["yields_per_second"] = stats.yields_per_second;
+    ret["mean_wait_time_us"] = to_us(stats.mean_wait_time);
+    ret["max_wait_time_us"] = to_us(stats.max_wait_time);
+    // Bucket i counts durations shorter than 2^i microseconds
+    ret["wait_time_histogram"] = stats.wait_time_histogram;
+    ret["slice_time_histogram"] = stats.slice_time_histogram;
+    ret["profiles"] = nlohmann::json::array();
+    for (const auto &profile : stats.profiles) {
+        ret["profiles"].push_back({ { "name", profile.name }, { "cpu_time_us", to_us(profile.cpu_time) }, { "slices", profile.slices }, { "samples", profile.samples } });
+    }
+    ret["sampling_interval_us"] = to_us(stats.sampling_interval);
+    ret["hot_coroutines"] = nlohmann::json::array();
+    for (const auto &coro : stats.hot_coroutines) {
+        ret["hot_coroutines"].push_back({ { "id", coro.id }, { "name", coro.name }, { "running_time_us", to_us(coro.running_time) }, { "samples", coro.samples } });
+    }
+    return ret;
+}
@@ -3,13 +3,16 @@
 #include "libs/json.h"
 #include "mm/library.h"
 #include "step.h"
+#include "utils/threadmanager.h"
 
 template< typename TokType >
 decltype(auto) tok_to_int_vect(const std::vector< TokType > &x) {
     return vector_map(x.begin(), x.end(), [](const auto &x) { return x.val(); });
 }
 
+std::vector< std::string > fix_htmldefs_for_web(const std::vector< std::string > &htmldefs);
 nlohmann::json jsonize(const ExtendedLibraryAddendum &addendum);
 nlohmann::json jsonize(const Assertion &assertion);
 nlohmann::json jsonize(const ProofTree< Sentence > &proof_tree);
 nlohmann::json jsonize(Step &step);
+nlohmann::json jsonize(const CoroutineThreadManager::Stats &stats);
@@ -0,0 +1,136 @@
+#include "libcontext.h"
+
+#include <zlib.h>
+
+#include "jsonize.h"
+#include "utils/utils.h"
+
+std::mutex LibraryContext::cache_mutex;
+std::unordered_map< const ExtendedLibrary*, std::weak_ptr< const LibraryContext > > LibraryContext::cache;
+
+template< typename TokType >
+static std::vector< std::string > map_to_vect(const std::unordered_map< TokType, std::string > &m) {
+    std::vector< std::string > ret;
+    ret.resize(m.size()+1);
+    for (auto &i : m) {
+        ret[i.first.val()] = i.second;
+    }
+    return ret;
+}
+
+std::shared_ptr< const LibraryContext > LibraryContext::get_context(const std::shared_ptr< const ExtendedLibrary > &library)
+{
+    std::unique_lock< std::mutex > lock(cache_mutex);
+    auto it = cache.find(library.get());
+    if (it != cache.end()) {
+        auto ret = it->second.lock();
+        if (ret != nullptr) {
+            return ret;
+        }
+    }
+    // Expired entries are swept here, since a different library may have been allocated at the same address
+    for (auto it2 = cache.begin(); it2 != cache.end(); ) {
+        if (it2->second.expired()) {
+            it2 = cache.erase(it2);
+        } else {
+            it2++;
+        }
+    }
+    // The lock is kept while serializing, so that concurrent loads do not duplicate the work
+    std::shared_ptr< const LibraryContext > ret(new LibraryContext(library));
+    cache[library.get()] = ret;
+    return ret;
+}
+
+LibraryContext::LibraryContext(const std::shared_ptr< const ExtendedLibrary > &library) : library(library)
+{
+    nlohmann::json ret;
+    ret["symbols"] = map_to_vect(library->get_symbols());
+    ret["labels"] = map_to_vect(library->get_labels());
+    ret["addendum"] = jsonize(library->get_addendum());
+    ret["max_number"] = library->get_max_number().val();
+    this->json = ret.dump();
+    this->gzipped = gzip_compress(this->json);
+    HashSink hasher;
+    hasher.write(this->json.data(), this->json.size());
+    this->etag = "\"" + hasher.get_digest() + "-" + std::to_string(this->json.size()) + "\"";
+}
+
+const std::string &LibraryContext::get_etag() const
+{
+    return this->etag;
+}
+
+const std::string &LibraryContext::get_json() const
+{
+    return this->json;
+}
+
+const std::string &LibraryContext::get_gzipped() const
+{
+    return this->gzipped;
+}
+
+nlohmann::json get_labels_range(const ExtendedLibrary &library, size_t begin, size_t end)
+{
+    end = std::min(end, library.get_labels_num() + 1);
+    begin = std::min(begin, end);
+    std::vector< std::string > labels;
+    labels.reserve(end - begin);
+    for (size_t i = begin; i < end; i++) {
+        labels.push_back(i == 0 ? "" : library.resolve_label(LabTok(i)));
+    }
+    nlohmann::json ret;
+    ret["begin"] = begin;
+    ret["labels"] = labels;
+    return ret;
+}
+
+static const std::string &get_or_empty(const std::vector< std::string > &v, size_t idx)
+{
+    static const std::string empty;
+    return idx < v.size() ? v[idx] : empty;
+}
+
+nlohmann::json get_symbols_range(const ExtendedLibrary &library, size_t begin, size_t end)
+{
+    end = std::min(end, library.get_symbols_num() + 1);
+    begin = std::min(begin, end);
+    const auto &addendum = library.get_addendum();
+    std::vector< std::string > symbols;
+    std::vector< std::string > htmldefs;
+    std::vector< std::string > althtmldefs;
+    std::vector< std::string > latexdefs;
+    for (size_t i = begin; i < end; i++) {
+        symbols.push_back(i == 0 ? "" : library.resolve_symbol(SymTok(i)));
+        htmldefs.push_back(get_or_empty(addendum.get_htmldefs(), i));
+        althtmldefs.push_back(get_or_empty(addendum.get_althtmldefs(), i));
+        latexdefs.push_back(get_or_empty(addendum.get_latexdefs(), i));
+    }
+    nlohmann::json ret;
+    ret["begin"] = begin;
+    ret["symbols"] = symbols;
+    ret["htmldefs"] = fix_htmldefs_for_web(htmldefs);
+    ret["althtmldefs"] = althtmldefs;
+    ret["latexdefs"] = latexdefs;
+    return ret;
+}
+
+std::string gzip_compress(const std::string &data)
+{
+    z_stream stream = {};
+    // 15 bits of window plus 16 selects the gzip container instead of the raw zlib one
+    int res = deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    assert_or_throw< std::runtime_error >(res == Z_OK, "Could not initialize zlib");
+    std::string ret;
+    ret.resize(deflateBound(&stream, data.size()));
+    stream.next_in = reinterpret_cast< Bytef* >(const_cast< char* >(data.data()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast< Bytef* >(&ret[0]);
+    stream.avail_out = ret.size();
+    res = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    assert_or_throw< std::runtime_error >(res == Z_STREAM_END, "Could not compress data");
+    ret.resize(stream.total_out);
+    return ret;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+
+#include "libs/json.h"
+
+#include "mm/library.h"
+
+/*
+ * The static part of the context sent to the web client: symbols, labels and
+ * addendum of a library. It is serialized once per library (not once per
+ * request) and kept in a gzip-compressed copy as well, so that serving it only
+ * costs a copy; the ETag lets clients skip the download entirely when they
+ * already have it. Worksets using the same library share the same object.
+ */
+class LibraryContext {
+public:
+    static std::shared_ptr< const LibraryContext > get_context(const std::shared_ptr< const ExtendedLibrary > &library);
+
+    const std::string &get_etag() const;
+    const std::string &get_json() const;
+    const std::string &get_gzipped() const;
+
+private:
+    explicit LibraryContext(const std::shared_ptr< const ExtendedLibrary > &library);
+
+    // Keeps the library alive, so that its address can be used as cache key
+    std::shared_ptr< const ExtendedLibrary > library;
+    std::string etag;
+    std::string json;
+    std::string gzipped;
+
+    static std::mutex cache_mutex;
+    static std::unordered_map< const ExtendedLibrary*, std::weak_ptr< const LibraryContext > > cache;
+};
+
+// Ranges of the context, for clients that prefer to fetch what they need lazily; end is clamped
+nlohmann::json get_labels_range(const ExtendedLibrary &library, size_t begin, size_t end);
+nlohmann::json get_symbols_range(const ExtendedLibrary &library, size_t begin, size_t end);
+
+std::string gzip_compress(const std::string &data);
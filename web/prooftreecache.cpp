@@ -0,0 +1,157 @@
+#include "prooftreecache.h"
+
+#include <deque>
+
+#include "mm/proof.h"
+#include "utils/utils.h"
+
+CompactProofTree::CompactProofTree(const FlatProofTree< Sentence > &tree, FlatProofTree< Sentence >::Link root)
+    : sentences(tree.sentences)
+{
+    std::deque< FlatProofTree< Sentence >::Link > queue;
+    queue.push_back(root);
+    uint32_t next_child = 1;
+    while (!queue.empty()) {
+        const auto link = queue.front();
+        queue.pop_front();
+        const auto &node = tree.nodes[link.node];
+        if (link.saved_step) {
+            this->nodes.push_back({{}, node.sentence, next_child, 0, link.essential, {}, {}});
+            continue;
+        }
+        this->nodes.push_back({node.label, node.sentence, next_child, node.children_num, link.essential, node.number, tree.dists[node.dists]});
+        next_child += node.children_num;
+        for (uint32_t i = 0; i < node.children_num; i++) {
+            queue.push_back(tree.children[node.first_child + i]);
+        }
+    }
+}
+
+size_t CompactProofTree::get_cost() const
+{
+    size_t ret = this->nodes.size();
+    for (const auto &sent : this->sentences) {
+        ret += sent.size();
+    }
+    return ret;
+}
+
+nlohmann::json CompactProofTree::to_nested_json(uint32_t idx) const
+{
+    const auto &node = this->nodes.at(idx);
+    nlohmann::json ret;
+    ret["label"] = node.label;
+    ret["sentence"] = this->sentences[node.sentence];
+    ret["children"] = nlohmann::json::array();
+    for (uint32_t i = 0; i < node.children_num; i++) {
+        ret["children"].push_back(this->to_nested_json(node.first_child + i));
+    }
+    ret["dists"] = node.dists;
+    ret["essential"] = node.essential;
+    ret["number"] = node.number;
+    return ret;
+}
+
+nlohmann::json CompactProofTree::to_paged_json(uint32_t idx, size_t depth) const
+{
+    assert_or_throw< std::out_of_range >(idx < this->nodes.size(), "Proof tree node does not exist");
+    nlohmann::json nodes = nlohmann::json::array();
+    nlohmann::json sentences = nlohmann::json::object();
+    std::deque< std::pair< uint32_t, size_t > > queue;
+    queue.push_back(std::make_pair(idx, 0));
+    while (!queue.empty()) {
+        uint32_t cur_idx;
+        size_t cur_depth;
+        std::tie(cur_idx, cur_depth) = queue.front();
+        queue.pop_front();
+        const auto &node = this->nodes[cur_idx];
+        nlohmann::json jnode;
+        jnode["id"] = cur_idx;
+        jnode["label"] = node.label;
+        jnode["sentence"] = node.sentence;
+        jnode["children"] = nlohmann::json::array();
+        for (uint32_t i = 0; i < node.children_num; i++) {
+            jnode["children"].push_back(node.first_child + i);
+            if (cur_depth < depth) {
+                queue.push_back(std::make_pair(node.first_child + i, cur_depth + 1));
+            }
+        }
+        jnode["dists"] = node.dists;
+        jnode["essential"] = node.essential;
+        jnode["number"] = node.number;
+        nodes.push_back(jnode);
+        sentences[std::to_string(node.sentence)] = this->sentences[node.sentence];
+    }
+    nlohmann::json ret;
+    ret["nodes_num"] = this->nodes.size();
+    ret["nodes"] = nodes;
+    ret["sentences"] = sentences;
+    return ret;
+}
+
+std::mutex ProofTreeCache::caches_mutex;
+std::unordered_map< const ExtendedLibrary*, std::weak_ptr< ProofTreeCache > > ProofTreeCache::caches;
+
+ProofTreeCache::ProofTreeCache(const std::shared_ptr< const ExtendedLibrary > &library, size_t max_cost) : library(library), max_cost(max_cost)
+{
+}
+
+std::shared_ptr< ProofTreeCache > ProofTreeCache::get_cache(const std::shared_ptr< const ExtendedLibrary > &library)
+{
+    std::unique_lock< std::mutex > lock(caches_mutex);
+    auto it = caches.find(library.get());
+    if (it != caches.end()) {
+        auto ret = it->second.lock();
+        if (ret != nullptr) {
+            return ret;
+        }
+    }
+    for (auto it2 = caches.begin(); it2 != caches.end(); ) {
+        if (it2->second.expired()) {
+            it2 = caches.erase(it2);
+        } else {
+            it2++;
+        }
+    }
+    // Roughly 100 MB, counting nodes and symbols
+    std::shared_ptr< ProofTreeCache > ret(new ProofTreeCache(library, 1 << 24));
+    caches[library.get()] = ret;
+    return ret;
+}
+
+std::shared_ptr< const CompactProofTree > ProofTreeCache::get_proof_tree(LabTok label)
+{
+    {
+        std::unique_lock< std::mutex > lock(this->mutex);
+        auto it = this->index.find(label);
+        if (it != this->index.end()) {
+            this->lru.splice(this->lru.begin(), this->lru, it->second);
+            return it->second->second;
+        }
+    }
+
+    // The proof is executed without holding the lock, so that other trees can be served meanwhile
+    const Assertion &ass = this->library->get_assertion(label);
+    assert_or_throw< std::out_of_range >(ass.is_valid() && ass.is_theorem(), "Label is not a theorem");
+    const auto &executor = ass.get_proof_executor< Sentence >(*this->library, true);
+    executor->execute();
+    auto tree = std::make_shared< const CompactProofTree >(executor->get_flat_proof_tree(), executor->get_flat_proof_tree_root());
+
+    std::unique_lock< std::mutex > lock(this->mutex);
+    auto it = this->index.find(label);
+    if (it != this->index.end()) {
+        // Someone else generated it in the meantime
+        this->lru.splice(this->lru.begin(), this->lru, it->second);
+        return it->second->second;
+    }
+    this->lru.push_front(std::make_pair(label, tree));
+    this->index[label] = this->lru.begin();
+    this->cost += tree->get_cost();
+    // Always keep at least the tree just generated, even if it is larger than the bound
+    while (this->cost > this->max_cost && this->lru.size() > 1) {
+        this->cost -= this->lru.back().second->get_cost();
+        this->index.erase(this->lru.back().first);
+        this->lru.pop_back();
+    }
+    return tree;
+}
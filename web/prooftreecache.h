@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <list>
+#include <map>
+#include <unordered_map>
+
+#include "libs/json.h"
+
+#include "mm/library.h"
+#include "mm/sentengine.h"
+
+/*
+ * A proof tree flattened in breadth first order, so that the children of each
+ * node are contiguous; sentences are stored once and referenced by index,
+ * since the same sentence typically appears many times in a proof.
+ */
+struct CompactProofTree {
+    struct Node {
+        LabTok label;
+        uint32_t sentence;
+        uint32_t first_child;
+        uint32_t children_num;
+        bool essential;
+        LabTok number;
+        std::set< std::pair< SymTok, SymTok > > dists;
+    };
+
+    // Saved steps that are used again become leaves, as in FlatProofTree::unwind()
+    CompactProofTree(const FlatProofTree< Sentence > &tree, FlatProofTree< Sentence >::Link root);
+    size_t get_cost() const;
+    // The same format as jsonize(const ProofTree< Sentence >&)
+    nlohmann::json to_nested_json(uint32_t idx = 0) const;
+    // The nodes at distance at most depth from idx, each with its children ids, plus the sentences they use
+    nlohmann::json to_paged_json(uint32_t idx, size_t depth) const;
+
+    std::vector< Node > nodes;
+    std::vector< Sentence > sentences;
+};
+
+/*
+ * Proof trees generated for the web client, kept in a LRU cache bounded by
+ * the total number of nodes and symbols they contain. One cache is shared by
+ * all the worksets using the same library.
+ */
+class ProofTreeCache {
+public:
+    static std::shared_ptr< ProofTreeCache > get_cache(const std::shared_ptr< const ExtendedLibrary > &library);
+    // Throw std::out_of_range if the label is not a valid theorem
+    std::shared_ptr< const CompactProofTree > get_proof_tree(LabTok label);
+
+private:
+    ProofTreeCache(const std::shared_ptr< const ExtendedLibrary > &library, size_t max_cost);
+
+    std::shared_ptr< const ExtendedLibrary > library;
+    size_t max_cost;
+    size_t cost = 0;
+    std::mutex mutex;
+    // Most recently used trees are at the front
+    std::list< std::pair< LabTok, std::shared_ptr< const CompactProofTree > > > lru;
+    std::unordered_map< LabTok, decltype(lru)::iterator > index;
+
+    static std::mutex caches_mutex;
+    static std::unordered_map< const ExtendedLibrary*, std::weak_ptr< ProofTreeCache > > caches;
+};
@@ -0,0 +1,131 @@
+#include "resultstore.h"
+
+#include <thread>
+#include <iostream>
+
+#include "libs/json.h"
+#include "platform.h"
+
+std::mutex ResultStore::stores_mutex;
+std::unordered_map< std::string, std::weak_ptr< ResultStore > > ResultStore::stores;
+constexpr std::chrono::steady_clock::duration ResultStore::REFRESH_INTERVAL;
+
+std::shared_ptr< ResultStore > ResultStore::get_store(const boost::filesystem::path &filename)
+{
+    std::unique_lock< std::mutex > lock(stores_mutex);
+    auto &weak = stores[filename.string()];
+    auto ret = weak.lock();
+    if (ret == nullptr) {
+        ret = std::shared_ptr< ResultStore >(new ResultStore(filename));
+        weak = ret;
+    }
+    return ret;
+}
+
+ResultStore::ResultStore(const boost::filesystem::path &filename) : filename(filename), read_offset(0), refresh_scheduled(false), last_refresh(std::chrono::steady_clock::now())
+{
+    this->refresh();
+}
+
+void ResultStore::refresh()
+{
+    std::unique_lock< std::mutex > refresh_lock(this->refresh_mutex);
+    std::string data;
+    {
+        PlatformLockedFile file(this->filename, false);
+        if (file.size() <= this->read_offset) {
+            return;
+        }
+        data = file.read_from(this->read_offset);
+    }
+    // Lookups are not blocked while the records are parsed
+    std::vector< std::pair< std::string, std::vector< std::string > > > records;
+    size_t pos = 0;
+    size_t end;
+    // A line that is not terminated was left by a crashed writer, which put() terminates
+    while ((end = data.find('\n', pos)) != std::string::npos) {
+        try {
+            auto record = nlohmann::json::parse(data.begin() + static_cast< std::ptrdiff_t >(pos), data.begin() + static_cast< std::ptrdiff_t >(end));
+            records.emplace_back(record.at("key").get< std::string >(), record.at("proof").get< std::vector< std::string > >());
+        } catch (std::exception&) {
+            // Skip corrupted records
+        }
+        pos = end + 1;
+    }
+    this->read_offset += pos;
+    std::unique_lock< std::mutex > lock(this->mutex);
+    for (auto &record : records) {
+        this->proofs[record.first] = std::move(record.second);
+    }
+}
+
+void ResultStore::schedule_refresh()
+{
+    {
+        std::unique_lock< std::mutex > lock(this->mutex);
+        auto now = std::chrono::steady_clock::now();
+        if (now - this->last_refresh < REFRESH_INTERVAL) {
+            return;
+        }
+        this->last_refresh = now;
+    }
+    if (this->refresh_scheduled.exchange(true)) {
+        return;
+    }
+    std::weak_ptr< ResultStore > weak_self = this->shared_from_this();
+    std::thread([weak_self]() {
+        auto self = weak_self.lock();
+        if (self == nullptr) {
+            return;
+        }
+        try {
+            self->refresh();
+        } catch (std::exception &e) {
+            std::cerr << "Could not refresh the result store: " << e.what() << std::endl;
+        }
+        self->refresh_scheduled = false;
+    }).detach();
+}
+
+std::vector< std::string > ResultStore::get(const std::string &key)
+{
+    {
+        std::unique_lock< std::mutex > lock(this->mutex);
+        auto it = this->proofs.find(key);
+        if (it != this->proofs.end()) {
+            return it->second;
+        }
+    }
+    this->schedule_refresh();
+    return {};
+}
+
+void ResultStore::put(const std::string &key, const std::vector< std::string > &proof)
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    if (this->proofs.find(key) != this->proofs.end()) {
+        return;
+    }
+    nlohmann::json record;
+    record["key"] = key;
+    record["proof"] = proof;
+    std::string line = record.dump() + "\n";
+    {
+        // The check and the append go through the same locked descriptor
+        PlatformLockedFile file(this->filename, true);
+        // Terminate a line truncated by a crashed writer, so that it does not swallow our record
+        auto size = file.size();
+        if (size > 0 && file.read_from(size - 1) != "\n") {
+            line = "\n" + line;
+        }
+        file.append(line);
+    }
+    // The record will also be read back by the next refresh, which is harmless
+    this->proofs[key] = proof;
+}
+
+size_t ResultStore::get_size()
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    return this->proofs.size();
+}
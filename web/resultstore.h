@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+/*
+ * Proofs found by the strategies, stored on disk so that they survive
+ * worksets and processes. The file is an append-only log of JSON records,
+ * one per line; appends are done under an exclusive file lock and reads
+ * under a sharable one, both through a single PlatformLockedFile, so that
+ * several processes can safely use the same file. The file is read when the store is opened and lookups are then
+ * served from memory; a lookup that misses asks a background thread to pick
+ * up the records appended by other processes since, at most once every
+ * REFRESH_INTERVAL, so that the result is available to later lookups. A truncated last line (for example after a crash) is ignored.
+ * Keys are opaque here; callers are expected to include in them everything
+ * the proof depends on, such as the digest of the library.
+ */
+class ResultStore : public std::enable_shared_from_this< ResultStore > {
+public:
+    static std::shared_ptr< ResultStore > get_store(const boost::filesystem::path &filename);
+    // Return an empty vector if nothing is stored under key
+    std::vector< std::string > get(const std::string &key);
+    void put(const std::string &key, const std::vector< std::string > &proof);
+    size_t get_size();
+    // Read the records appended since the last refresh; normally done in the background by get()
+    void refresh();
+
+    static constexpr std::chrono::steady_clock::duration REFRESH_INTERVAL = std::chrono::seconds(1);
+
+private:
+    explicit ResultStore(const boost::filesystem::path &filename);
+    void schedule_refresh();
+
+    boost::filesystem::path filename;
+    // There is a single store per file in a process, so that its records are kept in memory once
+    std::mutex mutex;
+    // Serializes refreshes, which read the file without holding mutex
+    std::mutex refresh_mutex;
+    uint64_t read_offset;
+    std::atomic< bool > refresh_scheduled;
+    std::chrono::steady_clock::time_point last_refresh;
+    std::unordered_map< std::string, std::vector< std::string > > proofs;
+
+    static std::mutex stores_mutex;
+    static std::unordered_map< std::string, std::weak_ptr< ResultStore > > stores;
+};
@@ -1,6 +1,7 @@
 #include "step.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/type_index.hpp>
 
 #include "web/jsonize.h"
 #include "strategy.h"
@@ -28,7 +29,7 @@ void Step::before_being_adopted(size_t child_idx) {
 
 void Step::after_adopting(size_t child_idx) {
     (void) child_idx;
-    this->restart_search();
+    this->restart_search(PRIORITY_INTERACTIVE);
 }
 
 void Step::after_being_adopted(size_t child_idx) {
@@ -45,7 +46,7 @@ void Step::before_being_orphaned(size_t child_idx) {
 
 void Step::after_orphaning(size_t child_idx) {
     (void) child_idx;
-    this->restart_search();
+    this->restart_search(PRIORITY_INTERACTIVE);
 }
 
 void Step::after_being_orphaned(size_t child_idx) {
@@ -55,7 +56,7 @@ void Step::after_being_orphaned(size_t child_idx) {
 void Step::after_new_sentence(const Sentence &old_sent) {
     (void) old_sent;
     std::unique_lock< std::recursive_mutex > lock(this->global_mutex);
-    this->restart_search();
+    this->restart_search(PRIORITY_INTERACTIVE);
     auto strong_parent = this->parent.lock();
     if (strong_parent) {
         auto workset = this->get_workset().lock();
@@ -63,7 +64,7 @@ void Step::after_new_sentence(const Sentence &old_sent) {
             // Restart search from a coroutine to avoid deadlocks
             auto body = [strong_parent](Yielder &yield) {
                 (void) yield;
-                strong_parent->restart_search();
+                strong_parent->restart_search(PRIORITY_NORMAL);
             };
             auto shared_body = std::make_shared< decltype(body) >(body);
             workset->add_coroutine(make_auto_coroutine(shared_body));
@@ -71,7 +72,7 @@ void Step::after_new_sentence(const Sentence &old_sent) {
     }
 }
 
-void Step::restart_search()
+void Step::restart_search(CoroutinePriority priority)
 {
     std::unique_lock< std::recursive_mutex > lock(this->global_mutex);
     if (this->do_not_search) {
@@ -84,18 +85,19 @@ void Step::restart_search()
     auto &tb = workset->get_toolbox();
 
     this->current_priority = 0;
-    /* We cannot just use active_strategies.clear(), because this could trigger coroutine destructors,
-     * then would re-enter report_result() and reach here again. So we just swap its content with
-     * a local list, which is then cleared. This way all code re-entering report_result() will
-     * find an empty active_strategies and exit immediately.
-     */
-    std::list< std::pair< std::shared_ptr< StepStrategy >, std::shared_ptr< Coroutine > > > old_strategies;
-    this->active_strategies.swap(old_strategies);
-    old_strategies.clear();
+    // Stop the strategies of the previous search as soon as they yield, even if they are running now
+    if (this->current_data != nullptr && this->current_data->token != nullptr) {
+        this->current_data->token->cancel();
+    }
+    this->stop_strategies();
     this->winning_strategy = nullptr;
 
     // If any of this step or of its children does not parse, then do not call any strategy
     this->current_data = std::make_shared< StepStrategyData >();
+    this->current_data->token = std::make_shared< CoroutineToken >(priority);
+    if (priority == PRIORITY_INTERACTIVE) {
+        workset->set_interactive_token(this->current_data->token);
+    }
     this->current_data->thesis = this->get_sentence();
     this->current_data->pt_thesis = this->get_parsing_tree();
     if (this->current_data->pt_thesis.label == LabTok{}) {
@@ -124,9 +126,36 @@ void Step::restart_search()
     std::cerr << "Restarting search for step with id " << this->id << std::endl;
 #endif
 
+    // Identical goals are common, so another step (or a previous session) may have already proved this one
+    auto result_cache = workset->get_result_cache();
+    if (result_cache != nullptr) {
+        auto cached = result_cache->get(StepResultCache::make_key(*this->current_data));
+        if (cached == nullptr) {
+            cached = workset->get_stored_result(*this->current_data);
+        }
+        if (cached != nullptr) {
+            this->current_data->token->cancel();
+            this->winning_strategy = cached;
+            this->maybe_notify_update();
+            return;
+        }
+    }
+
     this->launch_strategies();
 }
 
+void Step::stop_strategies()
+{
+    /* We cannot just use active_strategies.clear(), because this could trigger coroutine destructors,
+     * then would re-enter report_result() and reach here again. So we just swap its content with
+     * a local list, which is then cleared. This way all code re-entering report_result() will
+     * find an empty active_strategies and exit immediately.
+     */
+    std::list< std::pair< std::shared_ptr< StepStrategy >, std::shared_ptr< Coroutine > > > old_strategies;
+    this->active_strategies.swap(old_strategies);
+    old_strategies.clear();
+}
+
 void Step::launch_strategies()
 {
     std::unique_lock< std::recursive_mutex > lock(this->global_mutex);
@@ -139,14 +168,16 @@ void Step::launch_strategies()
 #endif
 
     // Strategies of a certain priority are launched only after all strategies with lower priority have failed
-    auto strategies = create_strategies(this->current_priority, this->weak_from_this(), this->current_data, workset->get_toolbox());
+    auto strategies = create_strategies(this->current_priority, this->weak_from_this(), this->current_data, workset->get_toolbox(), workset->get_sat_session());
     for (const auto &strat : strategies) {
         auto coro = std::make_shared< Coroutine >(strat);
+        // CPU time is accounted separately for each kind of strategy
+        coro->set_profile(CoroutineProfile::get_profile(boost::typeindex::type_id_runtime(*strat).pretty_name()));
         // Add a small timeout the first time, so that the computation is not begun if the step is modified immediately
         if (this->current_priority == 0) {
-            workset->add_timed_coroutine(coro, std::chrono::milliseconds(200));
+            workset->add_timed_coroutine(coro, std::chrono::milliseconds(200), this->current_data->token);
         } else {
-            workset->add_coroutine(coro);
+            workset->add_coroutine(coro, this->current_data->token);
         }
         this->active_strategies.push_back(std::make_pair(strat, coro));
     }
@@ -165,8 +196,13 @@ void Step::report_result(std::shared_ptr<StepStrategy> strategy, std::shared_ptr
     std::cerr << "Strategy reported success for step with id " << this->id << std::endl;
 #endif
         this->active_strategies.clear();
+        this->current_data->token->cancel();
         this->winning_strategy = result;
         this->maybe_notify_update();
+        auto workset = this->get_workset().lock();
+        if (workset) {
+            workset->publish_result(this->current_data, result);
+        }
     } else {
 #ifdef LOG_STEP_OPS
     std::cerr << "Strategy reported failure for step with id " << this->id << std::endl;
@@ -179,6 +215,21 @@ void Step::report_result(std::shared_ptr<StepStrategy> strategy, std::shared_ptr
     }
 }
 
+void Step::adopt_result(const StepResultCache::key_type &key, std::shared_ptr<const StepStrategyResult> result)
+{
+    std::unique_lock< std::recursive_mutex > lock(this->global_mutex);
+    if (this->active_strategies.empty() || StepResultCache::make_key(*this->current_data) != key) {
+        return;
+    }
+#ifdef LOG_STEP_OPS
+    std::cerr << "Adopting result found by another step for step with id " << this->id << std::endl;
+#endif
+    this->stop_strategies();
+    this->current_data->token->cancel();
+    this->winning_strategy = result;
+    this->maybe_notify_update();
+}
+
 bool Step::reaches_by_parents(const Step &to)
 {
     std::vector< std::unique_lock< std::recursive_mutex > > locks;
@@ -532,13 +583,13 @@ nlohmann::json Step::answer_api1(HTTPCallback &cb, std::vector< std::string >::c
             // Sorting floating hypotheses by their label shoud give the expected order in the Assertion
             std::sort(float_hyps.begin(), float_hyps.end());
             buf << "thesis $p " << toolbox.print_sentence(thesis) << " $=" << std::endl;
-            UncompressedProof uncomp_proof(engine.get_proof_labels());
+            UncompressedProof uncomp_proof(engine.get_uncompressed_proof_labels());
             Assertion dummy_ass(float_hyps, ess_hyps);
             auto uncomp_op = uncomp_proof.get_operator(toolbox, dummy_ass);
             for (const auto &hyp : hyps) {
                 uncomp_op->set_new_hypothesis(hyp.first, hyp.second);
             }
-            auto comp_proof = uncomp_op->compress(ProofOperator::CS_BACKREFS_ON_IDENTICAL_SENTENCE);
+            auto comp_proof = uncomp_op->compress(ProofOperator::CS_MINIMIZE_SIZE);
             buf << toolbox.print_proof(comp_proof) << std::endl;
             buf << "$." << std::endl;
             ret["proof"] = buf.str();
@@ -635,7 +686,7 @@ bool Step::prove(CreativeCheckpointedProofEngine<Sentence> &engine)
 void Step::workset_reload()
 {
     std::unique_lock< std::recursive_mutex > lock(this->global_mutex);
-    this->restart_search();
+    this->restart_search(PRIORITY_BACKGROUND);
     for (const auto &child : this->children) {
         child.lock()->workset_reload();
     }
@@ -650,7 +701,7 @@ Step::Step(size_t id, std::shared_ptr<Workset> workset, bool do_not_search) : id
 
 void Step::init()
 {
-    this->restart_search();
+    this->restart_search(PRIORITY_BACKGROUND);
 }
 
 Step::~Step()
@@ -658,4 +709,7 @@ Step::~Step()
 #ifdef LOG_STEP_OPS
     std::cerr << "Destroying step with id " << id << std::endl;
 #endif
+    if (this->current_data != nullptr && this->current_data->token != nullptr) {
+        this->current_data->token->cancel();
+    }
 }
@@ -74,6 +74,8 @@ public:
     bool orphan();
     bool reparent(std::shared_ptr< Step > parent, size_t idx);
     void report_result(std::shared_ptr< StepStrategy > strategy, std::shared_ptr< StepStrategyResult > result);
+    // Stop searching and use result, if the step is still looking for a proof of the goal identified by key
+    void adopt_result(const StepResultCache::key_type &key, std::shared_ptr< const StepStrategyResult > result);
     nlohmann::json answer_api1(HTTPCallback &cb, std::vector< std::string >::const_iterator path_begin, std::vector< std::string >::const_iterator path_end);
     nlohmann::json dump();
     void load_dump(const nlohmann::json &dump);
@@ -101,8 +103,9 @@ private:
     void after_orphaning(size_t child_idx);
     void after_being_orphaned(size_t child_idx);
     void after_new_sentence(const Sentence &old_sent);
-    void restart_search();
+    void restart_search(CoroutinePriority priority);
     void launch_strategies();
+    void stop_strategies();
 
     bool reaches_by_parents(const Step &to);
 
@@ -5,6 +5,54 @@
 #include "provers/wffsat.h"
 #include "provers/uct.h"
 
+StepResultCache::StepResultCache(size_t max_size) : max_size(max_size), hits(0), misses(0)
+{
+}
+
+StepResultCache::key_type StepResultCache::make_key(const StepStrategyData &data)
+{
+    return std::make_tuple(data.thesis, data.hypotheses, data.antidists);
+}
+
+std::shared_ptr< const StepStrategyResult > StepResultCache::get(const key_type &key)
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    auto it = this->results.find(key);
+    if (it == this->results.end()) {
+        this->misses++;
+        return nullptr;
+    }
+    this->hits++;
+    this->lru.splice(this->lru.begin(), this->lru, it->second.second);
+    return it->second.first;
+}
+
+void StepResultCache::put(const key_type &key, std::shared_ptr< const StepStrategyResult > result)
+{
+    std::unique_lock< std::mutex > lock(this->mutex);
+    auto it = this->results.find(key);
+    if (it != this->results.end()) {
+        this->lru.splice(this->lru.begin(), this->lru, it->second.second);
+        return;
+    }
+    this->lru.push_front(key);
+    this->results.insert(std::make_pair(key, std::make_pair(result, this->lru.begin())));
+    while (this->results.size() > this->max_size) {
+        this->results.erase(this->lru.back());
+        this->lru.pop_back();
+    }
+}
+
+size_t StepResultCache::get_hits() const
+{
+    return this->hits;
+}
+
+size_t StepResultCache::get_misses() const
+{
+    return this->misses;
+}
+
 StepStrategy::~StepStrategy() {
 }
 
@@ -19,6 +67,11 @@ void StepStrategy::maybe_report_result(std::shared_ptr< StepStrategy > strategy,
     }
 }
 
+bool StepStrategy::is_canceled() const
+{
+    return this->data->token != nullptr && this->data->token->is_canceled();
+}
+
 class FailingStrategyResult : public StepStrategyResult, public enable_create< FailingStrategyResult > {
 protected:
     FailingStrategyResult() {}
@@ -108,6 +161,9 @@ void UnificationStrategy::operator()(Yielder &yield) {
     });
 
     yield();
+    if (this->is_canceled()) {
+        return;
+    }
 
     auto pt_th = std::make_pair(this->data->thesis[0], this->data->pt_thesis);
     std::vector< std::pair< SymTok, ParsingTree< SymTok, LabTok > > > pt_hyps;
@@ -166,8 +222,8 @@ struct WffStrategyResult : public StepStrategyResult, public enable_create< WffS
     const LibraryToolbox &toolbox;
 };
 
-WffStrategy::WffStrategy(std::weak_ptr<StrategyManager> manager, std::shared_ptr<const StepStrategyData> data, const LibraryToolbox &toolbox, WffStrategy::SubStrategy substrategy) :
-    StepStrategy(manager, data, toolbox), substrategy(substrategy)
+WffStrategy::WffStrategy(std::weak_ptr<StrategyManager> manager, std::shared_ptr<const StepStrategyData> data, const LibraryToolbox &toolbox, WffStrategy::SubStrategy substrategy, std::shared_ptr<WffSatSession> sat_session) :
+    StepStrategy(manager, data, toolbox), substrategy(substrategy), sat_session(sat_session)
 {
 }
 
@@ -184,6 +240,9 @@ void WffStrategy::operator()(Yielder &yield)
     for (const auto &pt_hyp : this->data->pt_hypotheses) {
         wff = Imp::create(wff_from_pt(pt_hyp, this->toolbox), wff);
         yield();
+        if (this->is_canceled()) {
+            return;
+        }
     }
 
     result->wff = wff;
@@ -192,7 +251,11 @@ void WffStrategy::operator()(Yielder &yield)
         tie(result->success, result->prover) = wff->get_adv_truth_prover(this->toolbox);
         break;
     case SUBSTRATEGY_WFFSAT:
-        tie(result->success, result->prover) = get_sat_prover(wff, this->toolbox);
+        if (this->sat_session) {
+            tie(result->success, result->prover) = this->sat_session->get_sat_prover(wff);
+        } else {
+            tie(result->success, result->prover) = get_sat_prover(wff, this->toolbox);
+        }
         break;
     default:
         assert(!"Should not arrive here");
@@ -248,7 +311,7 @@ void UctStrategy::operator()(Yielder &yield)
 
     yield();
 
-    for (unsigned i = 0; i < 10000; i++) {
+    for (unsigned i = 0; i < 10000 && !this->is_canceled(); i++) {
         auto res = result->prover->visit();
         result->visits_num++;
         if (res == PROVED) {
@@ -261,7 +324,7 @@ void UctStrategy::operator()(Yielder &yield)
     }
 }
 
-std::vector<std::shared_ptr<StepStrategy> > create_strategies(unsigned priority, std::weak_ptr<StrategyManager> manager, std::shared_ptr<const StepStrategyData> data, const LibraryToolbox &toolbox)
+std::vector<std::shared_ptr<StepStrategy> > create_strategies(unsigned priority, std::weak_ptr<StrategyManager> manager, std::shared_ptr<const StepStrategyData> data, const LibraryToolbox &toolbox, std::shared_ptr<WffSatSession> sat_session)
 {
     switch (priority) {
     case 0:
@@ -272,7 +335,7 @@ std::vector<std::shared_ptr<StepStrategy> > create_strategies(unsigned priority,
     case 1:
         return {
             //WffStrategy::create(manager, data, toolbox, WffStrategy::SUBSTRATEGY_WFF),
-            WffStrategy::create(manager, data, toolbox, WffStrategy::SUBSTRATEGY_WFFSAT),
+            WffStrategy::create(manager, data, toolbox, WffStrategy::SUBSTRATEGY_WFFSAT, sat_session),
         };
     case 2:
         return {
@@ -282,3 +345,143 @@ std::vector<std::shared_ptr<StepStrategy> > create_strategies(unsigned priority,
         return {};
     }
 };
+
+std::string canonicalize_goal(const StepStrategyData &data, const LibraryToolbox &toolbox)
+{
+    auto resolve = [&toolbox](const Sentence &sent) {
+        return vector_map(sent.begin(), sent.end(), [&toolbox](SymTok tok) { return toolbox.resolve_symbol(tok); });
+    };
+    nlohmann::json ret = nlohmann::json::array();
+    ret.push_back(resolve(data.thesis));
+    ret.push_back(vector_map(data.hypotheses.begin(), data.hypotheses.end(), resolve));
+    std::set< std::pair< std::string, std::string > > antidists;
+    for (const auto &pair : data.antidists) {
+        antidists.insert(std::minmax(toolbox.resolve_symbol(pair.first), toolbox.resolve_symbol(pair.second)));
+    }
+    ret.push_back(antidists);
+    return ret.dump();
+}
+
+struct StoredStrategyResult : public StepStrategyResult, public enable_create< StoredStrategyResult > {
+    bool get_success() const {
+        return true;
+    }
+
+    nlohmann::json get_web_json() const {
+        nlohmann::json ret;
+        ret["type"] = "stored";
+        return ret;
+    }
+
+    nlohmann::json get_dump_json() const {
+        nlohmann::json ret;
+        ret["type"] = "stored";
+        return ret;
+    }
+
+    bool prove(CheckpointedProofEngine &engine, const std::vector< std::shared_ptr< StepStrategyCallback > > &children) const {
+        // The stored proof comes from disk, so check that it proves the thesis before committing it
+        auto inspectable = dynamic_cast< InspectableProofEngine< Sentence >* >(&engine);
+        size_t stack_size = inspectable != nullptr ? inspectable->get_stack().size() : 0;
+        engine.checkpoint();
+        // Whatever makes the replay stop, including exceptions that are not proof errors, the engine is rolled back
+        bool committed = false;
+        Finally rollback_guard([&engine,&committed]() {
+            if (!committed) {
+                engine.rollback();
+            }
+        });
+        try {
+            for (const auto &step : this->proof) {
+                if (step.first != LabTok{}) {
+                    engine.process_label(step.first);
+                } else if (step.second >= children.size() || !children[step.second]->prove()) {
+                    return false;
+                }
+            }
+        } catch (const ProofException< Sentence >&) {
+            return false;
+        }
+        if (inspectable != nullptr) {
+            const auto &stack = inspectable->get_stack();
+            if (stack.size() != stack_size + 1 || stack.back() != this->thesis) {
+                return false;
+            }
+        }
+        engine.commit();
+        committed = true;
+        return true;
+    }
+
+    // Either a label, or LabTok{} and the index of a hypothesis
+    std::vector< std::pair< LabTok, size_t > > proof;
+    Sentence thesis;
+};
+
+struct PlaceholderCallback final : public StepStrategyCallback {
+    PlaceholderCallback(CreativeProofEngineImpl< Sentence > &engine, const Sentence &sent) : engine(engine), sent(sent) {}
+
+    bool prove() {
+        this->engine.process_new_hypothesis(this->sent);
+        return true;
+    }
+
+    CreativeProofEngineImpl< Sentence > &engine;
+    const Sentence &sent;
+};
+
+std::vector< std::string > serialize_result_proof(const StepStrategyData &data, const StepStrategyResult &result, const LibraryToolbox &toolbox)
+{
+    CreativeProofEngineImpl< Sentence > engine(toolbox);
+    std::vector< std::shared_ptr< StepStrategyCallback > > children;
+    for (const auto &hyp : data.hypotheses) {
+        children.push_back(std::make_shared< PlaceholderCallback >(engine, hyp));
+    }
+    if (!result.prove(engine, children)) {
+        return {};
+    }
+    if (engine.get_stack().size() != 1 || engine.get_stack().back() != data.thesis) {
+        return {};
+    }
+    std::vector< std::string > ret;
+    const auto &new_hyps = engine.get_new_hypotheses();
+    for (const auto &label : engine.get_uncompressed_proof_labels()) {
+        auto it = new_hyps.find(label);
+        if (it != new_hyps.end()) {
+            auto idx = std::find(data.hypotheses.begin(), data.hypotheses.end(), it->second) - data.hypotheses.begin();
+            ret.push_back("#" + std::to_string(idx));
+        } else {
+            auto name = toolbox.resolve_label(label);
+            // Temporary labels are not stable across processes
+            if (toolbox.get_library().get_label(name) != label) {
+                return {};
+            }
+            ret.push_back(name);
+        }
+    }
+    return ret;
+}
+
+std::shared_ptr< const StepStrategyResult > deserialize_result_proof(const StepStrategyData &data, const std::vector< std::string > &proof, const LibraryToolbox &toolbox)
+{
+    auto ret = StoredStrategyResult::create();
+    ret->thesis = data.thesis;
+    for (const auto &step : proof) {
+        if (!step.empty() && step[0] == '#') {
+            size_t idx;
+            try {
+                idx = std::stoul(step.substr(1));
+            } catch (const std::logic_error&) {
+                return nullptr;
+            }
+            ret->proof.push_back(std::make_pair(LabTok{}, idx));
+        } else {
+            LabTok label = toolbox.get_library().get_label(step);
+            if (label == LabTok{}) {
+                return nullptr;
+            }
+            ret->proof.push_back(std::make_pair(label, 0));
+        }
+    }
+    return ret;
+}
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <map>
+#include <tuple>
 
 #include "libs/json.h"
 #include "utils/utils.h"
@@ -8,6 +13,8 @@
 #include "mm/toolbox.h"
 #include "mm/engine.h"
 
+class WffSatSession;
+
 struct StepStrategyData {
     Sentence thesis;
     std::vector< Sentence > hypotheses;
@@ -15,6 +22,37 @@ struct StepStrategyData {
     std::vector< ParsingTree< SymTok, LabTok > > pt_hypotheses;
     std::set< std::pair< SymTok, SymTok > > antidists;
     std::set< std::pair< LabTok, LabTok > > lab_antidists;
+    // Canceled when the step restarts its search, so that stale strategies stop at their next yield
+    std::shared_ptr< CoroutineToken > token;
+};
+
+class StepStrategyResult;
+
+/*
+ * Successful strategy results, indexed by the goal they prove (thesis,
+ * hypotheses in order and antidists), so that steps with the same goal can
+ * reuse them instead of searching again. Results do not depend on anything
+ * else than their goal, so a cache can be shared by all the steps using the
+ * same toolbox. Bounded with LRU eviction.
+ */
+class StepResultCache {
+public:
+    typedef std::tuple< Sentence, std::vector< Sentence >, std::set< std::pair< SymTok, SymTok > > > key_type;
+
+    explicit StepResultCache(size_t max_size = 4096);
+    static key_type make_key(const StepStrategyData &data);
+    std::shared_ptr< const StepStrategyResult > get(const key_type &key);
+    void put(const key_type &key, std::shared_ptr< const StepStrategyResult > result);
+    size_t get_hits() const;
+    size_t get_misses() const;
+
+private:
+    size_t max_size;
+    std::mutex mutex;
+    std::list< key_type > lru;
+    std::map< key_type, std::pair< std::shared_ptr< const StepStrategyResult >, std::list< key_type >::iterator > > results;
+    std::atomic< size_t > hits;
+    std::atomic< size_t > misses;
 };
 
 class StepStrategyCallback {
@@ -45,6 +83,7 @@ public:
 protected:
     StepStrategy(std::weak_ptr< StrategyManager > manager, std::shared_ptr< const StepStrategyData > data, const LibraryToolbox &toolbox);
     void maybe_report_result(std::shared_ptr<StepStrategy> strategy, std::shared_ptr< StepStrategyResult > result);
+    bool is_canceled() const;
 
     std::weak_ptr< StrategyManager > manager;
     std::shared_ptr< const StepStrategyData > data;
@@ -71,10 +110,11 @@ public:
         SUBSTRATEGY_WFF,
         SUBSTRATEGY_WFFSAT,
     };
-    WffStrategy(std::weak_ptr< StrategyManager > manager, std::shared_ptr< const StepStrategyData > data, const LibraryToolbox &toolbox, SubStrategy substrategy);
+    WffStrategy(std::weak_ptr< StrategyManager > manager, std::shared_ptr< const StepStrategyData > data, const LibraryToolbox &toolbox, SubStrategy substrategy, std::shared_ptr< WffSatSession > sat_session = nullptr);
     void operator()(Yielder &yield);
 private:
     SubStrategy substrategy;
+    std::shared_ptr< WffSatSession > sat_session;
 };
 
 class UctStrategy : public StepStrategy, public enable_create< UctStrategy > {
@@ -94,4 +134,13 @@ std::vector< std::shared_ptr< StepStrategy > > create_strategies(Args&&... args)
     };
 }*/
 
-std::vector< std::shared_ptr< StepStrategy > > create_strategies(unsigned priority, std::weak_ptr< StrategyManager > manager, std::shared_ptr< const StepStrategyData > data, const LibraryToolbox &toolbox);
+std::vector< std::shared_ptr< StepStrategy > > create_strategies(unsigned priority, std::weak_ptr< StrategyManager > manager, std::shared_ptr< const StepStrategyData > data, const LibraryToolbox &toolbox, std::shared_ptr< WffSatSession > sat_session);
+
+// A description of the goal of data that does not depend on the process, suitable as a persistent key
+std::string canonicalize_goal(const StepStrategyData &data, const LibraryToolbox &toolbox);
+/* Replay result on a fresh engine and return its proof as a sequence of label names, where "#i" stands for
+ * the i-th hypothesis; return an empty vector if the proof uses labels that only exist in this process. */
+std::vector< std::string > serialize_result_proof(const StepStrategyData &data, const StepStrategyResult &result, const LibraryToolbox &toolbox);
+/* The inverse of serialize_result_proof(); return nullptr if some label does not exist in the library.
+ * Proving the result fails (without touching the engine) if the proof does not end with the thesis of data. */
+std::shared_ptr< const StepStrategyResult > deserialize_result_proof(const StepStrategyData &data, const std::vector< std::string > &proof, const LibraryToolbox &toolbox);
@@ -3,9 +3,12 @@
 #include <random>
 
 #include <boost/tokenizer.hpp>
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem/fstream.hpp>
 
-#if defined(USE_MICROHTTPD)
+#if defined(USE_BEAST)
+#include "httpd_beast.h"
+#elif defined(USE_MICROHTTPD)
 #include "httpd_microhttpd.h"
 #endif
 
@@ -13,6 +16,7 @@
 #include "memory.h"
 #include "utils/utils.h"
 #include "web.h"
+#include "jsonize.h"
 #include "platform.h"
 
 const bool SERVE_STATIC_FILES = true;
@@ -36,7 +40,9 @@ std::string generate_id() {
 }
 
 std::unique_ptr< HTTPD > make_server(int port, WebEndpoint &endpoint, bool open_server) {
-#if defined(USE_MICROHTTPD)
+#if defined(USE_BEAST)
+    return std::make_unique< HTTPD_beast >(port, endpoint, !open_server);
+#elif defined(USE_MICROHTTPD)
     return std::make_unique< HTTPD_microhttpd >(port, endpoint, !open_server);
 #else
     // If no HTTP implementation is provided, we return nullptr
@@ -239,6 +245,7 @@ void WebEndpoint::answer(HTTPCallback &cb)
             }
             cb.set_status_code(200);
             cb.add_header("Content-Type", guess_content_type(url));
+            cb.set_size(boost::filesystem::file_size(canonical_filename));
             /*string content;
             try {
                 content = string(istreambuf_iterator< char >(infile), istreambuf_iterator< char >());
@@ -249,7 +256,7 @@ void WebEndpoint::answer(HTTPCallback &cb)
                 return;
             }
             cb.set_answer(move(content));*/
-            cb.set_answerer(std::make_unique< HTTPFileAnswerer >(infile));
+            cb.set_answerer(std::make_unique< HTTPPathAnswerer >(infile, canonical_filename.string()));
             return;
         }
     }
@@ -313,6 +320,20 @@ void WebEndpoint::answer(HTTPCallback &cb)
             cb.set_status_code(se.get_status_code());
             cb.set_answer(std::to_string(se.get_status_code()) + " " + se.get_descr());
             return;
+        } catch (SendStream ss) {
+            cb.add_header("Content-Type", ss.get_content_type());
+            cb.add_header("Cache-Control", "no-cache");
+            cb.set_status_code(200);
+            cb.set_answerer(std::make_unique< HTTPFunctionAnswerer >(ss.get_producer()));
+            return;
+        } catch (SendBlob &sb) {
+            cb.add_header("Content-Type", sb.get_content_type());
+            for (const auto &header : sb.get_headers()) {
+                cb.add_header(header.first, header.second);
+            }
+            cb.set_status_code(sb.get_status_code());
+            cb.set_answer(std::string(sb.get_body()));
+            return;
         } catch (WaitForPost wfp) {
             auto callback = [wfp,&cb] (const auto &post_data) {
                 try {
@@ -363,12 +384,30 @@ std::shared_ptr< Session > WebEndpoint::get_session(std::string session_id)
     }
 }
 
-Session::Session(bool constant) : constant(constant), new_id(0)
+Session::Session(bool constant) : constant(constant), new_id(0), coroutine_group(std::make_shared< CoroutineGroup >())
 {
 }
 
 nlohmann::json Session::answer_api1(HTTPCallback &cb, std::vector< std::string >::const_iterator path_begin, std::vector< std::string >::const_iterator path_end)
 {
+    if (path_begin != path_end && *path_begin == "scheduler_stats") {
+        path_begin++;
+        assert_or_throw< SendError >(path_begin == path_end, 404);
+        // Scheduler statistics never take the locks of the worker queues, so they can be polled freely
+        return jsonize(CoroutineThreadManager::get_global().get_detailed_stats());
+    }
+    if (path_begin != path_end && *path_begin == "scheduler_sampling") {
+        assert_or_throw< SendError >(!this->is_constant(), 403);
+        path_begin++;
+        assert_or_throw< SendError >(path_begin != path_end, 404);
+        auto interval_ms = safe_stoi(*path_begin);
+        path_begin++;
+        assert_or_throw< SendError >(path_begin == path_end, 404);
+        // A zero interval disables sampling
+        CoroutineThreadManager::get_global().set_sampling_interval(std::chrono::milliseconds(interval_ms));
+        nlohmann::json ret = { { "status", "ok" } };
+        return ret;
+    }
     if (path_begin != path_end && *path_begin == "workset") {
         path_begin++;
         assert_or_throw< SendError >(path_begin != path_end, 404);
@@ -408,7 +447,7 @@ std::pair<size_t, std::shared_ptr<Workset> > Session::create_workset()
     std::unique_lock< std::mutex > lock(this->worksets_mutex);
     size_t id = this->new_id;
     this->new_id++;
-    auto workset = Workset::create(this->weak_from_this());
+    auto workset = Workset::create(this->weak_from_this(), this->coroutine_group);
     workset->set_name("Workset " + std::to_string(id + 1));
     this->worksets[id] = workset;
     return { id, this->worksets.at(id) };
@@ -455,3 +494,13 @@ int safe_stoi(const std::string &s)
         throw SendError(404);
     }
 }
+
+std::string get_request_header(HTTPCallback &cb, const std::string &name)
+{
+    for (const auto &header : cb.get_request_headers()) {
+        if (boost::iequals(header.first, name)) {
+            return header.second;
+        }
+    }
+    return "";
+}
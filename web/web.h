@@ -11,6 +11,7 @@ class Session;
 #include "web/httpd.h"
 #include "workset.h"
 #include "utils/utils.h"
+#include "utils/threadmanager.h"
 
 class SendError {
 public:
@@ -72,6 +73,58 @@ typename Container::mapped_type safe_at(Container &cont, const typename Containe
     }
 }
 
+// Thrown to answer with a stream of unknown length, whose chunks are returned by the producer
+class SendStream {
+public:
+    SendStream(const std::string &content_type, const std::function< std::string() > &producer) : content_type(content_type), producer(producer) {
+    }
+
+    const std::string &get_content_type() const {
+        return this->content_type;
+    }
+
+    const std::function< std::string() > &get_producer() const {
+        return this->producer;
+    }
+
+private:
+    std::string content_type;
+    std::function< std::string() > producer;
+};
+
+// Thrown to answer with a precomputed body, possibly with a custom status code and additional headers
+class SendBlob {
+public:
+    SendBlob(unsigned int status_code, const std::string &content_type, const std::vector< std::pair< std::string, std::string > > &headers, const std::string &body) :
+        status_code(status_code), content_type(content_type), headers(headers), body(body) {
+    }
+
+    unsigned int get_status_code() const {
+        return this->status_code;
+    }
+
+    const std::string &get_content_type() const {
+        return this->content_type;
+    }
+
+    const std::vector< std::pair< std::string, std::string > > &get_headers() const {
+        return this->headers;
+    }
+
+    const std::string &get_body() const {
+        return this->body;
+    }
+
+private:
+    unsigned int status_code;
+    std::string content_type;
+    std::vector< std::pair< std::string, std::string > > headers;
+    std::string body;
+};
+
+// Header names are case insensitive; return an empty string if the header is missing
+std::string get_request_header(HTTPCallback &cb, const std::string &name);
+
 class Session : public enable_create< Session >{
 public:
     nlohmann::json answer_api1(HTTPCallback &cb, std::vector< std::string >::const_iterator path_begin, std::vector< std::string >::const_iterator path_end);
@@ -90,6 +143,7 @@ private:
 
     bool constant;
     size_t new_id;
+    std::shared_ptr< CoroutineGroup > coroutine_group;
 };
 
 class WebEndpoint : public HTTPTarget {
@@ -4,22 +4,31 @@
 
 #include "libs/json.h"
 
-#include "mm/reader.h"
 #include "mm/engine.h"
 #include "mm/proof.h"
+#include "mm/tempgen.h"
 #include "platform.h"
 #include "jsonize.h"
+#include "provers/wffsat.h"
+#include "libcontext.h"
+#include "prooftreecache.h"
 
-static unsigned safe_hardware_concurrency() noexcept {
-    auto system = std::thread::hardware_concurrency();
-    if (system > 0) {
-        return system;
-    } else {
-        return 1;
+// Execute the time slices of the coroutines of a workset in its temporary variable scope
+class TempScopeContext : public CoroutineContext {
+public:
+    TempScopeContext(size_t scope) : scope(scope) {}
+
+    void run_slice(const std::function< void() > &slice) override {
+        TempGenerator::Scope temp_scope(this->scope);
+        slice();
     }
-}
 
-Workset::Workset(std::weak_ptr<Session> session) : thread_manager(std::make_unique< CoroutineThreadManager >(safe_hardware_concurrency())) /*, step_backrefs(BackreferenceRegistry< Step, Workset >::create()) */, session(session)
+private:
+    const size_t scope;
+};
+
+Workset::Workset(std::weak_ptr<Session> session, std::shared_ptr<CoroutineGroup> coroutine_group) : coroutine_group(coroutine_group),
+    temp_scope(TempGenerator::Scope::new_id()), coroutine_context(std::make_shared< TempScopeContext >(this->temp_scope)) /*, step_backrefs(BackreferenceRegistry< Step, Workset >::create()) */, session(session)
 {
 }
 
@@ -36,30 +45,50 @@ nlohmann::json Workset::get_stats()
     nlohmann::json ret = nlohmann::json::object();
     ret["current_used_ram"] = size_to_string(platform_get_current_used_ram());
     ret["peak_used_ram"] = size_to_string(platform_get_peak_used_ram());
-    auto ctm_stats = this->thread_manager->get_stats();
-    ret["running_coros"] = std::get<0>(ctm_stats);
-    ret["queued_coros"] = std::get<1>(ctm_stats);
-    ret["queued_timed_coros"] = std::get<2>(ctm_stats);
-    return ret;
-}
-
-template< typename TokType >
-std::vector< std::string > map_to_vect(const std::unordered_map< TokType, std::string > &m) {
-    std::vector< std::string > ret;
-    ret.resize(m.size()+1);
-    for (auto &i : m) {
-        ret[i.first.val()] = i.second;
+    auto ctm_stats = CoroutineThreadManager::get_global().get_detailed_stats();
+    ret["running_coros"] = ctm_stats.running_coros;
+    ret["queued_coros"] = ctm_stats.queued_coros;
+    ret["queued_timed_coros"] = ctm_stats.queued_timed_coros;
+    ret["queue_depths"] = ctm_stats.queue_depths;
+    ret["dispatched_coros"] = ctm_stats.dispatched_coros;
+    ret["stolen_coros"] = ctm_stats.stolen_coros;
+    ret["yields_per_second"] = ctm_stats.yields_per_second;
+    ret["mean_wait_time_us"] = std::chrono::duration_cast< std::chrono::microseconds >(ctm_stats.mean_wait_time).count();
+    ret["max_wait_time_us"] = std::chrono::duration_cast< std::chrono::microseconds >(ctm_stats.max_wait_time).count();
+    ret["session_active_coros"] = this->coroutine_group->get_active_coros();
+    ret["session_running_time_ms"] = std::chrono::duration_cast< std::chrono::milliseconds >(this->coroutine_group->get_running_time()).count();
+    if (this->result_cache != nullptr) {
+        ret["result_cache_hits"] = this->result_cache->get_hits();
+        ret["result_cache_misses"] = this->result_cache->get_misses();
     }
     return ret;
 }
 
 void Workset::init() {
+    // Subscribe before anything happens, so that polling clients do not miss what precedes their first poll
+    this->poll_subscription = this->events.subscribe();
     // We cannot create the root step before create() has returned (i.e., in the constructor)
     this->root_step = this->create_step(true);
     //pointer->step_backrefs->set_main(pointer);
 }
 
 nlohmann::json Workset::answer_api1(HTTPCallback &cb, std::vector< std::string >::const_iterator path_begin, std::vector< std::string >::const_iterator path_end)
+{
+    TempGenerator::Scope scope(this->temp_scope);
+    try {
+        return this->answer_api1_in_scope(cb, path_begin, path_end);
+    } catch (const WaitForPost &wfp) {
+        // The answer is completed later, when the POST data are available
+        auto callback = wfp.get_callback();
+        const size_t temp_scope = this->temp_scope;
+        throw WaitForPost([callback,temp_scope](const auto &post_data) {
+            TempGenerator::Scope scope(temp_scope);
+            return callback(post_data);
+        });
+    }
+}
+
+nlohmann::json Workset::answer_api1_in_scope(HTTPCallback &cb, std::vector< std::string >::const_iterator path_begin, std::vector< std::string >::const_iterator path_end)
 {
     std::unique_lock< std::recursive_mutex > lock(this->global_mutex);
     assert_or_throw< SendError >(path_begin != path_end, 404);
@@ -88,12 +117,46 @@ nlohmann::json Workset::answer_api1(HTTPCallback &cb, std::vector< std::string >
             return ret;
         }
         ret["status"] = "loaded";
-        ret["symbols"] = map_to_vect(this->library->get_symbols());
-        ret["labels"] = map_to_vect(this->library->get_labels());
-        const auto &addendum = this->library->get_addendum();
-        ret["addendum"] = jsonize(addendum);
+        // The heavy part of the context is served by library_context, which the client can cache
         ret["max_number"] = this->library->get_max_number().val();
+        ret["symbols_num"] = this->library->get_symbols_num();
+        ret["labels_num"] = this->library->get_labels_num();
+        ret["context_etag"] = this->library_context->get_etag();
         return ret;
+    } else if (*path_begin == "library_context") {
+        path_begin++;
+        assert_or_throw< SendError >(path_begin == path_end, 404);
+        assert_or_throw< SendError >(this->library != nullptr, 404);
+        const auto &context = this->library_context;
+        std::vector< std::pair< std::string, std::string > > headers = {
+            { "ETag", context->get_etag() },
+            { "Cache-Control", "private, no-cache" },
+            { "Vary", "Accept-Encoding" },
+        };
+        if (get_request_header(cb, "If-None-Match") == context->get_etag()) {
+            throw SendBlob(304, "application/json", headers, "");
+        }
+        if (boost::icontains(get_request_header(cb, "Accept-Encoding"), "gzip")) {
+            headers.push_back({ "Content-Encoding", "gzip" });
+            throw SendBlob(200, "application/json", headers, context->get_gzipped());
+        }
+        throw SendBlob(200, "application/json", headers, context->get_json());
+    } else if (*path_begin == "get_labels" || *path_begin == "get_symbols") {
+        bool labels = *path_begin == "get_labels";
+        path_begin++;
+        assert_or_throw< SendError >(path_begin != path_end, 404);
+        size_t begin = safe_stoi(*path_begin);
+        path_begin++;
+        assert_or_throw< SendError >(path_begin != path_end, 404);
+        size_t end = safe_stoi(*path_begin);
+        path_begin++;
+        assert_or_throw< SendError >(path_begin == path_end, 404);
+        assert_or_throw< SendError >(this->library != nullptr, 404);
+        if (labels) {
+            return get_labels_range(*this->library, begin, end);
+        } else {
+            return get_symbols_range(*this->library, begin, end);
+        }
     } else if (*path_begin == "get_sentence") {
         path_begin++;
         assert_or_throw< SendError >(path_begin != path_end, 404);
@@ -130,39 +193,56 @@ nlohmann::json Workset::answer_api1(HTTPCallback &cb, std::vector< std::string >
             ret["success"] = static_cast< bool >(res);
             return ret;
         });
+    } else if (*path_begin == "events") {
+        path_begin++;
+        assert_or_throw< SendError >(path_begin == path_end, 404);
+        assert_or_throw< SendError >(cb.get_method() == "GET", 405);
+        // Events are pushed as soon as they happen, in batches, until the workset is destroyed
+        auto subscription = this->events.subscribe();
+        throw SendStream("text/event-stream", [subscription]() {
+            auto events = subscription->pop(std::chrono::seconds(15), 256);
+            if (events.empty() && subscription->is_closed()) {
+                return std::string();
+            }
+            return format_event_stream_batch(events);
+        });
     } else if (*path_begin == "queue") {
         path_begin++;
         assert_or_throw< SendError >(path_begin == path_end, 404);
         assert_or_throw< SendError >(cb.get_method() == "POST", 405);
-        throw WaitForPost([this] (const auto &post_data) {
+        auto subscription = this->poll_subscription;
+        throw WaitForPost([subscription] (const auto &post_data) {
             (void) post_data;
-            std::unique_lock< std::mutex > queue_lock(this->queue_mutex);
             // Queue automatically returns after some timeout
-            auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(1);
-            while (this->queue.empty()) {
-                auto reason = this->queue_variable.wait_until(queue_lock, timeout);
-                if (reason == std::cv_status::timeout) {
-                    nlohmann::json ret = nlohmann::json::object();
-                    ret["event"] = "nothing";
-                    return ret;
-                }
+            auto events = subscription->pop(std::chrono::seconds(1), 1);
+            if (events.empty()) {
+                nlohmann::json ret = nlohmann::json::object();
+                ret["event"] = "nothing";
+                return ret;
             }
-            auto ret = this->queue.front();
-            this->queue.pop_front();
-            return ret;
+            return events.front();
         });
     } else if (*path_begin == "get_proof_tree") {
         path_begin++;
         assert_or_throw< SendError >(path_begin != path_end, 404);
         auto tok = LabTok(safe_stoi(*path_begin));
+        path_begin++;
+        assert_or_throw< SendError >(this->library != nullptr, 404);
         try {
-            const Assertion &ass = this->library->get_assertion(tok);
-            assert_or_throw< SendError >(ass.is_valid(), 404);
-            const auto &executor = ass.get_proof_executor< Sentence >(*this->library, true);
-            executor->execute();
-            const auto &proof_tree = executor->get_proof_tree();
+            auto proof_tree = this->proof_tree_cache->get_proof_tree(tok);
             nlohmann::json ret;
-            ret["proof_tree"] = jsonize(proof_tree);
+            if (path_begin == path_end) {
+                ret["proof_tree"] = proof_tree->to_nested_json();
+            } else {
+                // get_proof_tree/<label>/<node>/<depth> only returns a subtree, to be expanded on demand
+                auto node = safe_stoi(*path_begin);
+                path_begin++;
+                assert_or_throw< SendError >(path_begin != path_end, 404);
+                auto depth = safe_stoi(*path_begin);
+                path_begin++;
+                assert_or_throw< SendError >(path_begin == path_end && node >= 0 && depth >= 0, 404);
+                ret["proof_tree"] = proof_tree->to_paged_json(node, depth);
+            }
             return ret;
         } catch (std::out_of_range&) {
             throw SendError(404);
@@ -242,12 +322,21 @@ nlohmann::json Workset::answer_api1(HTTPCallback &cb, std::vector< std::string >
 
 void Workset::load_library(boost::filesystem::path filename, boost::filesystem::path cache_filename, std::string turnstile)
 {
-    FileTokenizer ft(filename);
-    Reader p(ft, false, true);
-    p.run();
-    this->library = std::make_unique< LibraryImpl >(p.get_library());
-    std::shared_ptr< ToolboxCache > cache = std::make_shared< FileToolboxCache >(cache_filename);
-    this->toolbox = std::make_unique< LibraryToolbox >(*this->library, turnstile, cache);
+    auto loaded = LibraryRegistry::get_registry().get_library(filename, cache_filename, turnstile);
+    this->library = std::shared_ptr< const ExtendedLibrary >(loaded, loaded->library.get());
+    this->toolbox = std::shared_ptr< const LibraryToolbox >(loaded, loaded->toolbox.get());
+    this->sat_session = std::make_shared< WffSatSession >(*this->toolbox);
+    this->result_cache = std::make_shared< StepResultCache >();
+    this->library_digest = loaded->digest;
+    this->library_context = LibraryContext::get_context(this->library);
+    this->proof_tree_cache = ProofTreeCache::get_cache(this->library);
+    try {
+        this->result_store = ResultStore::get_store(filename.string() + ".results");
+    } catch (std::exception &e) {
+        // Results are still cached in memory
+        std::cerr << "Could not open the result store: " << e.what() << std::endl;
+        this->result_store = nullptr;
+    }
 }
 
 const std::string &Workset::get_name()
@@ -270,6 +359,67 @@ const LibraryToolbox &Workset::get_toolbox() const {
     return *this->toolbox;
 }
 
+std::shared_ptr<WffSatSession> Workset::get_sat_session() const
+{
+    return this->sat_session;
+}
+
+std::shared_ptr<StepResultCache> Workset::get_result_cache() const
+{
+    return this->result_cache;
+}
+
+std::shared_ptr<const StepStrategyResult> Workset::get_stored_result(const StepStrategyData &data)
+{
+    if (this->result_store == nullptr) {
+        return nullptr;
+    }
+    auto proof = this->result_store->get(this->library_digest + " " + canonicalize_goal(data, *this->toolbox));
+    if (proof.empty()) {
+        return nullptr;
+    }
+    auto ret = deserialize_result_proof(data, proof, *this->toolbox);
+    if (ret != nullptr) {
+        this->result_cache->put(StepResultCache::make_key(data), ret);
+    }
+    return ret;
+}
+
+void Workset::publish_result(std::shared_ptr<const StepStrategyData> data, std::shared_ptr<const StepStrategyResult> result)
+{
+    if (this->result_cache == nullptr) {
+        return;
+    }
+    auto key = StepResultCache::make_key(*data);
+    this->result_cache->put(key, result);
+    // Other steps are notified from a coroutine, since the caller is holding the lock of its own step
+    auto body = [self=this->weak_from_this(),data,key,result](Yielder &yield) {
+        (void) yield;
+        auto strong_self = self.lock();
+        if (!strong_self) {
+            return;
+        }
+        std::vector< std::shared_ptr< Step > > steps;
+        {
+            std::unique_lock< std::recursive_mutex > lock(strong_self->global_mutex);
+            for (const auto &step : strong_self->steps) {
+                steps.push_back(step.second);
+            }
+        }
+        for (const auto &step : steps) {
+            step->adopt_result(key, result);
+        }
+        // Persisting requires replaying the proof, so it is done here as well
+        if (strong_self->result_store != nullptr) {
+            auto proof = serialize_result_proof(*data, *result, *strong_self->toolbox);
+            if (!proof.empty()) {
+                strong_self->result_store->put(strong_self->library_digest + " " + canonicalize_goal(*data, *strong_self->toolbox), proof);
+            }
+        }
+    };
+    this->add_coroutine(make_auto_coroutine(std::make_shared< decltype(body) >(body)));
+}
+
 std::set<std::pair<SymTok, SymTok> > Workset::get_antidists()
 {
     std::unique_lock< std::mutex > lock(this->queue_mutex);
@@ -283,6 +433,7 @@ std::shared_ptr<Step> Workset::get_root_step() const {
 std::shared_ptr<Workset> Workset::destroy()
 {
     auto strong_this = this->shared_from_this();
+    this->events.close();
     auto strong_session = this->session.lock();
     if (strong_session) {
         strong_session->destroy_workset(strong_this);
@@ -290,21 +441,39 @@ std::shared_ptr<Workset> Workset::destroy()
     return strong_this;
 }
 
-void Workset::add_coroutine(std::weak_ptr<Coroutine> coro)
+void Workset::add_coroutine(std::weak_ptr<Coroutine> coro, std::shared_ptr<CoroutineToken> token)
+{
+    auto strong_coro = coro.lock();
+    if (strong_coro != nullptr) {
+        strong_coro->set_context(this->coroutine_context);
+    }
+    CoroutineThreadManager::get_global().add_coroutine(coro, this->coroutine_group, token);
+}
+
+void Workset::add_timed_coroutine(std::weak_ptr<Coroutine> coro, std::chrono::system_clock::duration wait_time, std::shared_ptr<CoroutineToken> token)
 {
-    this->thread_manager->add_coroutine(coro);
+    auto strong_coro = coro.lock();
+    if (strong_coro != nullptr) {
+        strong_coro->set_context(this->coroutine_context);
+    }
+    CoroutineThreadManager::get_global().add_timed_coroutine(coro, wait_time, this->coroutine_group, token);
 }
 
-void Workset::add_timed_coroutine(std::weak_ptr<Coroutine> coro, std::chrono::system_clock::duration wait_time)
+void Workset::set_interactive_token(std::shared_ptr<CoroutineToken> token)
 {
-    this->thread_manager->add_timed_coroutine(coro, wait_time);
+    // Only the search started by the latest user edit keeps the interactive priority
+    std::unique_lock< std::mutex > lock(this->interactive_mutex);
+    auto old_token = this->interactive_token.lock();
+    if (old_token != nullptr && old_token != token) {
+        old_token->set_priority(PRIORITY_NORMAL);
+    }
+    token->set_priority(PRIORITY_INTERACTIVE);
+    this->interactive_token = token;
 }
 
 void Workset::add_to_queue(nlohmann::json data)
 {
-    std::unique_lock< std::mutex > lock(this->queue_mutex);
-    this->queue.push_back(data);
-    this->queue_variable.notify_one();
+    this->events.dispatch(data);
 }
 
 std::shared_ptr<Step> Workset::get_step(size_t id)
@@ -332,7 +501,8 @@ bool Workset::destroy_step(size_t id)
 
 SymTok Workset::safe_symbol(SymTok::val_type val)
 {
-    if (val <= this->toolbox->get_symbols_num()) {
+    // Temporary symbols can be reserved without having been published yet
+    if (val <= this->toolbox->get_symbols_num() && this->toolbox->resolve_symbol(SymTok(val)) != "") {
         return SymTok(val);
     } else {
         throw SendError(404);
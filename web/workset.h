@@ -5,12 +5,18 @@
 #include <unordered_map>
 
 class Workset;
+class WffSatSession;
+class ProofTreeCache;
+class LibraryContext;
 
 #include "web/web.h"
 #include "mm/library.h"
 #include "web/step.h"
 #include "mm/toolbox.h"
+#include "mm/libregistry.h"
 #include "utils/threadmanager.h"
+#include "web/events.h"
+#include "web/resultstore.h"
 
 class Workset : public enable_create< Workset > {
 public:
@@ -23,12 +29,20 @@ public:
     const std::string &get_name();
     void set_name(const std::string &name);
     const LibraryToolbox &get_toolbox() const;
+    std::shared_ptr< WffSatSession > get_sat_session() const;
+    std::shared_ptr< StepResultCache > get_result_cache() const;
+    // Look for a proof of the goal of data found by a previous session, possibly in another process
+    std::shared_ptr< const StepStrategyResult > get_stored_result(const StepStrategyData &data);
+    /* Store a result in the cache and on disk, and hand it to the other steps currently searching
+     * for the same goal */
+    void publish_result(std::shared_ptr< const StepStrategyData > data, std::shared_ptr< const StepStrategyResult > result);
     std::set< std::pair< SymTok, SymTok > > get_antidists();
     std::shared_ptr< Step > get_root_step() const;
     std::shared_ptr< Workset > destroy();
 
-    void add_coroutine(std::weak_ptr<Coroutine> coro);
-    void add_timed_coroutine(std::weak_ptr<Coroutine> coro, std::chrono::system_clock::duration wait_time);
+    void add_coroutine(std::weak_ptr<Coroutine> coro, std::shared_ptr< CoroutineToken > token = nullptr);
+    void add_timed_coroutine(std::weak_ptr<Coroutine> coro, std::chrono::system_clock::duration wait_time, std::shared_ptr< CoroutineToken > token = nullptr);
+    void set_interactive_token(std::shared_ptr< CoroutineToken > token);
     void add_to_queue(nlohmann::json data);
     //std::shared_ptr< BackreferenceRegistry< Step, Workset > > get_step_backrefs() const;
     std::shared_ptr< Step > get_step(size_t id);
@@ -39,17 +53,36 @@ public:
     std::shared_ptr< Step > create_steps_from_dump(const nlohmann::json &dump);
 
 protected:
-    Workset(std::weak_ptr< Session > session);
+    Workset(std::weak_ptr< Session > session, std::shared_ptr< CoroutineGroup > coroutine_group);
     void init();
 
 private:
+    nlohmann::json answer_api1_in_scope(HTTPCallback &cb, std::vector< std::string >::const_iterator path_begin, std::vector< std::string >::const_iterator path_end);
     std::shared_ptr< Step > create_step(bool do_no_search);
     void set_antidists(const std::set< std::pair< SymTok, SymTok > > &antidists);
     nlohmann::json get_stats();
 
-    std::unique_ptr< ExtendedLibrary > library;
-    std::unique_ptr< LibraryToolbox > toolbox;
-    std::unique_ptr< CoroutineThreadManager > thread_manager;
+    // Both point inside a LoadedLibrary shared with the other worksets using the same database
+    std::shared_ptr< const ExtendedLibrary > library;
+    std::shared_ptr< const LibraryToolbox > toolbox;
+    // Shared by all the WFF queries in this workset, so that they can reuse each other's work
+    std::shared_ptr< WffSatSession > sat_session;
+    // Results proved by any step, reused by steps with the same goal
+    std::shared_ptr< StepResultCache > result_cache;
+    std::shared_ptr< ResultStore > result_store;
+    std::string library_digest;
+    // Shared with the other worksets using the same library; the global caches
+    // only keep weak references, so they must be held here to outlive a request
+    std::shared_ptr< const LibraryContext > library_context;
+    std::shared_ptr< ProofTreeCache > proof_tree_cache;
+    // Coroutines run on the global CoroutineThreadManager, sharing the session's fair share
+    std::shared_ptr< CoroutineGroup > coroutine_group;
+    // The toolbox is shared, so the temporary variables of this workset are kept in their own
+    // scope; requests and coroutines are executed in it
+    size_t temp_scope;
+    std::shared_ptr< CoroutineContext > coroutine_context;
+    std::mutex interactive_mutex;
+    std::weak_ptr< CoroutineToken > interactive_token;
     std::recursive_mutex global_mutex;
     std::string name;
     //std::shared_ptr< BackreferenceRegistry< Step, Workset > > step_backrefs;
@@ -60,6 +93,7 @@ private:
     std::set< std::pair< SymTok, SymTok > > antidists;
 
     std::mutex queue_mutex;
-    std::condition_variable queue_variable;
-    std::list< nlohmann::json > queue;
+    EventDispatcher events;
+    // Only used by the long-polling queue endpoint; it is created with the workset
+    std::shared_ptr< EventSubscription > poll_subscription;
 };